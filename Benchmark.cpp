@@ -0,0 +1,142 @@
+// 基准测试模式
+#include "ConverterInternal.h"
+
+double Percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+}
+
+struct BenchmarkResult {
+    unsigned threads = 0;
+    size_t images = 0;
+    size_t failures = 0;
+    double wallSeconds = 0.0;
+    double megapixels = 0.0;
+    std::vector<double> decodeMs, writeSourceMs, commitMs, renameMs;
+};
+
+int RunBenchmark(const BenchmarkOptions& options, const std::vector<std::wstring>& inputPaths, ConversionMode mode, bool recursive,
+    const std::wstring& outputDir, const GUID& targetEncoderGuid, const WCHAR* targetExtension, float quality, unsigned numCores) {
+    // 与正常运行使用同一个枚举器收集语料，只是不启动转换阶段
+    std::vector<std::pair<std::wstring, std::wstring>> corpus; // 输入路径, 输出路径
+    {
+        Pipeline collector(1024);
+        std::thread drain([&] {
+            ImageJobPtr job;
+            std::wstring outPath;
+            while (collector.readQueue.Pop(job)) { if (SUCCEEDED(MakeOutputPath(*job->outputDir, job->inputPath, targetExtension, outPath))) { corpus.emplace_back(job->inputPath, outPath); } }
+        });
+        EnumerateInputs(inputPaths, mode, recursive, recursive ? std::min(8u, numCores) : 1u, outputDir, collector);
+        collector.readQueue.Close();
+        drain.join();
+    }
+    if (corpus.empty()) { wprintf(L"\nNo supported image files found to benchmark.\n"); return 0; }
+
+    std::vector<unsigned> threadCounts = options.threadCounts;
+    if (threadCounts.empty()) {
+        threadCounts.push_back(1);
+        if (numCores / 2 > 1) threadCounts.push_back(numCores / 2);
+        if (numCores > 1) threadCounts.push_back(numCores);
+    }
+    wprintf(L"Benchmark: %zu files, %u iteration(s), %s output.\n", corpus.size(), options.iterations, options.nullOutput ? L"null" : L"file");
+
+    PixelBufferPool pixelPool(DefaultPixelPoolLimit()); // 与正常运行相同的位图分配方式
+    std::vector<BenchmarkResult> results;
+    for (unsigned threadCount : threadCounts) {
+        BenchmarkResult result;
+        result.threads = threadCount;
+        std::mutex resultMutex;
+
+        for (unsigned iteration = 0; iteration < options.iterations; ++iteration) {
+            std::atomic<size_t> next(0);
+            const LONGLONG start = QueryTicks();
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < threadCount; ++t) {
+                threads.emplace_back([&] {
+                    if (FAILED(CoInitializeEx(NULL, COINIT_MULTITHREADED))) return;
+                    {
+                        ConversionContext context;
+                        context.pixelPool = &pixelPool;
+                        if (SUCCEEDED(context.Initialize(targetEncoderGuid, quality))) {
+                            // 样本先记录在线程本地，结束后一次性合并，避免计时受锁影响
+                            std::vector<StageTimings> samples;
+                            size_t failures = 0;
+                            for (size_t index = next.fetch_add(1); index < corpus.size(); index = next.fetch_add(1)) {
+                                StageTimings timings;
+                                HRESULT hr = S_OK;
+                                if (options.nullOutput) {
+                                    ComPtr<NullOutputStream> pNull = Microsoft::WRL::Make<NullOutputStream>();
+                                    hr = pNull ? ConvertImage(context, corpus[index].first.c_str(), pNull.Get(), &timings) : E_OUTOFMEMORY;
+                                }
+                                else {
+                                    ComPtr<MemoryOutputStream> pBuffer;
+                                    hr = Microsoft::WRL::MakeAndInitialize<MemoryOutputStream>(&pBuffer, 0);
+                                    if (SUCCEEDED(hr)) { hr = ConvertImage(context, corpus[index].first.c_str(), pBuffer.Get(), &timings); }
+                                    if (SUCCEEDED(hr)) {
+                                        bool renameFailed = false;
+                                        const LONGLONG renameStart = QueryTicks();
+                                        DWORD error = WriteBufferAndRename(pBuffer->Data(), pBuffer->Size(), MakeTempPath(corpus[index].second), corpus[index].second, renameFailed);
+                                        timings.renameMs = TicksToMs(QueryTicks() - renameStart);
+                                        if (error != ERROR_SUCCESS) hr = HRESULT_FROM_WIN32(error);
+                                    }
+                                }
+                                if (SUCCEEDED(hr)) { samples.push_back(timings); }
+                                else { ++failures; }
+                            }
+                            std::lock_guard<std::mutex> lock(resultMutex);
+                            result.failures += failures;
+                            for (const StageTimings& s : samples) {
+                                result.decodeMs.push_back(s.decodeMs);
+                                result.writeSourceMs.push_back(s.writeSourceMs);
+                                result.commitMs.push_back(s.commitMs);
+                                if (!options.nullOutput) result.renameMs.push_back(s.renameMs);
+                                result.megapixels += static_cast<double>(s.width) * s.height / 1e6;
+                                ++result.images;
+                            }
+                        }
+                    }
+                    CoUninitialize();
+                });
+            }
+            const std::vector<size_t> placement = ProcessorTopology::Get().Assign(threadCount);
+            for (unsigned t = 0; t < threadCount; ++t) { ProcessorTopology::Get().Pin(threads[t], placement[t]); }
+            for (auto& t : threads) { t.join(); }
+            result.wallSeconds += TicksToMs(QueryTicks() - start) / 1000.0;
+        }
+        wprintf(L"  %u thread(s): %.1f images/s\n", threadCount, result.wallSeconds > 0 ? result.images / result.wallSeconds : 0.0);
+        results.push_back(std::move(result));
+    }
+
+    FILE* out = stdout;
+    if (!options.reportPath.empty() && _wfopen_s(&out, options.reportPath.c_str(), L"w, ccs=UTF-8") != 0) {
+        wprintf(L"Error: Failed to open benchmark report file: %s\n", options.reportPath.c_str());
+        return 1;
+    }
+    if (options.json) { fwprintf(out, L"[\n"); }
+    else { fwprintf(out, L"threads,iterations,images,failures,wall_s,images_per_s,megapixels_per_s,decode_p50_ms,decode_p90_ms,decode_p99_ms,writesource_p50_ms,writesource_p90_ms,writesource_p99_ms,commit_p50_ms,commit_p90_ms,commit_p99_ms,rename_p50_ms,rename_p90_ms,rename_p99_ms\n"); }
+    for (size_t i = 0; i < results.size(); ++i) {
+        BenchmarkResult& r = results[i];
+        const double imagesPerSecond = r.wallSeconds > 0 ? r.images / r.wallSeconds : 0.0;
+        const double mpPerSecond = r.wallSeconds > 0 ? r.megapixels / r.wallSeconds : 0.0;
+        const double d50 = Percentile(r.decodeMs, 0.50), d90 = Percentile(r.decodeMs, 0.90), d99 = Percentile(r.decodeMs, 0.99);
+        const double w50 = Percentile(r.writeSourceMs, 0.50), w90 = Percentile(r.writeSourceMs, 0.90), w99 = Percentile(r.writeSourceMs, 0.99);
+        const double c50 = Percentile(r.commitMs, 0.50), c90 = Percentile(r.commitMs, 0.90), c99 = Percentile(r.commitMs, 0.99);
+        const double r50 = Percentile(r.renameMs, 0.50), r90 = Percentile(r.renameMs, 0.90), r99 = Percentile(r.renameMs, 0.99);
+        if (options.json) {
+            fwprintf(out, L"  {\"threads\": %u, \"iterations\": %u, \"images\": %zu, \"failures\": %zu, \"wall_s\": %.3f, \"images_per_s\": %.2f, \"megapixels_per_s\": %.2f, ",
+                r.threads, options.iterations, r.images, r.failures, r.wallSeconds, imagesPerSecond, mpPerSecond);
+            fwprintf(out, L"\"decode_ms\": [%.2f, %.2f, %.2f], \"writesource_ms\": [%.2f, %.2f, %.2f], \"commit_ms\": [%.2f, %.2f, %.2f], \"rename_ms\": [%.2f, %.2f, %.2f]}%s\n",
+                d50, d90, d99, w50, w90, w99, c50, c90, c99, r50, r90, r99, i + 1 < results.size() ? L"," : L"");
+        }
+        else {
+            fwprintf(out, L"%u,%u,%zu,%zu,%.3f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+                r.threads, options.iterations, r.images, r.failures, r.wallSeconds, imagesPerSecond, mpPerSecond,
+                d50, d90, d99, w50, w90, w99, c50, c90, c99, r50, r90, r99);
+        }
+    }
+    if (options.json) { fwprintf(out, L"]\n"); }
+    if (out != stdout) { fclose(out); }
+    return 0;
+}
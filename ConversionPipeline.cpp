@@ -0,0 +1,1297 @@
+// 流水线各阶段、转换引擎与 grid 图块编码
+#include "ConverterInternal.h"
+
+// === 修改：用一次重叠 ReadFile 把整个文件读入内存。超过 bufferLimit 时不读取，由调用方回退 ===
+// 文件头嗅探读取的字节数，足以覆盖 ftyp 盒中的兼容品牌列表
+const DWORD kSniffBytes = 512;
+
+// 修改：读入的同时嗅探文件头。内容不是可识别的图片 (例如扩展名为 .jpg 的 HTML 错误页) 时返回 WINCODEC_ERR_UNKNOWNIMAGEFORMAT，不再交给解码器
+HRESULT ReadFileToBuffer(const WCHAR* path, ULONGLONG bufferLimit, std::vector<BYTE>& buffer, bool& tooLarge, GUID& container) {
+    tooLarge = false;
+    container = GUID_NULL;
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+
+    HRESULT hr = S_OK;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize)) { hr = HRESULT_FROM_WIN32(GetLastError()); }
+    else if (static_cast<ULONGLONG>(fileSize.QuadPart) > bufferLimit || fileSize.QuadPart > MAXDWORD) {
+        // 临时文件模式只读文件头
+        tooLarge = true;
+        BYTE header[kSniffBytes];
+        OVERLAPPED overlapped = { 0 };
+        DWORD bytesRead = 0;
+        if (!ReadFile(hFile, header, kSniffBytes, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING) { hr = HRESULT_FROM_WIN32(GetLastError()); }
+        else if (!GetOverlappedResult(hFile, &overlapped, &bytesRead, TRUE)) { hr = HRESULT_FROM_WIN32(GetLastError()); }
+        else { container = SniffContainerFormat(header, bytesRead); }
+    }
+    else if (fileSize.QuadPart > 0) {
+        buffer.resize(static_cast<size_t>(fileSize.QuadPart));
+        OVERLAPPED overlapped = { 0 };
+        DWORD bytesRead = 0;
+        if (!ReadFile(hFile, buffer.data(), static_cast<DWORD>(buffer.size()), NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING) { hr = HRESULT_FROM_WIN32(GetLastError()); }
+        else if (!GetOverlappedResult(hFile, &overlapped, &bytesRead, TRUE)) { hr = HRESULT_FROM_WIN32(GetLastError()); }
+        else if (bytesRead != buffer.size()) { hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF); }
+        else { container = SniffContainerFormat(buffer.data(), buffer.size()); }
+    }
+    CloseHandle(hFile);
+    if (SUCCEEDED(hr) && IsEqualGUID(container, GUID_NULL)) {
+        std::vector<BYTE>().swap(buffer);
+        hr = WINCODEC_ERR_UNKNOWNIMAGEFORMAT;
+    }
+    return hr;
+}
+
+// === 新增：用一次 WriteFile 写出编码结果，再在同一句柄上原子改名为最终文件 ===
+// 返回Win32错误码；失败时临时文件随句柄关闭一起删除
+DWORD WriteBufferAndRename(const BYTE* pData, size_t size, const std::wstring& tempPath, const std::wstring& finalPath, bool& renameFailed) {
+    renameFailed = false;
+    if (size > MAXDWORD) return ERROR_FILE_TOO_LARGE;
+
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE | DELETE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return GetLastError();
+
+    DWORD error = ERROR_SUCCESS;
+    DWORD bytesWritten = 0;
+    if (!WriteFile(hFile, pData, static_cast<DWORD>(size), &bytesWritten, NULL)) { error = GetLastError(); }
+    else if (bytesWritten != size) { error = ERROR_WRITE_FAULT; }
+    else {
+        // FILE_RENAME_INFO 末尾是变长的文件名
+        const size_t nameBytes = finalPath.size() * sizeof(WCHAR);
+        std::vector<BYTE> renameBuffer(sizeof(FILE_RENAME_INFO) + nameBytes);
+        FILE_RENAME_INFO* pRename = reinterpret_cast<FILE_RENAME_INFO*>(renameBuffer.data());
+        pRename->ReplaceIfExists = TRUE;
+        pRename->RootDirectory = NULL;
+        pRename->FileNameLength = static_cast<DWORD>(nameBytes);
+        memcpy(pRename->FileName, finalPath.c_str(), nameBytes);
+        if (!SetFileInformationByHandle(hFile, FileRenameInfo, pRename, static_cast<DWORD>(renameBuffer.size()))) {
+            error = GetLastError();
+            renameFailed = true;
+        }
+    }
+
+    if (error != ERROR_SUCCESS) {
+        FILE_DISPOSITION_INFO disposition = { TRUE };
+        SetFileInformationByHandle(hFile, FileDispositionInfo, &disposition, sizeof(disposition));
+    }
+    CloseHandle(hFile);
+    return error;
+}
+
+// 新增：阶段线程的COM初始化与转换上下文创建
+bool InitializeStageThread(ConversionContext& context, const Pipeline* pipeline) {
+    // 位图和流会在阶段线程之间传递，因此使用MTA
+    HRESULT hr_com = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    if (FAILED(hr_com)) {
+        std::lock_guard<std::mutex> lock(console_mutex);
+        wprintf(L"Error: Failed to initialize COM in worker thread. HR=0x%X\n", hr_com);
+        return false;
+    }
+    HRESULT hr_ctx = context.Initialize(pipeline->targetEncoderGuid, pipeline->quality);
+    if (FAILED(hr_ctx)) {
+        {
+            std::lock_guard<std::mutex> lock(console_mutex);
+            wprintf(L"Error: Failed to initialize WIC context in worker thread. HR=0x%X\n", hr_ctx);
+        }
+        context = ConversionContext();
+        CoUninitialize();
+        return false;
+    }
+    context.pixelPool = pipeline->pixelPool;
+    context.maxDimension = pipeline->maxDimension;
+    context.copyMetadata = pipeline->copyMetadata;
+    // WIC 的 HEIF 编码器不会把 EXIF 方向转换为 irot 属性，查看器按像素原样显示；去除元数据时方向标签也不复存在。这两种情况都先转正像素
+    context.bakeOrientation = IsEqualGUID(pipeline->targetEncoderGuid, GUID_ContainerFormatHeif) || !pipeline->copyMetadata;
+    return true;
+}
+
+void PostWriteResult(Pipeline* pipeline, CompletionRing* ring, ImageJobPtr job, HRESULT hr, bool finalizeFailed, DWORD lastError, ULONGLONG outputBytes);
+
+
+ConversionManifest::Record MakeManifestRecord(const Pipeline& pipeline, const ImageJob& job) {
+    ConversionManifest::Record record = { 0 };
+    record.pathHash = job.manifestKey;
+    record.size = job.sourceSize;
+    record.lastWriteTime = job.sourceWriteTime;
+    record.targetFormat = pipeline.targetEncoderGuid;
+    // --target-size 时记录为负的目标 KB 数，与任何固定质量都不相等，旧清单格式不变
+    record.quality = pipeline.targetSize ? -static_cast<float>(pipeline.targetSize / 1024) : pipeline.quality;
+    record.maxDimension = pipeline.maxDimension;
+    return record;
+}
+
+// === 新增：预读阶段 (I/O)，计算输出路径并把源文件读入内存 ===
+void ReadStage(Pipeline* pipeline) {
+    CompletionRing* ring = pipeline->reporter->RegisterProducer();
+    ImageJobPtr job;
+    while (pipeline->readQueue.Pop(job)) {
+        job->timeline.Mark(JobTimeline::ReadStart);
+        // 修改：库调用提交的任务没有输出目录，输出路径由调用方给出 (或不写文件)
+        if (job->outputDir) { job->hr = MakeOutputPath(*job->outputDir, job->inputPath, pipeline->targetExtension, job->finalOutPath); }
+
+        ConversionManifest* manifest = pipeline->ManifestFor(*job);
+        RunJournal* journal = pipeline->JournalFor(*job);
+        if (manifest || journal) { job->manifestKey = HashPath(job->inputPath); }
+        // 新增：--resume 时跳过上次运行已完成的文件，不检查输出文件
+        if (journal && journal->IsCompleted(job->manifestKey)) {
+            CompletionRecord record;
+            record.outcome = JobOutcome::Resumed;
+            record.job = std::move(job);
+            pipeline->reporter->Post(ring, record);
+            continue;
+        }
+        // 新增：增量模式下，源文件大小、修改时间和编码参数都未变化则直接跳过
+        // 修改：--watch 时初始扫描与变化通知可能先后投递同一个文件，已在转换中的同样跳过
+        if (manifest) {
+            const ConversionManifest::Record manifestRecord = MakeManifestRecord(*pipeline, *job);
+            if (manifest->IsUnchanged(manifestRecord, job->finalOutPath) || !manifest->BeginConversion(manifestRecord)) {
+                CompletionRecord record;
+                record.outcome = JobOutcome::Skipped;
+                record.job = std::move(job);
+                pipeline->reporter->Post(ring, record);
+                continue;
+            }
+        }
+
+        if (SUCCEEDED(job->hr) && job->inputInMemory) {
+            job->container = SniffContainerFormat(job->sourceBytes.data(), job->sourceBytes.size());
+            if (job->sourceBytes.size() > MAXDWORD) { job->hr = E_INVALIDARG; }
+            else if (IsEqualGUID(job->container, GUID_NULL)) { job->hr = WINCODEC_ERR_UNKNOWNIMAGEFORMAT; }
+        }
+        else if (SUCCEEDED(job->hr)) { job->hr = ReadFileToBuffer(job->inputPath.c_str(), pipeline->bufferLimit, job->sourceBytes, job->useTempFile, job->container); }
+        job->timeline.Mark(JobTimeline::ReadEnd);
+        // 新增：--dedup 时按内容查缓存。临时文件模式的大文件不在内存中，不参与去重
+        if (pipeline->dedup && SUCCEEDED(job->hr) && !job->useTempFile) {
+            std::wstring stem;
+            std::vector<std::wstring> suffixes;
+            const DedupCache::Claim claim = pipeline->dedup->Begin(job, stem, suffixes);
+            if (claim == DedupCache::Claim::Parked) { pipeline->activeReaders.fetch_add(1); continue; }
+            if (claim == DedupCache::Claim::Cached) {
+                std::vector<BYTE>().swap(job->sourceBytes);
+                ULONGLONG outputBytes = 0;
+                const HRESULT hr = pipeline->dedup->Materialize(stem, suffixes, *job, outputBytes);
+                PostWriteResult(pipeline, ring, std::move(job), hr, false, ERROR_SUCCESS, outputBytes);
+                continue;
+            }
+        }
+        if (!pipeline->decodeQueue.Push(std::move(job))) break;
+    }
+    pipeline->ReleaseReader();
+}
+
+// 新增：网格编码的图块边长。取 64 的倍数；网格最多 256 x 256 块，行列数超限时加大
+static UINT GridTileEdge(UINT requested, UINT width, UINT height) {
+    UINT tileSize = std::max(64u, (requested + 63) / 64 * 64);
+    while ((width + tileSize - 1) / tileSize > 256 || (height + tileSize - 1) / tileSize > 256 || static_cast<ULONGLONG>((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize) > kMaxGridTiles) { tileSize += 64; }
+    return tileSize;
+}
+
+// 新增：网格编码同时在途的图块数，为编码线程数的两倍，足够让所有编码线程都有图块可做
+static size_t GridTilesInFlight(const Pipeline& pipeline) {
+    return std::max<size_t>(2, static_cast<size_t>(pipeline.encodeThreads) * 2);
+}
+
+// 新增：只解析文件头，估算一张图片从解码到编码完成期间的内存占用
+// 修改：打开的解码器留在 job 中交给解码阶段，每张图片只创建一次解码器
+ULONGLONG EstimateWorkingSet(const Pipeline& pipeline, const ConversionContext& context, ImageJob& job) {
+    ULONGLONG bytes = job.sourceBytes.size();
+    ComPtr<IWICStream> pStream;
+    ComPtr<IWICBitmapDecoder> pDecoder;
+    ComPtr<IWICBitmapFrameDecode> pFrame;
+    HRESULT hr = context.factory->CreateStream(&pStream);
+    if (SUCCEEDED(hr)) {
+        hr = job.useTempFile
+            ? pStream->InitializeFromFilename(job.inputPath.c_str(), GENERIC_READ)
+            : pStream->InitializeFromMemory(const_cast<BYTE*>(job.sourceBytes.data()), static_cast<DWORD>(job.sourceBytes.size()));
+    }
+    if (SUCCEEDED(hr)) { hr = context.CreateDecoder(pStream.Get(), &pDecoder, job.container); }
+    if (SUCCEEDED(hr)) { hr = pDecoder->GetFrame(0, &pFrame); }
+    UINT width = 0, height = 0;
+    WICPixelFormatGUID format = GUID_WICPixelFormatUndefined;
+    if (SUCCEEDED(hr)) { hr = pFrame->GetSize(&width, &height); }
+    if (SUCCEEDED(hr)) { hr = pFrame->GetPixelFormat(&format); }
+    if (FAILED(hr)) return bytes; // 无法解析的文件很快会在解码阶段失败
+    job.decoder = pDecoder;
+
+    // 新增：网格编码的大图惰性解码，驻留的是一个条带和在途图块的像素，以及各图块编码器的工作缓冲区 (与解码阶段的判断一致)
+    UINT frameCount = 1;
+    if (FAILED(pDecoder->GetFrameCount(&frameCount))) { frameCount = 1; }
+    if (pipeline.gridTileSize && frameCount == 1
+        && NeedsGridEncoding(context.maxDimension ? std::min(width, context.maxDimension) : width, context.maxDimension ? std::min(height, context.maxDimension) : height)) {
+        if (context.maxDimension && std::max(width, height) > context.maxDimension) {
+            const double ratio = static_cast<double>(context.maxDimension) / std::max(width, height);
+            width = static_cast<UINT>(std::max(1.0, width * ratio + 0.5));
+            height = static_cast<UINT>(std::max(1.0, height * ratio + 0.5));
+        }
+        const ULONGLONG tileSize = GridTileEdge(pipeline.gridTileSize, width, height);
+        bytes += static_cast<ULONGLONG>(width) * 4 * tileSize;
+        bytes += GridTilesInFlight(pipeline) * tileSize * tileSize * (4 + 3);
+        return bytes;
+    }
+
+    ULONGLONG pixels = static_cast<ULONGLONG>(width) * height;
+    // 完整解码的位图 (临时文件模式下惰性解码，不驻留)。有 SIMD 内核的格式落地为 32 位
+    if (!job.useTempFile) {
+        WICPixelFormatGUID converted;
+        UINT bitsPerPixel = GetPixelKernels().Select(format, converted) ? 32 : GetBitsPerPixel(context.factory.Get(), format);
+        bytes += PixelBufferPool::SizeClass(static_cast<size_t>(pixels * (bitsPerPixel ? bitsPerPixel : 32) / 8));
+    }
+    // 缩小后的位图与原图短暂共存，之后编码器只处理缩小后的像素
+    if (context.maxDimension && std::max(width, height) > context.maxDimension) {
+        const double ratio = static_cast<double>(context.maxDimension) / std::max(width, height);
+        pixels = static_cast<ULONGLONG>(std::max(1.0, width * ratio + 0.5)) * static_cast<ULONGLONG>(std::max(1.0, height * ratio + 0.5));
+        bytes += PixelBufferPool::SizeClass(static_cast<size_t>(pixels * 4));
+    }
+    // 编码器内部的格式转换与 YUV 工作缓冲区，粗略按每像素 3 字节估计
+    bytes += pixels * 3;
+    return bytes;
+}
+
+// === 新增：准入阶段，按内存预算放行图片。放不下的大图先推迟，让后面的小图填补空闲 ===
+// 修改：推迟的图片的源数据计入预算；预算占满后不再取新图片，推迟队列的字节数因此有上限
+void AdmissionStage(Pipeline* pipeline) {
+    ConversionContext context;
+    const bool ready = InitializeStageThread(context, pipeline);
+    MemoryBudget& budget = *pipeline->memoryBudget;
+    const ULONGLONG starvationMs = 2000; // 推迟超过该时间后不再放行新图片，避免大图饿死
+
+    std::deque<std::pair<ULONGLONG, ImageJobPtr>> deferred; // 推迟时间, 任务
+    bool inputOpen = true;
+    bool aborted = false;
+    for (;;) {
+        // 按推迟先后尝试放行
+        for (auto it = deferred.begin(); it != deferred.end();) {
+            if (budget.TryAdmit(it->second->admittedBytes, it->second->sourceBytes.size())) {
+                if (!pipeline->admittedQueue.Push(std::move(it->second))) { aborted = true; break; }
+                it = deferred.erase(it);
+            }
+            else { ++it; }
+        }
+        if (aborted) break;
+
+        const bool starving = !deferred.empty() && GetTickCount64() - deferred.front().first > starvationMs;
+        if (!inputOpen || starving || (!deferred.empty() && budget.Exhausted())) {
+            if (!inputOpen && deferred.empty()) break;
+            budget.WaitForRelease(std::chrono::milliseconds(50));
+            continue;
+        }
+
+        ImageJobPtr job;
+        PopResult result = PopResult::Item;
+        if (deferred.empty()) { if (!pipeline->decodeQueue.Pop(job)) result = PopResult::Closed; }
+        else { result = pipeline->decodeQueue.PopFor(job, std::chrono::milliseconds(20)); }
+        if (result == PopResult::Closed) { inputOpen = false; continue; }
+        if (result == PopResult::Timeout) continue;
+
+        if (SUCCEEDED(job->hr)) { job->admittedBytes = ready ? EstimateWorkingSet(*pipeline, context, *job) : job->sourceBytes.size(); }
+        if (budget.TryAdmit(job->admittedBytes)) {
+            if (!pipeline->admittedQueue.Push(std::move(job))) break;
+        }
+        else {
+            budget.Hold(job->sourceBytes.size());
+            deferred.emplace_back(GetTickCount64(), std::move(job));
+        }
+    }
+    pipeline->admittedQueue.Close();
+
+    if (ready) {
+        context = ConversionContext();
+        CoUninitialize();
+    }
+}
+
+// === 新增：解码阶段，从内存解码出完整位图 ===
+void DecodeStage(Pipeline* pipeline, size_t lane) {
+    EncodeLane& output = *pipeline->lanes[lane];
+    ConversionContext context;
+    const bool ready = InitializeStageThread(context, pipeline);
+    context.numaNode = output.numaNode;
+
+    // 启用内存预算时只处理已准入的图片
+    BoundedQueue<ImageJobPtr>& input = pipeline->memoryBudget ? pipeline->admittedQueue : pipeline->decodeQueue;
+    ImageJobPtr job;
+    while (input.Pop(job)) {
+        job->timeline.Mark(JobTimeline::DecodeStart);
+        bool largeFrame = false; // 新增：超大图像保持惰性解码
+        if (SUCCEEDED(job->hr)) {
+            if (!ready) { job->hr = E_FAIL; }
+            else {
+                ComPtr<IWICBitmapDecoder> pDecoder = std::move(job->decoder); // 新增：准入阶段已打开时直接使用
+                if (!pDecoder) {
+                    ComPtr<IWICStream> pInputStream;
+                    job->hr = context.factory->CreateStream(&pInputStream);
+                    if (SUCCEEDED(job->hr)) {
+                        job->hr = job->useTempFile
+                            ? pInputStream->InitializeFromFilename(job->inputPath.c_str(), GENERIC_READ)
+                            : pInputStream->InitializeFromMemory(job->sourceBytes.data(), static_cast<DWORD>(job->sourceBytes.size()));
+                    }
+                    if (SUCCEEDED(job->hr)) { job->hr = context.CreateDecoder(pInputStream.Get(), &pDecoder, job->container); }
+                }
+                UINT frameCount = 1;
+                if (SUCCEEDED(job->hr) && FAILED(pDecoder->GetFrameCount(&frameCount))) { frameCount = 1; }
+                // 新增：记下首帧元数据的位置，不在这里解析
+                if (SUCCEEDED(job->hr)) {
+                    ComPtr<IWICBitmapFrameDecode> pFirstFrame;
+                    if (SUCCEEDED(pDecoder->GetFrame(0, &pFirstFrame))) {
+                        CaptureMetadata(context.factory.Get(), pFirstFrame.Get(), context.copyMetadata, job->metadata);
+                        // 新增：超出 HEVC 级别上限的图像不整幅解码 (缩小后的尺寸按上限估计)，由编码阶段按条带读取
+                        UINT width = 0, height = 0;
+                        if (pipeline->gridTileSize && frameCount == 1 && SUCCEEDED(pFirstFrame->GetSize(&width, &height))) {
+                            if (context.maxDimension) { width = std::min(width, context.maxDimension); height = std::min(height, context.maxDimension); }
+                            largeFrame = NeedsGridEncoding(width, height);
+                        }
+                    }
+                }
+                // 临时文件模式保持惰性解码，由编码器直接从文件拉取像素，避免大图整幅驻留内存
+                if (SUCCEEDED(job->hr) && frameCount > 1) {
+                    job->frames.reset(new FrameSequence(context, pDecoder.Get(), frameCount, !job->useTempFile));
+                    job->hr = job->frames->Initialize();
+                    if (SUCCEEDED(job->hr)) { job->hr = job->frames->Next(job->decodedFrame); }
+                }
+                else if (SUCCEEDED(job->hr)) {
+                    job->hr = DecodeFrame(context, pDecoder.Get(), 0, !job->useTempFile && !largeFrame, &job->decodedFrame);
+                    if (SUCCEEDED(job->hr) && context.bakeOrientation && job->metadata.orientation > 1) {
+                        job->hr = ApplyOrientation(context, job->metadata.orientation, !job->useTempFile && !largeFrame, job->decodedFrame);
+                        job->metadata.orientationBaked = SUCCEEDED(job->hr);
+                    }
+                    // 新增：硬件编码的输出不经 WIC 写元数据，Exif/XMP 趁源数据还在时原样取出
+                    if (SUCCEEDED(job->hr) && pipeline->gpu && context.copyMetadata && !job->useTempFile) {
+                        CaptureRawMetadata(job->sourceBytes.data(), job->sourceBytes.size(), job->container, job->metadata);
+                    }
+                }
+                // 缩略图直接取自刚解码的位图 (或源文件内嵌的缩略图)，输出端不必再完整解码一次；像素已转正时内嵌缩略图方向不符，不再复用
+                if (SUCCEEDED(job->hr) && (pipeline->thumbnailSize || pipeline->previewSize)) {
+                    MakeThumbnails(context, job->metadata.orientationBaked ? nullptr : pDecoder.Get(), job->decodedFrame.Get(), pipeline->thumbnailSize, pipeline->previewSize, job->thumbnail, job->preview);
+                }
+            }
+        }
+        if (FAILED(job->hr)) { job->decodedFrame.Reset(); job->frames.reset(); job->metadata = FrameMetadata(); }
+        else if (job->decodedFrame) {
+            job->decodedFrame->GetSize(&job->timeline.width, &job->timeline.height);
+            job->gridEncode = pipeline->gridTileSize && !job->frames && NeedsGridEncoding(job->timeline.width, job->timeline.height);
+        }
+        job->timeline.Mark(JobTimeline::DecodeEnd);
+        // 完整解码后立即释放源数据；多帧文件的解码器仍在读取，元数据读取器按需从源数据取块，惰性解码的大图同样从源数据读取，这些情况等编码后释放
+        if (!job->frames && !job->metadata.ReferencesSource() && !largeFrame) { std::vector<BYTE>().swap(job->sourceBytes); }
+        if (!output.encodeQueue.Push(std::move(job))) break;
+    }
+    if (output.activeDecoders.fetch_sub(1) == 1) { output.encodeQueue.Close(); }
+
+    if (ready) {
+        context = ConversionContext(); // 先释放COM对象，再反初始化COM
+        CoUninitialize();
+    }
+}
+
+// 新增：为一个输出文件创建编码目标：内存模式编码到内存流，临时文件模式编码到 path.tmp
+// 修改：结果交还调用方的任务总是编码到内存，大文件也只是输入端从文件读取
+HRESULT CreateOutputStream(const ConversionContext& context, const ImageJob& job, const std::wstring& path, ComPtr<IStream>& stream, ComPtr<MemoryOutputStream>& buffer) {
+    if (!job.useTempFile || job.returnBytes) {
+        HRESULT hr = Microsoft::WRL::MakeAndInitialize<MemoryOutputStream>(&buffer, 0, context.numaNode);
+        if (SUCCEEDED(hr)) { stream = buffer; }
+        return hr;
+    }
+    ComPtr<IWICStream> pFileStream;
+    HRESULT hr = context.factory->CreateStream(&pFileStream);
+    if (SUCCEEDED(hr)) { hr = pFileStream->InitializeFromFilename(MakeTempPath(path).c_str(), GENERIC_WRITE); }
+    if (SUCCEEDED(hr)) { stream = pFileStream; }
+    return hr;
+}
+
+// 新增：多帧文件。容器支持多帧时 (HEIF) 全部帧写入同一文件；否则 (JPEG) 展开为 name_001.jpg、name_002.jpg ...
+HRESULT EncodeMultiFrameJob(const ConversionContext& context, ImageJob& job) {
+    ComPtr<IStream> pStream;
+    if (context.SupportsMultiframe()) {
+        HRESULT hr = CreateOutputStream(context, job, job.finalOutPath, pStream, job.encodedBuffer);
+        if (FAILED(hr)) return hr;
+        return EncodeSequence(context, job.decodedFrame.Get(), *job.frames, pStream.Get(), job.thumbnail.Get(), &job.metadata);
+    }
+
+    const std::wstring basePath = job.finalOutPath;
+    const UINT count = job.frames->Count();
+    job.outputFrames = count;
+    for (UINT i = 0; i < count; ++i) {
+        ComPtr<IWICBitmapSource> pFrame;
+        if (i == 0) { pFrame.Swap(job.decodedFrame); }
+        else {
+            HRESULT hr = job.frames->Next(pFrame);
+            if (FAILED(hr)) return hr;
+        }
+        // 先登记输出，失败时由写出阶段清理已生成的临时文件
+        std::wstring path = MakeNumberedPath(basePath, i + 1, count);
+        ComPtr<MemoryOutputStream>* pBuffer = nullptr;
+        if (i == 0) { job.finalOutPath = path; pBuffer = &job.encodedBuffer; }
+        else {
+            job.extraOutputs.push_back(ImageJob::ExtraOutput());
+            job.extraOutputs.back().path = path;
+            pBuffer = &job.extraOutputs.back().buffer;
+        }
+        HRESULT hr = CreateOutputStream(context, job, path, pStream, *pBuffer);
+        if (SUCCEEDED(hr)) { hr = EncodeImage(context, pFrame.Get(), pStream.Get(), nullptr, i == 0 ? job.thumbnail.Get() : nullptr, i == 0 ? &job.metadata : nullptr); }
+        pStream.Reset();
+        if (FAILED(hr)) return hr;
+    }
+    return S_OK;
+}
+
+// === 新增：编码阶段 (CPU密集)，编码到内存流 ===
+void EncodeStage(Pipeline* pipeline, size_t lane) {
+    EncodeLane& input = *pipeline->lanes[lane];
+    ConversionContext context;
+    const bool ready = InitializeStageThread(context, pipeline);
+    context.numaNode = input.numaNode;
+
+    WorkerGate* gate = pipeline->encodeGate;
+    // 修改：硬件编码器从共用的池中按张借用；出现与尺寸无关的失败后，本线程不再尝试硬件编码
+    HardwareEncoderPool* hardwarePool = ready ? pipeline->hardwareEncoders : nullptr;
+    std::shared_future<bool> encoderProbe = pipeline->encoderProbe; // 每个线程各持一份副本，get 不会互相竞争
+    bool encoderAvailable = true;
+    ImageJobPtr job;
+    for (;;) {
+        // 先取得名额再取任务，避免被限流的线程占着任务不处理
+        if (gate) gate->Acquire(lane);
+        // 新增：启用网格编码时先帮忙编码其他线程放入的图块，再取新文件
+        // 修改：同时等待新文件与图块，图块入队时被唤醒，不再按 10ms 轮询
+        if (ready && pipeline->gridTileSize) {
+            const PopResult result = input.encodeQueue.PopOr(job, [pipeline] { return pipeline->gridTiles.HasWork(); });
+            if (result == PopResult::Woken) {
+                pipeline->gridTiles.RunOne(context);
+                if (gate) gate->Release(lane);
+                continue;
+            }
+            if (result == PopResult::Closed) {
+                if (gate) gate->Release(lane);
+                break;
+            }
+        }
+        else if (!input.encodeQueue.Pop(job)) {
+            if (gate) gate->Release(lane);
+            break;
+        }
+        job->timeline.Mark(JobTimeline::EncodeStart);
+        // 新增：编码器不可用时停止接收新文件，已在流水线中的图片直接失败
+        if (encoderProbe.valid()) {
+            encoderAvailable = encoderProbe.get();
+            encoderProbe = std::shared_future<bool>();
+            if (!encoderAvailable) { pipeline->readQueue.Close(); }
+        }
+        const bool decoded = SUCCEEDED(job->hr);
+        if (SUCCEEDED(job->hr)) {
+            if (!ready) { job->hr = E_FAIL; }
+            else if (!encoderAvailable) { job->hr = WINCODEC_ERR_COMPONENTNOTFOUND; }
+            else if (job->frames) { job->hr = EncodeMultiFrameJob(context, *job); }
+            else if (job->gridEncode) {
+                // 新增：超大图像按固定质量以网格编码，不做 --target-size 搜索，也不走硬件编码器
+                ComPtr<IStream> pStream;
+                job->hr = CreateOutputStream(context, *job, job->finalOutPath, pStream, job->encodedBuffer);
+                if (SUCCEEDED(job->hr)) { job->hr = EncodeGridJob(context, *pipeline, *job, pStream.Get()); }
+            }
+            else if (pipeline->targetSize) {
+                // 新增：各次尝试都编码到内存，只有最终结果交给写出阶段；结束后恢复固定质量
+                job->hr = EncodeToTargetSize(context, *job, pipeline->targetSize, pipeline->quality >= 0.0f ? pipeline->quality : 1.0f, pipeline->qualityHistory);
+                context.SetQuality(pipeline->quality);
+            }
+            else {
+                // 内存模式编码到内存流；回退路径与原实现一致，直接编码到 .tmp 文件
+                ComPtr<IStream> pStream;
+                job->hr = CreateOutputStream(context, *job, job->finalOutPath, pStream, job->encodedBuffer);
+                // 硬件编码器的封装不含缩略图，只带 ICC 与原样取出的 Exif/XMP，其他元数据 (IPTC、TIFF 标签等) 走 WIC；硬件编码失败 (例如尺寸超出上限) 时未写入任何数据，同样回退到 WIC
+                bool encoded = false;
+                if (SUCCEEDED(job->hr) && hardwarePool && !job->thumbnail && job->metadata.PortableToHevc()) {
+                    // 池中的编码器都在使用时这张图片直接走 WIC
+                    std::unique_ptr<HardwareHevcEncoder> hardware = hardwarePool->TryAcquire();
+                    if (hardware) {
+                        const HRESULT hardwareHr = hardware->Encode(context.factory.Get(), job->decodedFrame.Get(), pipeline->quality, &job->metadata, pStream.Get());
+                        encoded = SUCCEEDED(hardwareHr);
+                        if (FAILED(hardwareHr) && hardwareHr != HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED)) {
+                            hardwarePool->Discard(std::move(hardware));
+                            hardwarePool = nullptr;
+                        }
+                        else { hardwarePool->Release(std::move(hardware)); }
+                    }
+                }
+                if (SUCCEEDED(job->hr) && !encoded) { job->hr = EncodeImage(context, job->decodedFrame.Get(), pStream.Get(), nullptr, job->thumbnail.Get(), &job->metadata); }
+            }
+            // 旁车文件：与主输出同名，后缀为 .thumb.jpg / .preview.jpg；生成失败不影响主输出。不写文件的任务没有旁车
+            if (SUCCEEDED(job->hr) && pipeline->thumbnailSidecar && !job->returnBytes) {
+                const size_t extensionOffset = PathFindExtensionW(job->finalOutPath.c_str()) - job->finalOutPath.c_str();
+                const std::wstring stem = job->finalOutPath.substr(0, extensionOffset);
+                const std::pair<IWICBitmapSource*, const WCHAR*> sidecars[] = { { job->thumbnail.Get(), L".thumb.jpg" }, { job->preview.Get(), L".preview.jpg" } };
+                for (const auto& sidecar : sidecars) {
+                    ImageJob::ExtraOutput output;
+                    if (sidecar.first && SUCCEEDED(EncodeSidecarJpeg(context, sidecar.first, output.buffer))) {
+                        output.path = stem + sidecar.second;
+                        output.sidecar = true;
+                        job->extraOutputs.push_back(std::move(output));
+                    }
+                }
+            }
+        }
+        // 新增：解码成功而编码器创建或提交失败，才可能是缺少 HEVC 组件
+        job->encoderUnavailable = decoded && ready && IsCodecUnavailableError(job->hr);
+        job->decodedFrame.Reset();
+        job->thumbnail.Reset();
+        job->preview.Reset();
+        job->metadata = FrameMetadata();
+        job->frames.reset();
+        std::vector<BYTE>().swap(job->sourceBytes);
+        if (pipeline->memoryBudget && job->admittedBytes) { pipeline->memoryBudget->Release(job->admittedBytes); job->admittedBytes = 0; }
+        if (gate) gate->Release(lane);
+        pipeline->encodedJobs.fetch_add(1, std::memory_order_relaxed);
+        job->timeline.Mark(JobTimeline::EncodeEnd);
+        if (!pipeline->writeQueue.Push(std::move(job))) break;
+    }
+    // 修改：各通道的队列先后关闭，门在最后一个编码线程退出时才关闭，之前仍按上限限流；
+    // 同一通道被限流的线程依次取得名额、看到队列关闭后退出
+    if (pipeline->activeEncoders.fetch_sub(1) == 1) {
+        if (gate) gate->Close();
+        if (ready && pipeline->hardwareEncoders) { pipeline->hardwareEncoders->Clear(); } // 其他编码线程都已退出，不再有借出的编码器
+        pipeline->writeQueue.Close();
+    }
+
+    if (ready) {
+        context = ConversionContext();
+        CoUninitialize();
+    }
+}
+
+// 新增：完成一个输出文件。之前的步骤已失败时只清理临时文件
+HRESULT FinalizeOutput(bool useTempFile, const std::wstring& finalOutPath, MemoryOutputStream* pBuffer, HRESULT hr, bool& finalizeFailed, DWORD& lastError, ULONGLONG& outputBytes) {
+    const std::wstring& tempOutPath = MakeTempPath(finalOutPath);
+    if (FAILED(hr) || finalizeFailed) {
+        if (useTempFile) { DeleteFileW(tempOutPath.c_str()); }
+        return hr;
+    }
+    if (!useTempFile) {
+        // 内存模式：一次写出并原子改名，失败时临时文件已随句柄删除
+        if (!pBuffer) return E_UNEXPECTED;
+        outputBytes += pBuffer->Size();
+        lastError = WriteBufferAndRename(pBuffer->Data(), pBuffer->Size(), tempOutPath, finalOutPath, finalizeFailed);
+        if (lastError != ERROR_SUCCESS && !finalizeFailed) { hr = HRESULT_FROM_WIN32(lastError); }
+    }
+    else {
+        DeleteFileW(finalOutPath.c_str());
+        if (!MoveFileW(tempOutPath.c_str(), finalOutPath.c_str())) {
+            lastError = GetLastError();
+            finalizeFailed = true;
+            DeleteFileW(tempOutPath.c_str());
+        }
+    }
+    return hr;
+}
+
+// 新增：把一个图片的写出结果记入清单/日志并交给进度输出，同步与异步写出共用
+void PostWriteResult(Pipeline* pipeline, CompletionRing* ring, ImageJobPtr job, HRESULT hr, bool finalizeFailed, DWORD lastError, ULONGLONG outputBytes) {
+    CompletionRecord record;
+    record.outputBytes = outputBytes;
+    record.hr = hr;
+    ConversionManifest* manifest = pipeline->ManifestFor(*job);
+    if (FAILED(hr)) {
+        record.outcome = JobOutcome::Failed;
+        if (job->encoderUnavailable) { pipeline->codecFailures.fetch_add(1, std::memory_order_relaxed); }
+    }
+    else if (finalizeFailed) { record.outcome = JobOutcome::Failed; record.finalizeError = lastError; }
+    else {
+        record.outcome = JobOutcome::Converted;
+        // 修改：记下首个输出的大小，输出被删除或替换后下次运行重新转换
+        if (manifest) {
+            ConversionManifest::Record manifestRecord = MakeManifestRecord(*pipeline, *job);
+            ULONGLONG writeTime = 0;
+            manifestRecord.outputFrames = job->outputFrames;
+            GetOutputStamp(job->finalOutPath, manifestRecord.outputSize, writeTime);
+            manifest->Add(manifestRecord);
+        }
+        // 输出已改名到位后才记入日志，中断时未记录的文件重新转换即可
+        if (RunJournal* journal = pipeline->JournalFor(*job)) { journal->Add(job->manifestKey); }
+    }
+    if (manifest) { manifest->EndConversion(MakeManifestRecord(*pipeline, *job)); }
+    // 新增：--dedup 时取出等待本文件结果的副本 (输出路径需在清空 extraOutputs 之前取得)
+    // 修改：编码成功而写出失败时不把错误传给副本，由第一个副本接手重新转换
+    const bool converted = record.outcome == JobOutcome::Converted;
+    const bool writeFailed = !converted && SUCCEEDED(job->hr);
+    std::vector<ImageJobPtr> copies;
+    ImageJobPtr successor;
+    std::wstring stem;
+    std::vector<std::wstring> suffixes;
+    if (pipeline->dedup && job->dedupOwner) { copies = pipeline->dedup->Complete(*job, converted, writeFailed, successor, stem, suffixes); }
+    // 新增：库调用提交的任务在此把结果交给调用方；不写文件时编码结果随之返回
+    if (job->request) {
+        ConversionOutput output;
+        output.hr = FAILED(hr) ? hr : (finalizeFailed ? HRESULT_FROM_WIN32(lastError) : S_OK);
+        if (SUCCEEDED(output.hr) && job->returnBytes) {
+            if (job->encodedBuffer) { output.bytes.assign(job->encodedBuffer->Data(), job->encodedBuffer->Data() + job->encodedBuffer->Size()); }
+            for (const ImageJob::ExtraOutput& extra : job->extraOutputs) {
+                if (extra.buffer) { output.extraBytes.emplace_back(extra.buffer->Data(), extra.buffer->Data() + extra.buffer->Size()); }
+            }
+        }
+        job->request->Deliver(output);
+    }
+    job->encodedBuffer.Reset();
+    job->extraOutputs.clear();
+    record.job = std::move(job);
+    pipeline->reporter->Post(ring, record);
+
+    // 接手的副本回到解码队列；等待期间释放了源数据的重新读入
+    if (successor) {
+        if (successor->sourceBytes.empty()) {
+            successor->hr = ReadFileToBuffer(successor->inputPath.c_str(), pipeline->bufferLimit, successor->sourceBytes, successor->useTempFile, successor->container);
+        }
+        if (!pipeline->decodeQueue.Requeue(successor)) {
+            successor->hr = E_ABORT;
+            PostWriteResult(pipeline, ring, std::move(successor), E_ABORT, false, ERROR_SUCCESS, 0);
+        }
+        pipeline->ReleaseReader();
+    }
+    // 副本与本文件内容完全相同，解码或编码失败时以同样的错误上报
+    for (ImageJobPtr& copy : copies) {
+        if (converted) {
+            ULONGLONG copyBytes = 0;
+            const HRESULT hrCopy = pipeline->dedup->Materialize(stem, suffixes, *copy, copyBytes);
+            PostWriteResult(pipeline, ring, std::move(copy), hrCopy, false, ERROR_SUCCESS, copyBytes);
+        }
+        else { PostWriteResult(pipeline, ring, std::move(copy), hr, finalizeFailed, lastError, 0); }
+        pipeline->ReleaseReader();
+    }
+}
+
+// === 新增：异步输出写入器 ===
+// 内存模式的编码结果以对齐的大块 FILE_FLAG_NO_BUFFERING 重叠写入，完成通知经 I/O 完成端口送达写入器自己的线程；
+// 截断到实际大小、改名和结果上报都在这些线程上完成，写出阶段线程只负责打开文件和发起写入。
+// 修改：扩展有效数据长度 (VDL) 的写入在 NTFS 上同步完成，与块的提交方式无关。每个文件同一时刻只有一块在途、
+// 按偏移顺序推进，只有前沿的一块扩展 VDL，不出现后面的块等待前面空洞补零；写入 (无论是否同步完成) 都在写入器线程上发起，
+// 写出阶段只投递一个启动通知，多个文件之间仍并行
+class AsyncFileWriter {
+public:
+    AsyncFileWriter(Pipeline& pipeline, unsigned threadCount, size_t maxInFlight)
+        : pipeline_(pipeline), threadCount_(std::max(1u, threadCount)), maxInFlight_(std::max<size_t>(1, maxInFlight)) {}
+    ~AsyncFileWriter() { Stop(); }
+
+    HRESULT Start() {
+        port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, threadCount_);
+        if (!port_) return HRESULT_FROM_WIN32(GetLastError());
+        for (unsigned i = 0; i < threadCount_; ++i) { threads_.emplace_back(&AsyncFileWriter::Run, this); }
+        return S_OK;
+    }
+
+    // 成功时接管 job；无法异步写出时 (例如文件系统不接受无缓冲打开) 返回 false，job 保持不变由调用方同步写出。
+    // 在途的图片数达到上限时阻塞，只阻塞写出阶段，编码线程不受影响
+    bool Submit(ImageJobPtr& job) {
+        std::unique_ptr<Batch> batch(new Batch());
+        if (!AddFile(*batch, job->finalOutPath, job->encodedBuffer.Get())) return false;
+        for (const ImageJob::ExtraOutput& extra : job->extraOutputs) { if (!AddFile(*batch, extra.path, extra.buffer.Get())) return false; }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [this] { return inFlight_ < maxInFlight_; });
+            ++inFlight_;
+        }
+        batch->job = std::move(job);
+        batch->remaining = batch->files.size();
+        // 最后一块完成后 batch 即在完成线程上释放，提交前先取出各文件的第一块
+        std::vector<Chunk*> chunks;
+        for (auto& file : batch->files) { chunks.push_back(&file->chunks.front()); file->next = 1; }
+        batch.release();
+        for (Chunk* chunk : chunks) { PostQueuedCompletionStatus(port_, 0, kIssueKey, &chunk->overlapped); }
+        return true;
+    }
+
+    // 等所有在途写入完成后退出线程
+    void Stop() {
+        if (!port_) return;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [this] { return inFlight_ == 0; });
+        }
+        for (size_t i = 0; i < threads_.size(); ++i) { PostQueuedCompletionStatus(port_, 0, kExitKey, NULL); }
+        for (auto& thread : threads_) { if (thread.joinable()) { thread.join(); } }
+        threads_.clear();
+        CloseHandle(port_);
+        port_ = NULL;
+    }
+
+private:
+    static const size_t kSectorAlignment = 4096;     // 512 与 4K 扇区的公倍数
+    static const DWORD kChunkBytes = 1024 * 1024;    // 单次写入大小，同一文件的块依次提交
+    static const ULONG_PTR kExitKey = 1;
+    static const ULONG_PTR kIssueKey = 2;            // 新增：在写入器线程上发起该块的写入
+
+    struct Batch;
+    struct FileWrite;
+    struct Chunk {
+        OVERLAPPED overlapped;
+        FileWrite* file;
+        size_t offset;
+        DWORD length;
+    };
+    struct FileWrite {
+        HANDLE handle = INVALID_HANDLE_VALUE;
+        std::wstring tempPath;
+        const std::wstring* finalPath = nullptr;
+        const BYTE* data = nullptr;
+        size_t size = 0;
+        std::vector<Chunk> chunks;
+        size_t next = 0;                     // 修改：下一个待提交的块；同一文件只有一块在途，无需原子操作
+        std::atomic<DWORD> error{ ERROR_SUCCESS };
+        bool renameFailed = false;
+        Batch* batch = nullptr;
+    };
+    struct Batch {
+        ~Batch() {
+            // 未提交就放弃的文件 (后续输出打开失败) 随句柄删除
+            for (auto& file : files) {
+                if (file->handle == INVALID_HANDLE_VALUE) continue;
+                FILE_DISPOSITION_INFO disposition = { TRUE };
+                SetFileInformationByHandle(file->handle, FileDispositionInfo, &disposition, sizeof(disposition));
+                CloseHandle(file->handle);
+            }
+        }
+        ImageJobPtr job;
+        std::vector<std::unique_ptr<FileWrite>> files;
+        std::atomic<size_t> remaining{ 0 };
+    };
+
+    bool AddFile(Batch& batch, const std::wstring& finalPath, MemoryOutputStream* pBuffer) {
+        if (!pBuffer) return false; // 临时文件模式的输出已在 .tmp 中
+        const size_t size = pBuffer->Size();
+        const size_t alignedSize = (size + kSectorAlignment - 1) & ~(kSectorAlignment - 1);
+        // 无缓冲写入要求地址和长度按扇区对齐；缓冲区按 64KB 分配，尾部补齐的字节写出后再截掉
+        if (reinterpret_cast<ULONG_PTR>(pBuffer->Data()) % kSectorAlignment != 0 || alignedSize > pBuffer->Capacity()) return false;
+
+        std::unique_ptr<FileWrite> file(new FileWrite());
+        file->tempPath = MakeTempPath(finalPath);
+        file->finalPath = &finalPath;
+        file->data = pBuffer->Data();
+        file->size = size;
+        file->batch = &batch;
+        file->handle = CreateFileW(file->tempPath.c_str(), GENERIC_WRITE | DELETE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING, NULL);
+        if (file->handle == INVALID_HANDLE_VALUE) return false;
+        batch.files.push_back(std::move(file));
+        FileWrite& added = *batch.files.back();
+        if (!CreateIoCompletionPort(added.handle, port_, 0, 0)) return false;
+        // 预先设好文件大小，写入时不必逐块扩展文件
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(alignedSize);
+        if (alignedSize && !SetFileInformationByHandle(added.handle, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) return false;
+
+        for (size_t offset = 0; offset < alignedSize; offset += kChunkBytes) {
+            Chunk chunk = {};
+            chunk.overlapped.Offset = static_cast<DWORD>(offset);
+            chunk.overlapped.OffsetHigh = static_cast<DWORD>(static_cast<ULONGLONG>(offset) >> 32);
+            chunk.file = &added;
+            chunk.offset = offset;
+            chunk.length = static_cast<DWORD>(std::min<size_t>(kChunkBytes, alignedSize - offset));
+            added.chunks.push_back(chunk);
+        }
+        if (added.chunks.empty()) { Chunk chunk = {}; chunk.file = &added; added.chunks.push_back(chunk); } // 空文件：只投递完成通知
+        return true;
+    }
+
+    void Issue(Chunk& chunk) {
+        if (chunk.length == 0) { PostQueuedCompletionStatus(port_, 0, 0, &chunk.overlapped); return; }
+        FileWrite& file = *chunk.file;
+        if (!WriteFile(file.handle, file.data + chunk.offset, chunk.length, NULL, &chunk.overlapped) && GetLastError() != ERROR_IO_PENDING) {
+            // 提交失败不会产生完成通知，补投一个，统一在完成线程上收尾
+            SetError(file, GetLastError());
+            PostQueuedCompletionStatus(port_, 0, 0, &chunk.overlapped);
+        }
+    }
+
+    static void SetError(FileWrite& file, DWORD error) {
+        DWORD expected = ERROR_SUCCESS;
+        file.error.compare_exchange_strong(expected, error);
+    }
+
+    void Run() {
+        CompletionRing* ring = pipeline_.reporter->RegisterProducer();
+        for (;;) {
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            LPOVERLAPPED overlapped = nullptr;
+            const BOOL ok = GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, INFINITE);
+            if (!overlapped) {
+                if (!ok || key == kExitKey) break;
+                continue;
+            }
+            Chunk* chunk = CONTAINING_RECORD(overlapped, Chunk, overlapped);
+            if (key == kIssueKey) { Issue(*chunk); continue; }
+            FileWrite& file = *chunk->file;
+            if (!ok) { SetError(file, GetLastError()); }
+            else if (bytes != chunk->length && file.error.load() == ERROR_SUCCESS) { SetError(file, ERROR_WRITE_FAULT); }
+            // 修改：上一块完成后才提交下一块；出错后不再提交，直接收尾
+            if (file.error.load() == ERROR_SUCCESS && file.next < file.chunks.size()) {
+                Issue(file.chunks[file.next++]);
+                continue;
+            }
+
+            FinishFile(file);
+            Batch* batch = file.batch;
+            if (batch->remaining.fetch_sub(1) != 1) continue;
+            FinishBatch(batch, ring);
+        }
+    }
+
+    // 截到实际大小并原子改名为最终文件；失败时随句柄删除临时文件
+    void FinishFile(FileWrite& file) {
+        if (file.error.load() == ERROR_SUCCESS) {
+            FILE_END_OF_FILE_INFO endOfFile;
+            endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(file.size);
+            if (!SetFileInformationByHandle(file.handle, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) { SetError(file, GetLastError()); }
+        }
+        if (file.error.load() == ERROR_SUCCESS) {
+            const size_t nameBytes = file.finalPath->size() * sizeof(WCHAR);
+            std::vector<BYTE> renameBuffer(sizeof(FILE_RENAME_INFO) + nameBytes);
+            FILE_RENAME_INFO* pRename = reinterpret_cast<FILE_RENAME_INFO*>(renameBuffer.data());
+            pRename->ReplaceIfExists = TRUE;
+            pRename->RootDirectory = NULL;
+            pRename->FileNameLength = static_cast<DWORD>(nameBytes);
+            memcpy(pRename->FileName, file.finalPath->c_str(), nameBytes);
+            if (!SetFileInformationByHandle(file.handle, FileRenameInfo, pRename, static_cast<DWORD>(renameBuffer.size()))) {
+                SetError(file, GetLastError());
+                file.renameFailed = true;
+            }
+        }
+        if (file.error.load() != ERROR_SUCCESS) {
+            FILE_DISPOSITION_INFO disposition = { TRUE };
+            SetFileInformationByHandle(file.handle, FileDispositionInfo, &disposition, sizeof(disposition));
+        }
+        CloseHandle(file.handle);
+        file.handle = INVALID_HANDLE_VALUE;
+    }
+
+    // 与同步路径 (FinalizeOutput) 的结果含义一致：写入失败记为 hr，改名失败记为 finalizeError
+    void FinishBatch(Batch* batch, CompletionRing* ring) {
+        HRESULT hr = S_OK;
+        bool finalizeFailed = false;
+        DWORD lastError = ERROR_SUCCESS;
+        ULONGLONG outputBytes = 0;
+        // 修改：files[0] 为主输出，其后依次对应 extraOutputs；旁车文件写出失败时只从输出列表中去掉，不计为失败
+        std::vector<ImageJob::ExtraOutput>& extras = batch->job->extraOutputs;
+        for (size_t i = 0; i < batch->files.size(); ++i) {
+            const FileWrite& file = *batch->files[i];
+            const DWORD error = file.error.load();
+            if (i > 0 && extras[i - 1].sidecar && error != ERROR_SUCCESS) continue;
+            outputBytes += file.size;
+            if (error == ERROR_SUCCESS || FAILED(hr) || finalizeFailed) continue;
+            if (file.renameFailed) { finalizeFailed = true; lastError = error; }
+            else { hr = HRESULT_FROM_WIN32(error); }
+        }
+        for (size_t i = batch->files.size(); i-- > 1;) {
+            if (extras[i - 1].sidecar && batch->files[i]->error.load() != ERROR_SUCCESS) { extras.erase(extras.begin() + (i - 1)); }
+        }
+        PostWriteResult(&pipeline_, ring, std::move(batch->job), hr, finalizeFailed, lastError, outputBytes);
+        delete batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --inFlight_;
+        }
+        idle_.notify_all();
+    }
+
+    Pipeline& pipeline_;
+    const unsigned threadCount_;
+    const size_t maxInFlight_;
+    HANDLE port_ = NULL;
+    std::vector<std::thread> threads_;
+    size_t inFlight_ = 0;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+};
+
+// === 修改：写出阶段 (I/O)，由原 Worker 的收尾逻辑演变而来：写临时文件、改名并输出结果 ===
+void WriteStage(Pipeline* pipeline) {
+    CompletionRing* ring = pipeline->reporter->RegisterProducer();
+    ImageJobPtr job;
+    while (pipeline->writeQueue.Pop(job)) {
+        job->timeline.Mark(JobTimeline::WriteStart);
+        // 新增：不写文件的任务直接上报，编码结果由 PostWriteResult 交还调用方
+        if (job->returnBytes) {
+            ULONGLONG outputBytes = job->encodedBuffer ? job->encodedBuffer->Size() : 0;
+            for (const ImageJob::ExtraOutput& extra : job->extraOutputs) { if (extra.buffer) { outputBytes += extra.buffer->Size(); } }
+            const HRESULT hr = job->hr;
+            PostWriteResult(pipeline, ring, std::move(job), hr, false, ERROR_SUCCESS, outputBytes);
+            continue;
+        }
+        // 新增：输出全部在内存中时交给异步写入器，结果由其完成线程上报
+        if (SUCCEEDED(job->hr) && pipeline->fileWriter && job->encodedBuffer && pipeline->fileWriter->Submit(job)) continue;
+
+        bool finalizeFailed = false;
+        DWORD lastError = ERROR_SUCCESS;
+        ULONGLONG outputBytes = 0;
+        // --target-size 时临时文件模式的图片同样编码到内存
+        HRESULT hr = FinalizeOutput(job->useTempFile && !job->encodedBuffer, job->finalOutPath, job->encodedBuffer.Get(), job->hr, finalizeFailed, lastError, outputBytes);
+        job->encodedBuffer.Reset();
+        for (auto it = job->extraOutputs.begin(); it != job->extraOutputs.end();) {
+            ImageJob::ExtraOutput& extra = *it;
+            // 临时文件模式下多帧展开的输出已在 .tmp 中；带缓冲区的输出 (旁车文件) 总是从内存写出
+            if (!extra.sidecar) { hr = FinalizeOutput(!extra.buffer, extra.path, extra.buffer.Get(), hr, finalizeFailed, lastError, outputBytes); }
+            else {
+                // 修改：旁车文件的错误单独记录，主输出已失败时只清理；写出失败的旁车文件从输出列表中去掉
+                bool sidecarFailed = finalizeFailed;
+                DWORD sidecarError = ERROR_SUCCESS;
+                ULONGLONG sidecarBytes = 0;
+                const HRESULT hrSidecar = FinalizeOutput(false, extra.path, extra.buffer.Get(), hr, sidecarFailed, sidecarError, sidecarBytes);
+                if (FAILED(hr) || finalizeFailed || FAILED(hrSidecar) || sidecarFailed) { it = job->extraOutputs.erase(it); continue; }
+                outputBytes += sidecarBytes;
+            }
+            extra.buffer.Reset();
+            ++it;
+        }
+        PostWriteResult(pipeline, ring, std::move(job), hr, finalizeFailed, lastError, outputBytes);
+    }
+}
+
+// 新增：流水线的唯一入口，命令行的枚举与 Converter::Submit 都经此投递；预读队列已关闭 (编码器不可用) 时返回 false
+bool SubmitJob(Pipeline& pipeline, ImageJobPtr job) {
+    job->index = pipeline.discoveredFiles.fetch_add(1);
+    job->timeline.Mark(JobTimeline::Queued);
+    return pipeline.readQueue.Push(std::move(job)); // 队列满时在此处阻塞
+}
+
+// === 新增：WorkerTuner 实现 ===
+void WorkerTuner::Start(const Pipeline* pipeline) {
+    pipeline_ = pipeline;
+    thread_ = std::thread(&WorkerTuner::Run, this);
+}
+
+void WorkerTuner::Stop() {
+    stopping_ = true;
+    if (thread_.joinable()) { thread_.join(); }
+}
+
+bool WorkerTuner::WaitForEncoded(size_t target) {
+    while (pipeline_->encodedJobs.load(std::memory_order_relaxed) < target) {
+        if (stopping_.load()) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return true;
+}
+
+double WorkerTuner::Measure(unsigned level) {
+    gate_.SetLimit(level);
+    // 先丢弃切换档位时已在途的任务，再测量一个窗口
+    const size_t warmupEnd = pipeline_->encodedJobs.load() + level;
+    if (!WaitForEncoded(warmupEnd)) return -1.0;
+
+    const size_t window = std::max<size_t>(16, 2 * level);
+    const size_t begin = pipeline_->encodedJobs.load();
+    const LONGLONG start = QueryTicks();
+    if (!WaitForEncoded(begin + window)) return -1.0;
+    const double seconds = TicksToMs(QueryTicks() - start) / 1000.0;
+    return seconds > 0.0 ? (pipeline_->encodedJobs.load() - begin) / seconds : 0.0;
+}
+
+void WorkerTuner::Run() {
+    auto budgetLeft = [this] { return pipeline_->encodedJobs.load() < tuningFiles_; };
+
+    unsigned bestLevel = std::max(1u, maxWorkers_ / 2);
+    double bestRate = Measure(bestLevel);
+    if (bestRate < 0.0) return;
+    unsigned rejected = 0; // 最近一次被否决的档位，用于最后的细化
+
+    // 向上探测：只有明显更快才接受更多线程
+    bool climbed = false;
+    while (bestLevel < maxWorkers_ && budgetLeft()) {
+        const unsigned up = std::min(maxWorkers_, bestLevel * 2);
+        const double rate = Measure(up);
+        if (rate < 0.0) return;
+        if (rate > bestRate * 1.03) { bestLevel = up; bestRate = rate; climbed = true; }
+        else { rejected = up; break; }
+    }
+    // 向下探测：吞吐基本不变时优先更少的线程 (编码器内部可能已经多线程)
+    while (!climbed && bestLevel > 1 && budgetLeft()) {
+        const unsigned down = std::max(1u, bestLevel / 2);
+        const double rate = Measure(down);
+        if (rate < 0.0) return;
+        if (rate >= bestRate * 0.97) { bestLevel = down; bestRate = std::max(bestRate, rate); }
+        else { rejected = down; break; }
+    }
+    // 细化：在最佳档位与被否决档位之间再试一次中点
+    if (rejected != 0 && budgetLeft()) {
+        const unsigned mid = (bestLevel + rejected) / 2;
+        if (mid != bestLevel && mid != rejected) {
+            const double rate = Measure(mid);
+            if (rate < 0.0) return;
+            if (mid < bestLevel ? rate >= bestRate * 0.97 : rate > bestRate * 1.03) { bestLevel = mid; }
+        }
+    }
+
+    gate_.SetLimit(bestLevel);
+    settled_ = bestLevel;
+}
+
+// === 新增：ConversionEngine 实现 ===
+ConversionEngine::ConversionEngine(const EngineSettings& settings) : config_(settings.config) {
+    const bool toHeic = settings.mode == ConversionMode::ToHeic;
+    // --gpu 时初始化 Media Foundation 和所选显卡；失败时整个批次使用 WIC
+    bool gpuReady = false;
+    if (config_.gpuIndex >= 0 && toHeic) {
+        gpuStatus_ = MFStartup(MF_VERSION, MFSTARTUP_LITE);
+        mediaFoundationStarted_ = SUCCEEDED(gpuStatus_);
+        if (SUCCEEDED(gpuStatus_)) { gpuStatus_ = gpu_.Initialize(static_cast<UINT>(config_.gpuIndex)); }
+        gpuReady = SUCCEEDED(gpuStatus_);
+    }
+
+    // HEVC 探测在后台线程进行 (结果按组件版本缓存)，与目录枚举和流水线启动并行
+    if (settings.probe) {
+        const GpuDevice* probeGpu = gpuReady ? &gpu_ : nullptr;
+        const bool reportProbe = settings.outputLevel != OutputLevel::Quiet && toHeic;
+        bool* pFromCache = &probeFromCache_;
+        probe_ = std::async(std::launch::async, [probeGpu, reportProbe, pFromCache]() {
+            bool available = false;
+            if (SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED))) {
+                {
+                    ComPtr<IWICImagingFactory> pFactory;
+                    if (SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&pFactory)))) {
+                        available = CheckHevcEncoderAvailability(pFactory.Get(), probeGpu, reportProbe, pFromCache);
+                    }
+                }
+                CoUninitialize();
+            }
+            return available;
+        }).share();
+    }
+
+    // 编码阶段是CPU瓶颈，按核心数分配；解码和I/O阶段只需少量线程保持编码器不空闲
+    const unsigned int num_cores = GetLogicalProcessorCount();
+    if (config_.encodeThreads == 0) config_.encodeThreads = num_cores;
+    if (config_.decodeThreads == 0) config_.decodeThreads = std::max(1u, num_cores / 2);
+    if (config_.ioThreads == 0) config_.ioThreads = std::min(4u, num_cores);
+    if (config_.writeThreads == 0) config_.writeThreads = std::min(2u, num_cores);
+    if (config_.queueDepth == 0) config_.queueDepth = config_.encodeThreads * 2;
+
+    // 多 NUMA 节点时每个节点一个编码通道，解码和编码线程按节点处理器数量分配
+    const ProcessorTopology& topology = ProcessorTopology::Get();
+    const size_t laneCount = topology.IsNuma() ? topology.Domains().size() : 1;
+    laneDecoders_.assign(1, config_.decodeThreads);
+    laneEncoders_.assign(1, config_.encodeThreads);
+    if (laneCount > 1) {
+        laneDecoders_ = topology.Distribute(config_.decodeThreads);
+        laneEncoders_ = topology.Distribute(config_.encodeThreads);
+        config_.decodeThreads = 0;
+        config_.encodeThreads = 0;
+        for (size_t lane = 0; lane < laneCount; ++lane) { config_.decodeThreads += laneDecoders_[lane]; config_.encodeThreads += laneEncoders_[lane]; }
+    }
+
+    pipeline_.reset(new Pipeline(config_.queueDepth, laneCount, config_.largestFirst));
+    Pipeline& pipeline = *pipeline_;
+    pipeline.quality = settings.quality;
+    pipeline.targetExtension = toHeic ? L".heic" : L".jpg";
+    pipeline.targetEncoderGuid = toHeic ? GUID_ContainerFormatHeif : GUID_ContainerFormatJpeg;
+    pipeline.bufferLimit = config_.bufferLimit;
+    pipeline.thumbnailSize = config_.thumbnailSize;
+    pipeline.previewSize = config_.previewSize;
+    pipeline.thumbnailSidecar = config_.thumbnailSidecar && (config_.thumbnailSize || config_.previewSize);
+    pipeline.maxDimension = config_.maxDimension;
+    pipeline.copyMetadata = config_.copyMetadata;
+    pipeline.targetSize = config_.targetSize;
+    pipeline.gridTileSize = toHeic ? config_.gridTileSize : 0;
+    if (gpuReady) {
+        pipeline.gpu = &gpu_;
+        hardwareEncoders_.reset(new HardwareEncoderPool(gpu_, std::min(gpu_.EncodeEngines(), config_.encodeThreads)));
+        pipeline.hardwareEncoders = hardwareEncoders_.get();
+    }
+    pipeline.encoderProbe = probe_;
+
+    pixelPool_.reset(new PixelBufferPool(config_.pixelPoolLimit ? config_.pixelPoolLimit
+        : (config_.maxMemory ? std::min(config_.maxMemory, DefaultPixelPoolLimit()) : DefaultPixelPoolLimit())));
+    pipeline.pixelPool = pixelPool_.get();
+    memoryBudget_.reset(new MemoryBudget(config_.maxMemory));
+    if (config_.maxMemory) { pipeline.memoryBudget = memoryBudget_.get(); }
+
+    // 预读阶段 (跳过的文件)、写出阶段和异步写入器的完成线程各自注册一个环形缓冲区
+    reporter_.reset(new ProgressReporter(settings.outputLevel));
+    pipeline.reporter = reporter_.get();
+
+    pipeline.activeReaders = config_.ioThreads;
+    for (size_t lane = 0; lane < laneCount; ++lane) {
+        if (laneCount > 1) { pipeline.lanes[lane]->numaNode = topology.Domains()[lane].numaNode; }
+        pipeline.lanes[lane]->activeDecoders = laneDecoders_[lane];
+    }
+    pipeline.activeEncoders = config_.encodeThreads;
+    pipeline.encodeThreads = std::max(1u, config_.encodeThreads);
+
+    // 自动模式：从一半的线程开始，调优完成后固定上限
+    encodeGate_.reset(new WorkerGate(std::max(1u, config_.encodeThreads / 2), laneEncoders_));
+    tuner_.reset(new WorkerTuner(*encodeGate_, config_.encodeThreads, 320));
+    if (settings.autoWorkers && config_.encodeThreads > 1) { pipeline.encodeGate = encodeGate_.get(); }
+}
+
+ConversionEngine::~ConversionEngine() {
+    Finish();
+}
+
+void ConversionEngine::Start() {
+    Pipeline& pipeline = *pipeline_;
+    // 内存模式的输出以无缓冲重叠写入经完成端口写出，改名在写入器线程上完成
+    fileWriter_.reset(new AsyncFileWriter(pipeline, config_.writeThreads, config_.queueDepth));
+    if (SUCCEEDED(fileWriter_->Start())) { pipeline.fileWriter = fileWriter_.get(); }
+
+    reporter_->Start(&pipeline);
+    started_ = true;
+    for (unsigned int i = 0; i < config_.ioThreads; ++i) { threads_.emplace_back(ReadStage, &pipeline); }
+    if (pipeline.memoryBudget) { threads_.emplace_back(AdmissionStage, &pipeline); }
+    // 多通道时线程固定在通道所在节点；单通道时按处理器组轮转分配
+    const ProcessorTopology& topology = ProcessorTopology::Get();
+    const size_t laneCount = pipeline.lanes.size();
+    auto startLaneThreads = [&](void (*stage)(Pipeline*, size_t), const std::vector<unsigned>& perLane) {
+        unsigned total = 0;
+        for (unsigned n : perLane) total += n;
+        const std::vector<size_t> placement = topology.Assign(total);
+        unsigned index = 0;
+        for (size_t lane = 0; lane < perLane.size(); ++lane) {
+            for (unsigned i = 0; i < perLane[lane]; ++i, ++index) {
+                threads_.emplace_back(stage, &pipeline, lane);
+                topology.Pin(threads_.back(), laneCount > 1 ? lane : placement[index]);
+            }
+        }
+    };
+    startLaneThreads(DecodeStage, laneDecoders_);
+    startLaneThreads(EncodeStage, laneEncoders_);
+    for (unsigned int i = 0; i < config_.writeThreads; ++i) { threads_.emplace_back(WriteStage, &pipeline); }
+    if (pipeline.encodeGate) { tuner_->Start(&pipeline); }
+}
+
+void ConversionEngine::Finish() {
+    if (finished_) return;
+    finished_ = true;
+    pipeline_->scanComplete = true;
+    pipeline_->readQueue.Close();
+    for (auto& t : threads_) { if (t.joinable()) { t.join(); } }
+    if (fileWriter_) { fileWriter_->Stop(); } // 等待在途的异步写入上报结果
+    if (started_) {
+        if (pipeline_->encodeGate) { tuner_->Stop(); }
+        reporter_->Stop();
+    }
+    // 探测线程可能仍在使用显卡，等它结束后再关闭 Media Foundation
+    if (probe_.valid()) { probe_.wait(); }
+    pipeline_->gpu = nullptr;
+    pipeline_->hardwareEncoders = nullptr;
+    hardwareEncoders_.reset(); // 通常已由最后一个编码线程清空
+    if (mediaFoundationStarted_) {
+        gpu_.Reset();
+        MFShutdown();
+        mediaFoundationStarted_ = false;
+    }
+}
+
+HRESULT EncodeGridTile(const ConversionContext& context, GridTileTask& task, const FrameMetadata* pMetadata) {
+    ComPtr<IWICBitmap> pTile;
+    HRESULT hr = context.factory->CreateBitmapFromMemory(task.tileSize, task.tileSize, GUID_WICPixelFormat32bppBGR, task.tileSize * 4,
+        static_cast<UINT>(task.pixels.size()), task.pixels.data(), &pTile);
+    std::vector<BYTE>().swap(task.pixels); // 位图已复制了像素
+    ComPtr<MemoryOutputStream> pBuffer;
+    if (SUCCEEDED(hr)) { hr = Microsoft::WRL::MakeAndInitialize<MemoryOutputStream>(&pBuffer, 0, context.numaNode); }
+    if (SUCCEEDED(hr)) { hr = EncodeImage(context, pTile.Get(), pBuffer.Get(), nullptr, nullptr, pMetadata); }
+    if (SUCCEEDED(hr)) { hr = ExtractHeifImage(pBuffer->Data(), pBuffer->Size(), task.result); }
+    return hr;
+}
+
+void GridBatch::Complete(HRESULT result) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (FAILED(result) && SUCCEEDED(hr)) { hr = result; }
+        --pending;
+    }
+    queue.Wake();
+}
+
+bool GridBatch::Failed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return FAILED(hr);
+}
+
+bool GridTileQueue::RunOne(const ConversionContext& context) {
+    GridTileTask* task = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty()) return false;
+        task = tasks_.front();
+        tasks_.pop_front();
+        size_.fetch_sub(1);
+    }
+    // 同一图像已有图块失败时其余图块不再编码
+    task->batch->Complete(task->batch->Failed() ? E_ABORT : EncodeGridTile(context, *task, nullptr));
+    return true;
+}
+
+HRESULT EncodeGridJob(const ConversionContext& context, Pipeline& pipeline, ImageJob& job, IStream* pOutputStream) {
+    UINT width = 0, height = 0;
+    HRESULT hr = job.decodedFrame->GetSize(&width, &height);
+    if (FAILED(hr)) return hr;
+    const UINT tileSize = GridTileEdge(pipeline.gridTileSize, width, height);
+    const UINT columns = (width + tileSize - 1) / tileSize;
+    const UINT rows = (height + tileSize - 1) / tileSize;
+    if (static_cast<ULONGLONG>(width) * 4 * tileSize > UINT_MAX) return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+
+    // 源图惰性解码，每次只取一个条带 (一行图块) 的像素
+    ComPtr<IWICFormatConverter> pConverter;
+    hr = context.factory->CreateFormatConverter(&pConverter);
+    if (SUCCEEDED(hr)) { hr = pConverter->Initialize(job.decodedFrame.Get(), GUID_WICPixelFormat32bppBGR, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom); }
+    if (FAILED(hr)) return hr;
+
+    const UINT stripStride = width * 4;
+    std::vector<BYTE> strip(static_cast<size_t>(stripStride) * tileSize);
+    std::vector<GridTileTask> tasks(static_cast<size_t>(columns) * rows);
+    GridBatch batch(pipeline.gridTiles);
+    // 修改：在途图块数按编码线程数限制 (与准入阶段的估计一致)，峰值内存与图像宽高都无关；每个图块入队前等待
+    const size_t maxInFlight = GridTilesInFlight(pipeline);
+    // 等待在途图块降到 limit 以下，期间本线程也从共享队列取图块编码
+    // 修改：队列为空时等待图块入队或本图像的图块完成，不再按 5ms 轮询
+    auto help = [&](size_t limit) {
+        auto settled = [&] {
+            std::lock_guard<std::mutex> lock(batch.mutex);
+            return batch.pending <= limit;
+        };
+        while (!settled()) {
+            if (!pipeline.gridTiles.RunOne(context)) { pipeline.gridTiles.WaitForWork(settled); }
+        }
+    };
+
+    for (UINT row = 0; row < rows && SUCCEEDED(hr) && !batch.Failed(); ++row) {
+        const UINT top = row * tileSize;
+        const UINT stripRows = std::min(tileSize, height - top);
+        const WICRect rect = { 0, static_cast<INT>(top), static_cast<INT>(width), static_cast<INT>(stripRows) };
+        hr = pConverter->CopyPixels(&rect, stripStride, static_cast<UINT>(strip.size()), strip.data());
+        for (UINT column = 0; column < columns && SUCCEEDED(hr); ++column) {
+            GridTileTask& task = tasks[static_cast<size_t>(row) * columns + column];
+            if (row != 0 || column != 0) { help(maxInFlight - 1); }
+            task.tileSize = tileSize;
+            task.batch = &batch;
+            task.pixels.resize(static_cast<size_t>(tileSize) * tileSize * 4);
+            const UINT left = column * tileSize;
+            const UINT tileColumns = std::min(tileSize, width - left);
+            // 边缘图块重复最后一列/行补齐，解码时按 grid 的输出尺寸裁掉
+            for (UINT y = 0; y < tileSize; ++y) {
+                const BYTE* src = strip.data() + static_cast<size_t>(std::min(y, stripRows - 1)) * stripStride + static_cast<size_t>(left) * 4;
+                BYTE* dst = task.pixels.data() + static_cast<size_t>(y) * tileSize * 4;
+                memcpy(dst, src, static_cast<size_t>(tileColumns) * 4);
+                for (UINT x = tileColumns; x < tileSize; ++x) { memcpy(dst + x * 4, src + (tileColumns - 1) * 4, 4); }
+            }
+            // 首个图块带上 Exif/XMP/ICC，在本线程编码，元数据读取器不跨线程使用
+            if (row == 0 && column == 0) { hr = EncodeGridTile(context, task, &job.metadata); }
+            else {
+                {
+                    std::lock_guard<std::mutex> lock(batch.mutex);
+                    ++batch.pending;
+                }
+                pipeline.gridTiles.Push(&task);
+            }
+        }
+    }
+    help(0); // 已入队的图块引用 tasks，必须全部完成后才能返回
+    std::vector<BYTE>().swap(strip);
+    if (SUCCEEDED(hr)) { hr = batch.hr; }
+    if (FAILED(hr)) return hr;
+
+    HeifCodedImage thumbnail;
+    bool haveThumbnail = false;
+    if (job.thumbnail) {
+        ComPtr<MemoryOutputStream> pBuffer;
+        haveThumbnail = SUCCEEDED(Microsoft::WRL::MakeAndInitialize<MemoryOutputStream>(&pBuffer, 0, context.numaNode))
+            && SUCCEEDED(EncodeImage(context, job.thumbnail.Get(), pBuffer.Get())) && SUCCEEDED(ExtractHeifImage(pBuffer->Data(), pBuffer->Size(), thumbnail));
+    }
+    std::vector<const HeifCodedImage*> results;
+    results.reserve(tasks.size());
+    for (const auto& task : tasks) { results.push_back(&task.result); }
+    return WriteHeifGrid(width, height, columns, rows, results, haveThumbnail ? &thumbnail : nullptr, pOutputStream);
+}
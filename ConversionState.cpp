@@ -0,0 +1,518 @@
+// 转换清单、运行日志与重复内容去重
+#include "ConverterInternal.h"
+
+// === 新增：ConversionManifest 实现 ===
+HRESULT ConversionManifest::Open(const std::wstring& path, bool rememberAdds) {
+    path_ = path;
+    rememberAdds_ = rememberAdds;
+
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+    LARGE_INTEGER fileSize = { 0 };
+    GetFileSizeEx(hFile, &fileSize);
+
+    // 文件头损坏或版本不符时视为空清单，Close 时整体重写
+    if (fileSize.QuadPart >= static_cast<LONGLONG>(sizeof(Header))) {
+        mapping_ = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_) { view_ = static_cast<const BYTE*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)); }
+        if (view_) {
+            const Header* header = reinterpret_cast<const Header*>(view_);
+            const ULONGLONG recordBytes = static_cast<ULONGLONG>(fileSize.QuadPart) - sizeof(Header);
+            const ULONGLONG totalCount = recordBytes / sizeof(Record);
+            if (header->magic == kMagic && header->version == kVersion && header->recordSize == sizeof(Record) && header->sortedCount <= totalCount) {
+                sorted_ = reinterpret_cast<const Record*>(view_ + sizeof(Header));
+                sortedCount_ = static_cast<size_t>(header->sortedCount);
+                for (size_t i = sortedCount_; i < totalCount; ++i) { tail_[sorted_[i].pathHash] = sorted_[i]; }
+            }
+        }
+    }
+    CloseHandle(hFile);
+
+    if (!sorted_) {
+        // 新建或重建清单：写入空文件头，后续追加记录
+        Unmap();
+        HANDLE hNew = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+        if (hNew == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+        Header header = { kMagic, kVersion, 0, sizeof(Record), 0 };
+        DWORD written = 0;
+        BOOL ok = WriteFile(hNew, &header, sizeof(header), &written, NULL);
+        CloseHandle(hNew);
+        if (!ok) return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    appendFile_ = CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (appendFile_ == INVALID_HANDLE_VALUE) { Unmap(); return HRESULT_FROM_WIN32(GetLastError()); }
+    return S_OK;
+}
+
+bool ConversionManifest::IsUnchanged(const Record& probe, const std::wstring& outputPath) const {
+    const Record* found = nullptr;
+    Record latest;
+    {
+        // 只有 rememberAdds 时才有写入方；否则 tail_ 打开后只读，各预读线程无锁查询
+        std::unique_lock<std::mutex> lock(tailMutex_, std::defer_lock);
+        if (rememberAdds_) { lock.lock(); }
+        auto it = tail_.find(probe.pathHash);
+        if (it != tail_.end()) { latest = it->second; found = &latest; } // 追加区的记录更新，优先使用
+    }
+    if (!found && sorted_) {
+        const Record* end = sorted_ + sortedCount_;
+        const Record* pos = std::lower_bound(sorted_, end, probe.pathHash, [](const Record& r, ULONGLONG hash) { return r.pathHash < hash; });
+        if (pos != end && pos->pathHash == probe.pathHash) { found = pos; }
+    }
+    if (!found || found->size != probe.size || found->lastWriteTime != probe.lastWriteTime
+        || found->targetFormat != probe.targetFormat || found->quality != probe.quality || found->maxDimension != probe.maxDimension) return false;
+    // 新增：输出被删除、移走或换成别的文件时不能跳过
+    const std::wstring output = found->outputFrames > 1 ? MakeNumberedPath(outputPath, 1, found->outputFrames) : outputPath;
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExW(output.c_str(), GetFileExInfoStandard, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) return false;
+    return ((static_cast<ULONGLONG>(info.nFileSizeHigh) << 32) | info.nFileSizeLow) == found->outputSize;
+}
+
+bool ConversionManifest::BeginConversion(const Record& record) {
+    if (!rememberAdds_) return true;
+    std::lock_guard<std::mutex> lock(tailMutex_);
+    auto it = inFlight_.find(record.pathHash);
+    if (it != inFlight_.end() && it->second.size == record.size && it->second.lastWriteTime == record.lastWriteTime) return false;
+    inFlight_[record.pathHash] = record;
+    return true;
+}
+
+void ConversionManifest::EndConversion(const Record& record) {
+    if (!rememberAdds_) return;
+    std::lock_guard<std::mutex> lock(tailMutex_);
+    auto it = inFlight_.find(record.pathHash);
+    // 转换期间又投递了文件的新版本时，条目已属于新版本
+    if (it != inFlight_.end() && it->second.size == record.size && it->second.lastWriteTime == record.lastWriteTime) { inFlight_.erase(it); }
+}
+
+void ConversionManifest::Add(const Record& record) {
+    if (rememberAdds_) {
+        std::lock_guard<std::mutex> lock(tailMutex_);
+        tail_[record.pathHash] = record;
+    }
+    std::vector<Record> batch;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        pending_.push_back(record);
+        if (pending_.size() < kBatchSize) return;
+        batch.swap(pending_);
+    }
+    FlushBatch(batch);
+}
+
+void ConversionManifest::FlushBatch(std::vector<Record>& batch) {
+    if (batch.empty()) return;
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    if (appendFile_ != INVALID_HANDLE_VALUE) {
+        DWORD written = 0;
+        if (WriteFile(appendFile_, batch.data(), static_cast<DWORD>(batch.size() * sizeof(Record)), &written, NULL)) { appended_ = true; }
+    }
+}
+
+void ConversionManifest::Unmap() {
+    if (view_) { UnmapViewOfFile(view_); view_ = nullptr; }
+    if (mapping_) { CloseHandle(mapping_); mapping_ = NULL; }
+    sorted_ = nullptr;
+    sortedCount_ = 0;
+}
+
+void ConversionManifest::Close() {
+    if (appendFile_ == INVALID_HANDLE_VALUE) return;
+
+    std::vector<Record> batch;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        batch.swap(pending_);
+    }
+    FlushBatch(batch);
+    CloseHandle(appendFile_);
+    appendFile_ = INVALID_HANDLE_VALUE;
+
+    Unmap();
+    if (tail_.empty() && !appended_) return;
+    tail_.clear();
+
+    // 重新映射整个文件 (含本次追加)，稳定排序后同一路径只保留最后出现的一条，即最新记录
+    std::vector<Record> merged;
+    {
+        HANDLE hFile = CreateFileW(path_.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize = { 0 };
+        GetFileSizeEx(hFile, &fileSize);
+        HANDLE hMapping = fileSize.QuadPart > static_cast<LONGLONG>(sizeof(Header)) ? CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        const BYTE* pView = hMapping ? static_cast<const BYTE*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        if (pView) {
+            const Record* records = reinterpret_cast<const Record*>(pView + sizeof(Header));
+            merged.assign(records, records + (static_cast<size_t>(fileSize.QuadPart) - sizeof(Header)) / sizeof(Record));
+            UnmapViewOfFile(pView);
+        }
+        if (hMapping) CloseHandle(hMapping);
+        CloseHandle(hFile);
+    }
+    std::stable_sort(merged.begin(), merged.end(), [](const Record& a, const Record& b) { return a.pathHash < b.pathHash; });
+    auto last = merged.begin();
+    for (auto it = merged.begin(); it != merged.end(); ++it) {
+        if (last != merged.begin() && (last - 1)->pathHash == it->pathHash) { *(last - 1) = *it; }
+        else { *last++ = *it; }
+    }
+    merged.erase(last, merged.end());
+
+    std::wstring tempPath = path_ + L".tmp";
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return; // 追加区仍在原文件中，下次运行会再合并
+    Header header = { kMagic, kVersion, merged.size(), sizeof(Record), 0 };
+    DWORD written = 0;
+    BOOL ok = WriteFile(hFile, &header, sizeof(header), &written, NULL);
+    if (ok && !merged.empty()) { ok = WriteFile(hFile, merged.data(), static_cast<DWORD>(merged.size() * sizeof(Record)), &written, NULL); }
+    CloseHandle(hFile);
+    if (!ok || !MoveFileExW(tempPath.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING)) { DeleteFileW(tempPath.c_str()); }
+}
+
+// === 新增：RunJournal 实现 ===
+HRESULT RunJournal::Open(const std::wstring& path, ULONGLONG settingsKey, bool resume, size_t& resumed) {
+    path_ = path;
+    resumed = 0;
+
+    // 读入上次运行的记录；末尾写了一半的记录 (进程在写入中途被终止) 丢弃
+    ULONGLONG validBytes = 0;
+    if (resume) {
+        HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER fileSize = { 0 };
+            Header header = { 0 };
+            DWORD bytesRead = 0;
+            if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart >= static_cast<LONGLONG>(sizeof(Header)) && fileSize.QuadPart <= MAXDWORD &&
+                ReadFile(hFile, &header, sizeof(header), &bytesRead, NULL) && bytesRead == sizeof(header) &&
+                header.magic == kMagic && header.version == kVersion && header.settingsKey == settingsKey) {
+                std::vector<ULONGLONG> entries(static_cast<size_t>((fileSize.QuadPart - sizeof(Header)) / sizeof(ULONGLONG)));
+                const DWORD entryBytes = static_cast<DWORD>(entries.size() * sizeof(ULONGLONG));
+                if (entries.empty() || (ReadFile(hFile, entries.data(), entryBytes, &bytesRead, NULL) && bytesRead == entryBytes)) {
+                    completed_.insert(entries.begin(), entries.end());
+                    validBytes = sizeof(Header) + entryBytes;
+                }
+            }
+            CloseHandle(hFile);
+        }
+        resumed = completed_.size();
+    }
+
+    // 续写时截掉无效的尾部；否则 (包括参数已变化) 新建日志
+    file_ = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, validBytes ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+    BOOL ok = TRUE;
+    if (validBytes) {
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(validBytes);
+        ok = SetFilePointerEx(file_, end, NULL, FILE_BEGIN) && SetEndOfFile(file_);
+    }
+    else {
+        Header header = { kMagic, kVersion, settingsKey };
+        DWORD written = 0;
+        ok = WriteFile(file_, &header, sizeof(header), &written, NULL) && FlushFileBuffers(file_);
+    }
+    if (!ok) {
+        const HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+        return hr;
+    }
+    return S_OK;
+}
+
+void RunJournal::Add(ULONGLONG pathHash) {
+    std::vector<ULONGLONG> batch;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        pending_.push_back(pathHash);
+        if (pending_.size() < kBatchSize) return;
+        batch.swap(pending_);
+    }
+    FlushBatch(batch);
+}
+
+void RunJournal::FlushBatch(std::vector<ULONGLONG>& batch) {
+    if (batch.empty()) return;
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    if (file_ == INVALID_HANDLE_VALUE) return;
+    // 每批刷到磁盘：断电后最多丢失一批记录，对应的文件下次重新转换
+    DWORD written = 0;
+    if (WriteFile(file_, batch.data(), static_cast<DWORD>(batch.size() * sizeof(ULONGLONG)), &written, NULL)) { FlushFileBuffers(file_); }
+}
+
+void RunJournal::Close(bool finished) {
+    if (file_ == INVALID_HANDLE_VALUE) return;
+    std::vector<ULONGLONG> batch;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        batch.swap(pending_);
+    }
+    FlushBatch(batch);
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+    if (finished) { DeleteFileW(path_.c_str()); }
+}
+
+ULONGLONG MakeJournalKey(const Pipeline& pipeline) {
+    // 影响输出内容的参数，与增量清单比对的字段一致
+    struct Settings {
+        GUID targetFormat;
+        float quality;
+        DWORD maxDimension;
+        ULONGLONG targetSize;
+        DWORD copyMetadata;
+        DWORD thumbnailSize;
+    } settings = { pipeline.targetEncoderGuid, pipeline.quality, pipeline.maxDimension, pipeline.targetSize, pipeline.copyMetadata ? 1u : 0u, pipeline.thumbnailSize };
+    ULONGLONG hash = 14695981039346656037ull;
+    const BYTE* bytes = reinterpret_cast<const BYTE*>(&settings);
+    for (size_t i = 0; i < sizeof(settings); ++i) { hash = (hash ^ bytes[i]) * 1099511628211ull; }
+    return hash;
+}
+
+// === 新增：--dedup 的内容哈希与去重缓存 ===
+ULONGLONG Xxh64(const void* data, size_t size, ULONGLONG seed) {
+    const ULONGLONG P1 = 11400714785074694791ull, P2 = 14029467366897019727ull, P3 = 1609587929392839161ull, P4 = 9650029242287828579ull, P5 = 2870177450012600261ull;
+    const BYTE* p = static_cast<const BYTE*>(data);
+    const BYTE* const end = p + size;
+    auto read64 = [](const BYTE* q) { ULONGLONG v; memcpy(&v, q, sizeof(v)); return v; };
+    auto read32 = [](const BYTE* q) { UINT32 v; memcpy(&v, q, sizeof(v)); return static_cast<ULONGLONG>(v); };
+    auto mix = [=](ULONGLONG acc, ULONGLONG lane) { return _rotl64(acc + lane * P2, 31) * P1; };
+    auto merge = [=](ULONGLONG acc, ULONGLONG lane) { return (acc ^ mix(0, lane)) * P1 + P4; };
+
+    ULONGLONG h;
+    if (size >= 32) {
+        ULONGLONG v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        const BYTE* const limit = end - 32;
+        do {
+            v1 = mix(v1, read64(p));
+            v2 = mix(v2, read64(p + 8));
+            v3 = mix(v3, read64(p + 16));
+            v4 = mix(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = _rotl64(v1, 1) + _rotl64(v2, 7) + _rotl64(v3, 12) + _rotl64(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    }
+    else { h = seed + P5; }
+    h += size;
+    for (; p + 8 <= end; p += 8) { h = _rotl64(h ^ mix(0, read64(p)), 27) * P1 + P4; }
+    if (p + 4 <= end) { h = _rotl64(h ^ (read32(p) * P1), 23) * P2 + P3; p += 4; }
+    for (; p < end; ++p) { h = _rotl64(h ^ (*p * P5), 11) * P1; }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static std::wstring StemOfOutput(const std::wstring& path) {
+    return path.substr(0, PathFindExtensionW(path.c_str()) - path.c_str());
+}
+
+static bool EndsWithInsensitive(const std::wstring& text, const wchar_t* ending) {
+    const size_t length = wcslen(ending);
+    return text.size() >= length && _wcsicmp(text.c_str() + text.size() - length, ending) == 0;
+}
+
+bool GetOutputStamp(const std::wstring& path, ULONGLONG& size, ULONGLONG& writeTime) {
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) return false;
+    size = (static_cast<ULONGLONG>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    writeTime = (static_cast<ULONGLONG>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+HRESULT DedupCache::Open(const std::wstring& path, ULONGLONG settingsKey, bool copyOnly) {
+    path_ = path;
+    settingsKey_ = settingsKey;
+    copyOnly_ = copyOnly;
+
+    // 缓存文件缺失或损坏时从空缓存开始；末尾不完整的记录丢弃
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER fileSize = { 0 };
+        std::vector<BYTE> contents;
+        DWORD bytesRead = 0;
+        if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart >= static_cast<LONGLONG>(sizeof(Header)) && fileSize.QuadPart <= MAXDWORD) {
+            contents.resize(static_cast<size_t>(fileSize.QuadPart));
+            if (!ReadFile(hFile, contents.data(), static_cast<DWORD>(contents.size()), &bytesRead, NULL) || bytesRead != contents.size()) { contents.clear(); }
+        }
+        CloseHandle(hFile);
+
+        Header header = { 0 };
+        if (!contents.empty()) { memcpy(&header, contents.data(), sizeof(header)); }
+        if (header.magic == kMagic && header.version == kVersion) {
+            size_t offset = sizeof(Header);
+            while (offset + sizeof(FileRecord) <= contents.size()) {
+                FileRecord record;
+                memcpy(&record, contents.data() + offset, sizeof(record));
+                const size_t pathBytes = static_cast<size_t>(record.pathChars) * sizeof(WCHAR);
+                if (record.pathChars == 0 || record.suffixChars > record.pathChars || pathBytes > contents.size() - offset - sizeof(record)) break;
+                std::wstring output(record.pathChars, L'\0');
+                memcpy(&output[0], contents.data() + offset + sizeof(record), pathBytes);
+                offset += sizeof(record) + pathBytes;
+
+                Entry& entry = entries_[Key{ record.key, record.sourceSize }];
+                entry.checkHash = record.checkHash;
+                entry.stem = output.substr(0, record.pathChars - record.suffixChars);
+                entry.suffixes.assign(1, output.substr(record.pathChars - record.suffixChars));
+                entry.outputSize = record.outputSize;
+                entry.outputWriteTime = record.outputWriteTime;
+            }
+        }
+        else { changed_ = true; }
+    }
+    open_ = true;
+    return S_OK;
+}
+
+DedupCache::Claim DedupCache::Begin(ImageJobPtr& job, std::wstring& stem, std::vector<std::wstring>& suffixes) {
+    job->contentKey = Xxh64(job->sourceBytes.data(), job->sourceBytes.size(), settingsKey_);
+    job->contentSize = job->sourceBytes.size();
+    // 修改：键相同还要核对第二个哈希 (不同种子)，两者同时碰撞的概率可以忽略；核对不符时各自编码，不去链接别的图片的输出
+    const ULONGLONG checkHash = Xxh64(job->sourceBytes.data(), job->sourceBytes.size(), settingsKey_ ^ kCheckSeed);
+    const Key key = { job->contentKey, job->contentSize };
+    // 第一轮遇到上次运行留下的条目时在锁外核对输出，过时的条目清除后第二轮由本 job 接手
+    for (int pass = 0; pass < 2; ++pass) {
+        std::wstring output;
+        ULONGLONG expectedSize = 0, expectedTime = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Entry& entry = entries_[key];
+            if (entry.stem.empty()) {
+                entry.stem = StemOfOutput(job->finalOutPath);
+                entry.checkHash = checkHash;
+                entry.pending = true;
+                job->dedupOwner = true;
+                return Claim::Encode;
+            }
+            if (entry.checkHash != checkHash) break;
+            if (entry.pending) {
+                // 等待期间不占用源文件内存；第一个等待者保留，写出失败时由它接手。调用方传入的内存数据无法重读，同样保留
+                if (!entry.waiters.empty() && !job->inputInMemory) { std::vector<BYTE>().swap(job->sourceBytes); }
+                entry.waiters.push_back(std::move(job));
+                return Claim::Parked;
+            }
+            if (entry.verified) {
+                stem = entry.stem;
+                suffixes = entry.suffixes;
+                return Claim::Cached;
+            }
+            output = entry.stem + entry.suffixes.front();
+            expectedSize = entry.outputSize;
+            expectedTime = entry.outputWriteTime;
+        }
+        ULONGLONG size = 0, writeTime = 0;
+        const bool valid = GetOutputStamp(output, size, writeTime) && size == expectedSize && writeTime == expectedTime;
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[key];
+        if (entry.pending || entry.verified) continue; // 另一个线程已处理过该条目
+        if (valid) { entry.verified = true; }
+        else { entry = Entry(); changed_ = true; }
+    }
+    job->dedupOwner = false;
+    return Claim::Encode;
+}
+
+std::vector<ImageJobPtr> DedupCache::Complete(const ImageJob& job, bool succeeded, bool handOver, ImageJobPtr& successor, std::wstring& stem, std::vector<std::wstring>& suffixes) {
+    std::vector<std::wstring> outputs(1, job.finalOutPath);
+    for (const ImageJob::ExtraOutput& extra : job.extraOutputs) { outputs.push_back(extra.path); }
+    ULONGLONG outputSize = 0, outputWriteTime = 0;
+    const bool stamped = succeeded && outputs.size() == 1 && GetOutputStamp(outputs.front(), outputSize, outputWriteTime);
+
+    std::vector<ImageJobPtr> waiters;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(Key{ job.contentKey, job.contentSize });
+    if (it == entries_.end()) return waiters;
+    Entry& entry = it->second;
+    // 写出失败 (目标被占用、无权限、改名失败) 只与本文件的输出路径有关，副本换一个路径仍可能成功
+    if (!succeeded && handOver && !entry.waiters.empty()) {
+        successor = std::move(entry.waiters.front());
+        entry.waiters.erase(entry.waiters.begin());
+        entry.stem = StemOfOutput(successor->finalOutPath);
+        successor->dedupOwner = true;
+        return waiters;
+    }
+    waiters.swap(entry.waiters);
+    stem = entry.stem;
+    suffixes.clear();
+    for (const std::wstring& output : outputs) {
+        if (output.size() < stem.size() || _wcsnicmp(output.c_str(), stem.c_str(), stem.size()) != 0) { succeeded = false; suffixes.clear(); break; }
+        suffixes.push_back(output.substr(stem.size()));
+    }
+    // 失败的内容不缓存，之后遇到相同内容的文件重新转换
+    if (!succeeded) {
+        entries_.erase(it);
+        return waiters;
+    }
+    entry.suffixes = suffixes;
+    entry.pending = false;
+    entry.verified = true;
+    entry.outputSize = outputSize;
+    entry.outputWriteTime = outputWriteTime;
+    if (stamped) { changed_ = true; }
+    return waiters;
+}
+
+HRESULT DedupCache::Materialize(const std::wstring& stem, const std::vector<std::wstring>& suffixes, ImageJob& job, ULONGLONG& outputBytes) {
+    if (suffixes.empty()) return E_UNEXPECTED;
+    const std::wstring targetStem = StemOfOutput(job.finalOutPath);
+    UINT frames = 0;
+    for (const std::wstring& suffix : suffixes) {
+        const bool sidecar = EndsWithInsensitive(suffix, L".thumb.jpg") || EndsWithInsensitive(suffix, L".preview.jpg");
+        if (!sidecar) { ++frames; }
+        const std::wstring source = stem + suffix;
+        const std::wstring target = targetStem + suffix;
+        ULONGLONG size = 0, writeTime = 0;
+        if (!GetOutputStamp(source, size, writeTime)) return HRESULT_FROM_WIN32(GetLastError());
+        outputBytes += size;
+        if (_wcsicmp(source.c_str(), target.c_str()) == 0) continue; // 同一个文件的重复运行，输出已在原处
+
+        // 先在临时名上建立链接/副本，再原子替换，与编码输出的写出方式一致
+        const std::wstring temp = MakeTempPath(target);
+        DeleteFileW(temp.c_str());
+        const bool linked = !copyOnly_ && CreateHardLinkW(temp.c_str(), source.c_str(), NULL);
+        if (!linked && !CopyFileW(source.c_str(), temp.c_str(), FALSE)) return HRESULT_FROM_WIN32(GetLastError());
+        if (!MoveFileExW(temp.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            const DWORD error = GetLastError();
+            DeleteFileW(temp.c_str());
+            return HRESULT_FROM_WIN32(error);
+        }
+        (linked ? linked_ : copied_).fetch_add(1, std::memory_order_relaxed);
+    }
+    job.finalOutPath = targetStem + suffixes.front();
+    job.outputFrames = std::max(1u, frames);
+    return S_OK;
+}
+
+void DedupCache::Close() {
+    if (!open_) return;
+    open_ = false;
+    if (!changed_) return;
+
+    // 整体重写：只保留单输出、已有大小与时间的条目。先写临时文件再替换，写入中断时旧缓存仍然完整
+    std::vector<BYTE> contents(sizeof(Header));
+    const Header header = { kMagic, kVersion };
+    memcpy(contents.data(), &header, sizeof(header));
+    for (const auto& item : entries_) {
+        const Entry& entry = item.second;
+        if (entry.pending || entry.stem.empty() || entry.suffixes.size() != 1 || entry.outputWriteTime == 0) continue;
+        const std::wstring output = entry.stem + entry.suffixes.front();
+        const FileRecord record = { item.first.hash, item.first.size, entry.checkHash, entry.outputSize, entry.outputWriteTime, static_cast<DWORD>(output.size()), static_cast<DWORD>(entry.suffixes.front().size()) };
+        const size_t offset = contents.size();
+        contents.resize(offset + sizeof(record) + output.size() * sizeof(WCHAR));
+        memcpy(contents.data() + offset, &record, sizeof(record));
+        memcpy(contents.data() + offset + sizeof(record), output.data(), output.size() * sizeof(WCHAR));
+    }
+    entries_.clear();
+    if (contents.size() > MAXDWORD) return;
+
+    const std::wstring temp = MakeTempPath(path_);
+    HANDLE hFile = CreateFileW(temp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return;
+    DWORD written = 0;
+    const BOOL ok = WriteFile(hFile, contents.data(), static_cast<DWORD>(contents.size()), &written, NULL) && written == contents.size();
+    CloseHandle(hFile);
+    if (!ok || !MoveFileExW(temp.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING)) { DeleteFileW(temp.c_str()); }
+}
@@ -0,0 +1,85 @@
+// Converter 库接口
+#include "ConverterInternal.h"
+
+// === 新增：Converter 库接口实现 ===
+// 修改：不再另有一套单帧转换逻辑，每项作为一个 ImageJob 进入与命令行相同的流水线，多帧、--gpu、--target-size、网格编码等都一致
+struct Converter::Impl {
+    std::unique_ptr<ConversionEngine> engine;
+};
+
+static ImageJobPtr MakeLibraryJob(ConversionItem& item, std::unique_ptr<ConversionRequest> request) {
+    ImageJobPtr job = std::make_unique<ImageJob>();
+    job->request = std::move(request);
+    if (!item.inputBytes.empty()) {
+        job->sourceBytes.swap(item.inputBytes);
+        job->sourceSize = job->sourceBytes.size();
+        job->inputInMemory = true;
+        job->inputPath = item.inputPath; // 只用于显示
+    }
+    else { job->hr = ToExtendedLengthPath(item.inputPath, job->inputPath); }
+    if (item.outputPath.empty()) { job->returnBytes = true; }
+    else if (SUCCEEDED(job->hr)) { job->hr = ToExtendedLengthPath(item.outputPath, job->finalOutPath); }
+    return job;
+}
+
+HRESULT Converter::Create(const ConverterOptions& options, std::unique_ptr<Converter>& converter) {
+    EngineSettings settings;
+    settings.mode = options.mode;
+    settings.quality = options.quality;
+    settings.config.encodeThreads = options.threads;
+    settings.config.bufferLimit = options.bufferLimit;
+    settings.config.maxMemory = options.maxMemory;
+    settings.config.largestFirst = false; // 按提交顺序处理，Submit 按队列深度阻塞
+    settings.config.thumbnailSize = options.thumbnailSize;
+    settings.config.thumbnailSidecar = options.thumbnailSidecar;
+    settings.config.gpuIndex = options.gpuIndex;
+    settings.config.maxDimension = options.maxDimension;
+    settings.config.copyMetadata = options.copyMetadata;
+    settings.config.targetSize = options.targetSize;
+    settings.config.gridTileSize = options.gridTileSize;
+    settings.autoWorkers = options.threads == 0;
+    settings.probe = options.mode == ConversionMode::ToHeic; // 与原来一样只在编码 HEIC 时探测
+    settings.outputLevel = OutputLevel::Quiet;
+
+    // 显卡与 Media Foundation 在调用线程上初始化；调用方尚未初始化 COM 时临时进入 MTA，流水线线程各自进入 MTA
+    const HRESULT hrCom = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    std::unique_ptr<Converter> instance(new Converter());
+    instance->impl_.reset(new Impl());
+    instance->impl_->engine.reset(new ConversionEngine(settings));
+    ConversionEngine& engine = *instance->impl_->engine;
+    HRESULT hr = S_OK;
+    if (engine.Probe().valid() && !engine.Probe().get()) { hr = WINCODEC_ERR_COMPONENTNOTFOUND; }
+    if (SUCCEEDED(hr)) { engine.Start(); }
+    else { instance.reset(); }
+    if (SUCCEEDED(hrCom)) { CoUninitialize(); }
+    if (FAILED(hr)) return hr;
+    converter = std::move(instance);
+    return S_OK;
+}
+
+Converter::~Converter() {
+    if (!impl_) return;
+    impl_->engine->Finish(); // 已提交的任务仍会处理完
+}
+
+std::vector<std::future<ConversionOutput>> Converter::Submit(std::vector<ConversionItem> batch) {
+    std::vector<std::future<ConversionOutput>> futures;
+    futures.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        std::unique_ptr<ConversionRequest> request(new ConversionRequest());
+        request->index = i;
+        futures.push_back(request->promise.get_future());
+        SubmitJob(impl_->engine->GetPipeline(), MakeLibraryJob(batch[i], std::move(request)));
+    }
+    return futures;
+}
+
+void Converter::Submit(std::vector<ConversionItem> batch, Callback onComplete) {
+    auto callback = std::make_shared<const Callback>(std::move(onComplete));
+    for (size_t i = 0; i < batch.size(); ++i) {
+        std::unique_ptr<ConversionRequest> request(new ConversionRequest());
+        request->index = i;
+        request->callback = callback;
+        SubmitJob(impl_->engine->GetPipeline(), MakeLibraryJob(batch[i], std::move(request)));
+    }
+}
@@ -0,0 +1,1517 @@
+#pragma once
+// 转换引擎的内部声明，供 ImageConverterLib 的各源文件和命令行程序共用。对外接口见 ImageConverter.h
+#include <iostream>
+
+#define NOMINMAX
+#include <windows.h>
+#include <wincodec.h>
+#include <wincodecsdk.h>
+#include <wrl/client.h>
+#include <wrl/implements.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <shlwapi.h>
+#include <pathcch.h>
+#include <d3d11_4.h>
+#include <dxgi.h>
+#include <mfapi.h>
+#include <mftransform.h>
+#include <mferror.h>
+#include <strmif.h>
+#include <codecapi.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <deque>
+#include <condition_variable>
+#include <future>
+#include <unordered_set>
+#include <unordered_map>
+#include <chrono>
+#include <cstdio>
+#include <climits>
+#include <cmath>
+#include <intrin.h>
+#include <immintrin.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+#include "ImageConverter.h" // 新增：库接口，ConversionMode 也在其中定义
+
+#pragma comment(lib, "windowscodecs.lib")
+#pragma comment(lib, "shlwapi.lib")
+#pragma comment(lib, "pathcch.lib")
+#pragma comment(lib, "mfplat.lib")
+#pragma comment(lib, "mfuuid.lib")
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "dxgi.lib")
+
+using Microsoft::WRL::ComPtr;
+
+// 新增：每个工作线程独享的转换上下文。
+// 在解码/编码阶段线程初始化 COM 后创建一次，缓存工厂、编解码器组件信息和编码参数模板，
+// 使逐文件的热循环中不再进行 CoCreateInstance 和组件枚举。
+class PixelBufferPool;
+
+struct ConversionContext {
+    ComPtr<IWICImagingFactory> factory;
+    ComPtr<IWICBitmapEncoderInfo> encoderInfo;                 // 目标容器格式对应的编码器
+    std::vector<ComPtr<IWICBitmapDecoderInfo>> decoderInfos;   // 系统中已注册的全部解码器
+
+    // 可复用的属性包模板 (ImageQuality)
+    bool hasQualityOption = false;
+    wchar_t qualityPropName[16] = L"ImageQuality";
+    PROPBAG2 qualityOption = { 0 };
+    VARIANT qualityValue;
+
+    DWORD numaNode = NUMA_NO_PREFERRED_NODE; // 新增：本线程所在的 NUMA 节点，位图和编码缓冲区在该节点上分配
+    PixelBufferPool* pixelPool = nullptr;    // 新增：非空时解码位图的像素内存来自该池
+    UINT maxDimension = 0;                   // 新增：--max-dimension，解码后把长边缩小到该值，0 表示不缩放
+    bool copyMetadata = true;                // 新增：把源文件的 EXIF/XMP/ICC 带到输出，--strip-metadata 时关闭
+    bool bakeOrientation = false;            // 新增：按 EXIF 方向把像素转正后再编码
+
+    HRESULT Initialize(const GUID& targetEncoderGuid, float quality);
+    HRESULT CreateDecoder(IStream* pStream, IWICBitmapDecoder** ppDecoder, const GUID& container = GUID_NULL) const; // 修改：已知容器格式时直接选用对应解码器
+    HRESULT CreateEncoder(IWICBitmapEncoder** ppEncoder) const;
+    HRESULT ApplyEncoderOptions(IPropertyBag2* pPropertyBag) const;
+    void SetQuality(float quality); // 新增：更换 ImageQuality 模板，小于 0 表示使用编码器默认值
+    bool SupportsMultiframe() const; // 新增：目标容器能否保存多帧 (HEIF 可以，JPEG 不行)
+};
+
+// 新增：可增长的内存输出流。按分配粒度对齐的连续缓冲区，编码结果可一次性写出。
+class MemoryOutputStream : public Microsoft::WRL::RuntimeClass<
+    Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>,
+    Microsoft::WRL::ChainInterfaces<IStream, ISequentialStream>> {
+public:
+    HRESULT RuntimeClassInitialize(size_t initialCapacity, DWORD numaNode = NUMA_NO_PREFERRED_NODE);
+    ~MemoryOutputStream();
+
+    const BYTE* Data() const { return data_; }
+    size_t Size() const { return size_; }
+    size_t Capacity() const { return capacity_; } // 新增：按 64KB 对齐，异步写入器据此确认补齐到扇区大小的尾部可读
+
+    // ISequentialStream
+    IFACEMETHODIMP Read(void* pv, ULONG cb, ULONG* pcbRead) override;
+    IFACEMETHODIMP Write(const void* pv, ULONG cb, ULONG* pcbWritten) override;
+    // IStream
+    IFACEMETHODIMP Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition) override;
+    IFACEMETHODIMP SetSize(ULARGE_INTEGER libNewSize) override;
+    IFACEMETHODIMP CopyTo(IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER*) override { return E_NOTIMPL; }
+    IFACEMETHODIMP Commit(DWORD) override { return S_OK; }
+    IFACEMETHODIMP Revert() override { return E_NOTIMPL; }
+    IFACEMETHODIMP LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return STG_E_INVALIDFUNCTION; }
+    IFACEMETHODIMP UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return STG_E_INVALIDFUNCTION; }
+    IFACEMETHODIMP Stat(STATSTG* pstatstg, DWORD grfStatFlag) override;
+    IFACEMETHODIMP Clone(IStream**) override { return E_NOTIMPL; }
+
+private:
+    HRESULT EnsureCapacity(size_t required);
+
+    BYTE* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    size_t position_ = 0;
+    DWORD numaNode_ = NUMA_NO_PREFERRED_NODE;
+};
+
+// 新增：按大小分级复用的像素缓冲池，同时给出解码位图占用内存的硬上限。
+// 每张大图都由 WIC 重新分配、释放整幅缓冲区会造成大量提交内存抖动，这里把释放的块留给后续同级别的图片
+class PixelBufferPool {
+public:
+    explicit PixelBufferPool(ULONGLONG capacityBytes) : capacity_(capacityBytes) {}
+    ~PixelBufferPool();
+
+    // 取得至少 bytes 字节的块，总量超出上限时阻塞等待归还。
+    // 单块本身超过上限时，等其他块全部归还后仍然分配，保证大图能够前进
+    BYTE* Acquire(size_t bytes, DWORD numaNode, size_t& blockSize);
+    void Release(BYTE* block, size_t blockSize, DWORD numaNode);
+
+    ULONGLONG Capacity() const { return capacity_; }
+    static size_t SizeClass(size_t bytes);
+
+private:
+    struct FreeBlock {
+        BYTE* data;
+        size_t size;
+        DWORD numaNode;
+    };
+    void EvictOne();
+
+    const ULONGLONG capacity_;
+    std::mutex mutex_;
+    std::condition_variable released_;
+    std::vector<FreeBlock> free_;        // 空闲块，数量很少，线性查找即可
+    ULONGLONG committed_ = 0;            // 空闲 + 使用中
+    ULONGLONG outstanding_ = 0;          // 使用中
+};
+
+ULONGLONG DefaultPixelPoolLimit();       // 物理内存的一半
+UINT GetBitsPerPixel(IWICImagingFactory* pFactory, const WICPixelFormatGUID& format); // 新增：未知格式返回 0
+
+// === 新增：格式转换与缩小使用的 SIMD 内核，启动时按 CPU 支持的指令集 (AVX-512 / AVX2 / 标量) 选择一次 ===
+typedef void (*PixelRowKernel)(const BYTE* src, BYTE* dst, UINT width, const UINT32* palette);
+
+struct PixelKernels {
+    const WCHAR* name = L"scalar";
+    PixelRowKernel rgba64ToBgra = nullptr;   // 16 位/通道 -> 8 位/通道，同时交换 R/B
+    PixelRowKernel bgra64ToBgra = nullptr;
+    PixelRowKernel rgb48ToBgra = nullptr;
+    PixelRowKernel bgr48ToBgra = nullptr;
+    PixelRowKernel gray16ToBgra = nullptr;
+    PixelRowKernel index8ToBgra = nullptr;   // palette 为 256 项 BGRA
+    void (*accumulate)(float* acc, const float* src, size_t count, float weight) = nullptr; // acc += weight * src
+
+    // 源格式有专用内核时返回它，并给出转换后的格式 (32bppBGRA 或 32bppPBGRA)；否则返回 nullptr，交给 WIC 转换
+    PixelRowKernel Select(REFWICPixelFormatGUID source, WICPixelFormatGUID& converted) const;
+};
+
+const PixelKernels& GetPixelKernels();
+
+// 新增：像素内存来自缓冲池 (或直接在指定 NUMA 节点上分配) 的位图，由解码阶段调用 CopyPixels 填充。
+// CreateBitmapFromMemory 会再复制一份，因此直接实现 IWICBitmapSource，编码器用 WriteSource 从该内存读取
+class PooledBitmap : public Microsoft::WRL::RuntimeClass<
+    Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>, IWICBitmapSource> {
+public:
+    // 索引色格式返回 WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT，由调用方回退到 CreateBitmapFromSource。
+    // 16 位、48 位 RGB 和 8 位索引色在落地时由 SIMD 内核直接转为 32bppBGRA
+    HRESULT RuntimeClassInitialize(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, PixelBufferPool* pPool, DWORD numaNode);
+    // 新增：只分配像素内存，由调用方通过 Pixels() 填充 (缩小阶段的输出)
+    HRESULT RuntimeClassInitialize(UINT width, UINT height, REFWICPixelFormatGUID format, UINT bitsPerPixel, double dpiX, double dpiY, PixelBufferPool* pPool, DWORD numaNode);
+    ~PooledBitmap();
+
+    BYTE* Pixels() const { return pixels_; }
+    size_t Stride() const { return stride_; }
+
+    IFACEMETHODIMP GetSize(UINT* puiWidth, UINT* puiHeight) override;
+    IFACEMETHODIMP GetPixelFormat(WICPixelFormatGUID* pPixelFormat) override;
+    IFACEMETHODIMP GetResolution(double* pDpiX, double* pDpiY) override;
+    IFACEMETHODIMP CopyPalette(IWICPalette*) override { return WINCODEC_ERR_PALETTEUNAVAILABLE; }
+    IFACEMETHODIMP CopyPixels(const WICRect* prc, UINT cbStride, UINT cbBufferSize, BYTE* pbBuffer) override;
+
+private:
+    HRESULT Allocate(PixelBufferPool* pPool, DWORD numaNode); // 按 width_/height_/bitsPerPixel_ 分配
+    HRESULT ConvertFrom(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, PixelRowKernel kernel, REFWICPixelFormatGUID convertedFormat, PixelBufferPool* pPool, DWORD numaNode);
+
+    BYTE* pixels_ = nullptr;
+    size_t blockSize_ = 0;
+    PixelBufferPool* pool_ = nullptr;
+    DWORD numaNode_ = NUMA_NO_PREFERRED_NODE;
+    UINT width_ = 0;
+    UINT height_ = 0;
+    UINT bitsPerPixel_ = 0;
+    size_t stride_ = 0;
+    WICPixelFormatGUID format_ = GUID_WICPixelFormatUndefined;
+    double dpiX_ = 96.0;
+    double dpiY_ = 96.0;
+};
+
+// 新增：丢弃所有写入数据、只记录长度的输出流，基准测试中用于隔离编解码开销
+class NullOutputStream : public Microsoft::WRL::RuntimeClass<
+    Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>,
+    Microsoft::WRL::ChainInterfaces<IStream, ISequentialStream>> {
+public:
+    ULONGLONG Size() const { return size_; }
+
+    IFACEMETHODIMP Read(void*, ULONG, ULONG* pcbRead) override { if (pcbRead) *pcbRead = 0; return S_FALSE; }
+    IFACEMETHODIMP Write(const void*, ULONG cb, ULONG* pcbWritten) override {
+        position_ += cb;
+        size_ = std::max(size_, position_);
+        if (pcbWritten) *pcbWritten = cb;
+        return S_OK;
+    }
+    IFACEMETHODIMP Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition) override {
+        LONGLONG base = dwOrigin == STREAM_SEEK_SET ? 0 : dwOrigin == STREAM_SEEK_CUR ? static_cast<LONGLONG>(position_) : static_cast<LONGLONG>(size_);
+        if (dwOrigin > STREAM_SEEK_END || base + dlibMove.QuadPart < 0) return STG_E_INVALIDFUNCTION;
+        position_ = static_cast<ULONGLONG>(base + dlibMove.QuadPart);
+        if (plibNewPosition) plibNewPosition->QuadPart = position_;
+        return S_OK;
+    }
+    IFACEMETHODIMP SetSize(ULARGE_INTEGER libNewSize) override { size_ = libNewSize.QuadPart; return S_OK; }
+    IFACEMETHODIMP CopyTo(IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER*) override { return E_NOTIMPL; }
+    IFACEMETHODIMP Commit(DWORD) override { return S_OK; }
+    IFACEMETHODIMP Revert() override { return E_NOTIMPL; }
+    IFACEMETHODIMP LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return STG_E_INVALIDFUNCTION; }
+    IFACEMETHODIMP UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return STG_E_INVALIDFUNCTION; }
+    IFACEMETHODIMP Stat(STATSTG* pstatstg, DWORD) override {
+        if (!pstatstg) return STG_E_INVALIDPOINTER;
+        ZeroMemory(pstatstg, sizeof(*pstatstg));
+        pstatstg->type = STGTY_STREAM;
+        pstatstg->cbSize.QuadPart = size_;
+        return S_OK;
+    }
+    IFACEMETHODIMP Clone(IStream**) override { return E_NOTIMPL; }
+
+private:
+    ULONGLONG size_ = 0;
+    ULONGLONG position_ = 0;
+};
+
+// 新增：单张图片各阶段耗时 (毫秒)，可选填充
+struct StageTimings {
+    double decodeMs = 0.0;       // 打开 + 解码
+    double writeSourceMs = 0.0;
+    double commitMs = 0.0;
+    double renameMs = 0.0;       // 写出 + 改名
+    UINT width = 0;
+    UINT height = 0;
+};
+
+// 新增：高精度计时
+inline LONGLONG QueryTicks() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+inline double TicksToMs(LONGLONG ticks) {
+    static const LONGLONG frequency = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f.QuadPart; }();
+    return ticks * 1000.0 / frequency;
+}
+
+// 新增：GIF 动画逐帧合成。GIF 的后续帧只包含变化区域，需要按处置方式叠加到逻辑屏幕上才是完整画面
+class GifCompositor {
+public:
+    HRESULT Initialize(IWICBitmapDecoder* pDecoder);
+    HRESULT Compose(IWICImagingFactory* pFactory, IWICBitmapFrameDecode* pFrame, ComPtr<IWICBitmapSource>& composed);
+
+private:
+    UINT width_ = 0;
+    UINT height_ = 0;
+    std::vector<BYTE> canvas_;    // 32bppBGRA
+    std::vector<BYTE> previous_;  // 处置方式 3 (恢复到前一画面) 时的备份
+    UINT pendingDisposal_ = 0;    // 上一帧显示后的处置方式
+    WICRect pendingRect_ = {};
+};
+
+// 新增：多帧文件 (GIF 动画、多页 TIFF、连拍 HEIC) 的顺序取帧器。
+// 取出第 i 帧后在后台线程预先解码第 i+1 帧，使解码与编码重叠；惰性解码时解码器被编码器占用，不做预取
+class FrameSequence {
+public:
+    FrameSequence(const ConversionContext& context, IWICBitmapDecoder* pDecoder, UINT frameCount, bool materialize)
+        : factory_(context.factory), pool_(context.pixelPool), numaNode_(context.numaNode), maxDimension_(context.maxDimension), decoder_(pDecoder), frameCount_(frameCount), materialize_(materialize) {}
+    ~FrameSequence();
+
+    HRESULT Initialize();
+    UINT Count() const { return frameCount_; }
+    UINT Remaining() const { return frameCount_ - nextIndex_; }
+    HRESULT Next(ComPtr<IWICBitmapSource>& frame);
+
+private:
+    HRESULT Produce(UINT index, ComPtr<IWICBitmapSource>& frame);
+    void PrefetchLoop();
+
+    ComPtr<IWICImagingFactory> factory_;
+    PixelBufferPool* pool_;
+    DWORD numaNode_;
+    UINT maxDimension_;
+    ComPtr<IWICBitmapDecoder> decoder_;
+    const UINT frameCount_;
+    const bool materialize_;
+    std::unique_ptr<GifCompositor> gif_;
+    UINT nextIndex_ = 0;
+    bool pending_ = false;                 // 已向预取线程请求下一帧 (只由调用 Next 的线程访问)
+    // 修改：每个序列只用一个预取线程，第一次预取时启动，逐帧接收请求，不再每帧新建线程
+    std::thread prefetch_;
+    std::mutex prefetchMutex_;
+    std::condition_variable prefetchWake_;
+    UINT requestIndex_ = 0;
+    bool requested_ = false;
+    bool ready_ = false;
+    bool stopping_ = false;
+    ComPtr<IWICBitmapSource> prefetched_;
+    HRESULT prefetchResult_ = S_OK;
+};
+
+// === 新增：Media Foundation 硬件 HEVC 编码后端 ===
+// WIC 的 HEIF 编码器不能指定显卡，也不保证使用硬件。该后端直接驱动显卡的 HEVC 编码 MFT：
+// 像素上传为 BGRA 纹理，由 D3D11 视频处理器在显存中转换为 NV12 后送入编码器，码流再封装为 HEIF。
+
+// 选定的显卡及其 DXGI 设备管理器，所有编码线程共享 (设备开启了多线程保护)
+class GpuDevice {
+public:
+    HRESULT Initialize(UINT adapterIndex);
+    void Reset();
+    HRESULT EnumerateEncoder(ComPtr<IMFActivate>& activate) const; // 每次返回新的激活对象，供各线程创建独立的 MFT
+
+    ID3D11Device* Device() const { return device_.Get(); }
+    IMFDXGIDeviceManager* DeviceManager() const { return manager_.Get(); }
+    const std::wstring& AdapterName() const { return adapterName_; }
+    const std::wstring& EncoderName() const { return encoderName_; }
+    unsigned EncodeEngines() const; // 新增：估计的硬件编码引擎数，决定共用编码器的数量
+
+private:
+    ComPtr<ID3D11Device> device_;
+    ComPtr<IMFDXGIDeviceManager> manager_;
+    UINT resetToken_ = 0;
+    LUID adapterLuid_ = {};
+    UINT vendorId_ = 0;
+    std::wstring adapterName_;
+    std::wstring encoderName_;
+};
+
+struct FrameMetadata;
+
+// 修改：编码器由 HardwareEncoderPool 借给编码线程，同一时刻只有一个线程使用。MFT 按图片尺寸配置，尺寸不变时在图片之间复用
+class HardwareHevcEncoder {
+public:
+    explicit HardwareHevcEncoder(const GpuDevice& gpu) : gpu_(gpu) {}
+    ~HardwareHevcEncoder() { Shutdown(); }
+
+    // 编码单帧图片并以 HEIF 写入 pOutputStream，pMetadata 中的 ICC 与 Exif/XMP 一并写入。失败时不写入任何数据，调用方可以回退到 WIC
+    // 修改：尺寸超出编码器能力时返回 HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED)，其他失败说明硬件后端本身不可用
+    HRESULT Encode(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, float quality, const FrameMetadata* pMetadata, IStream* pOutputStream);
+
+private:
+    HRESULT Configure(UINT codedWidth, UINT codedHeight, float quality);
+    HRESULT PrepareSurfaces(UINT width, UINT height, UINT codedWidth, UINT codedHeight);
+    HRESULT Upload(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, UINT width, UINT height);
+    HRESULT ConvertToNv12();
+    HRESULT RunEncoder(std::vector<BYTE>& bitstream);
+    HRESULT PullOutput(std::vector<BYTE>& bitstream);
+    void UpdateSequenceHeader(IMFMediaType* pOutputType);
+    void Shutdown();
+
+    const GpuDevice& gpu_;
+    ComPtr<IMFActivate> activate_;
+    ComPtr<IMFTransform> transform_;
+    ComPtr<IMFMediaEventGenerator> events_;
+    DWORD inputStreamId_ = 0;
+    DWORD outputStreamId_ = 0;
+    UINT codedWidth_ = 0;
+    UINT codedHeight_ = 0;
+    ULONGLONG rejectedPixels_ = ULLONG_MAX; // 编码器拒绝过的大尺寸，不小于它的图片直接回退
+    std::vector<BYTE> sequenceHeader_;      // 输出类型携带的 VPS/SPS/PPS
+
+    ComPtr<ID3D11VideoDevice> videoDevice_;
+    ComPtr<ID3D11VideoContext> videoContext_;
+    ComPtr<ID3D11VideoProcessorEnumerator> processorEnum_;
+    ComPtr<ID3D11VideoProcessor> processor_;
+    ComPtr<ID3D11Texture2D> bgraTexture_;
+    ComPtr<ID3D11Texture2D> nv12Texture_;
+    ComPtr<ID3D11VideoProcessorInputView> inputView_;
+    ComPtr<ID3D11VideoProcessorOutputView> outputView_;
+    UINT surfaceWidth_ = 0;
+    UINT surfaceHeight_ = 0;
+    std::vector<BYTE> uploadBand_;
+};
+
+// 新增：各编码线程共用的硬件编码器。消费级显卡可同时打开的编码会话很少 (NVENC/QSV 常见为 2-5 个)，
+// 超过编码引擎数的会话也只是在显卡上排队。编码器按需创建，数量不超过 capacity
+class HardwareEncoderPool {
+public:
+    HardwareEncoderPool(const GpuDevice& gpu, unsigned capacity) : gpu_(gpu), capacity_(std::max(1u, capacity)) {}
+
+    // 没有空闲的编码器且已达上限时返回空，调用方这张图片改用 WIC，不等待显卡
+    std::unique_ptr<HardwareHevcEncoder> TryAcquire();
+    void Release(std::unique_ptr<HardwareHevcEncoder> encoder);
+    // 编码器失败后不再放回，在调用线程上销毁，空出的名额可以重新创建
+    void Discard(std::unique_ptr<HardwareHevcEncoder> encoder);
+    // 最后一个编码线程退出前调用，在 MTA 线程上释放 MFT；可重复调用
+    void Clear();
+
+private:
+    const GpuDevice& gpu_;
+    const unsigned capacity_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<HardwareHevcEncoder>> idle_;
+    unsigned created_ = 0;
+};
+
+// 新增：首帧的元数据来源。只保存读取器而不展开内容，编码时整块复制到目标帧
+struct FrameMetadata {
+    ComPtr<IWICMetadataBlockReader> blocks;                 // EXIF/XMP/IPTC 等元数据块，引用源数据
+    ComPtr<IWICMetadataQueryReader> query;
+    std::vector<ComPtr<IWICColorContext>> colorContexts;    // ICC 配置
+    USHORT orientation = 1;                                 // EXIF 方向 (1-8)
+    bool orientationBaked = false;                          // 像素已按方向转正，输出的方向标签应为 1
+
+    UINT contentBlocks = 0;                                 // 新增：承载 Exif/XMP/IPTC 等的块数，JFIF、PNG gAMA 之类的结构块不计
+    std::vector<BYTE> exif;                                 // 新增：硬件编码时从源文件原样取出的 Exif (自 TIFF 头起) 与 XMP 包
+    std::vector<BYTE> xmp;
+    bool rawComplete = false;                               // 新增：源文件中的元数据全部包含在 exif/xmp 中
+
+    bool ReferencesSource() const { return blocks != nullptr || query != nullptr; }
+    bool HasContent() const { return contentBlocks > 0 || !colorContexts.empty(); }
+    // 新增：硬件编码的 HEIF 封装能完整携带的元数据：ICC，以及原样取出的 Exif/XMP
+    bool PortableToHevc() const { return (contentBlocks == 0 || rawComplete) && (orientation == 1 || orientationBaked); }
+};
+
+// 新增：从 WIC 编码出的单图 HEIF 中取出的主图像项：编码数据、关联的属性盒 (原样保存) 以及描述它的 Exif/XMP 项
+struct HeifCodedImage {
+    struct Property {
+        std::vector<BYTE> box;
+        bool essential;
+    };
+    struct MetadataItem {
+        char type[4];
+        std::string contentType; // mime 项的内容类型
+        std::vector<BYTE> data;
+    };
+    char type[4] = {};           // 通常为 hvc1
+    std::vector<BYTE> data;
+    std::vector<Property> properties;
+    std::vector<MetadataItem> metadata;
+};
+
+// 修改：HEVC 参数集解析移到公共声明中，硬件编码的封装与单元测试共用
+const UINT kHevcNalVps = 32;
+const UINT kHevcNalSps = 33;
+const UINT kHevcNalPps = 34;
+
+struct HevcNalUnit {
+    const BYTE* data;
+    size_t size;
+    UINT type;
+};
+
+struct HevcSpsInfo {
+    BYTE generalProfile[12] = {}; // general_profile_space ... general_level_idc，与 hvcC 中的布局相同
+    UINT maxSubLayers = 1;
+    bool temporalIdNested = false;
+    UINT chromaFormat = 1;
+    UINT bitDepthLumaMinus8 = 0;
+    UINT bitDepthChromaMinus8 = 0;
+    UINT width = 0;  // 裁剪窗口之后的解码输出尺寸
+    UINT height = 0;
+};
+
+std::vector<HevcNalUnit> SplitAnnexB(const std::vector<BYTE>& stream); // 单元指向 stream 内部
+std::vector<BYTE> NalToRbsp(const HevcNalUnit& nal);
+bool ParseHevcSps(const HevcNalUnit& sps, HevcSpsInfo& info);
+
+// 新增：HEVC Level 6.2 的 MaxLumaPs 及由此得出的单边上限 sqrt(8 * MaxLumaPs)，超出时改用网格编码
+const ULONGLONG kHevcMaxLumaPicture = 35651584;
+const UINT kHevcMaxPictureEdge = 16888;
+const ULONGLONG kMaxGridTiles = 16384; // 网格项与图块项共用 16 位项目编号
+
+// 函数前向声明
+HRESULT DecodeImage(const ConversionContext& context, IStream* pInputStream, bool materialize, IWICBitmapSource** ppBitmap, StageTimings* timings = nullptr); // 新增：解码阶段
+HRESULT DecodeFrame(const ConversionContext& context, IWICBitmapDecoder* pDecoder, UINT index, bool materialize, IWICBitmapSource** ppBitmap, StageTimings* timings = nullptr);
+HRESULT MaterializeFrame(IWICImagingFactory* pFactory, PixelBufferPool* pPool, DWORD numaNode, IWICBitmapSource* pFrame, IWICBitmapSource** ppBitmap); // 新增：完整解码到内存
+HRESULT EncodeImage(const ConversionContext& context, IWICBitmapSource* pSource, IStream* pOutputStream, StageTimings* timings = nullptr, IWICBitmapSource* pThumbnail = nullptr, const FrameMetadata* pMetadata = nullptr); // 新增：编码阶段
+HRESULT EncodeSequence(const ConversionContext& context, IWICBitmapSource* pFirstFrame, FrameSequence& frames, IStream* pOutputStream, IWICBitmapSource* pThumbnail, const FrameMetadata* pMetadata); // 新增：多帧写入同一容器
+void CaptureMetadata(IWICImagingFactory* pFactory, IWICBitmapFrameDecode* pFrame, bool copyMetadata, FrameMetadata& metadata); // 新增：记录元数据块、ICC 配置与方向
+void CaptureRawMetadata(const BYTE* data, size_t size, const GUID& container, FrameMetadata& metadata); // 新增：从 JPEG/PNG 源文件原样取出 Exif 与 XMP
+HRESULT ApplyOrientation(const ConversionContext& context, USHORT orientation, bool materialize, ComPtr<IWICBitmapSource>& bitmap); // 新增：按 EXIF 方向转正像素
+void WriteFrameMetadata(const ConversionContext& context, IWICBitmapFrameEncode* pFrameEncode, const FrameMetadata& metadata); // 新增：元数据写入目标帧
+HRESULT ScaleToFit(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, UINT longEdge, ComPtr<IWICBitmapSource>& scaled); // 新增：等比缩小到长边不超过 longEdge
+HRESULT ResizeToFit(IWICImagingFactory* pFactory, PixelBufferPool* pPool, DWORD numaNode, IWICBitmapSource* pSource, UINT maxDimension, ComPtr<IWICBitmapSource>& resized); // 新增：--max-dimension 的面积平均缩小
+HRESULT MakeThumbnails(const ConversionContext& context, IWICBitmapDecoder* pDecoder, IWICBitmapSource* pDecoded, UINT thumbnailSize, UINT previewSize,
+    ComPtr<IWICBitmapSource>& thumbnail, ComPtr<IWICBitmapSource>& preview);
+HRESULT EncodeSidecarJpeg(const ConversionContext& context, IWICBitmapSource* pSource, ComPtr<MemoryOutputStream>& buffer); // 新增：缩略图/预览图旁车文件
+std::wstring MakeNumberedPath(const std::wstring& path, UINT number, UINT count); // 新增：name.jpg -> name_001.jpg
+HRESULT WriteHeifFromHevc(const std::vector<BYTE>& bitstream, const std::vector<BYTE>& sequenceHeader, UINT width, UINT height, const FrameMetadata* pMetadata, IStream* pOutputStream); // 新增：HEVC 码流封装为 HEIF，附带 ICC/Exif/XMP
+bool NeedsGridEncoding(UINT width, UINT height); // 新增：超出 HEVC 级别上限的图像需要网格编码
+HRESULT ExtractHeifImage(const BYTE* file, size_t size, HeifCodedImage& image); // 新增：取出 HEIF 文件的主图像项
+HRESULT WriteHeifGrid(UINT width, UINT height, UINT columns, UINT rows, const std::vector<const HeifCodedImage*>& tiles, const HeifCodedImage* thumbnail, IStream* pOutputStream); // 新增：图块封装为 grid 图像
+HRESULT ConvertImage(const ConversionContext& context, const WCHAR* inputPath, IStream* pOutputStream, StageTimings* timings);                       // 新增：基准测试使用的完整转换
+HRESULT MakeOutputPath(const std::wstring& outputDir, const std::wstring& inputPath, const WCHAR* targetExtension, std::wstring& outPath); // 修改：路径过长等错误不再被忽略
+HRESULT ToExtendedLengthPath(const std::wstring& path, std::wstring& extended); // 新增：转为 \\?\ 形式的绝对路径，不受 MAX_PATH 限制
+void StripExtendedPrefix(std::wstring& path); // 新增：\\?\C:\x -> C:\x，\\?\UNC\server\x -> \\server\x
+const std::wstring& MakeTempPath(const std::wstring& path); // 新增：path + ".tmp"，写入本线程复用的缓冲区
+bool IsSupportedInputFile(const WCHAR* fileName, ConversionMode mode); // 改造后的文件支持判断函数，不做任何内存分配
+bool CheckHevcEncoderAvailability(IWICImagingFactory* pFactory, const GpuDevice* pGpu = nullptr, bool report = false, bool* pFromCache = nullptr); // 修改：pFromCache 报告结果是否来自缓存 (未实际试编码)
+bool IsCodecUnavailableError(HRESULT hr); // 新增：缺少 HEIF/HEVC 组件导致的失败，用于在实际转换失败时给出安装指引
+ULONGLONG MakeHevcProbeKey(IWICImagingFactory* pFactory); // 新增：HEVC 探测缓存的键，组件缺失时返回 0
+bool IsHevcProbeCached(ULONGLONG probeKey);
+void StoreHevcProbe(ULONGLONG probeKey);
+void ClearHevcProbe();                    // 新增：删除缓存的探测结果，下次启动重新探测
+void ShowHevcInstallGuidance();
+ULONGLONG EstimateConversionCost(const WCHAR* fileName, ULONGLONG fileSize); // 新增：按文件大小和格式估算转换耗时的相对值
+size_t SweepOrphanedTempFiles(const std::wstring& outputDir, const WCHAR* targetExtension, bool recursive); // 新增：删除中断遗留的 .tmp，返回删除数
+GUID SniffContainerFormat(const BYTE* header, size_t size); // 新增：按文件头判断真实的容器格式，无法识别时返回 GUID_NULL
+
+// 新增：--target-size 在尝试次数内找不到不超过目标大小的质量
+const HRESULT E_TARGET_SIZE_UNREACHABLE = MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x0201);
+
+extern std::mutex console_mutex; // 定义在 ProgressReporter.cpp
+
+// 新增：单个任务在流水线中的时间线 (QPC 时刻)。工作线程只写入时间戳，不做格式化或分配，
+// 耗时与排队时间由进度线程在输出指标时计算
+struct JobTimeline {
+    enum Point { Queued, ReadStart, ReadEnd, DecodeStart, DecodeEnd, EncodeStart, EncodeEnd, WriteStart, Done, PointCount };
+    LONGLONG ticks[PointCount] = {};
+    UINT width = 0;   // 解码后的首帧尺寸
+    UINT height = 0;
+    void Mark(Point point) { ticks[point] = QueryTicks(); }
+};
+
+// 新增：经 Converter::Submit 提交的一项。结果在写出阶段交给调用方；任务因流水线关闭被丢弃时以 E_ABORT 交付
+struct ConversionRequest {
+    ~ConversionRequest() {
+        if (delivered) return;
+        ConversionOutput output;
+        output.hr = E_ABORT;
+        Deliver(output);
+    }
+    void Deliver(ConversionOutput& output) {
+        delivered = true;
+        if (callback) { (*callback)(index, output); }
+        else { promise.set_value(std::move(output)); }
+    }
+
+    size_t index = 0;
+    std::promise<ConversionOutput> promise;
+    std::shared_ptr<const Converter::Callback> callback; // 为空时通过 promise 交付结果
+    bool delivered = false;
+};
+
+// 新增：流水线中流转的单个图片任务
+struct ImageJob {
+    size_t index = 0;
+    ULONGLONG cost = 0;                     // 新增：预估转换开销，按大小排序时先处理开销大的图片
+    std::wstring inputPath;
+    std::shared_ptr<const std::wstring> outputDir; // 新增：输出目录，同一目录下的文件共享同一份字符串
+    std::wstring finalOutPath;
+    ULONGLONG sourceSize = 0;               // 新增：枚举时取得的源文件大小与修改时间，供增量模式比对
+    ULONGLONG sourceWriteTime = 0;
+    ULONGLONG manifestKey = 0;              // 新增：源路径的哈希，增量清单与运行日志共用
+    size_t bucket = 0;                      // 新增：--lease-dir 时文件所属的桶，清单与日志按桶分开
+    ULONGLONG contentKey = 0;               // 新增：--dedup 时源文件内容与输出参数的哈希
+    ULONGLONG contentSize = 0;              // 修改：与 contentKey 一起构成去重的键
+    bool dedupOwner = false;                // 新增：本 job 负责编码，内容相同的副本等待其结果
+    bool useTempFile = false;               // 新增：超出内存缓冲上限的文件回退到原有的临时文件路径
+    GUID container = GUID_NULL;             // 新增：文件头嗅探出的真实格式，与扩展名无关
+    std::vector<BYTE> sourceBytes;          // 预读阶段读入的源文件内容
+    ComPtr<IWICBitmapDecoder> decoder;      // 新增：准入阶段估算内存时打开的解码器，解码阶段接着使用
+    ComPtr<IWICBitmapSource> decodedFrame;  // 解码阶段产出的位图
+    ComPtr<MemoryOutputStream> encodedBuffer; // 编码阶段产出的内存流 (内存模式)
+    std::unique_ptr<FrameSequence> frames;  // 新增：多帧文件的后续帧，由编码阶段继续读取
+    UINT outputFrames = 1;                  // 新增：多帧展开时的输出文件数，记入增量清单
+    struct ExtraOutput {
+        std::wstring path;
+        ComPtr<MemoryOutputStream> buffer;  // 临时文件模式下为空
+        bool sidecar = false;               // 新增：缩略图/预览旁车文件，写出失败不影响主输出
+    };
+    std::vector<ExtraOutput> extraOutputs;  // 新增：多帧展开为编号文件时第 2 帧起的输出，以及缩略图旁车文件
+    ComPtr<IWICBitmapSource> thumbnail;     // 新增：由解码后的位图缩小得到，嵌入输出并可写为旁车文件
+    ComPtr<IWICBitmapSource> preview;
+    FrameMetadata metadata;                 // 新增：首帧的元数据，编码时复制到输出
+    bool gridEncode = false;                // 新增：超大图像，decodedFrame 保持惰性解码，编码阶段按条带读取并以网格编码
+    ULONGLONG admittedBytes = 0;            // 新增：准入时占用的内存预算，编码完成后归还
+    HRESULT hr = S_OK;                      // 任一阶段失败后，后续阶段直接透传给写出阶段
+    bool encoderUnavailable = false;        // 新增：失败发生在编码器一侧且像是缺少 HEVC 组件 (解码失败不算)
+    JobTimeline timeline;                   // 新增：逐文件指标的时间戳
+    std::unique_ptr<ConversionRequest> request; // 新增：库调用提交的任务，finalOutPath 已由调用方给出
+    bool inputInMemory = false;             // 新增：调用方直接提供了 sourceBytes，预读阶段不读文件
+    bool returnBytes = false;               // 新增：调用方没有给出输出路径，编码结果交还调用方而不写文件
+};
+using ImageJobPtr = std::unique_ptr<ImageJob>;
+
+class QualityHistory;
+HRESULT EncodeToTargetSize(ConversionContext& context, ImageJob& job, ULONGLONG targetBytes, float maxQuality, QualityHistory& history); // 新增：在内存中搜索满足大小上限的质量
+
+// 新增：阶段之间的有界队列。队列满时生产者阻塞，从而限制在途任务占用的内存。
+enum class PopResult {
+    Item,
+    Timeout,
+    Closed,
+    Woken       // 新增：PopOr 的外部条件成立
+};
+
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(1, capacity)) {}
+
+    // 队列已关闭时返回 false
+    bool Push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // 队列已关闭且取空时返回 false
+    bool Pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // 新增：带超时的 Pop，供需要同时等待其他条件的消费者轮询
+    PopResult PopFor(T& item, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!not_empty_.wait_for(lock, timeout, [this] { return closed_ || !items_.empty(); })) return PopResult::Timeout;
+        if (items_.empty()) return PopResult::Closed;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return PopResult::Item;
+    }
+
+    // 新增：同时等待外部条件 (例如另一个队列有任务)，条件优先于本队列的元素。改变条件的一方随后调用 Notify
+    template <typename Predicate>
+    PopResult PopOr(T& item, Predicate wake) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [&] { return closed_ || !items_.empty() || wake(); });
+        if (wake()) return PopResult::Woken;
+        if (items_.empty()) return PopResult::Closed;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return PopResult::Item;
+    }
+
+    // 新增：不受容量限制地放回一个元素，供下游阶段的线程回送任务时使用，避免与上游互相等待。
+    // 队列已关闭时返回 false，item 保持不变
+    bool Requeue(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // 在本队列的锁下唤醒一个等待者，与 PopOr 的条件检查不会错过
+    void Notify() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        not_empty_.notify_one();
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+// 新增：待预读队列。按预估开销从大到小出队，避免批次末尾只剩一张大图在单线程上运行；
+// 开销相同 (或按扫描顺序处理) 时按发现顺序出队。接口与 BoundedQueue 一致
+class OrderedJobQueue {
+public:
+    OrderedJobQueue(size_t capacity, bool largestFirst) : capacity_(std::max<size_t>(1, capacity)), largestFirst_(largestFirst) {}
+
+    bool Push(ImageJobPtr item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || heap_.size() < capacity_; });
+        if (closed_) return false;
+        heap_.push_back(std::move(item));
+        std::push_heap(heap_.begin(), heap_.end(), Compare(largestFirst_));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool Pop(ImageJobPtr& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !heap_.empty(); });
+        if (heap_.empty()) return false;
+        std::pop_heap(heap_.begin(), heap_.end(), Compare(largestFirst_));
+        item = std::move(heap_.back());
+        heap_.pop_back();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    // 堆顶为“最大”元素：开销更大者优先，其次发现更早者优先
+    struct Compare {
+        explicit Compare(bool largestFirst) : largestFirst(largestFirst) {}
+        bool operator()(const ImageJobPtr& a, const ImageJobPtr& b) const {
+            if (largestFirst && a->cost != b->cost) return a->cost < b->cost;
+            return a->index > b->index;
+        }
+        bool largestFirst;
+    };
+
+    const size_t capacity_;
+    const bool largestFirst_;
+    std::vector<ImageJobPtr> heap_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+// 新增：增量模式的持久化转换清单。
+// 文件布局：文件头 + 按路径哈希排序的记录区 (内存映射后二分查找) + 未排序的追加区。
+// 运行中的新记录批量追加到文件末尾，Close 时合并追加区、重新排序并整体替换。
+class ConversionManifest {
+public:
+    struct Record {
+        ULONGLONG pathHash;
+        ULONGLONG size;
+        ULONGLONG lastWriteTime;
+        GUID targetFormat;
+        float quality;
+        DWORD maxDimension;   // 新增：原保留字段，0 表示未缩放，旧清单可直接沿用
+        DWORD outputFrames;   // 新增：输出文件数 (多帧展开时大于 1，首个输出带编号)
+        DWORD reserved;
+        ULONGLONG outputSize; // 新增：首个输出文件的大小，跳过前核对输出仍在
+    };
+
+    ~ConversionManifest() { Close(); }
+
+    // rememberAdds：本次运行新增的记录也参与 IsUnchanged 的比对 (--watch 的重扫与重复通知)，代价是每条记录常驻内存
+    HRESULT Open(const std::wstring& path, bool rememberAdds = false);
+    // 修改：源文件与参数都未变化，且输出文件 (outputPath，多帧时为其首个编号文件) 仍在且大小一致
+    bool IsUnchanged(const Record& probe, const std::wstring& outputPath) const;
+    // 新增：rememberAdds 时登记正在转换的文件；同一路径、同样大小与修改时间的文件已在转换中时返回 false
+    bool BeginConversion(const Record& record);
+    void EndConversion(const Record& record);
+    void Add(const Record& record);   // 线程安全，每积累 kBatchSize 条写一次文件
+    void Close();
+
+private:
+    struct Header {
+        DWORD magic;
+        DWORD version;
+        ULONGLONG sortedCount;
+        DWORD recordSize;
+        DWORD reserved;
+    };
+    static const DWORD kMagic = 0x464D4348; // "HCMF"
+    static const DWORD kVersion = 2;  // 修改：版本 2 起记录输出文件大小，旧清单视为空清单重建
+    static const size_t kBatchSize = 256;
+
+    void FlushBatch(std::vector<Record>& batch);
+    void Unmap();
+
+    std::wstring path_;
+    HANDLE appendFile_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+    const BYTE* view_ = nullptr;
+    const Record* sorted_ = nullptr;  // 映射区中的有序记录
+    size_t sortedCount_ = 0;
+    std::unordered_map<ULONGLONG, Record> tail_; // 上次运行未合并的追加记录，rememberAdds 时还包括本次运行的记录
+    bool rememberAdds_ = false;
+    mutable std::mutex tailMutex_;               // rememberAdds 时 tail_ 在运行中被修改，同时保护 inFlight_
+    std::unordered_map<ULONGLONG, Record> inFlight_;
+
+    std::mutex pendingMutex_;
+    std::vector<Record> pending_;
+    std::mutex fileMutex_;
+    bool appended_ = false;
+};
+
+ULONGLONG HashPath(const std::wstring& path); // 新增：大小写无关的路径哈希 (FNV-1a)
+void ReportShardTotals(const std::wstring& coordinationDir, unsigned shard, unsigned shardCount, int converted, int failed, int skipped); // 新增：写出本分片的统计并汇总所有分片
+
+// 新增：--resume 的运行日志。每次运行都把已完成的源文件 (路径哈希) 按批追加并刷到磁盘，进程被中断后 --resume 据此跳过。
+// 与增量清单不同：日志只描述一次运行，不比对文件内容；运行正常结束且没有失败时删除
+class RunJournal {
+public:
+    ~RunJournal() { Close(false); }
+
+    HRESULT Open(const std::wstring& path, ULONGLONG settingsKey, bool resume, size_t& resumed);
+    bool IsCompleted(ULONGLONG pathHash) const { return completed_.count(pathHash) != 0; }
+    void Add(ULONGLONG pathHash);     // 线程安全，每积累 kBatchSize 条写一次文件
+    void Close(bool finished);
+
+private:
+    struct Header {
+        DWORD magic;
+        DWORD version;
+        ULONGLONG settingsKey;        // 输出参数的哈希，参数变化后旧日志作废
+    };
+    static const DWORD kMagic = 0x524A4348; // "HCJR"
+    static const DWORD kVersion = 1;
+    static const size_t kBatchSize = 256;
+
+    void FlushBatch(std::vector<ULONGLONG>& batch);
+
+    std::wstring path_;
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    std::unordered_set<ULONGLONG> completed_; // 打开后只读，各预读线程无锁查询
+
+    std::mutex pendingMutex_;
+    std::vector<ULONGLONG> pending_;
+    std::mutex fileMutex_;
+};
+
+ULONGLONG Xxh64(const void* data, size_t size, ULONGLONG seed); // 新增：XXH64，--dedup 的内容哈希
+
+// 新增：--dedup 的内容去重缓存。预读阶段对读入内存的源文件做 XXH64 (以输出参数哈希为种子，目标格式、质量等不同的结果互不命中)，
+// 同一次运行中内容相同的文件只编码一次，其余副本等第一个写出后硬链接 (跨卷、链接数已满或 --dedup copy 时复制) 到自己的输出路径。
+// 只有一个输出的结果记入 .heicconv.dedup，之后的运行命中时先核对已有输出的大小与修改时间
+class DedupCache {
+public:
+    enum class Claim {
+        Encode,   // 第一次见到该内容，调用方照常转换，结束后由 PostWriteResult 调用 Complete
+        Parked,   // 相同内容正在转换，job 已交给缓存，等待 Complete 返回
+        Cached,   // 已有结果，stem + suffixes 为现成的输出
+    };
+
+    ~DedupCache() { Close(); }
+
+    HRESULT Open(const std::wstring& path, ULONGLONG settingsKey, bool copyOnly);
+    Claim Begin(ImageJobPtr& job, std::wstring& stem, std::vector<std::wstring>& suffixes);
+    // 第一个副本的结果已确定；失败时删除条目，返回的等待者由调用方按同样的错误上报。
+    // handOver 为 true (编码成功而写出失败) 时不删除条目，改由第一个等待者经 successor 接手转换，其余继续等待
+    std::vector<ImageJobPtr> Complete(const ImageJob& job, bool succeeded, bool handOver, ImageJobPtr& successor, std::wstring& stem, std::vector<std::wstring>& suffixes);
+    // 把 stem + 各后缀链接/复制到 job 的输出路径 (job 的输出路径去掉扩展名 + 同一后缀)。
+    // 修改：成功后 job 的输出路径与输出文件数改为首个输出与帧数，与自己编码时一致，供增量清单记录
+    HRESULT Materialize(const std::wstring& stem, const std::vector<std::wstring>& suffixes, ImageJob& job, ULONGLONG& outputBytes);
+    void Close();
+
+    size_t Linked() const { return linked_.load(); }
+    size_t Copied() const { return copied_.load(); }
+
+private:
+    struct Entry {
+        std::wstring stem;                   // 为空表示条目尚无主人
+        std::vector<std::wstring> suffixes;  // 扩展名，多帧编号与旁车文件的后缀
+        std::vector<ImageJobPtr> waiters;
+        ULONGLONG outputSize = 0;            // 单输出时记录，用于下次运行核对
+        ULONGLONG outputWriteTime = 0;
+        ULONGLONG checkHash = 0;             // 修改：另一种子的内容哈希，键相同时据此排除碰撞
+        bool pending = false;
+        bool verified = false;               // 本次运行产生或已核对过
+    };
+    struct Key {
+        ULONGLONG hash;
+        ULONGLONG size;                      // 源文件字节数
+        bool operator==(const Key& other) const { return hash == other.hash && size == other.size; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return static_cast<size_t>(key.hash ^ (key.size * 0x9E3779B97F4A7C15ull)); }
+    };
+    struct Header {
+        DWORD magic;
+        DWORD version;
+    };
+    struct FileRecord {
+        ULONGLONG key;
+        ULONGLONG sourceSize;
+        ULONGLONG checkHash;
+        ULONGLONG outputSize;
+        ULONGLONG outputWriteTime;
+        DWORD pathChars;                     // 其后紧跟输出路径 (不含结尾的 0)
+        DWORD suffixChars;                   // 路径末尾属于后缀 (扩展名) 的字符数
+    };
+    static const DWORD kMagic = 0x44444348; // "HCDD"
+    static const DWORD kVersion = 2;        // 修改：2 起记录源文件大小与核对哈希
+    static const ULONGLONG kCheckSeed = 0x9E3779B97F4A7C15ull; // 与 settingsKey 异或，作为核对哈希的种子
+
+    std::wstring path_;
+    ULONGLONG settingsKey_ = 0;
+    bool copyOnly_ = false;
+    bool open_ = false;
+    bool changed_ = false;
+    std::mutex mutex_;
+    std::unordered_map<Key, Entry, KeyHash> entries_;
+    std::atomic<size_t> linked_{ 0 };
+    std::atomic<size_t> copied_{ 0 };
+};
+
+// 新增：限制同时工作的编码线程数。线程按最大数量启动，由调优器在运行中调整上限。
+// 总上限按各通道 (NUMA 节点) 上的线程数比例分配，避免某个节点的名额被另一节点上空等的线程占住
+class WorkerGate {
+public:
+    WorkerGate(unsigned limit, std::vector<unsigned> laneWorkers)
+        : laneWorkers_(std::move(laneWorkers)), limits_(laneWorkers_.size(), 1), active_(laneWorkers_.size(), 0) { ApplyLimit(limit); }
+
+    // 取得工作名额；门已关闭时立即返回
+    void Acquire(size_t lane) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        available_.wait(lock, [this, lane] { return closed_ || active_[lane] < limits_[lane]; });
+        ++active_[lane];
+    }
+
+    void Release(size_t lane) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --active_[lane];
+        available_.notify_all(); // 等待者可能属于不同通道
+    }
+
+    void SetLimit(unsigned limit) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ApplyLimit(limit);
+        available_.notify_all();
+    }
+
+    // 输入耗尽后调用，唤醒所有等待的线程使其退出
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        available_.notify_all();
+    }
+
+private:
+    void ApplyLimit(unsigned limit) {
+        unsigned total = 0;
+        for (unsigned n : laneWorkers_) total += n;
+        for (size_t lane = 0; lane < laneWorkers_.size(); ++lane) {
+            unsigned share = total ? (limit * laneWorkers_[lane] + total / 2) / total : limit;
+            limits_[lane] = std::max(1u, std::min(share, laneWorkers_[lane]));
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable available_;
+    const std::vector<unsigned> laneWorkers_;
+    std::vector<unsigned> limits_;
+    std::vector<unsigned> active_;
+    bool closed_ = false;
+};
+
+// 新增：--max-memory 的全局内存预算。按估算的工作集准入图片，图片编码完成后归还
+class MemoryBudget {
+public:
+    explicit MemoryBudget(ULONGLONG capacityBytes) : capacity_(capacityBytes) {}
+
+    // 没有任何图片在处理时总是放行，保证超过预算的单张大图也能完成
+    // 修改：heldBytes 为该图片推迟期间经 Hold 计入的源数据，放行时转入工作集，不重复计算
+    bool TryAdmit(ULONGLONG bytes, ULONGLONG heldBytes = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const ULONGLONG otherHeld = held_ - std::min(held_, heldBytes);
+        if (used_ != 0 && used_ + otherHeld + bytes > capacity_) return false;
+        held_ = otherHeld;
+        used_ += bytes;
+        return true;
+    }
+
+    // 新增：推迟的图片仍持有完整的源数据，在放行前同样占用预算
+    void Hold(ULONGLONG bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        held_ += bytes;
+    }
+
+    // 新增：处理中与推迟中的图片已占满预算
+    bool Exhausted() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return used_ + held_ >= capacity_;
+    }
+
+    void Release(ULONGLONG bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            used_ -= std::min(used_, bytes);
+        }
+        released_.notify_all();
+    }
+
+    // 等待有预算归还或超时
+    void WaitForRelease(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait_for(lock, timeout);
+    }
+
+    ULONGLONG Capacity() const { return capacity_; }
+
+private:
+    const ULONGLONG capacity_;
+    ULONGLONG used_ = 0;
+    ULONGLONG held_ = 0; // 推迟中的图片的源数据
+    std::mutex mutex_;
+    std::condition_variable released_;
+};
+
+// 新增：处理器拓扑。每个 (NUMA 节点, 处理器组) 组合作为一个放置域；
+// 超过 64 个逻辑处理器时 GetSystemInfo 只报告当前组，这里统计全部处理器组
+struct PlacementDomain {
+    USHORT numaNode = 0;
+    GROUP_AFFINITY affinity = {};
+    unsigned processors = 0;
+};
+
+class ProcessorTopology {
+public:
+    static const ProcessorTopology& Get();
+
+    const std::vector<PlacementDomain>& Domains() const { return domains_; }
+    bool IsNuma() const { return numa_; }   // 存在多于一个 NUMA 节点
+    unsigned LogicalProcessors() const { return total_; }
+
+    // 按各域处理器数量加权轮转，返回前 count 个线程各自所在的域
+    std::vector<size_t> Assign(unsigned count) const;
+    // 把 count 个线程按比例分给各域，每个域至少一个
+    std::vector<unsigned> Distribute(unsigned count) const;
+    void Pin(std::thread& thread, size_t domain) const;
+
+private:
+    ProcessorTopology();
+
+    std::vector<PlacementDomain> domains_;
+    unsigned total_ = 0;
+    bool numa_ = false;
+};
+
+unsigned GetLogicalProcessorCount();
+
+// 新增：单个文件的处理结果，由工作线程投递给进度输出线程，工作线程上不做任何格式化
+enum class JobOutcome {
+    Converted,
+    Failed,
+    Skipped,
+    Resumed     // 新增：被中断的上一次运行已完成
+};
+
+struct CompletionRecord {
+    ImageJobPtr job;                      // 直接移交任务对象，此时其中的大块缓冲区已释放
+    JobOutcome outcome = JobOutcome::Failed;
+    HRESULT hr = S_OK;                    // 转换失败时的错误码
+    DWORD finalizeError = ERROR_SUCCESS;  // 改名失败时的Win32错误码
+    ULONGLONG outputBytes = 0;
+};
+
+// 新增：单生产者单消费者的无锁环形缓冲区，每个产生结果的工作线程独占一个
+class CompletionRing {
+public:
+    static const size_t kCapacity = 1024; // 必须是2的幂
+
+    bool TryPush(CompletionRecord& record) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= kCapacity) return false;
+        slots_[tail & (kCapacity - 1)] = std::move(record);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(CompletionRecord& record) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+        record = std::move(slots_[head & (kCapacity - 1)]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::atomic<size_t> head_{ 0 };  // 仅消费者写
+    char padding_[64];               // 避免生产者与消费者的计数器处于同一缓存行
+    std::atomic<size_t> tail_{ 0 };  // 仅生产者写
+    CompletionRecord slots_[kCapacity];
+};
+
+// 新增：输出详细程度
+enum class OutputLevel {
+    Quiet,    // 只输出最终统计
+    Normal,   // 节流刷新的进度行 + 失败记录
+    Verbose   // 每个文件一行 (原有行为)
+};
+
+struct Pipeline;
+class AsyncFileWriter;
+
+// 新增：逐文件指标输出。在进度线程上由完成记录生成：有 ETW 会话监听时写 TraceLogging 事件，--metrics 时追加一行 JSON
+class MetricsSink {
+public:
+    MetricsSink();   // 注册 ETW 提供者
+    ~MetricsSink();
+
+    HRESULT OpenFile(const std::wstring& path); // JSON lines 文件，追加写入
+    void Record(const CompletionRecord& record);
+    // 修改：进度线程定时调用，--watch 时可从控制台处理线程调用，长时间运行或被关闭时已完成的记录不丢失
+    void Flush();
+    void Close();
+
+    MetricsSink(const MetricsSink&) = delete;
+    MetricsSink& operator=(const MetricsSink&) = delete;
+
+private:
+    static const size_t kFlushBytes = 64 * 1024;
+    void FlushLocked();
+
+    bool registered_ = false;
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    std::string buffer_;
+    std::mutex mutex_;   // 新增：保护 buffer_ 与 file_
+};
+const char* ResultCategory(const CompletionRecord& record); // 新增：把结果归为少数几类 (converted/corrupt_input/io ...)，供指标聚合
+
+// 新增：进度输出。后台线程定期排空各工作线程的环形缓冲区，统计并渲染进度行。
+class ProgressReporter {
+public:
+    explicit ProgressReporter(OutputLevel level) : level_(level) {}
+
+    CompletionRing* RegisterProducer();   // 每个生产者线程启动时调用一次，各得一个独占的环形缓冲区
+    void Post(CompletionRing* ring, CompletionRecord& record);
+
+    void Start(const Pipeline* pipeline);
+    void Stop();                          // 排空剩余记录并结束进度行
+    void SetMetrics(MetricsSink* metrics) { metrics_ = metrics; } // 新增：Start 之前调用
+    void FlushMetrics() { if (metrics_) { metrics_->Flush(); } }  // 新增：可从任意线程调用
+
+    int Converted() const { return converted_; }
+    int Failed() const { return failed_; }
+    int Skipped() const { return skipped_; }
+
+private:
+    void Run();
+    void Drain();
+    void Handle(CompletionRecord& record);
+    void RenderProgress();
+    void PrintLine(const WCHAR* line);
+
+    const OutputLevel level_;
+    std::vector<std::unique_ptr<CompletionRing>> rings_;
+    std::mutex ringsMutex_;                    // 修改：生产者在运行中注册，保护 rings_ 的增长
+    std::vector<CompletionRing*> drainRings_;  // 只由消费者使用：Drain 时 rings_ 的快照
+    const Pipeline* pipeline_ = nullptr;
+    MetricsSink* metrics_ = nullptr;
+    std::thread thread_;
+    std::atomic<bool> stopping_{ false };
+
+    // 以下字段只由后台线程访问
+    int converted_ = 0;
+    int failed_ = 0;
+    int skipped_ = 0;
+    ULONGLONG processedBytes_ = 0;
+    ULONGLONG startTick_ = 0;
+    ULONGLONG lastRenderTick_ = 0;
+    ULONGLONG lastFlushTick_ = 0;
+    size_t lastLineLength_ = 0;
+};
+
+// 新增：各阶段的线程数与队列深度
+struct PipelineConfig {
+    unsigned ioThreads = 0;
+    unsigned decodeThreads = 0;
+    unsigned encodeThreads = 0;
+    unsigned writeThreads = 0;
+    size_t queueDepth = 0;
+    ULONGLONG bufferLimit = 256ull * 1024 * 1024; // 新增：单个文件走内存模式的上限，0 表示始终使用临时文件
+    ULONGLONG pixelPoolLimit = 0;                 // 新增：解码位图总内存上限，0 表示使用默认值
+    ULONGLONG maxMemory = 0;                      // 新增：--max-memory，0 表示不做准入控制
+    bool largestFirst = true;                     // 新增：--order size (默认) 或 scan
+    UINT thumbnailSize = 0;                       // 新增：--thumbnail 长边像素，0 表示不生成
+    UINT previewSize = 0;                         // 新增：--preview 长边像素，只写旁车文件
+    bool thumbnailSidecar = false;                // 新增：--sidecar 同时把缩略图写为单独的 JPEG
+    int gpuIndex = -1;                            // 新增：--gpu 显卡序号，-1 表示只用 WIC
+    UINT maxDimension = 0;                        // 新增：--max-dimension 长边像素，0 表示不缩放
+    bool copyMetadata = true;                     // 新增：--strip-metadata 时为 false
+    ULONGLONG targetSize = 0;                     // 新增：--target-size 每张输出的字节上限，0 表示按固定质量编码
+    UINT gridTileSize = 512;                      // 新增：--grid-tile 网格编码的图块边长，0 表示不做网格编码
+};
+
+// 新增：--target-size 的质量记忆。按源格式、源码率和目标码率分桶，记住最近一次命中的质量，相似的图片从该值开始搜索
+class QualityHistory {
+public:
+    static ULONGLONG MakeKey(const GUID& container, double targetBitsPerPixel, double sourceBitsPerPixel);
+    bool Lookup(ULONGLONG key, float& quality) const;
+    void Remember(ULONGLONG key, float quality);
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<ULONGLONG, float> qualities_;
+};
+
+// 新增：--shard k/N 的工作集划分。文件按相对于输入根目录的路径 (大小写无关) 的稳定哈希落入 N * kBucketsPerShard 个桶，
+// 桶按序号轮流属于各分片，重新运行时同一文件总是落在同一个节点上
+struct ShardFilter {
+    static const unsigned kBucketsPerShard = 4;
+    unsigned index = 0;                 // 本节点的分片，从 0 开始
+    unsigned count = 0;                 // 0 表示不分片
+    size_t outputRootLength = 0;        // 输出目录字符串中根目录部分的长度，其后即相对路径
+    bool leased = false;                // 修改：--lease-dir 时接受所有桶，由 LeasedInputs 按领取情况投递
+
+    bool Accepts(const std::wstring& outputDir, const WCHAR* fileName) const;
+    size_t Bucket(const std::wstring& outputDir, const WCHAR* fileName) const; // 新增：count 为 0 时返回 0
+};
+
+// 新增：--lease-dir 时按桶暂存的输入。目录只遍历一次：已领到的桶中的文件直接投递，其余的只保存路径，领到对应的桶后再投递
+class LeasedInputs {
+public:
+    explicit LeasedInputs(size_t bucketCount) : claimed_(bucketCount, false), pending_(bucketCount) {}
+
+    bool Defer(size_t bucket, std::wstring& path, const std::shared_ptr<const std::wstring>& outputDir, ULONGLONG size, const FILETIME& lastWriteTime); // 桶尚未领取时暂存并返回 true
+    void Claim(Pipeline& pipeline, const std::vector<bool>& wave); // 标记为已领取并投递已暂存的文件
+
+private:
+    struct Entry {
+        std::wstring path;
+        std::shared_ptr<const std::wstring> outputDir;
+        ULONGLONG size;
+        FILETIME lastWriteTime;
+    };
+    std::mutex mutex_;
+    std::vector<bool> claimed_;
+    std::vector<std::vector<Entry>> pending_;
+};
+
+// 新增：--lease-dir 的工作租约。各节点在共享目录中以 CREATE_NEW 创建 bucket-NNNNN.lease 领取桶，持有期间每 30 秒续租；
+// 处理完后改名为 .done。节点先领本分片的桶，做完后领取其他节点尚未开始的桶，慢节点剩下的工作因此被快节点分担。
+// 超过 kStaleAfter 未续租的租约 (节点崩溃或失联) 可被接管；续租时确认租约仍在自己手中。
+class WorkLeases {
+public:
+    ~WorkLeases() { Finish(false); }
+
+    HRESULT Open(const std::wstring& dir, unsigned shard, unsigned shardCount);
+    bool ClaimWave(size_t maxBuckets, std::vector<bool>& wave); // 领取下一批桶，没有可领的桶时返回 false
+    void Finish(bool completed);
+    size_t Stolen() const { return stolen_; }
+    size_t Lost() const { return lost_.load(); } // 新增：续租时发现已被其他节点接管的租约数
+
+private:
+    static const ULONGLONG kStaleAfter = 5ull * 60 * 10000000; // 100ns 单位
+
+    struct Lease {
+        size_t bucket;
+        HANDLE handle;
+        bool lost;      // 续租时发现句柄已不再指向 bucket-NNNNN.lease
+    };
+
+    std::wstring BucketPath(size_t bucket, const WCHAR* suffix) const;
+    bool TryClaim(size_t bucket);
+    void Heartbeat();
+    bool HoldsLease(const Lease& lease) const;
+
+    std::wstring dir_;
+    unsigned shard_ = 0;
+    unsigned shardCount_ = 1;
+    std::unordered_set<size_t> attempted_;
+    size_t stolen_ = 0;
+    std::mutex mutex_;
+    std::condition_variable stopCv_;
+    bool stopping_ = false;
+    std::vector<Lease> held_;
+    std::atomic<size_t> lost_{ 0 };
+    std::thread heartbeat_;
+};
+
+// 新增：流水线共享状态。每个阶段的最后一个线程退出时关闭下游队列。
+// 新增：每个 NUMA 节点一个编码通道。解码线程把位图放入本节点的队列，由同节点的编码线程取走，避免位图跨节点访问
+struct EncodeLane {
+    explicit EncodeLane(size_t queueDepth) : encodeQueue(queueDepth) {}
+
+    DWORD numaNode = NUMA_NO_PREFERRED_NODE;
+    BoundedQueue<ImageJobPtr> encodeQueue;  // 已解码，待编码
+    std::atomic<unsigned> activeDecoders{ 0 };
+};
+
+// 新增：网格编码的图块任务。大图的编码线程把图块放入共享队列，各编码线程在取新文件之前先帮忙编码图块
+class GridTileQueue;
+
+struct GridBatch {
+    explicit GridBatch(GridTileQueue& tileQueue) : queue(tileQueue) {}
+
+    std::mutex mutex;
+    GridTileQueue& queue; // 修改：图块完成时经队列唤醒等待中的大图编码线程
+    size_t pending = 0;  // 已入队尚未完成的图块数
+    HRESULT hr = S_OK;   // 第一个失败的图块
+
+    void Complete(HRESULT result);
+    bool Failed();
+};
+
+struct GridTileTask {
+    UINT tileSize = 0;
+    std::vector<BYTE> pixels;    // tileSize x tileSize 的 32bppBGR 像素，编码前释放
+    HeifCodedImage result;
+    GridBatch* batch = nullptr;
+};
+
+class GridTileQueue {
+public:
+    // 修改：入队后唤醒各编码队列上的一个等待者，空闲的编码线程不再轮询
+    void Push(GridTileTask* task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(task);
+            size_.fetch_add(1);
+        }
+        helpers_.notify_all();
+        for (BoundedQueue<ImageJobPtr>* queue : watchers_) { queue->Notify(); }
+    }
+    // 新增：大图的编码线程在此等待，直到有图块可做或 settled 成立；GridBatch::Complete 经 Wake 唤醒
+    template <typename Predicate>
+    void WaitForWork(Predicate settled) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        helpers_.wait(lock, [&] { return !tasks_.empty() || settled(); });
+    }
+    void Wake() {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        helpers_.notify_all();
+    }
+    bool RunOne(const ConversionContext& context); // 取出并编码一个图块，队列为空时返回 false
+    bool HasWork() const { return size_.load() > 0; }
+    void Watch(BoundedQueue<ImageJobPtr>* queue) { watchers_.push_back(queue); } // 新增：流水线启动前登记各通道的编码队列
+
+private:
+    std::mutex mutex_;
+    std::deque<GridTileTask*> tasks_;
+    std::atomic<size_t> size_{ 0 };
+    std::condition_variable helpers_;
+    std::vector<BoundedQueue<ImageJobPtr>*> watchers_;
+};
+
+HRESULT EncodeGridTile(const ConversionContext& context, GridTileTask& task, const FrameMetadata* pMetadata);
+HRESULT EncodeGridJob(const ConversionContext& context, Pipeline& pipeline, ImageJob& job, IStream* pOutputStream); // 新增：以 HEIF 网格编码超大图像
+
+// 按大小排序时待预读队列需要足够的前瞻才能把大图排到前面；只保存路径等元数据，占用很小
+const size_t kOrderedLookahead = 65536;
+
+struct Pipeline {
+    explicit Pipeline(size_t queueDepth, size_t laneCount = 1, bool largestFirst = false)
+        : readQueue(largestFirst ? std::max(queueDepth, kOrderedLookahead) : queueDepth, largestFirst), decodeQueue(queueDepth), admittedQueue(queueDepth), writeQueue(queueDepth) {
+        for (size_t i = 0; i < laneCount; ++i) {
+            lanes.emplace_back(new EncodeLane(queueDepth));
+            gridTiles.Watch(&lanes.back()->encodeQueue);
+        }
+    }
+
+    float quality = -1.0f;
+    const WCHAR* targetExtension = nullptr;
+    UINT thumbnailSize = 0;
+    UINT previewSize = 0;
+    bool thumbnailSidecar = false;
+    UINT maxDimension = 0;
+    bool copyMetadata = true;
+    ULONGLONG targetSize = 0;
+    QualityHistory qualityHistory;          // 新增：--target-size 时各编码线程共享
+    GUID targetEncoderGuid = GUID_NULL;
+    ULONGLONG bufferLimit = 0;
+    ConversionManifest* manifest = nullptr; // 新增：非空时启用增量模式
+    RunJournal* journal = nullptr;          // 新增：运行日志，--resume 时跳过其中已完成的文件
+    DedupCache* dedup = nullptr;            // 新增：--dedup 时内容相同的文件只编码一次
+    ProgressReporter* reporter = nullptr;
+    PixelBufferPool* pixelPool = nullptr;
+    MemoryBudget* memoryBudget = nullptr;   // 新增：非空时由准入阶段按内存预算放行图片
+    WorkerGate* encodeGate = nullptr;       // 新增：-j auto 时限制活动编码线程数
+    const GpuDevice* gpu = nullptr;         // 新增：--gpu 时单帧 HEIC 由该显卡的硬件编码器编码
+    HardwareEncoderPool* hardwareEncoders = nullptr; // 新增：--gpu 时各编码线程共用的硬件编码器
+    std::shared_future<bool> encoderProbe;  // 新增：后台进行的 HEVC 探测，编码线程在第一次编码前等待结果；--skip-probe 时无效
+    std::atomic<size_t> codecFailures{ 0 }; // 新增：创建或提交编码器时因缺少组件而失败的文件数
+    AsyncFileWriter* fileWriter = nullptr;  // 新增：非空时内存模式的输出经完成端口异步写出
+    ShardFilter shard;                      // 新增：--shard 时只处理本节点分到的文件
+    LeasedInputs* leasedInputs = nullptr;   // 新增：--lease-dir 的初始扫描期间非空
+    std::vector<ConversionManifest*> bucketManifests; // 新增：--lease-dir 时按桶打开的清单与日志，非空时取代 manifest/journal
+    std::vector<RunJournal*> bucketJournals;
+    UINT gridTileSize = 0;                  // 新增：非 0 时超大图像以该边长的图块做网格编码
+    unsigned encodeThreads = 1;             // 新增：编码线程总数，限制网格编码的在途图块数
+    GridTileQueue gridTiles;                // 新增：待编码的网格图块，所有编码线程共享
+
+    // 新增：枚举与转换并行进行，总数在扫描结束前只是下限
+    std::atomic<size_t> discoveredFiles{ 0 };
+    std::atomic<bool> scanComplete{ false };
+    std::atomic<size_t> encodedJobs{ 0 };   // 新增：编码阶段完成数，调优器据此计算吞吐
+
+    OrderedJobQueue readQueue;              // 待预读
+    BoundedQueue<ImageJobPtr> decodeQueue;  // 已读入内存，待解码
+    BoundedQueue<ImageJobPtr> admittedQueue; // 新增：启用内存预算时，已准入，待解码
+    std::vector<std::unique_ptr<EncodeLane>> lanes;
+    BoundedQueue<ImageJobPtr> writeQueue;   // 已编码，待写出
+
+    std::atomic<unsigned> activeReaders{ 0 };  // 修改：--dedup 时每个等待中的副本也占一个计数，保证其可被送回解码队列
+    std::atomic<unsigned> activeEncoders{ 0 };
+
+    void ReleaseReader() { if (activeReaders.fetch_sub(1) == 1) { decodeQueue.Close(); } }
+
+    // 新增：桶的清单与日志在领取时打开，之后才会有该桶的文件进入流水线
+    ConversionManifest* ManifestFor(const ImageJob& job) const { return bucketManifests.empty() ? manifest : bucketManifests[job.bucket]; }
+    RunJournal* JournalFor(const ImageJob& job) const { return bucketJournals.empty() ? journal : bucketJournals[job.bucket]; }
+};
+
+// 新增：-j auto 的调优器。在前若干个文件上逐档测量编码吞吐 (爬山法)，之后固定在最佳线程数
+class WorkerTuner {
+public:
+    WorkerTuner(WorkerGate& gate, unsigned maxWorkers, size_t tuningFiles)
+        : gate_(gate), maxWorkers_(std::max(1u, maxWorkers)), tuningFiles_(tuningFiles) {}
+
+    void Start(const Pipeline* pipeline);
+    void Stop();
+    unsigned Settled() const { return settled_; }
+
+private:
+    void Run();
+    double Measure(unsigned level);   // 返回 images/s；流水线结束时返回负值
+    bool WaitForEncoded(size_t target);
+
+    WorkerGate& gate_;
+    const unsigned maxWorkers_;
+    const size_t tuningFiles_;
+    const Pipeline* pipeline_ = nullptr;
+    std::thread thread_;
+    std::atomic<bool> stopping_{ false };
+    std::atomic<unsigned> settled_{ 0 };
+};
+
+// 新增：转换引擎的参数。命令行与 Converter 共用，线程数为 0 的项按逻辑处理器数决定
+struct EngineSettings {
+    ConversionMode mode = ConversionMode::ToHeic;
+    float quality = -1.0f;
+    PipelineConfig config;
+    bool autoWorkers = true;      // 编码线程数由调优器决定
+    bool probe = true;            // 在后台探测 HEVC 编码器
+    OutputLevel outputLevel = OutputLevel::Normal;
+};
+
+// 新增：转换引擎，命令行与 Converter 库接口共用。构造时初始化显卡、启动 HEVC 探测并按处理器拓扑搭建流水线；
+// 调用方在 Start 之前挂上清单、日志等可选组件，之后经 SubmitJob 投递任务，Finish 等待全部完成
+class ConversionEngine {
+public:
+    explicit ConversionEngine(const EngineSettings& settings);
+    ~ConversionEngine();
+
+    Pipeline& GetPipeline() { return *pipeline_; }
+    ProgressReporter& Reporter() { return *reporter_; }
+    const PipelineConfig& Config() const { return config_; }     // 已补全各阶段线程数
+    size_t LaneCount() const { return pipeline_->lanes.size(); }
+    HRESULT GpuStatus() const { return gpuStatus_; }              // --gpu 时显卡与硬件编码器的初始化结果
+    const std::shared_future<bool>& Probe() const { return probe_; } // 未探测时无效
+    bool ProbeFromCache() const { return probeFromCache_; }       // Probe().get() 之后读取
+    unsigned TunedWorkers() const { return tuner_->Settled(); }
+
+    void Start();   // 启动各阶段线程
+    void Finish();  // 关闭输入，等待所有任务上报；可重复调用
+
+    ConversionEngine(const ConversionEngine&) = delete;
+    ConversionEngine& operator=(const ConversionEngine&) = delete;
+
+private:
+    PipelineConfig config_;
+    std::vector<unsigned> laneDecoders_;
+    std::vector<unsigned> laneEncoders_;
+    GpuDevice gpu_;
+    std::unique_ptr<HardwareEncoderPool> hardwareEncoders_;
+    bool mediaFoundationStarted_ = false;
+    HRESULT gpuStatus_ = S_OK;
+    bool probeFromCache_ = false; // 由探测线程写入
+    std::shared_future<bool> probe_;
+    std::unique_ptr<PixelBufferPool> pixelPool_;
+    std::unique_ptr<MemoryBudget> memoryBudget_;
+    std::unique_ptr<ProgressReporter> reporter_;
+    std::unique_ptr<Pipeline> pipeline_;
+    std::unique_ptr<WorkerGate> encodeGate_;
+    std::unique_ptr<WorkerTuner> tuner_;
+    std::unique_ptr<AsyncFileWriter> fileWriter_;
+    std::vector<std::thread> threads_;
+    bool started_ = false;
+    bool finished_ = false;
+};
+bool SubmitJob(Pipeline& pipeline, ImageJobPtr job);
+
+// 新增：跨源文件使用的引擎函数
+ULONGLONG MakeJournalKey(const Pipeline& pipeline); // 新增：运行日志的参数哈希
+DWORD WriteBufferAndRename(const BYTE* pData, size_t size, const std::wstring& tempPath, const std::wstring& finalPath, bool& renameFailed); // 写入临时文件后改名为最终路径，返回 Win32 错误码
+bool GetOutputStamp(const std::wstring& path, ULONGLONG& size, ULONGLONG& writeTime); // 新增：输出文件的大小与修改时间
+void PushInputFile(Pipeline& pipeline, std::wstring fullPath, const std::shared_ptr<const std::wstring>& outputDir, ULONGLONG size, const FILETIME& lastWriteTime);
+void EnumerateInputs(const std::vector<std::wstring>& inputPaths, ConversionMode mode, bool recursive, unsigned scanThreads, const std::wstring& outputDir, Pipeline& pipeline);
+void WatchInputs(const std::vector<std::wstring>& inputPaths, ConversionMode mode, bool recursive, const std::wstring& outputDir, DWORD quietMs, Pipeline& pipeline,
+    const std::function<bool()>& initialScan); // 新增：--watch，直到 Ctrl+C 才返回
+
+// === 新增：基准测试模式 ===
+struct BenchmarkOptions {
+    unsigned iterations = 3;
+    std::vector<unsigned> threadCounts;   // 为空时使用 1、核心数/2、核心数
+    bool nullOutput = false;              // 输出到空流，只测量编解码
+    bool json = false;                    // 默认输出CSV
+    std::wstring reportPath;              // 为空时输出到控制台
+};
+int RunBenchmark(const BenchmarkOptions& options, const std::vector<std::wstring>& inputPaths, ConversionMode mode, bool recursive,
+    const std::wstring& outputDir, const GUID& targetEncoderGuid, const WCHAR* targetExtension, float quality, unsigned numCores);
@@ -0,0 +1,125 @@
+// HEVC 编码器探测与探测结果缓存
+#include "ConverterInternal.h"
+
+static bool ProbeWicHevcEncoder(IWICImagingFactory* pFactory) {
+    if (!pFactory) return false;
+    ComPtr<IWICBitmapEncoder> pEncoder;
+    HRESULT hr = pFactory->CreateEncoder(GUID_ContainerFormatHeif, NULL, &pEncoder);
+    if (FAILED(hr)) return false;
+    ComPtr<IStream> pStream;
+    hr = CreateStreamOnHGlobal(NULL, TRUE, &pStream);
+    if (FAILED(hr)) return false;
+    hr = pEncoder->Initialize(pStream.Get(), WICBitmapEncoderNoCache);
+    if (FAILED(hr)) return false;
+    ComPtr<IWICBitmapFrameEncode> pFrameEncode;
+    ComPtr<IPropertyBag2> pPropertyBag;
+    hr = pEncoder->CreateNewFrame(&pFrameEncode, &pPropertyBag);
+    if (FAILED(hr)) return false;
+    hr = pFrameEncode->Initialize(pPropertyBag.Get());
+    if (FAILED(hr)) return false;
+    ComPtr<IWICBitmap> pBitmap;
+    hr = pFactory->CreateBitmap(1, 1, GUID_WICPixelFormat32bppPBGRA, WICBitmapCacheOnDemand, &pBitmap);
+    if (FAILED(hr)) return false;
+    hr = pFrameEncode->WriteSource(pBitmap.Get(), NULL);
+    if (FAILED(hr)) return false;
+    hr = pFrameEncode->Commit();
+    if (FAILED(hr)) return false;
+    return true;
+}
+
+// 修改：同时报告实际使用的编码后端。pGpu 非空表示硬件编码器可用，此时 WIC 组件只作为回退
+bool CheckHevcEncoderAvailability(IWICImagingFactory* pFactory, const GpuDevice* pGpu, bool report, bool* pFromCache) {
+    // 修改：组件未变化时沿用上次成功的探测结果，跳过加载 HEVC MFT 的试编码
+    const ULONGLONG probeKey = MakeHevcProbeKey(pFactory);
+    bool wicAvailable = IsHevcProbeCached(probeKey);
+    if (pFromCache) { *pFromCache = wicAvailable; }
+    if (!wicAvailable) {
+        wicAvailable = ProbeWicHevcEncoder(pFactory);
+        if (wicAvailable) { StoreHevcProbe(probeKey); }
+    }
+    if (report) {
+        if (pGpu) {
+            wprintf(L"HEVC encoder: Media Foundation hardware (%s on %s)%s\n", pGpu->EncoderName().empty() ? L"HEVC MFT" : pGpu->EncoderName().c_str(),
+                pGpu->AdapterName().c_str(), wicAvailable ? L", WIC fallback" : L", no WIC fallback");
+        }
+        else if (wicAvailable) { wprintf(L"HEVC encoder: WIC (HEVC Video Extensions)\n"); }
+    }
+    return wicAvailable || pGpu != nullptr;
+}
+
+// === 新增：HEVC 探测结果缓存 ===
+// 只缓存探测成功的结果。键覆盖 HEIF 编码器的 CLSID 与版本以及已注册的 HEVC 编码器 MFT，
+// 安装、更新或卸载编解码器后键随之变化；商店包更新不一定改变注册信息，因此结果最多沿用一周
+static const WCHAR kSettingsRegistryKey[] = L"Software\\ImageToHeicConverter";
+static const ULONGLONG kHevcProbeLifetime = 7ull * 24 * 3600 * 10000000; // 单位 100ns
+
+ULONGLONG MakeHevcProbeKey(IWICImagingFactory* pFactory) {
+    std::wstring identity;
+    ComPtr<IWICComponentInfo> pInfo;
+    if (!pFactory || FAILED(pFactory->CreateComponentInfo(CLSID_WICHeifEncoder, &pInfo))) return 0; // HEIF 扩展未安装，不缓存
+    WCHAR text[64];
+    UINT length = 0;
+    if (SUCCEEDED(pInfo->GetVersion(ARRAYSIZE(text), text, &length))) { identity += text; }
+
+    // 只读取注册信息，不加载 MFT
+    MFT_REGISTER_TYPE_INFO outputType = { MFMediaType_Video, MFVideoFormat_HEVC };
+    IMFActivate** ppActivates = nullptr;
+    UINT32 count = 0;
+    if (SUCCEEDED(MFTEnumEx(MFT_CATEGORY_VIDEO_ENCODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_ASYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+        NULL, &outputType, &ppActivates, &count))) {
+        for (UINT32 i = 0; i < count; ++i) {
+            GUID clsid = GUID_NULL;
+            if (SUCCEEDED(ppActivates[i]->GetGUID(MFT_TRANSFORM_CLSID_Attribute, &clsid)) && StringFromGUID2(clsid, text, ARRAYSIZE(text))) { identity += text; }
+            WCHAR* pName = nullptr;
+            UINT32 nameLength = 0;
+            if (SUCCEEDED(ppActivates[i]->GetAllocatedString(MFT_FRIENDLY_NAME_Attribute, &pName, &nameLength))) { identity += pName; CoTaskMemFree(pName); }
+            ppActivates[i]->Release();
+        }
+        CoTaskMemFree(ppActivates);
+    }
+    if (count == 0) return 0; // 没有 HEVC 编码器，探测必然失败
+
+    ULONGLONG hash = 14695981039346656037ull;
+    for (WCHAR ch : identity) { hash = (hash ^ static_cast<ULONGLONG>(ch)) * 1099511628211ull; }
+    return hash ? hash : 1;
+}
+
+bool IsHevcProbeCached(ULONGLONG probeKey) {
+    if (probeKey == 0) return false;
+    ULONGLONG cachedKey = 0, cachedTime = 0;
+    DWORD size = sizeof(cachedKey);
+    if (RegGetValueW(HKEY_CURRENT_USER, kSettingsRegistryKey, L"HevcProbeKey", RRF_RT_REG_QWORD, NULL, &cachedKey, &size) != ERROR_SUCCESS) return false;
+    size = sizeof(cachedTime);
+    if (RegGetValueW(HKEY_CURRENT_USER, kSettingsRegistryKey, L"HevcProbeTime", RRF_RT_REG_QWORD, NULL, &cachedTime, &size) != ERROR_SUCCESS) return false;
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    const ULONGLONG current = (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+    return cachedKey == probeKey && current >= cachedTime && current - cachedTime < kHevcProbeLifetime;
+}
+
+void StoreHevcProbe(ULONGLONG probeKey) {
+    if (probeKey == 0) return;
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    const ULONGLONG current = (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+    // 缓存写入失败 (例如受限账户) 只影响下次启动速度
+    RegSetKeyValueW(HKEY_CURRENT_USER, kSettingsRegistryKey, L"HevcProbeTime", REG_QWORD, &current, sizeof(current));
+    RegSetKeyValueW(HKEY_CURRENT_USER, kSettingsRegistryKey, L"HevcProbeKey", REG_QWORD, &probeKey, sizeof(probeKey));
+}
+
+void ClearHevcProbe() {
+    RegDeleteKeyValueW(HKEY_CURRENT_USER, kSettingsRegistryKey, L"HevcProbeKey");
+}
+
+bool IsCodecUnavailableError(HRESULT hr) {
+    return hr == WINCODEC_ERR_COMPONENTNOTFOUND || hr == WINCODEC_ERR_COMPONENTINITIALIZEFAILURE || hr == MF_E_TOPO_CODEC_NOT_FOUND;
+}
+
+void ShowHevcInstallGuidance() {
+    wprintf(L"\nError: HEIC/HEVC component is unavailable or not fully functional on this system.\n");
+    wprintf(L"This program requires the official \"HEVC Video Extensions\" to read/write HEIC files.\n\n");
+    wprintf(L"Please install it from the Microsoft Store. Trying the free version first is recommended:\n");
+    wprintf(L"1. (Free) HEVC Video Extensions from Device Manufacturer:\n   https://www.microsoft.com/store/productId/9N4WGH0Z6VHQ\n\n");
+    wprintf(L"2. (Paid Alternative) HEVC Video Extensions:\n   https://www.microsoft.com/store/productId/9NMZLZ57R3T7\n\n");
+    wprintf(L"After installation, please run this program again.\n");
+}
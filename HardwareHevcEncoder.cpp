@@ -0,0 +1,441 @@
+// 显卡设备与 Media Foundation 硬件 HEVC 编码
+#include "ConverterInternal.h"
+
+// === 新增：Media Foundation 硬件 HEVC 编码后端实现 ===
+
+HRESULT GpuDevice::Initialize(UINT adapterIndex) {
+    ComPtr<IDXGIFactory1> pDxgiFactory;
+    HRESULT hr = CreateDXGIFactory1(IID_PPV_ARGS(&pDxgiFactory));
+    if (FAILED(hr)) return hr;
+    ComPtr<IDXGIAdapter1> pAdapter;
+    hr = pDxgiFactory->EnumAdapters1(adapterIndex, &pAdapter); // 没有该序号的显卡时返回 DXGI_ERROR_NOT_FOUND
+    if (FAILED(hr)) return hr;
+    DXGI_ADAPTER_DESC1 desc;
+    hr = pAdapter->GetDesc1(&desc);
+    if (FAILED(hr)) return hr;
+    if (desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) return MF_E_UNSUPPORTED_D3D_TYPE; // 软件渲染器没有硬件编码器
+    adapterLuid_ = desc.AdapterLuid;
+    vendorId_ = desc.VendorId;
+    adapterName_ = desc.Description;
+
+    // 指定显卡时驱动类型必须为 UNKNOWN；旧版运行时不认识 11.1，去掉后重试
+    const D3D_FEATURE_LEVEL levels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0, D3D_FEATURE_LEVEL_10_1, D3D_FEATURE_LEVEL_10_0 };
+    const UINT flags = D3D11_CREATE_DEVICE_VIDEO_SUPPORT | D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+    hr = D3D11CreateDevice(pAdapter.Get(), D3D_DRIVER_TYPE_UNKNOWN, NULL, flags, levels, ARRAYSIZE(levels), D3D11_SDK_VERSION, &device_, NULL, NULL);
+    if (hr == E_INVALIDARG) { hr = D3D11CreateDevice(pAdapter.Get(), D3D_DRIVER_TYPE_UNKNOWN, NULL, flags, levels + 1, ARRAYSIZE(levels) - 1, D3D11_SDK_VERSION, &device_, NULL, NULL); }
+    if (FAILED(hr)) return hr;
+
+    // 编码线程和 MFT 内部线程共用立即上下文
+    ComPtr<ID3D11Multithread> pMultithread;
+    if (SUCCEEDED(device_.As(&pMultithread))) { pMultithread->SetMultithreadProtected(TRUE); }
+    hr = MFCreateDXGIDeviceManager(&resetToken_, &manager_);
+    if (SUCCEEDED(hr)) { hr = manager_->ResetDevice(device_.Get(), resetToken_); }
+
+    // 确认该显卡上确实有 HEVC 编码器，并记下名称供报告
+    ComPtr<IMFActivate> pActivate;
+    if (SUCCEEDED(hr)) { hr = EnumerateEncoder(pActivate); }
+    if (SUCCEEDED(hr)) {
+        WCHAR* pName = nullptr;
+        UINT32 length = 0;
+        if (SUCCEEDED(pActivate->GetAllocatedString(MFT_FRIENDLY_NAME_Attribute, &pName, &length))) { encoderName_ = pName; CoTaskMemFree(pName); }
+    }
+    if (FAILED(hr)) { Reset(); }
+    return hr;
+}
+
+void GpuDevice::Reset() {
+    manager_.Reset();
+    device_.Reset();
+}
+
+// D3D11 与 DXGI 都不报告编码引擎数，按厂商估计：GeForce 高端型号有两个 NVENC，Intel 与 AMD 的消费级显卡通常一个
+unsigned GpuDevice::EncodeEngines() const {
+    const UINT kVendorNvidia = 0x10DE;
+    return vendorId_ == kVendorNvidia ? 2u : 1u;
+}
+
+HRESULT GpuDevice::EnumerateEncoder(ComPtr<IMFActivate>& activate) const {
+    MFT_REGISTER_TYPE_INFO inputType = { MFMediaType_Video, MFVideoFormat_NV12 };
+    MFT_REGISTER_TYPE_INFO outputType = { MFMediaType_Video, MFVideoFormat_HEVC };
+    ComPtr<IMFAttributes> pFilter;
+    HRESULT hr = MFCreateAttributes(&pFilter, 1);
+    // 只列出属于所选显卡的编码器
+    if (SUCCEEDED(hr)) { hr = pFilter->SetBlob(MFT_ENUM_ADAPTER_LUID, reinterpret_cast<const UINT8*>(&adapterLuid_), sizeof(adapterLuid_)); }
+    IMFActivate** ppActivates = nullptr;
+    UINT32 count = 0;
+    if (SUCCEEDED(hr)) {
+        hr = MFTEnum2(MFT_CATEGORY_VIDEO_ENCODER, MFT_ENUM_FLAG_HARDWARE | MFT_ENUM_FLAG_SORTANDFILTER, &inputType, &outputType, pFilter.Get(), &ppActivates, &count);
+    }
+    if (FAILED(hr)) return hr;
+    if (count > 0) { activate = ppActivates[0]; }
+    for (UINT32 i = 0; i < count; ++i) { ppActivates[i]->Release(); }
+    CoTaskMemFree(ppActivates);
+    return count > 0 ? S_OK : MF_E_TOPO_CODEC_NOT_FOUND;
+}
+
+HRESULT HardwareHevcEncoder::Encode(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, float quality, const FrameMetadata* pMetadata, IStream* pOutputStream) {
+    if (!pFactory || !pSource || !pOutputStream) return E_INVALIDARG;
+    UINT width = 0, height = 0;
+    HRESULT hr = pSource->GetSize(&width, &height);
+    if (FAILED(hr)) return hr;
+    // 4:2:0 要求偶数尺寸，补齐的一行/一列在 HEIF 中由 clap 裁掉
+    const UINT codedWidth = (width + 1) & ~1u;
+    const UINT codedHeight = (height + 1) & ~1u;
+    const ULONGLONG pixels = static_cast<ULONGLONG>(codedWidth) * codedHeight;
+    if (codedWidth > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || codedHeight > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || pixels >= rejectedPixels_) {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    hr = Configure(codedWidth, codedHeight, quality);
+    if (FAILED(hr)) {
+        Shutdown();
+        // 硬件编码器常见上限为 4096 或 8192；超过 4K 仍失败时记下尺寸，之后更大的图片不再逐张尝试。
+        // 修改：4K 以内的配置失败与尺寸无关，原样返回，由调用方停用硬件编码
+        if (codedWidth > 4096 || codedHeight > 4096) {
+            rejectedPixels_ = std::min(rejectedPixels_, pixels);
+            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        }
+        return hr;
+    }
+    hr = PrepareSurfaces(width, height, codedWidth, codedHeight);
+    if (SUCCEEDED(hr)) { hr = Upload(pFactory, pSource, width, height); }
+    if (SUCCEEDED(hr)) { hr = ConvertToNv12(); }
+    std::vector<BYTE> bitstream;
+    if (SUCCEEDED(hr)) { hr = RunEncoder(bitstream); }
+    if (SUCCEEDED(hr)) { hr = WriteHeifFromHevc(bitstream, sequenceHeader_, width, height, pMetadata, pOutputStream); }
+    if (FAILED(hr)) { Shutdown(); } // MFT 状态不确定，下一张图片重新创建
+    return hr;
+}
+
+HRESULT HardwareHevcEncoder::Configure(UINT codedWidth, UINT codedHeight, float quality) {
+    if (transform_ && codedWidth == codedWidth_ && codedHeight == codedHeight_) return S_OK;
+    // 多数硬件编码器不支持在流中途改变分辨率，尺寸变化时重新创建 MFT
+    Shutdown();
+    HRESULT hr = gpu_.EnumerateEncoder(activate_);
+    if (SUCCEEDED(hr)) { hr = activate_->ActivateObject(IID_PPV_ARGS(&transform_)); }
+    ComPtr<IMFAttributes> pAttributes;
+    if (SUCCEEDED(hr)) { hr = transform_->GetAttributes(&pAttributes); }
+    // 硬件 MFT 都是异步的，使用前必须解锁
+    if (SUCCEEDED(hr)) { hr = pAttributes->SetUINT32(MF_TRANSFORM_ASYNC_UNLOCK, TRUE); }
+    if (SUCCEEDED(hr)) { hr = transform_->ProcessMessage(MFT_MESSAGE_SET_D3D_MANAGER, reinterpret_cast<ULONG_PTR>(gpu_.DeviceManager())); }
+
+    // 静态图片：只有一个 I 帧，按质量而不是码率控制。质量模式不可用时退回固定 QP
+    const UINT32 percent = quality < 0.0f ? 90u : static_cast<UINT32>(quality * 100.0f + 0.5f);
+    ComPtr<ICodecAPI> pCodecApi;
+    if (SUCCEEDED(hr) && SUCCEEDED(transform_.As(&pCodecApi))) {
+        VARIANT value;
+        VariantInit(&value);
+        value.vt = VT_UI4;
+        value.ulVal = eAVEncCommonRateControlMode_Quality;
+        bool qualityMode = SUCCEEDED(pCodecApi->SetValue(&CODECAPI_AVEncCommonRateControlMode, &value));
+        value.ulVal = percent;
+        qualityMode = qualityMode && SUCCEEDED(pCodecApi->SetValue(&CODECAPI_AVEncCommonQuality, &value));
+        value.ulVal = 1;
+        pCodecApi->SetValue(&CODECAPI_AVEncMPVGOPSize, &value);
+        value.vt = VT_BOOL;
+        value.boolVal = VARIANT_TRUE;
+        pCodecApi->SetValue(&CODECAPI_AVLowLatencyMode, &value);
+        if (!qualityMode) {
+            value.vt = VT_UI8;
+            value.ullVal = 10 + (100 - std::min(percent, 100u)) * 41 / 100; // 质量 100 -> QP 10，质量 0 -> QP 51
+            pCodecApi->SetValue(&CODECAPI_AVEncVideoEncodeQP, &value);
+        }
+    }
+
+    // 先输出类型后输入类型，这是编码 MFT 要求的顺序
+    if (SUCCEEDED(hr)) {
+        hr = transform_->GetStreamIDs(1, &inputStreamId_, 1, &outputStreamId_);
+        if (hr == E_NOTIMPL) { inputStreamId_ = 0; outputStreamId_ = 0; hr = S_OK; }
+    }
+    ComPtr<IMFMediaType> pOutputType;
+    if (SUCCEEDED(hr)) { hr = MFCreateMediaType(&pOutputType); }
+    if (SUCCEEDED(hr)) { hr = pOutputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video); }
+    if (SUCCEEDED(hr)) { hr = pOutputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_HEVC); }
+    if (SUCCEEDED(hr)) { hr = MFSetAttributeSize(pOutputType.Get(), MF_MT_FRAME_SIZE, codedWidth, codedHeight); }
+    if (SUCCEEDED(hr)) { hr = MFSetAttributeRatio(pOutputType.Get(), MF_MT_FRAME_RATE, 30, 1); }
+    if (SUCCEEDED(hr)) { hr = MFSetAttributeRatio(pOutputType.Get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1); }
+    if (SUCCEEDED(hr)) { hr = pOutputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive); }
+    if (SUCCEEDED(hr)) { hr = pOutputType->SetUINT32(MF_MT_MPEG2_PROFILE, eAVEncH265VProfile_Main_420_8); }
+    if (SUCCEEDED(hr)) { hr = pOutputType->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_0_255); }
+    // 质量模式下码率只是上限提示，部分驱动要求必须设置
+    if (SUCCEEDED(hr)) { hr = pOutputType->SetUINT32(MF_MT_AVG_BITRATE, static_cast<UINT32>(std::min<ULONGLONG>(static_cast<ULONGLONG>(codedWidth) * codedHeight * 30 * 4, 0x7FFFFFFF))); }
+    if (SUCCEEDED(hr)) { hr = transform_->SetOutputType(outputStreamId_, pOutputType.Get(), 0); }
+
+    ComPtr<IMFMediaType> pInputType;
+    if (SUCCEEDED(hr)) { hr = MFCreateMediaType(&pInputType); }
+    if (SUCCEEDED(hr)) { hr = pInputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video); }
+    if (SUCCEEDED(hr)) { hr = pInputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12); }
+    if (SUCCEEDED(hr)) { hr = MFSetAttributeSize(pInputType.Get(), MF_MT_FRAME_SIZE, codedWidth, codedHeight); }
+    if (SUCCEEDED(hr)) { hr = MFSetAttributeRatio(pInputType.Get(), MF_MT_FRAME_RATE, 30, 1); }
+    if (SUCCEEDED(hr)) { hr = MFSetAttributeRatio(pInputType.Get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1); }
+    if (SUCCEEDED(hr)) { hr = pInputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive); }
+    if (SUCCEEDED(hr)) { hr = pInputType->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_0_255); }
+    if (SUCCEEDED(hr)) { hr = transform_->SetInputType(inputStreamId_, pInputType.Get(), 0); }
+
+    ComPtr<IMFMediaType> pCurrentType;
+    if (SUCCEEDED(hr) && SUCCEEDED(transform_->GetOutputCurrentType(outputStreamId_, &pCurrentType))) { UpdateSequenceHeader(pCurrentType.Get()); }
+    if (SUCCEEDED(hr)) { hr = transform_.As(&events_); }
+    if (SUCCEEDED(hr)) { hr = transform_->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0); }
+    if (SUCCEEDED(hr)) { hr = transform_->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0); }
+    if (SUCCEEDED(hr)) {
+        codedWidth_ = codedWidth;
+        codedHeight_ = codedHeight;
+    }
+    return hr;
+}
+
+HRESULT HardwareHevcEncoder::PrepareSurfaces(UINT width, UINT height, UINT codedWidth, UINT codedHeight) {
+    if (processor_ && width == surfaceWidth_ && height == surfaceHeight_) return S_OK;
+    inputView_.Reset();
+    outputView_.Reset();
+    processor_.Reset();
+    processorEnum_.Reset();
+    bgraTexture_.Reset();
+    nv12Texture_.Reset();
+    surfaceWidth_ = surfaceHeight_ = 0;
+
+    ID3D11Device* pDevice = gpu_.Device();
+    HRESULT hr = S_OK;
+    if (!videoContext_) {
+        ComPtr<ID3D11DeviceContext> pContext;
+        pDevice->GetImmediateContext(&pContext);
+        hr = pDevice->QueryInterface(IID_PPV_ARGS(&videoDevice_));
+        if (SUCCEEDED(hr)) { hr = pContext.As(&videoContext_); }
+        if (FAILED(hr)) { videoDevice_.Reset(); videoContext_.Reset(); return hr; }
+    }
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+    hr = pDevice->CreateTexture2D(&desc, NULL, &bgraTexture_);
+    if (SUCCEEDED(hr)) {
+        desc.Width = codedWidth;
+        desc.Height = codedHeight;
+        desc.Format = DXGI_FORMAT_NV12;
+        desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+        hr = pDevice->CreateTexture2D(&desc, NULL, &nv12Texture_);
+    }
+
+    D3D11_VIDEO_PROCESSOR_CONTENT_DESC content = {};
+    content.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+    content.InputFrameRate = { 30, 1 };
+    content.InputWidth = width;
+    content.InputHeight = height;
+    content.OutputFrameRate = { 30, 1 };
+    content.OutputWidth = codedWidth;
+    content.OutputHeight = codedHeight;
+    content.Usage = D3D11_VIDEO_USAGE_PLAYBACK_NORMAL;
+    if (SUCCEEDED(hr)) { hr = videoDevice_->CreateVideoProcessorEnumerator(&content, &processorEnum_); }
+    if (SUCCEEDED(hr)) { hr = videoDevice_->CreateVideoProcessor(processorEnum_.Get(), 0, &processor_); }
+    D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputDesc = {};
+    inputDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+    if (SUCCEEDED(hr)) { hr = videoDevice_->CreateVideoProcessorInputView(bgraTexture_.Get(), processorEnum_.Get(), &inputDesc, &inputView_); }
+    D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputDesc = {};
+    outputDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+    if (SUCCEEDED(hr)) { hr = videoDevice_->CreateVideoProcessorOutputView(nv12Texture_.Get(), processorEnum_.Get(), &outputDesc, &outputView_); }
+    if (FAILED(hr)) {
+        inputView_.Reset();
+        outputView_.Reset();
+        processor_.Reset();
+        return hr;
+    }
+
+    // 全范围 RGB 转为 BT.601 全范围 YCbCr，与 colr 盒中声明的一致
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE inputSpace = {};
+    inputSpace.RGB_Range = 0;
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE outputSpace = {};
+    outputSpace.YCbCr_Matrix = 0;
+    outputSpace.Nominal_Range = D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_0_255;
+    videoContext_->VideoProcessorSetStreamColorSpace(processor_.Get(), 0, &inputSpace);
+    videoContext_->VideoProcessorSetOutputColorSpace(processor_.Get(), &outputSpace);
+    videoContext_->VideoProcessorSetStreamFrameFormat(processor_.Get(), 0, D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+    // 按原尺寸 1:1 写到左上角，补齐部分填黑
+    const RECT rect = { 0, 0, static_cast<LONG>(width), static_cast<LONG>(height) };
+    videoContext_->VideoProcessorSetStreamSourceRect(processor_.Get(), 0, TRUE, &rect);
+    videoContext_->VideoProcessorSetStreamDestRect(processor_.Get(), 0, TRUE, &rect);
+    D3D11_VIDEO_COLOR black = {};
+    black.YCbCr.Y = 0.0f;
+    black.YCbCr.Cb = 0.5f;
+    black.YCbCr.Cr = 0.5f;
+    black.YCbCr.A = 1.0f;
+    videoContext_->VideoProcessorSetOutputBackgroundColor(processor_.Get(), TRUE, &black);
+    surfaceWidth_ = width;
+    surfaceHeight_ = height;
+    return S_OK;
+}
+
+HRESULT HardwareHevcEncoder::Upload(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, UINT width, UINT height) {
+    ComPtr<IWICFormatConverter> pConverter;
+    HRESULT hr = pFactory->CreateFormatConverter(&pConverter);
+    if (SUCCEEDED(hr)) { hr = pConverter->Initialize(pSource, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, NULL, 0.0f, WICBitmapPaletteTypeCustom); }
+    if (FAILED(hr)) return hr;
+
+    // 分带上传：CPU 侧只需要几 MB 的中转缓冲区，整幅 BGRA 图像只存在于显存中
+    const UINT stride = width * 4;
+    const UINT bandRows = std::max(1u, std::min(height, (4u * 1024 * 1024) / stride));
+    uploadBand_.resize(static_cast<size_t>(stride) * bandRows);
+    ComPtr<ID3D11DeviceContext> pContext;
+    gpu_.Device()->GetImmediateContext(&pContext);
+    for (UINT y = 0; y < height && SUCCEEDED(hr); y += bandRows) {
+        const UINT rows = std::min(bandRows, height - y);
+        const WICRect rect = { 0, static_cast<INT>(y), static_cast<INT>(width), static_cast<INT>(rows) };
+        hr = pConverter->CopyPixels(&rect, stride, stride * rows, uploadBand_.data());
+        if (SUCCEEDED(hr)) {
+            const D3D11_BOX box = { 0, y, 0, width, y + rows, 1 };
+            pContext->UpdateSubresource(bgraTexture_.Get(), 0, &box, uploadBand_.data(), stride, 0);
+        }
+    }
+    return hr;
+}
+
+HRESULT HardwareHevcEncoder::ConvertToNv12() {
+    D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+    stream.Enable = TRUE;
+    stream.pInputSurface = inputView_.Get();
+    return videoContext_->VideoProcessorBlt(processor_.Get(), outputView_.Get(), 0, 1, &stream);
+}
+
+HRESULT HardwareHevcEncoder::RunEncoder(std::vector<BYTE>& bitstream) {
+    // NV12 纹理直接包装为输入样本，不经过系统内存
+    ComPtr<IMFMediaBuffer> pBuffer;
+    HRESULT hr = MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), nv12Texture_.Get(), 0, FALSE, &pBuffer);
+    ComPtr<IMF2DBuffer> p2DBuffer;
+    DWORD length = 0;
+    if (SUCCEEDED(hr)) { hr = pBuffer.As(&p2DBuffer); }
+    if (SUCCEEDED(hr)) { hr = p2DBuffer->GetContiguousLength(&length); }
+    if (SUCCEEDED(hr)) { hr = pBuffer->SetCurrentLength(length); }
+    ComPtr<IMFSample> pSample;
+    if (SUCCEEDED(hr)) { hr = MFCreateSample(&pSample); }
+    if (SUCCEEDED(hr)) { hr = pSample->AddBuffer(pBuffer.Get()); }
+    if (SUCCEEDED(hr)) { hr = pSample->SetSampleTime(0); }
+    if (SUCCEEDED(hr)) { hr = pSample->SetSampleDuration(10000000 / 30); }
+
+    // 异步 MFT：在它请求输入时送入唯一的一帧并随即要求排空，收集输出直到排空完成
+    bool inputSent = false;
+    while (SUCCEEDED(hr)) {
+        ComPtr<IMFMediaEvent> pEvent;
+        MediaEventType type = MEUnknown;
+        HRESULT status = S_OK;
+        hr = events_->GetEvent(0, &pEvent);
+        if (SUCCEEDED(hr)) { hr = pEvent->GetType(&type); }
+        if (SUCCEEDED(hr)) { hr = pEvent->GetStatus(&status); }
+        if (SUCCEEDED(hr)) { hr = status; }
+        if (FAILED(hr)) break;
+
+        if (type == METransformNeedInput && !inputSent) {
+            hr = transform_->ProcessInput(inputStreamId_, pSample.Get(), 0);
+            // 上一张图片排空后残留的输入请求可能已过期，等待下一个请求
+            if (hr == MF_E_NOTACCEPTING) { hr = S_OK; continue; }
+            if (SUCCEEDED(hr)) { hr = transform_->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0); }
+            inputSent = true;
+        }
+        else if (type == METransformHaveOutput) { hr = PullOutput(bitstream); }
+        else if (type == METransformDrainComplete && inputSent) { break; }
+    }
+    if (SUCCEEDED(hr) && bitstream.empty()) { hr = E_UNEXPECTED; }
+    return hr;
+}
+
+HRESULT HardwareHevcEncoder::PullOutput(std::vector<BYTE>& bitstream) {
+    MFT_OUTPUT_STREAM_INFO info = {};
+    HRESULT hr = transform_->GetOutputStreamInfo(outputStreamId_, &info);
+    if (FAILED(hr)) return hr;
+
+    MFT_OUTPUT_DATA_BUFFER output = {};
+    output.dwStreamID = outputStreamId_;
+    ComPtr<IMFSample> pSample;
+    const bool providesSamples = (info.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES | MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+    if (!providesSamples) {
+        ComPtr<IMFMediaBuffer> pBuffer;
+        const DWORD capacity = std::max<DWORD>(info.cbSize, static_cast<DWORD>(std::min<ULONGLONG>(static_cast<ULONGLONG>(codedWidth_) * codedHeight_ * 3 / 2, 0x7FFFFFFF)));
+        hr = MFCreateMemoryBuffer(capacity, &pBuffer);
+        if (SUCCEEDED(hr)) { hr = MFCreateSample(&pSample); }
+        if (SUCCEEDED(hr)) { hr = pSample->AddBuffer(pBuffer.Get()); }
+        if (FAILED(hr)) return hr;
+        output.pSample = pSample.Get();
+    }
+    DWORD status = 0;
+    hr = transform_->ProcessOutput(0, 1, &output, &status);
+    if (output.pEvents) { output.pEvents->Release(); }
+    if (providesSamples && output.pSample) { pSample.Attach(output.pSample); } // MFT 分配的样本由我们释放
+
+    if (hr == MF_E_TRANSFORM_STREAM_CHANGE) {
+        // 编码器重新协商了输出类型，接受它的首选类型后继续等待输出
+        ComPtr<IMFMediaType> pType;
+        hr = transform_->GetOutputAvailableType(outputStreamId_, 0, &pType);
+        if (SUCCEEDED(hr)) { hr = transform_->SetOutputType(outputStreamId_, pType.Get(), 0); }
+        if (SUCCEEDED(hr)) { UpdateSequenceHeader(pType.Get()); }
+        return hr;
+    }
+    if (FAILED(hr)) return hr;
+    if (!pSample) return E_UNEXPECTED;
+
+    ComPtr<IMFMediaBuffer> pContiguous;
+    hr = pSample->ConvertToContiguousBuffer(&pContiguous);
+    BYTE* pData = nullptr;
+    DWORD length = 0;
+    if (SUCCEEDED(hr)) { hr = pContiguous->Lock(&pData, NULL, &length); }
+    if (SUCCEEDED(hr)) {
+        bitstream.insert(bitstream.end(), pData, pData + length);
+        pContiguous->Unlock();
+    }
+    return hr;
+}
+
+void HardwareHevcEncoder::UpdateSequenceHeader(IMFMediaType* pOutputType) {
+    UINT32 size = 0;
+    if (FAILED(pOutputType->GetBlobSize(MF_MT_MPEG_SEQUENCE_HEADER, &size)) || size == 0) return;
+    std::vector<BYTE> header(size);
+    if (SUCCEEDED(pOutputType->GetBlob(MF_MT_MPEG_SEQUENCE_HEADER, header.data(), size, NULL))) { sequenceHeader_.swap(header); }
+}
+
+void HardwareHevcEncoder::Shutdown() {
+    if (transform_) {
+        transform_->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0);
+        transform_->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+    }
+    events_.Reset();
+    transform_.Reset();
+    if (activate_) { activate_->ShutdownObject(); activate_.Reset(); }
+    codedWidth_ = codedHeight_ = 0;
+    sequenceHeader_.clear();
+}
+
+// === 新增：HardwareEncoderPool 实现 ===
+std::unique_ptr<HardwareHevcEncoder> HardwareEncoderPool::TryAcquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_.empty()) {
+        std::unique_ptr<HardwareHevcEncoder> encoder = std::move(idle_.back());
+        idle_.pop_back();
+        return encoder;
+    }
+    if (created_ >= capacity_) return nullptr;
+    ++created_;
+    return std::unique_ptr<HardwareHevcEncoder>(new HardwareHevcEncoder(gpu_));
+}
+
+void HardwareEncoderPool::Release(std::unique_ptr<HardwareHevcEncoder> encoder) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(std::move(encoder));
+}
+
+void HardwareEncoderPool::Discard(std::unique_ptr<HardwareHevcEncoder> encoder) {
+    encoder.reset();
+    std::lock_guard<std::mutex> lock(mutex_);
+    --created_;
+}
+
+void HardwareEncoderPool::Clear() {
+    std::vector<std::unique_ptr<HardwareHevcEncoder>> idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle.swap(idle_);
+        created_ -= static_cast<unsigned>(idle.size());
+    }
+}
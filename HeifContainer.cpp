@@ -0,0 +1,779 @@
+// HEVC 码流解析与 HEIF 盒的读写
+#include "ConverterInternal.h"
+
+// --- HEVC 码流解析与 HEIF 封装 ---
+
+// Annex B 格式 (00 00 01 起始码) 拆分为 NAL 单元，不含起始码和末尾的填充零
+std::vector<HevcNalUnit> SplitAnnexB(const std::vector<BYTE>& stream) {
+    std::vector<HevcNalUnit> units;
+    const BYTE* p = stream.data();
+    const size_t n = stream.size();
+    size_t begin = 0;
+    bool inUnit = false;
+    auto flush = [&](size_t end) {
+        while (end > begin && p[end - 1] == 0) --end;
+        if (end - begin >= 2) { units.push_back({ p + begin, end - begin, (p[begin] >> 1) & 0x3Fu }); }
+    };
+    for (size_t i = 0; i + 2 < n;) {
+        if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1) {
+            if (inUnit) flush(i);
+            i += 3;
+            begin = i;
+            inUnit = true;
+        }
+        else { ++i; }
+    }
+    if (inUnit) flush(n);
+    return units;
+}
+
+// 去掉防竞争字节 (00 00 03 中的 03)
+std::vector<BYTE> NalToRbsp(const HevcNalUnit& nal) {
+    std::vector<BYTE> rbsp;
+    rbsp.reserve(nal.size);
+    size_t zeros = 0;
+    for (size_t i = 0; i < nal.size; ++i) {
+        if (zeros >= 2 && nal.data[i] == 3) { zeros = 0; continue; }
+        zeros = nal.data[i] == 0 ? zeros + 1 : 0;
+        rbsp.push_back(nal.data[i]);
+    }
+    return rbsp;
+}
+
+class RbspReader {
+public:
+    RbspReader(const std::vector<BYTE>& data, size_t bitOffset) : data_(data), pos_(bitOffset) {}
+
+    UINT32 Bits(UINT count) {
+        UINT32 value = 0;
+        while (count--) { value = (value << 1) | Bit(); }
+        return value;
+    }
+    UINT32 Ue() {
+        UINT zeros = 0;
+        while (!overrun_ && !Bit()) { if (++zeros == 32) { overrun_ = true; return 0; } }
+        return ((1u << zeros) - 1) + Bits(zeros);
+    }
+    void Skip(size_t count) { pos_ += count; }
+    bool Ok() const { return !overrun_ && pos_ <= data_.size() * 8; }
+
+private:
+    UINT32 Bit() {
+        if (pos_ >= data_.size() * 8) { overrun_ = true; return 0; }
+        const UINT32 bit = (data_[pos_ / 8] >> (7 - pos_ % 8)) & 1u;
+        ++pos_;
+        return bit;
+    }
+
+    const std::vector<BYTE>& data_;
+    size_t pos_;
+    bool overrun_ = false;
+};
+
+bool ParseHevcSps(const HevcNalUnit& sps, HevcSpsInfo& info) {
+    const std::vector<BYTE> rbsp = NalToRbsp(sps);
+    if (rbsp.size() < 15) return false;
+    RbspReader reader(rbsp, 16); // 跳过 2 字节 NAL 头
+    reader.Skip(4);              // sps_video_parameter_set_id
+    const UINT maxSubLayersMinus1 = reader.Bits(3);
+    info.temporalIdNested = reader.Bits(1) != 0;
+    info.maxSubLayers = maxSubLayersMinus1 + 1;
+    std::copy(rbsp.begin() + 3, rbsp.begin() + 15, info.generalProfile);
+    reader.Skip(96);
+    bool profilePresent[8] = {}, levelPresent[8] = {};
+    for (UINT i = 0; i < maxSubLayersMinus1; ++i) {
+        profilePresent[i] = reader.Bits(1) != 0;
+        levelPresent[i] = reader.Bits(1) != 0;
+    }
+    if (maxSubLayersMinus1 > 0) { reader.Skip(2 * (8 - maxSubLayersMinus1)); }
+    for (UINT i = 0; i < maxSubLayersMinus1; ++i) {
+        if (profilePresent[i]) reader.Skip(88);
+        if (levelPresent[i]) reader.Skip(8);
+    }
+    reader.Ue(); // sps_seq_parameter_set_id
+    info.chromaFormat = reader.Ue();
+    if (info.chromaFormat > 3) return false;
+    if (info.chromaFormat == 3) { reader.Skip(1); } // separate_colour_plane_flag
+    ULONGLONG width = reader.Ue();
+    ULONGLONG height = reader.Ue();
+    if (reader.Bits(1)) { // conformance_window_flag
+        const UINT subWidth = (info.chromaFormat == 1 || info.chromaFormat == 2) ? 2 : 1;
+        const UINT subHeight = info.chromaFormat == 1 ? 2 : 1;
+        const ULONGLONG left = reader.Ue(), right = reader.Ue(), top = reader.Ue(), bottom = reader.Ue();
+        if (subWidth * (left + right) >= width || subHeight * (top + bottom) >= height) return false;
+        width -= subWidth * (left + right);
+        height -= subHeight * (top + bottom);
+    }
+    info.bitDepthLumaMinus8 = reader.Ue();
+    info.bitDepthChromaMinus8 = reader.Ue();
+    info.width = static_cast<UINT>(width);
+    info.height = static_cast<UINT>(height);
+    return reader.Ok() && width > 0 && height > 0 && info.bitDepthLumaMinus8 <= 8 && info.bitDepthChromaMinus8 <= 8;
+}
+
+// ISOBMFF 盒子写入：Begin 预留长度字段，End 时回填
+class BoxWriter {
+public:
+    explicit BoxWriter(std::vector<BYTE>& out) : out_(out) {}
+
+    size_t Begin(const char* type) {
+        const size_t start = out_.size();
+        U32(0);
+        Bytes(type, 4);
+        return start;
+    }
+    size_t BeginFull(const char* type, BYTE version, UINT32 flags) {
+        const size_t start = Begin(type);
+        U32((static_cast<UINT32>(version) << 24) | flags);
+        return start;
+    }
+    void End(size_t start) { Patch32(start, static_cast<UINT32>(out_.size() - start)); }
+    void U8(UINT32 value) { out_.push_back(static_cast<BYTE>(value)); }
+    void U16(UINT32 value) { U8(value >> 8); U8(value); }
+    void U32(UINT32 value) { U16(value >> 16); U16(value); }
+    void Bytes(const void* data, size_t size) { const BYTE* p = static_cast<const BYTE*>(data); out_.insert(out_.end(), p, p + size); }
+    void Patch32(size_t position, UINT32 value) {
+        for (int i = 0; i < 4; ++i) { out_[position + i] = static_cast<BYTE>(value >> (24 - 8 * i)); }
+    }
+    size_t Position() const { return out_.size(); }
+
+private:
+    std::vector<BYTE>& out_;
+};
+
+static void WriteHvcC(BoxWriter& box, const HevcSpsInfo& sps, const HevcNalUnit* const parameterSets[3]) {
+    const size_t hvcC = box.Begin("hvcC");
+    box.U8(1); // configurationVersion
+    box.Bytes(sps.generalProfile, sizeof(sps.generalProfile));
+    box.U16(0xF000); // min_spatial_segmentation_idc = 0
+    box.U8(0xFC);    // parallelismType = 0
+    box.U8(0xFC | sps.chromaFormat);
+    box.U8(0xF8 | sps.bitDepthLumaMinus8);
+    box.U8(0xF8 | sps.bitDepthChromaMinus8);
+    box.U16(0);      // avgFrameRate
+    box.U8((sps.maxSubLayers << 3) | (sps.temporalIdNested ? 0x04 : 0x00) | 0x03); // lengthSizeMinusOne = 3
+    box.U8(3);
+    for (int i = 0; i < 3; ++i) {
+        box.U8(0x80 | parameterSets[i]->type); // array_completeness = 1
+        box.U16(1);
+        box.U16(static_cast<UINT32>(parameterSets[i]->size));
+        box.Bytes(parameterSets[i]->data, parameterSets[i]->size);
+    }
+    box.End(hvcC);
+}
+
+// 新增：把单帧 HEVC 码流封装为一个 hvc1 图像项的 HEIF 文件，Exif/XMP 作为描述它的元数据项
+HRESULT WriteHeifFromHevc(const std::vector<BYTE>& bitstream, const std::vector<BYTE>& sequenceHeader, UINT width, UINT height, const FrameMetadata* pMetadata, IStream* pOutputStream) {
+    const std::vector<HevcNalUnit> units = SplitAnnexB(bitstream);
+    const std::vector<HevcNalUnit> headerUnits = SplitAnnexB(sequenceHeader);
+    const HevcNalUnit* parameterSets[3] = {}; // VPS, SPS, PPS；码流中没有时取输出类型中的序列头
+    std::vector<const HevcNalUnit*> slices;
+    for (const auto& unit : units) {
+        if (unit.type >= kHevcNalVps && unit.type <= kHevcNalPps) { if (!parameterSets[unit.type - kHevcNalVps]) parameterSets[unit.type - kHevcNalVps] = &unit; }
+        else if (unit.type < kHevcNalVps) { slices.push_back(&unit); }
+    }
+    for (const auto& unit : headerUnits) {
+        if (unit.type >= kHevcNalVps && unit.type <= kHevcNalPps && !parameterSets[unit.type - kHevcNalVps]) parameterSets[unit.type - kHevcNalVps] = &unit;
+    }
+    HevcSpsInfo sps;
+    if (!parameterSets[0] || !parameterSets[1] || !parameterSets[2] || slices.empty()) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    if (!ParseHevcSps(*parameterSets[kHevcNalSps - kHevcNalVps], sps) || sps.width < width || sps.height < height) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    // ICC 写为 prof 类型的 colr；Exif 项以 4 字节的 TIFF 头偏移开头
+    std::vector<BYTE> icc;
+    struct MetadataItem {
+        char type[4];
+        const char* contentType;
+        std::vector<BYTE> data;
+    };
+    std::vector<MetadataItem> metadataItems;
+    if (pMetadata) {
+        for (const auto& pContext : pMetadata->colorContexts) {
+            WICColorContextType type = WICColorContextUninitialized;
+            UINT bytes = 0;
+            if (SUCCEEDED(pContext->GetType(&type)) && type == WICColorContextProfile && SUCCEEDED(pContext->GetProfileBytes(0, NULL, &bytes)) && bytes > 0) {
+                icc.resize(bytes);
+                if (SUCCEEDED(pContext->GetProfileBytes(bytes, icc.data(), &bytes))) { icc.resize(bytes); break; }
+                icc.clear();
+            }
+        }
+        if (!pMetadata->exif.empty()) {
+            MetadataItem item = { { 'E', 'x', 'i', 'f' }, nullptr, std::vector<BYTE>(4, 0) };
+            item.data.insert(item.data.end(), pMetadata->exif.begin(), pMetadata->exif.end());
+            metadataItems.push_back(std::move(item));
+        }
+        if (!pMetadata->xmp.empty()) { metadataItems.push_back(MetadataItem{ { 'm', 'i', 'm', 'e' }, "application/rdf+xml", pMetadata->xmp }); }
+    }
+
+    size_t payloadSize = 0;
+    for (const auto* slice : slices) { payloadSize += 4 + slice->size; }
+    for (const auto& item : metadataItems) { payloadSize += item.data.size(); }
+    if (payloadSize + icc.size() > 0xFFFFFF00u) return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    std::vector<BYTE> file;
+    file.reserve(payloadSize + 1024);
+    BoxWriter box(file);
+
+    const size_t ftyp = box.Begin("ftyp");
+    box.Bytes("heic", 4);
+    box.U32(0);
+    box.Bytes("mif1", 4);
+    box.Bytes("heic", 4);
+    box.End(ftyp);
+
+    const size_t meta = box.BeginFull("meta", 0, 0);
+    const size_t hdlr = box.BeginFull("hdlr", 0, 0);
+    box.U32(0);
+    box.Bytes("pict", 4);
+    box.U32(0); box.U32(0); box.U32(0);
+    box.U8(0); // 空名称
+    box.End(hdlr);
+    const size_t pitm = box.BeginFull("pitm", 0, 0);
+    box.U16(1);
+    box.End(pitm);
+    // iloc：每项一个数据段，偏移与长度各 4 字节，写完 mdat 后回填。图像为项 1，元数据项从 2 开始
+    const UINT itemCount = static_cast<UINT>(1 + metadataItems.size());
+    const size_t iloc = box.BeginFull("iloc", 0, 0);
+    box.U8(0x44); // offset_size = 4, length_size = 4
+    box.U8(0x00); // base_offset_size = 0
+    box.U16(itemCount);
+    std::vector<size_t> extentPositions;
+    for (UINT id = 1; id <= itemCount; ++id) {
+        box.U16(id);  // item_ID
+        box.U16(0);   // data_reference_index
+        box.U16(1);   // extent_count
+        extentPositions.push_back(box.Position());
+        box.U32(0);
+        box.U32(0);
+    }
+    box.End(iloc);
+    const size_t iinf = box.BeginFull("iinf", 0, 0);
+    box.U16(itemCount);
+    const size_t infe = box.BeginFull("infe", 2, 0);
+    box.U16(1); // item_ID
+    box.U16(0); // item_protection_index
+    box.Bytes("hvc1", 4);
+    box.U8(0);
+    box.End(infe);
+    for (size_t i = 0; i < metadataItems.size(); ++i) {
+        const size_t metadataInfe = box.BeginFull("infe", 2, 0);
+        box.U16(static_cast<UINT32>(2 + i));
+        box.U16(0);
+        box.Bytes(metadataItems[i].type, 4);
+        box.U8(0);
+        if (metadataItems[i].contentType) { box.Bytes(metadataItems[i].contentType, strlen(metadataItems[i].contentType) + 1); }
+        box.End(metadataInfe);
+    }
+    box.End(iinf);
+    if (!metadataItems.empty()) {
+        const size_t iref = box.BeginFull("iref", 0, 0);
+        for (size_t i = 0; i < metadataItems.size(); ++i) {
+            const size_t cdsc = box.Begin("cdsc");
+            box.U16(static_cast<UINT32>(2 + i));
+            box.U16(1);
+            box.U16(1);
+            box.End(cdsc);
+        }
+        box.End(iref);
+    }
+
+    const bool cropped = sps.width != width || sps.height != height;
+    const size_t iprp = box.Begin("iprp");
+    const size_t ipco = box.Begin("ipco");
+    WriteHvcC(box, sps, parameterSets); // 属性 1
+    const size_t ispe = box.BeginFull("ispe", 0, 0); // 属性 2：解码输出尺寸
+    box.U32(sps.width);
+    box.U32(sps.height);
+    box.End(ispe);
+    const size_t colr = box.Begin("colr"); // 属性 3：sRGB 原色与传输特性，BT.601 矩阵，全范围
+    box.Bytes("nclx", 4);
+    box.U16(1);
+    box.U16(13);
+    box.U16(6);
+    box.U8(0x80);
+    box.End(colr);
+    UINT nextProperty = 4;
+    UINT profProperty = 0, clapProperty = 0;
+    if (!icc.empty()) {
+        // 源文件的 ICC 配置，与 nclx (给出矩阵系数) 并存
+        const size_t prof = box.Begin("colr");
+        box.Bytes("prof", 4);
+        box.Bytes(icc.data(), icc.size());
+        box.End(prof);
+        profProperty = nextProperty++;
+    }
+    if (cropped) {
+        // 裁掉补齐的行/列，裁剪区域左上对齐
+        clapProperty = nextProperty++;
+        const size_t clap = box.Begin("clap");
+        box.U32(width); box.U32(1);
+        box.U32(height); box.U32(1);
+        box.U32(static_cast<UINT32>(static_cast<INT32>(width) - static_cast<INT32>(sps.width))); box.U32(2);
+        box.U32(static_cast<UINT32>(static_cast<INT32>(height) - static_cast<INT32>(sps.height))); box.U32(2);
+        box.End(clap);
+    }
+    box.End(ipco);
+    const size_t ipma = box.BeginFull("ipma", 0, 0);
+    box.U32(1); // entry_count
+    box.U16(1); // item_ID
+    box.U8(nextProperty - 1);
+    box.U8(0x80 | 1); // hvcC 为必需属性
+    box.U8(2);
+    box.U8(3);
+    if (profProperty) { box.U8(profProperty); }
+    if (clapProperty) { box.U8(0x80 | clapProperty); }
+    box.End(ipma);
+    box.End(iprp);
+    box.End(meta);
+
+    // mdat：4 字节长度前缀的 VCL NAL 单元
+    const size_t mdat = box.Begin("mdat");
+    const size_t dataStart = box.Position();
+    for (const auto* slice : slices) {
+        box.U32(static_cast<UINT32>(slice->size));
+        box.Bytes(slice->data, slice->size);
+    }
+    box.Patch32(extentPositions[0], static_cast<UINT32>(dataStart));
+    box.Patch32(extentPositions[0] + 4, static_cast<UINT32>(box.Position() - dataStart));
+    for (size_t i = 0; i < metadataItems.size(); ++i) {
+        box.Patch32(extentPositions[1 + i], static_cast<UINT32>(box.Position()));
+        box.Patch32(extentPositions[1 + i] + 4, static_cast<UINT32>(metadataItems[i].data.size()));
+        box.Bytes(metadataItems[i].data.data(), metadataItems[i].data.size());
+    }
+    box.End(mdat);
+
+    ULONG written = 0;
+    HRESULT hr = pOutputStream->Write(file.data(), static_cast<ULONG>(file.size()), &written);
+    if (SUCCEEDED(hr) && written != file.size()) { hr = STG_E_MEDIUMFULL; }
+    return hr;
+}
+
+// === 新增：大图的 HEIF 网格编码 ===
+// 按条带 CopyPixels 读取像素，切成等大的图块，每块用 WIC 单独编码为一个 HEIF，再取出其中的 hvc1 图像项，
+// 与一个 grid 派生图像项一起封装为一个文件。图块经共享队列分给所有编码线程
+
+static UINT32 ReadBe(const BYTE* p, size_t bytes) {
+    UINT32 value = 0;
+    for (size_t i = 0; i < bytes; ++i) { value = (value << 8) | p[i]; }
+    return value;
+}
+
+// 只读的盒子遍历：每次取出 [begin, end) 中的下一个盒子
+struct BoxCursor {
+    const BYTE* p;
+    size_t end;
+
+    bool Next(const BYTE*& box, size_t& boxSize, const BYTE*& body, size_t& bodySize, char type[4]) {
+        if (end < 8) return false;
+        size_t size = ReadBe(p, 4);
+        size_t header = 8;
+        if (size == 1) {
+            if (end < 16 || ReadBe(p + 8, 4) != 0) return false; // 超过 4GB 的盒子不会出现在单个图块中
+            size = ReadBe(p + 12, 4);
+            header = 16;
+        }
+        else if (size == 0) { size = end; }
+        if (size < header || size > end) return false;
+        memcpy(type, p + 4, 4);
+        box = p;
+        boxSize = size;
+        body = p + header;
+        bodySize = size - header;
+        p += size;
+        end -= size;
+        return true;
+    }
+};
+
+// 有界的大端读取，越界后所有读取返回 0 并记为失败
+class ByteReader {
+public:
+    ByteReader(const BYTE* p, size_t size) : p_(p), size_(size) {}
+
+    UINT32 Read(size_t bytes) {
+        if (bytes == 8) {
+            if (Read(4) != 0) { ok_ = false; } // 单个图块的文件不会有超过 4GB 的偏移
+            return Read(4);
+        }
+        if (!ok_ || bytes > 4 || bytes > size_ - pos_) { ok_ = false; return 0; }
+        const UINT32 value = ReadBe(p_ + pos_, bytes);
+        pos_ += bytes;
+        return value;
+    }
+    std::string String() {
+        std::string text;
+        while (ok_ && pos_ < size_ && p_[pos_] != 0) { text.push_back(static_cast<char>(p_[pos_++])); }
+        if (pos_ < size_) { ++pos_; } else { ok_ = false; }
+        return text;
+    }
+    bool Ok() const { return ok_; }
+
+private:
+    const BYTE* p_;
+    size_t size_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+HRESULT ExtractHeifImage(const BYTE* file, size_t size, HeifCodedImage& image) {
+    const HRESULT invalid = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    struct Extent { UINT32 offset; UINT32 length; };
+    struct Location { UINT32 method = 0; UINT32 base = 0; std::vector<Extent> extents; };
+    struct Info { char type[4]; std::string contentType; };
+    std::unordered_map<UINT32, Location> locations;
+    std::unordered_map<UINT32, Info> infos;
+    std::unordered_map<UINT32, std::vector<std::pair<UINT32, bool>>> associations;
+    std::vector<std::pair<UINT32, UINT32>> descriptions; // cdsc：(描述项, 被描述项)
+    std::vector<std::pair<const BYTE*, size_t>> properties;
+    const BYTE* idat = nullptr;
+    size_t idatSize = 0;
+    UINT32 primary = 0;
+    bool haveMeta = false;
+
+    BoxCursor top = { file, size };
+    const BYTE *box, *body;
+    size_t boxSize, bodySize;
+    char type[4];
+    while (!haveMeta && top.Next(box, boxSize, body, bodySize, type)) {
+        if (memcmp(type, "meta", 4) != 0 || bodySize < 4) continue;
+        haveMeta = true;
+        BoxCursor meta = { body + 4, bodySize - 4 };
+        while (meta.Next(box, boxSize, body, bodySize, type)) {
+            // idat 与 iprp 是普通盒子，其余是 FullBox
+            if (memcmp(type, "idat", 4) == 0) { idat = body; idatSize = bodySize; continue; }
+            if (memcmp(type, "iprp", 4) == 0) {
+                BoxCursor iprp = { body, bodySize };
+                const BYTE *child, *childBody;
+                size_t childSize, childBodySize;
+                char childType[4];
+                while (iprp.Next(child, childSize, childBody, childBodySize, childType)) {
+                    if (memcmp(childType, "ipco", 4) == 0) {
+                        BoxCursor ipco = { childBody, childBodySize };
+                        const BYTE *property, *propertyBody;
+                        size_t propertySize, propertyBodySize;
+                        char propertyType[4];
+                        while (ipco.Next(property, propertySize, propertyBody, propertyBodySize, propertyType)) { properties.emplace_back(property, propertySize); }
+                    }
+                    else if (memcmp(childType, "ipma", 4) == 0 && childBodySize >= 4) {
+                        const BYTE version = childBody[0];
+                        const bool wideIndex = (ReadBe(childBody + 1, 3) & 1) != 0;
+                        const UINT32 essentialBit = wideIndex ? 0x8000u : 0x80u;
+                        ByteReader reader(childBody + 4, childBodySize - 4);
+                        const UINT32 count = reader.Read(4);
+                        for (UINT32 i = 0; i < count && reader.Ok(); ++i) {
+                            auto& list = associations[reader.Read(version < 1 ? 2 : 4)];
+                            const UINT32 associationCount = reader.Read(1);
+                            for (UINT32 a = 0; a < associationCount && reader.Ok(); ++a) {
+                                const UINT32 value = reader.Read(wideIndex ? 2 : 1);
+                                list.emplace_back(value & (essentialBit - 1), (value & essentialBit) != 0);
+                            }
+                        }
+                        if (!reader.Ok()) return invalid;
+                    }
+                }
+                continue;
+            }
+            if (bodySize < 4) continue;
+            const BYTE version = body[0];
+            ByteReader reader(body + 4, bodySize - 4);
+            if (memcmp(type, "pitm", 4) == 0) { primary = reader.Read(version == 0 ? 2 : 4); }
+            else if (memcmp(type, "iloc", 4) == 0) {
+                const UINT32 sizes = reader.Read(1);
+                const UINT32 moreSizes = reader.Read(1);
+                const size_t offsetSize = sizes >> 4, lengthSize = sizes & 0x0F, baseSize = moreSizes >> 4;
+                const size_t indexSize = (version == 1 || version == 2) ? (moreSizes & 0x0F) : 0;
+                const UINT32 count = reader.Read(version < 2 ? 2 : 4);
+                for (UINT32 i = 0; i < count && reader.Ok(); ++i) {
+                    const UINT32 id = reader.Read(version < 2 ? 2 : 4);
+                    Location location;
+                    if (version == 1 || version == 2) { location.method = reader.Read(2) & 0x0F; }
+                    reader.Read(2); // data_reference_index
+                    location.base = reader.Read(baseSize);
+                    const UINT32 extentCount = reader.Read(2);
+                    for (UINT32 e = 0; e < extentCount && reader.Ok(); ++e) {
+                        reader.Read(indexSize);
+                        Extent extent;
+                        extent.offset = reader.Read(offsetSize);
+                        extent.length = reader.Read(lengthSize);
+                        location.extents.push_back(extent);
+                    }
+                    locations[id] = std::move(location);
+                }
+                if (!reader.Ok()) return invalid;
+            }
+            else if (memcmp(type, "iinf", 4) == 0) {
+                const size_t countSize = version == 0 ? 2 : 4;
+                if (bodySize < 4 + countSize) return invalid;
+                BoxCursor entries = { body + 4 + countSize, bodySize - 4 - countSize };
+                const BYTE *entry, *entryBody;
+                size_t entrySize, entryBodySize;
+                char entryType[4];
+                while (entries.Next(entry, entrySize, entryBody, entryBodySize, entryType)) {
+                    if (memcmp(entryType, "infe", 4) != 0 || entryBodySize < 4 || entryBody[0] < 2) continue;
+                    ByteReader infe(entryBody + 4, entryBodySize - 4);
+                    const UINT32 id = infe.Read(entryBody[0] == 2 ? 2 : 4);
+                    infe.Read(2); // item_protection_index
+                    Info info;
+                    const UINT32 itemType = infe.Read(4);
+                    for (int b = 0; b < 4; ++b) { info.type[b] = static_cast<char>(itemType >> (24 - 8 * b)); }
+                    infe.String(); // item_name
+                    if (memcmp(info.type, "mime", 4) == 0) { info.contentType = infe.String(); }
+                    if (infe.Ok()) { infos[id] = info; }
+                }
+            }
+            else if (memcmp(type, "iref", 4) == 0) {
+                BoxCursor refs = { body + 4, bodySize - 4 };
+                const BYTE *ref, *refBody;
+                size_t refSize, refBodySize;
+                char refType[4];
+                while (refs.Next(ref, refSize, refBody, refBodySize, refType)) {
+                    if (memcmp(refType, "cdsc", 4) != 0) continue;
+                    ByteReader refReader(refBody, refBodySize);
+                    const UINT32 from = refReader.Read(version == 0 ? 2 : 4);
+                    const UINT32 count = refReader.Read(2);
+                    for (UINT32 i = 0; i < count && refReader.Ok(); ++i) { descriptions.emplace_back(from, refReader.Read(version == 0 ? 2 : 4)); }
+                }
+            }
+        }
+    }
+    if (!haveMeta) return invalid;
+
+    auto itemData = [&](UINT32 id, std::vector<BYTE>& data) -> bool {
+        auto it = locations.find(id);
+        if (it == locations.end() || it->second.method > 1) return false;
+        const BYTE* source = it->second.method == 0 ? file : idat;
+        const size_t sourceSize = it->second.method == 0 ? size : idatSize;
+        if (!source) return false;
+        data.clear();
+        for (const auto& extent : it->second.extents) {
+            const size_t offset = static_cast<size_t>(it->second.base) + extent.offset;
+            if (offset > sourceSize) return false;
+            const size_t length = extent.length ? extent.length : sourceSize - offset; // 长度为 0 表示到文件末尾
+            if (length > sourceSize - offset) return false;
+            data.insert(data.end(), source + offset, source + offset + length);
+        }
+        return !data.empty();
+    };
+
+    auto primaryInfo = infos.find(primary);
+    if (primaryInfo == infos.end() || !itemData(primary, image.data)) return invalid;
+    memcpy(image.type, primaryInfo->second.type, 4);
+    image.properties.clear();
+    for (const auto& association : associations[primary]) {
+        if (association.first == 0 || association.first > properties.size()) continue;
+        const auto& property = properties[association.first - 1];
+        image.properties.push_back({ std::vector<BYTE>(property.first, property.first + property.second), association.second });
+    }
+    image.metadata.clear();
+    for (const auto& description : descriptions) {
+        if (description.second != primary) continue;
+        auto info = infos.find(description.first);
+        if (info == infos.end()) continue;
+        HeifCodedImage::MetadataItem item;
+        memcpy(item.type, info->second.type, 4);
+        item.contentType = info->second.contentType;
+        if (itemData(description.first, item.data)) { image.metadata.push_back(std::move(item)); }
+    }
+    return S_OK;
+}
+
+bool NeedsGridEncoding(UINT width, UINT height) {
+    return static_cast<ULONGLONG>(width) * height > kHevcMaxLumaPicture || width > kHevcMaxPictureEdge || height > kHevcMaxPictureEdge;
+}
+
+static bool IsBoxType(const std::vector<BYTE>& box, const char* type) { return box.size() >= 8 && memcmp(box.data() + 4, type, 4) == 0; }
+// 旋转、镜像与裁剪作用于整幅图像，放在 grid 项上而不是图块上
+static bool IsTransformProperty(const std::vector<BYTE>& box) { return IsBoxType(box, "irot") || IsBoxType(box, "imir") || IsBoxType(box, "clap"); }
+
+HRESULT WriteHeifGrid(UINT width, UINT height, UINT columns, UINT rows, const std::vector<const HeifCodedImage*>& tiles, const HeifCodedImage* thumbnail, IStream* pOutputStream) {
+    if (tiles.empty() || tiles.size() != static_cast<size_t>(columns) * rows || columns > 256 || rows > 256) return E_INVALIDARG;
+    const HeifCodedImage& first = *tiles[0];
+
+    // 属性按内容去重，各图块通常共用同一组 hvcC/ispe
+    std::vector<const std::vector<BYTE>*> ipco;
+    auto association = [&ipco](const HeifCodedImage::Property& property) -> UINT16 {
+        size_t index = 0;
+        while (index < ipco.size() && *ipco[index] != property.box) ++index;
+        if (index == ipco.size()) { ipco.push_back(&property.box); }
+        return static_cast<UINT16>((index + 1) | (property.essential ? 0x8000u : 0u));
+    };
+    struct Item {
+        UINT16 id;
+        char type[4];
+        const std::string* contentType;
+        bool hidden;
+        const std::vector<BYTE>* data;
+        std::vector<UINT16> properties;
+    };
+    std::vector<Item> items;
+
+    // grid 描述：version 0；输出尺寸超过 16 位时 flags = 1 使用 32 位字段
+    const bool wide = width > 0xFFFF || height > 0xFFFF;
+    std::vector<BYTE> gridData;
+    BoxWriter grid(gridData);
+    grid.U8(0);
+    grid.U8(wide ? 1 : 0);
+    grid.U8(rows - 1);
+    grid.U8(columns - 1);
+    if (wide) { grid.U32(width); grid.U32(height); }
+    else { grid.U16(width); grid.U16(height); }
+    HeifCodedImage::Property gridSize = { std::vector<BYTE>(), false };
+    BoxWriter ispeWriter(gridSize.box);
+    const size_t ispe = ispeWriter.BeginFull("ispe", 0, 0);
+    ispeWriter.U32(width);
+    ispeWriter.U32(height);
+    ispeWriter.End(ispe);
+
+    Item gridItem = { 1, { 'g', 'r', 'i', 'd' }, nullptr, false, &gridData, {} };
+    gridItem.properties.push_back(association(gridSize));
+    // 颜色信息以首个图块 (带 ICC) 为准，grid 与全部图块共用
+    std::vector<const HeifCodedImage::Property*> colors;
+    for (const auto& property : first.properties) {
+        if (IsBoxType(property.box, "colr")) { colors.push_back(&property); gridItem.properties.push_back(association(property)); }
+        else if (IsTransformProperty(property.box)) { gridItem.properties.push_back(association(property)); }
+    }
+    items.push_back(std::move(gridItem));
+
+    // 网格要求全部图块等大，且拼合后覆盖输出尺寸
+    UINT32 tileWidth = 0, tileHeight = 0;
+    for (const auto& property : first.properties) {
+        if (IsBoxType(property.box, "ispe") && property.box.size() >= 20) { tileWidth = ReadBe(property.box.data() + 12, 4); tileHeight = ReadBe(property.box.data() + 16, 4); }
+    }
+    if (static_cast<ULONGLONG>(tileWidth) * columns < width || static_cast<ULONGLONG>(tileHeight) * rows < height) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        Item tile = { static_cast<UINT16>(2 + i), {}, nullptr, true, &tiles[i]->data, {} };
+        memcpy(tile.type, tiles[i]->type, 4);
+        bool sizeMatches = false;
+        for (const auto& property : tiles[i]->properties) {
+            if (IsBoxType(property.box, "colr") || IsTransformProperty(property.box)) continue;
+            if (IsBoxType(property.box, "ispe") && property.box.size() >= 20) {
+                sizeMatches = ReadBe(property.box.data() + 12, 4) == tileWidth && ReadBe(property.box.data() + 16, 4) == tileHeight;
+            }
+            tile.properties.push_back(association(property));
+        }
+        if (!sizeMatches) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        for (const auto* color : colors) { tile.properties.push_back(association(*color)); }
+        if (tile.properties.size() > 255) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        items.push_back(std::move(tile));
+    }
+    UINT16 nextId = static_cast<UINT16>(2 + tiles.size());
+    UINT16 thumbnailId = 0;
+    if (thumbnail) {
+        Item item = { nextId++, {}, nullptr, false, &thumbnail->data, {} };
+        memcpy(item.type, thumbnail->type, 4);
+        for (const auto& property : thumbnail->properties) { item.properties.push_back(association(property)); }
+        thumbnailId = item.id;
+        items.push_back(std::move(item));
+    }
+    const UINT16 firstMetadataId = nextId;
+    for (const auto& metadata : first.metadata) {
+        Item item = { nextId++, {}, &metadata.contentType, false, &metadata.data, {} };
+        memcpy(item.type, metadata.type, 4);
+        items.push_back(std::move(item));
+    }
+
+    std::vector<BYTE> header;
+    BoxWriter box(header);
+    const size_t ftyp = box.Begin("ftyp");
+    box.Bytes("heic", 4);
+    box.U32(0);
+    box.Bytes("mif1", 4);
+    box.Bytes("heic", 4);
+    box.End(ftyp);
+
+    const size_t meta = box.BeginFull("meta", 0, 0);
+    const size_t hdlr = box.BeginFull("hdlr", 0, 0);
+    box.U32(0);
+    box.Bytes("pict", 4);
+    box.U32(0); box.U32(0); box.U32(0);
+    box.U8(0);
+    box.End(hdlr);
+    const size_t pitm = box.BeginFull("pitm", 0, 0);
+    box.U16(1);
+    box.End(pitm);
+    // iloc：每项一个数据段，偏移在写完头部后回填
+    const size_t iloc = box.BeginFull("iloc", 0, 0);
+    box.U8(0x44);
+    box.U8(0x00);
+    box.U16(static_cast<UINT32>(items.size()));
+    std::vector<size_t> extentPositions;
+    for (const auto& item : items) {
+        box.U16(item.id);
+        box.U16(0);
+        box.U16(1);
+        extentPositions.push_back(box.Position());
+        box.U32(0);
+        box.U32(static_cast<UINT32>(item.data->size()));
+    }
+    box.End(iloc);
+    const size_t iinf = box.BeginFull("iinf", 0, 0);
+    box.U16(static_cast<UINT32>(items.size()));
+    for (const auto& item : items) {
+        const size_t infe = box.BeginFull("infe", 2, item.hidden ? 1 : 0); // 图块不单独显示
+        box.U16(item.id);
+        box.U16(0);
+        box.Bytes(item.type, 4);
+        box.U8(0);
+        if (memcmp(item.type, "mime", 4) == 0 && item.contentType) { box.Bytes(item.contentType->c_str(), item.contentType->size() + 1); }
+        box.End(infe);
+    }
+    box.End(iinf);
+    const size_t iref = box.BeginFull("iref", 0, 0);
+    const size_t dimg = box.Begin("dimg"); // 按行优先顺序列出图块
+    box.U16(1);
+    box.U16(static_cast<UINT32>(tiles.size()));
+    for (size_t i = 0; i < tiles.size(); ++i) { box.U16(static_cast<UINT32>(2 + i)); }
+    box.End(dimg);
+    if (thumbnailId) {
+        const size_t thmb = box.Begin("thmb");
+        box.U16(thumbnailId);
+        box.U16(1);
+        box.U16(1);
+        box.End(thmb);
+    }
+    for (UINT16 id = firstMetadataId; id < nextId; ++id) {
+        const size_t cdsc = box.Begin("cdsc");
+        box.U16(id);
+        box.U16(1);
+        box.U16(1);
+        box.End(cdsc);
+    }
+    box.End(iref);
+    const size_t iprp = box.Begin("iprp");
+    const size_t ipcoBox = box.Begin("ipco");
+    for (const auto* property : ipco) { box.Bytes(property->data(), property->size()); }
+    box.End(ipcoBox);
+    size_t associated = 0;
+    for (const auto& item : items) { if (!item.properties.empty()) ++associated; }
+    const size_t ipma = box.BeginFull("ipma", 0, 1); // flags = 1：16 位属性序号
+    box.U32(static_cast<UINT32>(associated));
+    for (const auto& item : items) {
+        if (item.properties.empty()) continue;
+        box.U16(item.id);
+        box.U8(static_cast<UINT32>(item.properties.size()));
+        for (UINT16 property : item.properties) { box.U16(property); }
+    }
+    box.End(ipma);
+    box.End(iprp);
+    box.End(meta);
+
+    ULONGLONG payloadSize = 0;
+    for (const auto& item : items) { payloadSize += item.data->size(); }
+    if (header.size() + 8 + payloadSize > 0xFFFFFFFFull) return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    box.U32(static_cast<UINT32>(8 + payloadSize));
+    box.Bytes("mdat", 4);
+    size_t offset = header.size();
+    for (size_t i = 0; i < items.size(); ++i) {
+        box.Patch32(extentPositions[i], static_cast<UINT32>(offset));
+        offset += items[i].data->size();
+    }
+
+    auto write = [pOutputStream](const std::vector<BYTE>& data) {
+        ULONG written = 0;
+        HRESULT hr = pOutputStream->Write(data.data(), static_cast<ULONG>(data.size()), &written);
+        if (SUCCEEDED(hr) && written != data.size()) { hr = STG_E_MEDIUMFULL; }
+        return hr;
+    };
+    HRESULT hr = write(header);
+    for (size_t i = 0; i < items.size() && SUCCEEDED(hr); ++i) { hr = write(*items[i].data); }
+    return hr;
+}
@@ -0,0 +1,932 @@
+// WIC 解码/编码、缩略图、元数据与文件头嗅探
+#include "ConverterInternal.h"
+
+// === 新增：ConversionContext 实现 ===
+HRESULT ConversionContext::Initialize(const GUID& targetEncoderGuid, float quality) {
+    HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+    if (FAILED(hr)) return hr;
+
+    // 一次性枚举编解码器，后续直接通过组件信息创建实例，跳过注册表查找
+    ComPtr<IEnumUnknown> pEnum;
+    hr = factory->CreateComponentEnumerator(WICEncoder | WICDecoder, WICComponentEnumerateDefault, &pEnum);
+    if (FAILED(hr)) return hr;
+
+    ComPtr<IUnknown> pUnknown;
+    ULONG fetched = 0;
+    while (pEnum->Next(1, &pUnknown, &fetched) == S_OK && fetched == 1) {
+        ComPtr<IWICBitmapDecoderInfo> pDecoderInfo;
+        ComPtr<IWICBitmapEncoderInfo> pEncoderInfo;
+        if (SUCCEEDED(pUnknown.As(&pDecoderInfo))) {
+            decoderInfos.push_back(pDecoderInfo);
+        }
+        else if (!encoderInfo && SUCCEEDED(pUnknown.As(&pEncoderInfo))) {
+            GUID containerFormat;
+            if (SUCCEEDED(pEncoderInfo->GetContainerFormat(&containerFormat)) && containerFormat == targetEncoderGuid) {
+                encoderInfo = pEncoderInfo;
+            }
+        }
+        pUnknown.Reset();
+    }
+    if (!encoderInfo) return WINCODEC_ERR_COMPONENTNOTFOUND;
+
+    VariantInit(&qualityValue);
+    SetQuality(quality);
+    return S_OK;
+}
+
+void ConversionContext::SetQuality(float quality) {
+    hasQualityOption = quality >= 0.0f && quality <= 1.0f;
+    if (hasQualityOption) {
+        qualityOption.pstrName = qualityPropName;
+        qualityValue.vt = VT_R4;
+        qualityValue.fltVal = quality;
+    }
+}
+
+HRESULT ConversionContext::CreateDecoder(IStream* pStream, IWICBitmapDecoder** ppDecoder, const GUID& container) const {
+    LARGE_INTEGER zero = { 0 };
+    // 修改：某个解码器初始化失败时继续尝试下一个 (同一容器可能注册了多个解码器)，都失败时返回最后一个错误
+    HRESULT lastHr = WINCODEC_ERR_UNKNOWNIMAGEFORMAT;
+    // 新增：预读阶段已嗅探出格式时直接选用该容器的解码器，不再逐个解码器做模式匹配
+    if (!IsEqualGUID(container, GUID_NULL)) {
+        for (const auto& pInfo : decoderInfos) {
+            GUID decoderContainer;
+            if (FAILED(pInfo->GetContainerFormat(&decoderContainer)) || !IsEqualGUID(decoderContainer, container)) continue;
+            ComPtr<IWICBitmapDecoder> pDecoder;
+            if (FAILED(pInfo->CreateInstance(&pDecoder))) continue;
+            pStream->Seek(zero, STREAM_SEEK_SET, NULL);
+            HRESULT hr = pDecoder->Initialize(pStream, WICDecodeMetadataCacheOnDemand);
+            if (FAILED(hr)) { lastHr = hr; continue; }
+            *ppDecoder = pDecoder.Detach();
+            return S_OK;
+        }
+    }
+    // 与 CreateDecoderFromStream 的匹配逻辑相同，但使用缓存的解码器列表
+    for (const auto& pInfo : decoderInfos) {
+        BOOL matches = FALSE;
+        pStream->Seek(zero, STREAM_SEEK_SET, NULL);
+        if (FAILED(pInfo->MatchesPattern(pStream, &matches)) || !matches) continue;
+
+        ComPtr<IWICBitmapDecoder> pDecoder;
+        if (FAILED(pInfo->CreateInstance(&pDecoder))) continue;
+        pStream->Seek(zero, STREAM_SEEK_SET, NULL);
+        // 元数据按需加载：解码时不解析 EXIF 子目录和厂商注释，需要时由编码阶段整块复制
+        HRESULT hr = pDecoder->Initialize(pStream, WICDecodeMetadataCacheOnDemand);
+        if (FAILED(hr)) { lastHr = hr; continue; }
+        *ppDecoder = pDecoder.Detach();
+        return S_OK;
+    }
+    // 修改：没有任何解码器认识该文件，与 CreateDecoderFromStream 一样报告未知格式，不与缺少组件混淆
+    return lastHr;
+}
+
+HRESULT ConversionContext::CreateEncoder(IWICBitmapEncoder** ppEncoder) const {
+    return encoderInfo->CreateInstance(ppEncoder);
+}
+
+bool ConversionContext::SupportsMultiframe() const {
+    BOOL multiframe = FALSE;
+    return encoderInfo && SUCCEEDED(encoderInfo->DoesSupportMultiframe(&multiframe)) && multiframe;
+}
+
+HRESULT ConversionContext::ApplyEncoderOptions(IPropertyBag2* pPropertyBag) const {
+    if (!hasQualityOption) return S_OK;
+    // IPropertyBag2::Write 的参数未标记为 const，这里复制一份模板
+    PROPBAG2 option = qualityOption;
+    VARIANT value = qualityValue;
+    return pPropertyBag->Write(1, &option, &value);
+}
+
+// === 重构：原 ConvertImage 拆分为解码和编码两个阶段 ===
+HRESULT DecodeImage(const ConversionContext& context, IStream* pInputStream, bool materialize, IWICBitmapSource** ppBitmap, StageTimings* timings) {
+    const LONGLONG start = timings ? QueryTicks() : 0;
+
+    ComPtr<IWICBitmapDecoder> pDecoder;
+    HRESULT hr = context.CreateDecoder(pInputStream, &pDecoder);
+    if (FAILED(hr)) return hr;
+    if (timings) { timings->decodeMs += TicksToMs(QueryTicks() - start); }
+    return DecodeFrame(context, pDecoder.Get(), 0, materialize, ppBitmap, timings);
+}
+
+HRESULT DecodeFrame(const ConversionContext& context, IWICBitmapDecoder* pDecoder, UINT index, bool materialize, IWICBitmapSource** ppBitmap, StageTimings* timings) {
+    const LONGLONG start = timings ? QueryTicks() : 0;
+
+    ComPtr<IWICBitmapFrameDecode> pFrameDecode;
+    HRESULT hr = pDecoder->GetFrame(index, &pFrameDecode);
+    if (FAILED(hr)) return hr;
+    if (timings) { pFrameDecode->GetSize(&timings->width, &timings->height); }
+
+    ComPtr<IWICBitmapSource> pBitmap;
+    if (!materialize) { pBitmap = pFrameDecode; }
+    else {
+        hr = MaterializeFrame(context.factory.Get(), context.pixelPool, context.numaNode, pFrameDecode.Get(), pBitmap.GetAddressOf());
+        if (FAILED(hr)) return hr;
+    }
+    // 新增：--max-dimension。从已落地 (或惰性解码) 的位图流式缩小，编码器只看到缩小后的图像
+    if (context.maxDimension) {
+        hr = ResizeToFit(context.factory.Get(), context.pixelPool, context.numaNode, pBitmap.Get(), context.maxDimension, pBitmap);
+        if (FAILED(hr)) return hr;
+    }
+    if (timings && (materialize || context.maxDimension)) { timings->decodeMs += TicksToMs(QueryTicks() - start); }
+    *ppBitmap = pBitmap.Detach();
+    return S_OK;
+}
+
+HRESULT MaterializeFrame(IWICImagingFactory* pFactory, PixelBufferPool* pPool, DWORD numaNode, IWICBitmapSource* pFrame, IWICBitmapSource** ppBitmap) {
+    // WIC 解码是惰性的，这里强制完整解码，使解码开销留在解码阶段
+    HRESULT hr = S_OK;
+    ComPtr<IWICBitmapSource> pBitmap;
+    if (pPool || numaNode != NUMA_NO_PREFERRED_NODE) {
+        // 像素解码到池中复用的内存块；多 NUMA 节点时块位于本节点，随后由同一节点的编码线程读取
+        ComPtr<PooledBitmap> pLocal;
+        hr = Microsoft::WRL::MakeAndInitialize<PooledBitmap>(&pLocal, pFactory, pFrame, pPool, numaNode);
+        if (SUCCEEDED(hr)) { pBitmap = pLocal; }
+        else if (hr != WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT) { return hr; }
+    }
+    if (!pBitmap) {
+        ComPtr<IWICBitmap> pCached;
+        hr = pFactory->CreateBitmapFromSource(pFrame, WICBitmapCacheOnLoad, &pCached);
+        if (FAILED(hr)) return hr;
+        pBitmap = pCached;
+    }
+    *ppBitmap = pBitmap.Detach();
+    return S_OK;
+}
+
+// 新增：在已初始化的编码器上添加一帧
+HRESULT EncodeFrame(const ConversionContext& context, IWICBitmapEncoder* pEncoder, IWICBitmapSource* pSource, StageTimings* timings, IWICBitmapSource* pThumbnail, const FrameMetadata* pMetadata) {
+    ComPtr<IWICBitmapFrameEncode> pFrameEncode;
+    ComPtr<IPropertyBag2> pPropertyBag;
+    HRESULT hr = pEncoder->CreateNewFrame(&pFrameEncode, &pPropertyBag);
+    if (FAILED(hr)) return hr;
+
+    hr = context.ApplyEncoderOptions(pPropertyBag.Get());
+    if (FAILED(hr)) { /* Warning can be logged here if needed */ }
+
+    hr = pFrameEncode->Initialize(pPropertyBag.Get());
+    if (FAILED(hr)) return hr;
+
+    // 不支持内嵌缩略图的编码器返回 WINCODEC_ERR_UNSUPPORTEDOPERATION，忽略即可
+    if (pThumbnail) { pFrameEncode->SetThumbnail(pThumbnail); }
+    // 新增：元数据须在 WriteSource 之前设置
+    if (pMetadata) { WriteFrameMetadata(context, pFrameEncode.Get(), *pMetadata); }
+
+    LONGLONG start = timings ? QueryTicks() : 0;
+    hr = pFrameEncode->WriteSource(pSource, NULL);
+    if (FAILED(hr)) return hr;
+    if (timings) { timings->writeSourceMs += TicksToMs(QueryTicks() - start); start = QueryTicks(); }
+
+    hr = pFrameEncode->Commit();
+    if (timings) { timings->commitMs += TicksToMs(QueryTicks() - start); }
+    return hr;
+}
+
+HRESULT EncodeImage(const ConversionContext& context, IWICBitmapSource* pSource, IStream* pOutputStream, StageTimings* timings, IWICBitmapSource* pThumbnail, const FrameMetadata* pMetadata) {
+    HRESULT hr = S_OK;
+
+    ComPtr<IWICBitmapEncoder> pEncoder;
+    // 使用缓存的编码器组件信息直接创建目标编码器
+    hr = context.CreateEncoder(&pEncoder);
+    if (FAILED(hr)) return hr;
+
+    hr = pEncoder->Initialize(pOutputStream, WICBitmapEncoderNoCache);
+    if (FAILED(hr)) return hr;
+
+    hr = EncodeFrame(context, pEncoder.Get(), pSource, timings, pThumbnail, pMetadata);
+    if (FAILED(hr)) return hr;
+
+    const LONGLONG start = timings ? QueryTicks() : 0;
+    hr = pEncoder->Commit();
+    if (timings) { timings->commitMs += TicksToMs(QueryTicks() - start); }
+    return hr;
+}
+
+HRESULT EncodeSequence(const ConversionContext& context, IWICBitmapSource* pFirstFrame, FrameSequence& frames, IStream* pOutputStream, IWICBitmapSource* pThumbnail, const FrameMetadata* pMetadata) {
+    ComPtr<IWICBitmapEncoder> pEncoder;
+    HRESULT hr = context.CreateEncoder(&pEncoder);
+    if (FAILED(hr)) return hr;
+
+    hr = pEncoder->Initialize(pOutputStream, WICBitmapEncoderNoCache);
+    if (FAILED(hr)) return hr;
+
+    hr = EncodeFrame(context, pEncoder.Get(), pFirstFrame, nullptr, pThumbnail, pMetadata);
+    if (FAILED(hr)) return hr;
+    while (frames.Remaining() > 0) {
+        // Next 返回时下一帧已在后台开始解码
+        ComPtr<IWICBitmapSource> pFrame;
+        hr = frames.Next(pFrame);
+        if (FAILED(hr)) return hr;
+        hr = EncodeFrame(context, pEncoder.Get(), pFrame.Get(), nullptr, nullptr, nullptr);
+        if (FAILED(hr)) return hr;
+    }
+    return pEncoder->Commit();
+}
+
+// === 新增：缩略图与预览图 ===
+HRESULT ScaleToFit(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, UINT longEdge, ComPtr<IWICBitmapSource>& scaled) {
+    UINT width = 0, height = 0;
+    HRESULT hr = pSource->GetSize(&width, &height);
+    if (FAILED(hr)) return hr;
+    if (width == 0 || height == 0) return WINCODEC_ERR_INVALIDPARAMETER;
+
+    ComPtr<IWICBitmapSource> pInput = pSource;
+    if (std::max(width, height) > longEdge) {
+        const double ratio = static_cast<double>(longEdge) / std::max(width, height);
+        const UINT newWidth = std::max(1u, static_cast<UINT>(width * ratio + 0.5));
+        const UINT newHeight = std::max(1u, static_cast<UINT>(height * ratio + 0.5));
+        ComPtr<IWICBitmapScaler> pScaler;
+        hr = pFactory->CreateBitmapScaler(&pScaler);
+        if (SUCCEEDED(hr)) { hr = pScaler->Initialize(pSource, newWidth, newHeight, WICBitmapInterpolationModeFant); }
+        if (FAILED(hr)) return hr;
+        pInput = pScaler;
+    }
+    // 缩略图很小，落地为 WIC 位图，避免编码时反复从原图重采样
+    ComPtr<IWICBitmap> pBitmap;
+    hr = pFactory->CreateBitmapFromSource(pInput.Get(), WICBitmapCacheOnLoad, &pBitmap);
+    if (FAILED(hr)) return hr;
+    scaled = pBitmap;
+    return S_OK;
+}
+
+HRESULT MakeThumbnails(const ConversionContext& context, IWICBitmapDecoder* pDecoder, IWICBitmapSource* pDecoded, UINT thumbnailSize, UINT previewSize,
+    ComPtr<IWICBitmapSource>& thumbnail, ComPtr<IWICBitmapSource>& preview) {
+    HRESULT hr = S_OK;
+    if (previewSize) {
+        hr = ScaleToFit(context.factory.Get(), pDecoded, previewSize, preview);
+        if (FAILED(hr)) return hr;
+    }
+    if (!thumbnailSize) return S_OK;
+
+    // 源文件 (如相机 JPEG) 自带足够大的缩略图时直接复用
+    ComPtr<IWICBitmapFrameDecode> pFrame;
+    ComPtr<IWICBitmapSource> pEmbedded;
+    UINT width = 0, height = 0;
+    if (pDecoder && SUCCEEDED(pDecoder->GetFrame(0, &pFrame)) && SUCCEEDED(pFrame->GetThumbnail(&pEmbedded)) &&
+        SUCCEEDED(pEmbedded->GetSize(&width, &height)) && std::max(width, height) >= thumbnailSize) {
+        return ScaleToFit(context.factory.Get(), pEmbedded.Get(), thumbnailSize, thumbnail);
+    }
+    // 否则从较小的预览图缩小，没有预览图时从解码后的位图缩小
+    return ScaleToFit(context.factory.Get(), preview ? preview.Get() : pDecoded, thumbnailSize, thumbnail);
+}
+
+HRESULT EncodeSidecarJpeg(const ConversionContext& context, IWICBitmapSource* pSource, ComPtr<MemoryOutputStream>& buffer) {
+    HRESULT hr = Microsoft::WRL::MakeAndInitialize<MemoryOutputStream>(&buffer, 0, context.numaNode);
+    if (FAILED(hr)) return hr;
+
+    ComPtr<IWICBitmapEncoder> pEncoder;
+    hr = context.factory->CreateEncoder(GUID_ContainerFormatJpeg, NULL, &pEncoder);
+    if (SUCCEEDED(hr)) { hr = pEncoder->Initialize(buffer.Get(), WICBitmapEncoderNoCache); }
+
+    ComPtr<IWICBitmapFrameEncode> pFrameEncode;
+    ComPtr<IPropertyBag2> pPropertyBag;
+    if (SUCCEEDED(hr)) { hr = pEncoder->CreateNewFrame(&pFrameEncode, &pPropertyBag); }
+    if (SUCCEEDED(hr)) {
+        PROPBAG2 option = { 0 };
+        option.pstrName = const_cast<LPOLESTR>(L"ImageQuality");
+        VARIANT value;
+        VariantInit(&value);
+        value.vt = VT_R4;
+        value.fltVal = 0.85f;
+        pPropertyBag->Write(1, &option, &value);
+        hr = pFrameEncode->Initialize(pPropertyBag.Get());
+    }
+    if (SUCCEEDED(hr)) { hr = pFrameEncode->WriteSource(pSource, NULL); }
+    if (SUCCEEDED(hr)) { hr = pFrameEncode->Commit(); }
+    if (SUCCEEDED(hr)) { hr = pEncoder->Commit(); }
+    if (FAILED(hr)) { buffer.Reset(); }
+    return hr;
+}
+
+// === 新增：FrameSequence 实现 ===
+FrameSequence::~FrameSequence() {
+    if (!prefetch_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex_);
+        stopping_ = true;
+    }
+    prefetchWake_.notify_all();
+    prefetch_.join();
+}
+
+void FrameSequence::PrefetchLoop() {
+    HRESULT hr_com = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    std::unique_lock<std::mutex> lock(prefetchMutex_);
+    for (;;) {
+        prefetchWake_.wait(lock, [this] { return stopping_ || requested_; });
+        if (stopping_) break;
+        const UINT index = requestIndex_;
+        lock.unlock();
+        ComPtr<IWICBitmapSource> frame;
+        const HRESULT hr = Produce(index, frame);
+        lock.lock();
+        prefetched_.Swap(frame);
+        prefetchResult_ = hr;
+        requested_ = false;
+        ready_ = true;
+        prefetchWake_.notify_all();
+    }
+    lock.unlock();
+    if (SUCCEEDED(hr_com)) CoUninitialize();
+}
+
+HRESULT FrameSequence::Initialize() {
+    GUID container = GUID_NULL;
+    if (SUCCEEDED(decoder_->GetContainerFormat(&container)) && IsEqualGUID(container, GUID_ContainerFormatGif)) {
+        gif_.reset(new GifCompositor());
+        return gif_->Initialize(decoder_.Get());
+    }
+    return S_OK;
+}
+
+HRESULT FrameSequence::Produce(UINT index, ComPtr<IWICBitmapSource>& frame) {
+    ComPtr<IWICBitmapFrameDecode> pFrameDecode;
+    HRESULT hr = decoder_->GetFrame(index, &pFrameDecode);
+    if (FAILED(hr)) return hr;
+    if (gif_) { hr = gif_->Compose(factory_.Get(), pFrameDecode.Get(), frame); }
+    else if (!materialize_) { frame = pFrameDecode; }
+    else {
+        frame.Reset();
+        hr = MaterializeFrame(factory_.Get(), pool_, numaNode_, pFrameDecode.Get(), frame.GetAddressOf());
+    }
+    // 所有帧按同一比例缩小，保持序列尺寸一致
+    if (SUCCEEDED(hr) && maxDimension_) { hr = ResizeToFit(factory_.Get(), pool_, numaNode_, frame.Get(), maxDimension_, frame); }
+    return hr;
+}
+
+HRESULT FrameSequence::Next(ComPtr<IWICBitmapSource>& frame) {
+    if (nextIndex_ >= frameCount_) return E_BOUNDS;
+    HRESULT hr;
+    if (pending_) {
+        std::unique_lock<std::mutex> lock(prefetchMutex_);
+        prefetchWake_.wait(lock, [this] { return ready_; });
+        ready_ = false;
+        pending_ = false;
+        hr = prefetchResult_;
+        frame.Swap(prefetched_);
+        prefetched_.Reset();
+    }
+    else {
+        hr = Produce(nextIndex_, frame);
+    }
+    ++nextIndex_;
+    if (FAILED(hr)) return hr;
+
+    // GIF 合成按顺序依赖画布但不访问正在编码的帧，同样可以预取
+    if (nextIndex_ < frameCount_ && (materialize_ || gif_)) {
+        if (!prefetch_.joinable()) { prefetch_ = std::thread(&FrameSequence::PrefetchLoop, this); }
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex_);
+            requestIndex_ = nextIndex_;
+            requested_ = true;
+        }
+        prefetchWake_.notify_all();
+        pending_ = true;
+    }
+    return S_OK;
+}
+
+// === 新增：GifCompositor 实现 ===
+static bool ReadMetadataUInt(IWICMetadataQueryReader* pReader, LPCWSTR name, UINT& value) {
+    PROPVARIANT var;
+    PropVariantInit(&var);
+    bool found = false;
+    if (pReader && SUCCEEDED(pReader->GetMetadataByName(name, &var))) {
+        if (var.vt == VT_UI1) { value = var.bVal; found = true; }
+        else if (var.vt == VT_UI2) { value = var.uiVal; found = true; }
+        else if (var.vt == VT_UI4) { value = var.ulVal; found = true; }
+        else if (var.vt == VT_BOOL) { value = var.boolVal ? 1 : 0; found = true; }
+    }
+    PropVariantClear(&var);
+    return found;
+}
+
+HRESULT GifCompositor::Initialize(IWICBitmapDecoder* pDecoder) {
+    ComPtr<IWICMetadataQueryReader> pReader;
+    pDecoder->GetMetadataQueryReader(&pReader);
+    ReadMetadataUInt(pReader.Get(), L"/logscrdesc/Width", width_);
+    ReadMetadataUInt(pReader.Get(), L"/logscrdesc/Height", height_);
+    if (width_ == 0 || height_ == 0) {
+        // 逻辑屏幕尺寸缺失时以第一帧尺寸为准
+        ComPtr<IWICBitmapFrameDecode> pFirst;
+        HRESULT hr = pDecoder->GetFrame(0, &pFirst);
+        if (SUCCEEDED(hr)) { hr = pFirst->GetSize(&width_, &height_); }
+        if (FAILED(hr)) return hr;
+    }
+    canvas_.assign(static_cast<size_t>(width_) * height_ * 4, 0);
+    return S_OK;
+}
+
+HRESULT GifCompositor::Compose(IWICImagingFactory* pFactory, IWICBitmapFrameDecode* pFrame, ComPtr<IWICBitmapSource>& composed) {
+    const size_t canvasStride = static_cast<size_t>(width_) * 4;
+
+    // 先执行上一帧的处置方式
+    if (pendingDisposal_ == 2) {
+        for (INT y = pendingRect_.Y; y < pendingRect_.Y + pendingRect_.Height; ++y) {
+            memset(canvas_.data() + canvasStride * y + static_cast<size_t>(pendingRect_.X) * 4, 0, static_cast<size_t>(pendingRect_.Width) * 4);
+        }
+    }
+    else if (pendingDisposal_ == 3 && !previous_.empty()) {
+        canvas_.swap(previous_);
+    }
+
+    ComPtr<IWICMetadataQueryReader> pReader;
+    pFrame->GetMetadataQueryReader(&pReader);
+    UINT left = 0, top = 0, disposal = 0;
+    ReadMetadataUInt(pReader.Get(), L"/imgdesc/Left", left);
+    ReadMetadataUInt(pReader.Get(), L"/imgdesc/Top", top);
+    ReadMetadataUInt(pReader.Get(), L"/grctlext/Disposal", disposal);
+    UINT frameWidth = 0, frameHeight = 0;
+    HRESULT hr = pFrame->GetSize(&frameWidth, &frameHeight);
+    if (FAILED(hr)) return hr;
+
+    if (disposal == 3) { previous_ = canvas_; }
+
+    // 透明色在 GIF 解码器的调色板中 alpha 为 0，转换为 BGRA 后按 alpha 叠加
+    ComPtr<IWICFormatConverter> pConverter;
+    hr = pFactory->CreateFormatConverter(&pConverter);
+    if (SUCCEEDED(hr)) { hr = pConverter->Initialize(pFrame, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom); }
+    if (FAILED(hr)) return hr;
+
+    // 裁剪到逻辑屏幕范围
+    const UINT drawWidth = left < width_ ? std::min(frameWidth, width_ - left) : 0;
+    const UINT drawHeight = top < height_ ? std::min(frameHeight, height_ - top) : 0;
+    if (drawWidth > 0 && drawHeight > 0) {
+        const UINT frameStride = drawWidth * 4;
+        std::vector<BYTE> pixels(static_cast<size_t>(frameStride) * drawHeight);
+        WICRect rect = { 0, 0, static_cast<INT>(drawWidth), static_cast<INT>(drawHeight) };
+        hr = pConverter->CopyPixels(&rect, frameStride, static_cast<UINT>(pixels.size()), pixels.data());
+        if (FAILED(hr)) return hr;
+        for (UINT y = 0; y < drawHeight; ++y) {
+            const BYTE* src = pixels.data() + static_cast<size_t>(frameStride) * y;
+            BYTE* dst = canvas_.data() + canvasStride * (top + y) + static_cast<size_t>(left) * 4;
+            for (UINT x = 0; x < drawWidth; ++x, src += 4, dst += 4) {
+                if (src[3] != 0) { memcpy(dst, src, 4); }
+            }
+        }
+    }
+    pendingDisposal_ = disposal;
+    pendingRect_ = { static_cast<INT>(left), static_cast<INT>(top), static_cast<INT>(drawWidth), static_cast<INT>(drawHeight) };
+
+    // 画布会被下一帧修改，输出一份快照
+    ComPtr<IWICBitmap> pSnapshot;
+    hr = pFactory->CreateBitmapFromMemory(width_, height_, GUID_WICPixelFormat32bppBGRA, static_cast<UINT>(canvasStride),
+        static_cast<UINT>(canvas_.size()), canvas_.data(), &pSnapshot);
+    if (FAILED(hr)) return hr;
+    composed = pSnapshot;
+    return S_OK;
+}
+
+// === 新增：基准测试使用的完整转换 (打开文件 -> 解码 -> 编码到给定流) ===
+HRESULT ConvertImage(const ConversionContext& context, const WCHAR* inputPath, IStream* pOutputStream, StageTimings* timings) {
+    const LONGLONG start = QueryTicks();
+    ComPtr<IWICStream> pInputStream;
+    HRESULT hr = context.factory->CreateStream(&pInputStream);
+    if (FAILED(hr)) return hr;
+    hr = pInputStream->InitializeFromFilename(inputPath, GENERIC_READ);
+    if (FAILED(hr)) return hr;
+    if (timings) { timings->decodeMs += TicksToMs(QueryTicks() - start); } // 打开文件计入解码耗时
+
+    ComPtr<IWICBitmapSource> pBitmap;
+    hr = DecodeImage(context, pInputStream.Get(), true, &pBitmap, timings);
+    if (FAILED(hr)) return hr;
+    return EncodeImage(context, pBitmap.Get(), pOutputStream, timings);
+}
+
+// === 新增：MemoryOutputStream 实现 ===
+HRESULT MemoryOutputStream::RuntimeClassInitialize(size_t initialCapacity, DWORD numaNode) {
+    numaNode_ = numaNode;
+    return EnsureCapacity(std::max<size_t>(initialCapacity, 64 * 1024));
+}
+
+MemoryOutputStream::~MemoryOutputStream() {
+    if (data_) { VirtualFree(data_, 0, MEM_RELEASE); }
+}
+
+HRESULT MemoryOutputStream::EnsureCapacity(size_t required) {
+    if (required <= capacity_) return S_OK;
+    // 按 64KB 分配粒度对齐并成倍增长
+    size_t newCapacity = std::max(required, capacity_ * 2);
+    newCapacity = (newCapacity + 0xFFFF) & ~static_cast<size_t>(0xFFFF);
+    BYTE* newData = static_cast<BYTE*>(numaNode_ == NUMA_NO_PREFERRED_NODE
+        ? VirtualAlloc(NULL, newCapacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)
+        : VirtualAllocExNuma(GetCurrentProcess(), NULL, newCapacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, numaNode_));
+    if (!newData) return E_OUTOFMEMORY;
+    if (data_) {
+        memcpy(newData, data_, size_);
+        VirtualFree(data_, 0, MEM_RELEASE);
+    }
+    data_ = newData;
+    capacity_ = newCapacity;
+    return S_OK;
+}
+
+IFACEMETHODIMP MemoryOutputStream::Read(void* pv, ULONG cb, ULONG* pcbRead) {
+    if (!pv) return STG_E_INVALIDPOINTER;
+    size_t available = position_ < size_ ? size_ - position_ : 0;
+    ULONG toRead = static_cast<ULONG>(std::min<size_t>(cb, available));
+    if (toRead) { memcpy(pv, data_ + position_, toRead); }
+    position_ += toRead;
+    if (pcbRead) *pcbRead = toRead;
+    return toRead == cb ? S_OK : S_FALSE;
+}
+
+IFACEMETHODIMP MemoryOutputStream::Write(const void* pv, ULONG cb, ULONG* pcbWritten) {
+    if (!pv) return STG_E_INVALIDPOINTER;
+    HRESULT hr = EnsureCapacity(position_ + cb);
+    if (FAILED(hr)) return STG_E_MEDIUMFULL;
+    // VirtualAlloc 提交的页面已清零，Seek 越过末尾后留下的空洞无需再填充
+    memcpy(data_ + position_, pv, cb);
+    position_ += cb;
+    size_ = std::max(size_, position_);
+    if (pcbWritten) *pcbWritten = cb;
+    return S_OK;
+}
+
+IFACEMETHODIMP MemoryOutputStream::Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition) {
+    LONGLONG base = 0;
+    switch (dwOrigin) {
+    case STREAM_SEEK_SET: base = 0; break;
+    case STREAM_SEEK_CUR: base = static_cast<LONGLONG>(position_); break;
+    case STREAM_SEEK_END: base = static_cast<LONGLONG>(size_); break;
+    default: return STG_E_INVALIDFUNCTION;
+    }
+    LONGLONG newPosition = base + dlibMove.QuadPart;
+    if (newPosition < 0) return STG_E_INVALIDFUNCTION;
+    position_ = static_cast<size_t>(newPosition);
+    if (plibNewPosition) plibNewPosition->QuadPart = position_;
+    return S_OK;
+}
+
+IFACEMETHODIMP MemoryOutputStream::SetSize(ULARGE_INTEGER libNewSize) {
+    size_t newSize = static_cast<size_t>(libNewSize.QuadPart);
+    HRESULT hr = EnsureCapacity(newSize);
+    if (FAILED(hr)) return STG_E_MEDIUMFULL;
+    if (newSize < size_) { memset(data_ + newSize, 0, size_ - newSize); } // 保持容量内未使用区域为零
+    size_ = newSize;
+    return S_OK;
+}
+
+IFACEMETHODIMP MemoryOutputStream::Stat(STATSTG* pstatstg, DWORD grfStatFlag) {
+    if (!pstatstg) return STG_E_INVALIDPOINTER;
+    UNREFERENCED_PARAMETER(grfStatFlag);
+    ZeroMemory(pstatstg, sizeof(*pstatstg));
+    pstatstg->type = STGTY_STREAM;
+    pstatstg->cbSize.QuadPart = size_;
+    pstatstg->grfMode = STGM_READWRITE;
+    return S_OK;
+}
+
+UINT GetBitsPerPixel(IWICImagingFactory* pFactory, const WICPixelFormatGUID& format) {
+    ComPtr<IWICComponentInfo> pInfo;
+    ComPtr<IWICPixelFormatInfo> pFormatInfo;
+    UINT bitsPerPixel = 0;
+    HRESULT hr = pFactory->CreateComponentInfo(format, &pInfo);
+    if (SUCCEEDED(hr)) { hr = pInfo.As(&pFormatInfo); }
+    if (SUCCEEDED(hr)) { hr = pFormatInfo->GetBitsPerPixel(&bitsPerPixel); }
+    return SUCCEEDED(hr) ? bitsPerPixel : 0;
+}
+
+// === 新增：元数据随图片迁移 ===
+// 新增：只描述图像结构、不承载用户元数据的块 (JFIF、PNG 色彩/时间块、GIF 帧描述等)，判断有无元数据时不计
+static bool IsStructuralMetadataFormat(const GUID& format) {
+    static const GUID* const kStructural[] = {
+        &GUID_MetadataFormatUnknown, &GUID_MetadataFormatApp0, &GUID_MetadataFormatChunkgAMA, &GUID_MetadataFormatChunkcHRM, &GUID_MetadataFormatChunksRGB,
+        &GUID_MetadataFormatChunkiCCP, &GUID_MetadataFormatChunkbKGD, &GUID_MetadataFormatChunkhIST, &GUID_MetadataFormatChunktIME,
+        &GUID_MetadataFormatLSD, &GUID_MetadataFormatIMD, &GUID_MetadataFormatGCE,
+    };
+    for (const GUID* structural : kStructural) { if (IsEqualGUID(format, *structural)) return true; }
+    return false;
+}
+
+void CaptureMetadata(IWICImagingFactory* pFactory, IWICBitmapFrameDecode* pFrame, bool copyMetadata, FrameMetadata& metadata) {
+    // 按需加载的解码器到这里只定位了各个元数据块；块读取器不支持的格式 (如 BMP) 保持为空
+    if (copyMetadata) { pFrame->QueryInterface(IID_PPV_ARGS(&metadata.blocks)); }
+    pFrame->GetMetadataQueryReader(&metadata.query);
+    // 几乎所有 JPEG/PNG/TIFF/GIF 都提供块读取器，只有承载实际内容的块才算有元数据
+    if (metadata.blocks) {
+        UINT count = 0;
+        if (FAILED(metadata.blocks->GetCount(&count))) { count = 0; }
+        for (UINT i = 0; i < count; ++i) {
+            ComPtr<IWICMetadataReader> pReader;
+            GUID format = GUID_NULL;
+            if (SUCCEEDED(metadata.blocks->GetReaderByIndex(i, &pReader)) && SUCCEEDED(pReader->GetMetadataFormat(&format)) && !IsStructuralMetadataFormat(format)) { ++metadata.contentBlocks; }
+        }
+    }
+
+    // 方向标签位于 IFD0，读取它不会展开 EXIF 子目录和厂商注释
+    if (metadata.query) {
+        PROPVARIANT value;
+        PropVariantInit(&value);
+        if (SUCCEEDED(metadata.query->GetMetadataByName(L"System.Photo.Orientation", &value)) && value.vt == VT_UI2 && value.uiVal >= 1 && value.uiVal <= 8) {
+            metadata.orientation = value.uiVal;
+        }
+        PropVariantClear(&value);
+    }
+    if (!copyMetadata) { metadata.query.Reset(); return; }
+
+    // ICC 配置：先取数量，再传入预先创建的颜色上下文
+    UINT count = 0;
+    if (FAILED(pFrame->GetColorContexts(0, NULL, &count)) || count == 0) return;
+    metadata.colorContexts.resize(count);
+    std::vector<IWICColorContext*> contexts(count, nullptr);
+    for (UINT i = 0; i < count; ++i) {
+        if (FAILED(pFactory->CreateColorContext(&metadata.colorContexts[i]))) { metadata.colorContexts.clear(); return; }
+        contexts[i] = metadata.colorContexts[i].Get();
+    }
+    if (FAILED(pFrame->GetColorContexts(count, contexts.data(), &count))) { metadata.colorContexts.clear(); return; }
+    metadata.colorContexts.resize(count);
+}
+
+HRESULT ApplyOrientation(const ConversionContext& context, USHORT orientation, bool materialize, ComPtr<IWICBitmapSource>& bitmap) {
+    // 下标为 EXIF 方向值：2 水平翻转，3 旋转 180，4 垂直翻转，5-8 为转置/旋转组合
+    static const WICBitmapTransformOptions kTransforms[9] = {
+        WICBitmapTransformRotate0, WICBitmapTransformRotate0, WICBitmapTransformFlipHorizontal, WICBitmapTransformRotate180, WICBitmapTransformFlipVertical,
+        static_cast<WICBitmapTransformOptions>(WICBitmapTransformRotate90 | WICBitmapTransformFlipHorizontal), WICBitmapTransformRotate90,
+        static_cast<WICBitmapTransformOptions>(WICBitmapTransformRotate270 | WICBitmapTransformFlipHorizontal), WICBitmapTransformRotate270
+    };
+    if (orientation < 2 || orientation > 8) return S_OK;
+
+    ComPtr<IWICBitmapFlipRotator> pRotator;
+    HRESULT hr = context.factory->CreateBitmapFlipRotator(&pRotator);
+    if (SUCCEEDED(hr)) { hr = pRotator->Initialize(bitmap.Get(), kTransforms[orientation]); }
+    if (FAILED(hr)) return hr;
+    if (!materialize) { bitmap = pRotator; return S_OK; }
+
+    // 内存模式下转正后的像素同样落地到缓冲池，原位图随即释放
+    ComPtr<IWICBitmapSource> pRotated;
+    hr = MaterializeFrame(context.factory.Get(), context.pixelPool, context.numaNode, pRotator.Get(), pRotated.GetAddressOf());
+    if (SUCCEEDED(hr)) { bitmap = pRotated; }
+    return hr;
+}
+
+void WriteFrameMetadata(const ConversionContext& context, IWICBitmapFrameEncode* pFrameEncode, const FrameMetadata& metadata) {
+    // 元数据尽力保留：目标不接受的部分直接跳过，任何一步失败都不影响转换结果
+    if (!metadata.colorContexts.empty()) {
+        std::vector<IWICColorContext*> contexts;
+        for (const auto& pContext : metadata.colorContexts) { contexts.push_back(pContext.Get()); }
+        pFrameEncode->SetColorContexts(static_cast<UINT>(contexts.size()), contexts.data());
+    }
+
+    bool copied = false;
+    ComPtr<IWICMetadataBlockWriter> pBlockWriter;
+    if (metadata.blocks && SUCCEEDED(pFrameEncode->QueryInterface(IID_PPV_ARGS(&pBlockWriter)))) {
+        // 同类容器整块复制，不展开块内的标签树 (厂商注释原样带过去)
+        copied = SUCCEEDED(pBlockWriter->InitializeFromBlockReader(metadata.blocks.Get()));
+        // 容器不同时逐块转为目标格式的写入器，目标不认识的块跳过
+        ComPtr<IWICComponentFactory> pComponentFactory;
+        if (!copied && SUCCEEDED(context.factory.As(&pComponentFactory))) {
+            UINT count = 0;
+            if (FAILED(metadata.blocks->GetCount(&count))) { count = 0; }
+            for (UINT i = 0; i < count; ++i) {
+                ComPtr<IWICMetadataReader> pReader;
+                ComPtr<IWICMetadataWriter> pWriter;
+                if (SUCCEEDED(metadata.blocks->GetReaderByIndex(i, &pReader)) &&
+                    SUCCEEDED(pComponentFactory->CreateMetadataWriterFromReader(pReader.Get(), NULL, &pWriter)) &&
+                    SUCCEEDED(pBlockWriter->AddWriter(pWriter.Get()))) {
+                    copied = true;
+                }
+            }
+        }
+    }
+
+    ComPtr<IWICMetadataQueryWriter> pQueryWriter;
+    if ((!copied && metadata.query) || metadata.orientationBaked) { pFrameEncode->GetMetadataQueryWriter(&pQueryWriter); }
+    if (!pQueryWriter) return;
+    if (!copied && metadata.query) {
+        // 最后的退路：按属性名复制拍摄时间、相机信息和方向
+        static const WCHAR* const kProperties[] = { L"System.Photo.DateTaken", L"System.Photo.CameraManufacturer", L"System.Photo.CameraModel", L"System.Photo.Orientation" };
+        for (const WCHAR* name : kProperties) {
+            PROPVARIANT value;
+            PropVariantInit(&value);
+            if (SUCCEEDED(metadata.query->GetMetadataByName(name, &value))) { pQueryWriter->SetMetadataByName(name, &value); }
+            PropVariantClear(&value);
+        }
+    }
+    if (metadata.orientationBaked) {
+        // 像素已经转正，方向改写为 1，避免查看器再旋转一次
+        PROPVARIANT value;
+        PropVariantInit(&value);
+        value.vt = VT_UI2;
+        value.uiVal = 1;
+        pQueryWriter->SetMetadataByName(L"System.Photo.Orientation", &value);
+    }
+}
+
+// === 新增：文件头嗅探 ===
+namespace {
+UINT32 ReadBigEndian32(const BYTE* p) { return (static_cast<UINT32>(p[0]) << 24) | (static_cast<UINT32>(p[1]) << 16) | (static_cast<UINT32>(p[2]) << 8) | p[3]; }
+UINT32 ReadLittleEndian32(const BYTE* p) { return p[0] | (static_cast<UINT32>(p[1]) << 8) | (static_cast<UINT32>(p[2]) << 16) | (static_cast<UINT32>(p[3]) << 24); }
+
+// ISO BMFF 的 ftyp 盒：主品牌或任一兼容品牌属于 HEIF 系列即可
+bool IsHeifFileType(const BYTE* header, size_t size) {
+    static const char* const kBrands[] = { "heic", "heix", "heim", "heis", "hevc", "hevx", "hevm", "hevs", "mif1", "msf1", "avif", "avis" };
+    if (size < 16 || memcmp(header + 4, "ftyp", 4) != 0) return false;
+    const size_t boxSize = std::min<size_t>(ReadBigEndian32(header), size);
+    for (size_t offset = 8; offset + 4 <= boxSize; offset += 4) {
+        if (offset == 12) continue; // minor_version
+        for (const char* brand : kBrands) {
+            if (memcmp(header + offset, brand, 4) == 0) return true;
+        }
+    }
+    return false;
+}
+}
+
+// 新增：像素已转正时把 Exif IFD0 的方向标签改为 1
+static void ResetExifOrientation(std::vector<BYTE>& tiff) {
+    if (tiff.size() < 8) return;
+    const bool little = tiff[0] == 'I' && tiff[1] == 'I';
+    if (!little && !(tiff[0] == 'M' && tiff[1] == 'M')) return;
+    auto read16 = [&](size_t at) { return little ? static_cast<UINT>(tiff[at] | (tiff[at + 1] << 8)) : static_cast<UINT>((tiff[at] << 8) | tiff[at + 1]); };
+    const size_t ifd = little ? ReadLittleEndian32(&tiff[4]) : ReadBigEndian32(&tiff[4]);
+    if (ifd > tiff.size() - 2) return;
+    const size_t count = read16(ifd);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t entry = ifd + 2 + i * 12;
+        if (entry + 12 > tiff.size()) return;
+        if (read16(entry) == 0x0112 && read16(entry + 2) == 3) {
+            tiff[entry + 8] = little ? 1 : 0;
+            tiff[entry + 9] = little ? 0 : 1;
+            return;
+        }
+    }
+}
+
+void CaptureRawMetadata(const BYTE* data, size_t size, const GUID& container, FrameMetadata& metadata) {
+    static const char kExifId[] = "Exif\0";                           // 含结尾的 0，共 6 字节
+    static const char kXmpId[] = "http://ns.adobe.com/xap/1.0/";      // 其后跟一个 0
+    static const char kXmpKeyword[] = "XML:com.adobe.xmp";
+    bool complete = false;
+    if (IsEqualGUID(container, GUID_ContainerFormatJpeg)) {
+        // 扫描到 SOS 为止：APP1 的 Exif/XMP 原样取出；扩展 XMP、IPTC (APP13)、注释等无法原样带过去的段出现时不算完整
+        complete = true;
+        size_t offset = 2;
+        while (offset + 4 <= size && data[offset] == 0xFF) {
+            const BYTE marker = data[offset + 1];
+            if (marker == 0xFF) { ++offset; continue; }
+            if (marker == 0xDA || marker == 0xD9) break;
+            const size_t length = (static_cast<size_t>(data[offset + 2]) << 8) | data[offset + 3];
+            if (length < 2 || length > size - offset - 2) { complete = false; break; }
+            const BYTE* payload = data + offset + 4;
+            const size_t payloadSize = length - 2;
+            if (marker == 0xE1 && payloadSize > 6 && memcmp(payload, kExifId, 6) == 0) {
+                if (metadata.exif.empty()) { metadata.exif.assign(payload + 6, payload + payloadSize); }
+            }
+            else if (marker == 0xE1 && payloadSize > sizeof(kXmpId) && memcmp(payload, kXmpId, sizeof(kXmpId)) == 0) {
+                if (metadata.xmp.empty()) { metadata.xmp.assign(payload + sizeof(kXmpId), payload + payloadSize); }
+            }
+            else if ((marker >= 0xE1 && marker <= 0xEF && marker != 0xE2 && marker != 0xEE) || marker == 0xFE) { complete = false; }
+            offset += 2 + length;
+        }
+        if (offset + 4 > size || data[offset] != 0xFF) { complete = false; }
+    }
+    else if (IsEqualGUID(container, GUID_ContainerFormatPng)) {
+        // 遍历全部块 (eXIf 可以位于 IDAT 之后)：eXIf 与未压缩的 XMP iTXt 原样取出，其他文本块出现时不算完整
+        complete = true;
+        size_t offset = 8;
+        bool ended = false;
+        while (offset + 12 <= size) {
+            const size_t length = ReadBigEndian32(data + offset);
+            if (length > size - offset - 12) break;
+            const BYTE* type = data + offset + 4;
+            const BYTE* payload = data + offset + 8;
+            if (memcmp(type, "eXIf", 4) == 0) {
+                if (metadata.exif.empty()) { metadata.exif.assign(payload, payload + length); }
+            }
+            else if (memcmp(type, "iTXt", 4) == 0) {
+                // keyword\0 压缩标志 压缩方法 语言\0 译名\0 文本；压缩的 XMP 不处理
+                const BYTE* end = payload + length;
+                const BYTE* text = nullptr;
+                if (length > sizeof(kXmpKeyword) + 2 && memcmp(payload, kXmpKeyword, sizeof(kXmpKeyword)) == 0 && payload[sizeof(kXmpKeyword)] == 0) {
+                    const BYTE* translated = std::find(payload + sizeof(kXmpKeyword) + 2, end, 0);
+                    if (translated < end) { translated = std::find(translated + 1, end, 0); }
+                    if (translated < end) { text = translated + 1; }
+                }
+                if (!text) { complete = false; }
+                else if (metadata.xmp.empty()) { metadata.xmp.assign(text, end); }
+            }
+            else if (memcmp(type, "tEXt", 4) == 0 || memcmp(type, "zTXt", 4) == 0) { complete = false; }
+            else if (memcmp(type, "IEND", 4) == 0) { ended = true; break; }
+            offset += 12 + length;
+        }
+        if (!ended) { complete = false; }
+    }
+    metadata.rawComplete = complete;
+    if (!complete) { std::vector<BYTE>().swap(metadata.exif); std::vector<BYTE>().swap(metadata.xmp); }
+    else if (metadata.orientationBaked) { ResetExifOrientation(metadata.exif); }
+}
+
+GUID SniffContainerFormat(const BYTE* header, size_t size) {
+    static const BYTE kPngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    // 每种格式除魔数外再核对一个紧随其后的字段，过短的文件 (截断的上传) 一律拒绝
+    if (size >= 4 && header[0] == 0xFF && header[1] == 0xD8 && header[2] == 0xFF && header[3] >= 0xC0) return GUID_ContainerFormatJpeg;
+    if (size >= 16 && memcmp(header, kPngSignature, 8) == 0 && memcmp(header + 12, "IHDR", 4) == 0) return GUID_ContainerFormatPng;
+    if (size >= 13 && (memcmp(header, "GIF87a", 6) == 0 || memcmp(header, "GIF89a", 6) == 0)) return GUID_ContainerFormatGif;
+    if (size >= 8 && ((memcmp(header, "II*\0", 4) == 0 && ReadLittleEndian32(header + 4) >= 8) || (memcmp(header, "MM\0*", 4) == 0 && ReadBigEndian32(header + 4) >= 8))) return GUID_ContainerFormatTiff;
+    if (size >= 18 && header[0] == 'B' && header[1] == 'M') {
+        // BITMAPCOREHEADER、BITMAPINFOHEADER 及其 V2-V5 扩展
+        const UINT32 dibSize = ReadLittleEndian32(header + 14);
+        if (dibSize == 12 || dibSize == 40 || dibSize == 52 || dibSize == 56 || dibSize == 64 || dibSize == 108 || dibSize == 124) return GUID_ContainerFormatBmp;
+    }
+    if (size >= 16 && memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WEBPVP8", 7) == 0) return GUID_ContainerFormatWebp;
+    if (IsHeifFileType(header, size)) return GUID_ContainerFormatHeif;
+    return GUID_NULL;
+}
+
+// === 新增：--target-size，在内存中按质量二分编码，只保留不超过目标的最好结果 ===
+ULONGLONG QualityHistory::MakeKey(const GUID& container, double targetBitsPerPixel, double sourceBitsPerPixel) {
+    // 码率按 1/2 个数量级 (log2 步长 0.5) 分桶；源格式的码率反映了图片的复杂度
+    const LONG targetBucket = static_cast<LONG>(std::floor(std::log2(std::max(targetBitsPerPixel, 1e-4)) * 2.0));
+    const LONG sourceBucket = static_cast<LONG>(std::floor(std::log2(std::max(sourceBitsPerPixel, 1e-4)) * 2.0));
+    return (static_cast<ULONGLONG>(container.Data1) << 32) ^ (static_cast<ULONGLONG>(static_cast<USHORT>(targetBucket)) << 16) ^ static_cast<USHORT>(sourceBucket);
+}
+
+bool QualityHistory::Lookup(ULONGLONG key, float& quality) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = qualities_.find(key);
+    if (it == qualities_.end()) return false;
+    quality = it->second;
+    return true;
+}
+
+void QualityHistory::Remember(ULONGLONG key, float quality) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    qualities_[key] = quality;
+}
+
+HRESULT EncodeToTargetSize(ConversionContext& context, ImageJob& job, ULONGLONG targetBytes, float maxQuality, QualityHistory& history) {
+    const unsigned kMaxAttempts = 6;       // 每张图最多编码次数
+    const float kResolution = 0.02f;       // 质量区间收窄到该宽度即停止
+    const double kSizeSlope = 0.15;        // 经验模型：质量每变化 0.15，输出大小约变化一倍
+    const double kCloseEnough = 0.9;       // 达到目标的 90% 即视为命中，不再继续逼近
+
+    UINT width = 0, height = 0;
+    HRESULT hr = job.decodedFrame->GetSize(&width, &height);
+    if (FAILED(hr)) return hr;
+    const double pixels = std::max(1.0, static_cast<double>(width) * height);
+    const double targetBpp = targetBytes * 8.0 / pixels;
+    const double sourceBpp = job.sourceSize * 8.0 / pixels;
+    const ULONGLONG key = QualityHistory::MakeKey(job.container, targetBpp, sourceBpp);
+
+    // 起点：相似图片上次命中的质量；没有记录时按目标与源文件的大小之比估计
+    float quality = 0.0f;
+    if (!history.Lookup(key, quality)) {
+        const double ratio = static_cast<double>(targetBytes) / std::max<ULONGLONG>(job.sourceSize, 1);
+        quality = static_cast<float>(0.8 + kSizeSlope * std::log2(ratio));
+    }
+    float low = 0.0f, high = maxQuality;
+    bool lowTested = false, highTested = false; // 区间端点是否已实际编码过
+    quality = std::min(std::max(quality, low), high);
+
+    ComPtr<MemoryOutputStream> best;
+    float bestQuality = 0.0f;
+    double slope = kSizeSlope;
+    float previousQuality = -1.0f;
+    double previousSize = 0.0;
+    for (unsigned attempt = 0; attempt < kMaxAttempts; ++attempt) {
+        ComPtr<MemoryOutputStream> buffer;
+        hr = Microsoft::WRL::MakeAndInitialize<MemoryOutputStream>(&buffer, static_cast<size_t>(targetBytes), context.numaNode);
+        if (SUCCEEDED(hr)) {
+            context.SetQuality(quality);
+            hr = EncodeImage(context, job.decodedFrame.Get(), buffer.Get(), nullptr, job.thumbnail.Get(), &job.metadata);
+        }
+        if (FAILED(hr)) break;
+
+        // 有两次结果后用割线斜率代替经验值
+        const double size = std::max<double>(static_cast<double>(buffer->Size()), 1.0);
+        if (previousQuality >= 0.0f && std::fabs(quality - previousQuality) > 1e-3f && size != previousSize) {
+            slope = std::min(std::max((quality - previousQuality) / (std::log2(size) - std::log2(previousSize)), 0.02), 1.0);
+        }
+        previousQuality = quality;
+        previousSize = size;
+
+        if (size <= targetBytes) {
+            best = buffer;
+            bestQuality = quality;
+            low = quality;
+            lowTested = true;
+            if (size >= targetBytes * kCloseEnough || quality >= high) break;
+        }
+        else {
+            high = quality;
+            highTested = true;
+        }
+        if (high - low < kResolution) break;
+
+        // 外推到 [90%, 100%] 目标的中点；越过已测端点或太靠近它时退回二分，越过未测端点时先试该端点
+        float next = static_cast<float>(quality + slope * std::log2(targetBytes * (1.0 + kCloseEnough) / 2.0 / size));
+        const float margin = (high - low) / 8;
+        const float lowLimit = lowTested ? low + margin : low;
+        const float highLimit = highTested ? high - margin : high;
+        if (next < low && !lowTested) { next = low; }
+        else if (next > high && !highTested) { next = high; }
+        else if (next < lowLimit || next > highLimit) { next = (low + high) / 2; }
+        quality = next;
+    }
+    if (SUCCEEDED(hr) && !best) { hr = E_TARGET_SIZE_UNREACHABLE; }
+    if (SUCCEEDED(hr)) {
+        history.Remember(key, bestQuality);
+        job.encodedBuffer = best;
+    }
+    return hr;
+}
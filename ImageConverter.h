@@ -0,0 +1,69 @@
+#pragma once
+// 转换引擎的库接口。引擎编译在静态库工程 ImageConverterLib 中，
+// 控制台程序 ImageToHeicConverter 只含参数解析与 wmain，链接同一个库。
+#include <windows.h>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 新增：定义转换模式的枚举，让代码更清晰
+enum class ConversionMode {
+    ToHeic,
+    ToJpeg
+};
+
+// 新增：Converter 的创建参数，含义与同名命令行参数一致
+struct ConverterOptions {
+    ConversionMode mode = ConversionMode::ToHeic;
+    float quality = -1.0f;                        // 0-1，小于 0 使用编码器默认值
+    unsigned threads = 0;                         // 编码线程数，0 表示按逻辑处理器数并自动调整
+    UINT maxDimension = 0;                        // 长边像素上限，0 表示不缩放
+    UINT thumbnailSize = 0;                       // 内嵌缩略图长边像素，0 表示不生成
+    bool thumbnailSidecar = false;                // 新增：--sidecar，缩略图另存为 .thumb.jpg (只对写入文件的项有效)
+    bool copyMetadata = true;                     // 复制 EXIF/XMP/ICC
+    ULONGLONG bufferLimit = 256ull * 1024 * 1024; // 不超过该大小的输入文件整体读入内存，更大的直接从文件解码
+    ULONGLONG maxMemory = 0;                      // 新增：--max-memory 字节数，0 表示不做准入控制
+    ULONGLONG targetSize = 0;                     // 新增：--target-size 每张输出的字节上限，0 表示按固定质量编码
+    UINT gridTileSize = 512;                      // 新增：--grid-tile，超大图像的网格图块边长，0 表示不做网格编码
+    int gpuIndex = -1;                            // 新增：--gpu 显卡序号，-1 表示只用 WIC
+};
+
+// 新增：批次中的一项。inputBytes 非空时从内存转换，否则读取 inputPath；
+// outputPath 非空时写入该文件 (先写 .tmp 再原子改名)，否则编码结果放在 ConversionOutput::bytes 中返回
+struct ConversionItem {
+    std::wstring inputPath;
+    std::vector<BYTE> inputBytes;
+    std::wstring outputPath;
+};
+
+struct ConversionOutput {
+    HRESULT hr = E_PENDING;
+    std::vector<BYTE> bytes;
+    std::vector<std::vector<BYTE>> extraBytes; // 新增：目标格式不支持多帧 (JPEG) 时第 2 帧起的编码结果
+};
+
+// 新增：常驻的转换器。内部运行与命令行相同的流水线 (预读、解码、编码、写出各阶段线程)，
+// HEVC 编码器探测只在 Create 时做一次，之后可从任意线程反复提交批次；析构时处理完已提交的任务再退出
+class Converter {
+public:
+    using Callback = std::function<void(size_t index, ConversionOutput& output)>;
+
+    static HRESULT Create(const ConverterOptions& options, std::unique_ptr<Converter>& converter);
+    ~Converter();
+
+    // 预读队列已满时阻塞，直到流水线取走任务
+    std::vector<std::future<ConversionOutput>> Submit(std::vector<ConversionItem> batch);
+    // 每项完成时在写出线程上调用 onComplete，index 为该项在批次中的下标
+    void Submit(std::vector<ConversionItem> batch, Callback onComplete);
+
+    Converter(const Converter&) = delete;
+    Converter& operator=(const Converter&) = delete;
+
+private:
+    Converter() = default;
+
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,352 @@
+// ImageConverterLib 的单元测试：HEIF 盒的读写、HEVC 参数集解析与 XXH64。
+// 控制台程序，全部通过时返回 0；需要 WIC HEVC 编码器的用例在缺少组件时跳过
+#include "ConverterInternal.h"
+
+static int g_failures = 0;
+
+#define EXPECT(condition) \
+    do { if (!(condition)) { printf("  %s(%d): EXPECT(%s) failed\n", __FILE__, __LINE__, #condition); ++g_failures; } } while (0)
+
+// --- 测试辅助 ---
+
+// 按位写出 RBSP，用于构造参数集
+class BitWriter {
+public:
+    void Bits(UINT32 value, UINT count) {
+        while (count--) {
+            if (bits_ % 8 == 0) { data_.push_back(0); }
+            if ((value >> count) & 1u) { data_.back() |= static_cast<BYTE>(0x80u >> (bits_ % 8)); }
+            ++bits_;
+        }
+    }
+    void Ue(UINT32 value) {
+        const ULONGLONG coded = static_cast<ULONGLONG>(value) + 1;
+        UINT length = 0;
+        while ((coded >> length) > 1) ++length;
+        Bits(0, length);
+        Bits(static_cast<UINT32>(coded), length + 1);
+    }
+    void Bytes(const BYTE* data, size_t size) { for (size_t i = 0; i < size; ++i) { Bits(data[i], 8); } }
+    // rbsp_trailing_bits：一个 1，之后补零到字节边界
+    std::vector<BYTE> Finish() {
+        Bits(1, 1);
+        return data_;
+    }
+
+private:
+    std::vector<BYTE> data_;
+    size_t bits_ = 0;
+};
+
+// RBSP 加上防竞争字节 (两个 00 之后遇到 00-03 时插入 03)
+static std::vector<BYTE> RbspToNal(const std::vector<BYTE>& rbsp) {
+    std::vector<BYTE> nal;
+    size_t zeros = 0;
+    for (BYTE b : rbsp) {
+        if (zeros >= 2 && b <= 3) { nal.push_back(3); zeros = 0; }
+        nal.push_back(b);
+        zeros = b == 0 ? zeros + 1 : 0;
+    }
+    return nal;
+}
+
+// Main 配置、level 4.1；兼容标志与约束标志中的连续零字节使 NAL 中必然出现防竞争字节
+static const BYTE kGeneralProfile[12] = { 0x01, 0x60, 0x00, 0x00, 0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7B };
+
+// 4:2:0、8 位的 SPS RBSP (含 2 字节 NAL 头)；裁剪窗口以色度样本为单位
+static std::vector<BYTE> MakeSpsRbsp(UINT codedWidth, UINT codedHeight, UINT cropRight, UINT cropBottom) {
+    BitWriter writer;
+    writer.Bits(kHevcNalSps << 1, 8); // forbidden_zero_bit, nal_unit_type, nuh_layer_id 最高位
+    writer.Bits(1, 8);                // nuh_layer_id 其余位, nuh_temporal_id_plus1
+    writer.Bits(0, 4);                // sps_video_parameter_set_id
+    writer.Bits(0, 3);                // sps_max_sub_layers_minus1
+    writer.Bits(1, 1);                // sps_temporal_id_nesting_flag
+    writer.Bytes(kGeneralProfile, sizeof(kGeneralProfile));
+    writer.Ue(0);                     // sps_seq_parameter_set_id
+    writer.Ue(1);                     // chroma_format_idc
+    writer.Ue(codedWidth);
+    writer.Ue(codedHeight);
+    const bool crop = cropRight || cropBottom;
+    writer.Bits(crop ? 1 : 0, 1);     // conformance_window_flag
+    if (crop) { writer.Ue(0); writer.Ue(cropRight); writer.Ue(0); writer.Ue(cropBottom); }
+    writer.Ue(0);                     // bit_depth_luma_minus8
+    writer.Ue(0);                     // bit_depth_chroma_minus8
+    writer.Ue(4);                     // log2_max_pic_order_cnt_lsb_minus4
+    return writer.Finish();
+}
+
+static void AppendNal(std::vector<BYTE>& stream, const std::vector<BYTE>& nal, bool longStartCode) {
+    static const BYTE kStartCode[4] = { 0, 0, 0, 1 };
+    stream.insert(stream.end(), longStartCode ? kStartCode : kStartCode + 1, kStartCode + 4);
+    stream.insert(stream.end(), nal.begin(), nal.end());
+}
+
+static void AppendBe32(std::vector<BYTE>& out, UINT32 value) {
+    for (int i = 0; i < 4; ++i) { out.push_back(static_cast<BYTE>(value >> (24 - 8 * i))); }
+}
+
+static UINT32 ReadBe32(const BYTE* p) {
+    return (static_cast<UINT32>(p[0]) << 24) | (static_cast<UINT32>(p[1]) << 16) | (static_cast<UINT32>(p[2]) << 8) | p[3];
+}
+
+static std::vector<BYTE> MakeBox(const char* type, const std::vector<BYTE>& payload) {
+    std::vector<BYTE> box;
+    AppendBe32(box, static_cast<UINT32>(8 + payload.size()));
+    box.insert(box.end(), type, type + 4);
+    box.insert(box.end(), payload.begin(), payload.end());
+    return box;
+}
+
+static std::vector<BYTE> MakeIspe(UINT32 width, UINT32 height) {
+    std::vector<BYTE> payload(4, 0); // version, flags
+    AppendBe32(payload, width);
+    AppendBe32(payload, height);
+    return MakeBox("ispe", payload);
+}
+
+static const HeifCodedImage::Property* FindProperty(const HeifCodedImage& image, const char* type) {
+    for (const auto& property : image.properties) {
+        if (property.box.size() >= 8 && memcmp(property.box.data() + 4, type, 4) == 0) return &property;
+    }
+    return nullptr;
+}
+
+static bool ReadIspe(const HeifCodedImage& image, UINT32& width, UINT32& height) {
+    const HeifCodedImage::Property* ispe = FindProperty(image, "ispe");
+    if (!ispe || ispe->box.size() < 20) return false;
+    width = ReadBe32(ispe->box.data() + 12);
+    height = ReadBe32(ispe->box.data() + 16);
+    return true;
+}
+
+// 写入内存流后取出全部字节
+static HRESULT WriteToMemory(const std::function<HRESULT(IStream*)>& write, std::vector<BYTE>& file) {
+    ComPtr<MemoryOutputStream> pStream;
+    HRESULT hr = Microsoft::WRL::MakeAndInitialize<MemoryOutputStream>(&pStream, 0);
+    if (SUCCEEDED(hr)) { hr = write(pStream.Get()); }
+    if (SUCCEEDED(hr)) { file.assign(pStream->Data(), pStream->Data() + pStream->Size()); }
+    return hr;
+}
+
+// iloc 给出的 hvc1 数据应是 4 字节长度前缀的 NAL 单元序列，且恰好覆盖整个项
+static bool IsLengthPrefixed(const std::vector<BYTE>& data) {
+    size_t offset = 0;
+    while (offset + 4 <= data.size()) {
+        const UINT32 length = ReadBe32(data.data() + offset);
+        if (length == 0 || length > data.size() - offset - 4) return false;
+        offset += 4 + length;
+    }
+    return !data.empty() && offset == data.size();
+}
+
+// 测试用的图块：内容无意义的 hvcC、给定尺寸的 ispe，以及共用的 colr
+static HeifCodedImage MakeTile(UINT32 size, BYTE fill, const std::vector<BYTE>& colr) {
+    HeifCodedImage tile;
+    memcpy(tile.type, "hvc1", 4);
+    tile.data.assign(16, fill);
+    tile.properties.push_back({ MakeBox("hvcC", std::vector<BYTE>(23, 0x01)), true });
+    tile.properties.push_back({ MakeIspe(size, size), false });
+    tile.properties.push_back({ colr, false });
+    return tile;
+}
+
+// --- 测试用例 ---
+
+// 官方参考实现的已知结果 (seed = 0)
+static void TestXxh64() {
+    struct Vector {
+        const char* text;
+        ULONGLONG hash;
+    };
+    static const Vector kVectors[] = {
+        { "", 0xEF46DB3751D8E999ull },
+        { "a", 0xD24EC4F1A98C6E5Bull },
+        { "abc", 0x44BC2CF5AD770999ull },
+        { "Nobody inspects the spammish repetition", 0xFBCEA83C8A378BF1ull }, // 不少于 32 字节，经过四路累加与 8/4/1 字节尾部
+    };
+    for (const auto& vector : kVectors) { EXPECT(Xxh64(vector.text, strlen(vector.text), 0) == vector.hash); }
+
+    // 输入不必按 8 字节对齐
+    const Vector& longest = kVectors[ARRAYSIZE(kVectors) - 1];
+    std::vector<char> shifted(strlen(longest.text) + 1);
+    memcpy(shifted.data() + 1, longest.text, strlen(longest.text));
+    EXPECT(Xxh64(shifted.data() + 1, strlen(longest.text), 0) == longest.hash);
+    EXPECT(Xxh64("abc", 3, 1) != Xxh64("abc", 3, 0));
+}
+
+// SplitAnnexB / NalToRbsp / ParseHevcSps，以及 WriteHeifFromHevc 按裁剪窗口写出 ispe 与 clap
+static void TestSpsConformanceWindow() {
+    const std::vector<BYTE> spsRbsp = MakeSpsRbsp(1920, 1088, 0, 4); // 底部裁掉 8 行
+    const std::vector<BYTE> sps = RbspToNal(spsRbsp);
+    const std::vector<BYTE> vps = { 0x40, 0x01, 0x0C, 0x01, 0xFF, 0xFF };
+    const std::vector<BYTE> pps = { 0x44, 0x01, 0xC1, 0x72, 0xB0, 0x62, 0x40 };
+    const std::vector<BYTE> slice = { 0x26, 0x01, 0xAF, 0x00, 0x00, 0x03, 0x01, 0x80 }; // IDR_W_RADL，含防竞争字节
+    std::vector<BYTE> stream;
+    AppendNal(stream, vps, true);
+    AppendNal(stream, sps, true);
+    AppendNal(stream, pps, false);
+    AppendNal(stream, slice, false);
+    stream.push_back(0); // 末尾的填充零不属于最后一个单元
+
+    const std::vector<HevcNalUnit> units = SplitAnnexB(stream);
+    EXPECT(units.size() == 4);
+    if (units.size() != 4) return;
+    EXPECT(units[0].type == kHevcNalVps && units[1].type == kHevcNalSps && units[2].type == kHevcNalPps && units[3].type == 19);
+    EXPECT(units[1].size == sps.size() && units[3].size == slice.size());
+    EXPECT(sps.size() > spsRbsp.size());
+    EXPECT(NalToRbsp(units[1]) == spsRbsp);
+
+    HevcSpsInfo info;
+    EXPECT(ParseHevcSps(units[1], info));
+    EXPECT(info.width == 1920 && info.height == 1080);
+    EXPECT(info.chromaFormat == 1 && info.maxSubLayers == 1 && info.temporalIdNested);
+    EXPECT(info.bitDepthLumaMinus8 == 0 && info.bitDepthChromaMinus8 == 0);
+    EXPECT(memcmp(info.generalProfile, kGeneralProfile, sizeof(kGeneralProfile)) == 0);
+
+    // 右侧与底部各裁一个色度样本 (两个亮度样本)
+    const std::vector<BYTE> oddSps = RbspToNal(MakeSpsRbsp(64, 64, 1, 1));
+    const HevcNalUnit oddUnit = { oddSps.data(), oddSps.size(), kHevcNalSps };
+    EXPECT(ParseHevcSps(oddUnit, info) && info.width == 62 && info.height == 62);
+    // 裁剪窗口不小于编码尺寸时拒绝
+    const std::vector<BYTE> badSps = RbspToNal(MakeSpsRbsp(64, 64, 0, 32));
+    const HevcNalUnit badUnit = { badSps.data(), badSps.size(), kHevcNalSps };
+    EXPECT(!ParseHevcSps(badUnit, info));
+
+    // 输出尺寸等于裁剪后的尺寸：没有 clap，mdat 中是长度前缀的 slice
+    std::vector<BYTE> file;
+    HeifCodedImage image;
+    UINT32 width = 0, height = 0;
+    EXPECT(SUCCEEDED(WriteToMemory([&](IStream* s) { return WriteHeifFromHevc(stream, std::vector<BYTE>(), 1920, 1080, nullptr, s); }, file)));
+    EXPECT(SUCCEEDED(ExtractHeifImage(file.data(), file.size(), image)));
+    EXPECT(memcmp(image.type, "hvc1", 4) == 0);
+    EXPECT(image.data.size() == 4 + slice.size() && ReadBe32(image.data.data()) == slice.size() && memcmp(image.data.data() + 4, slice.data(), slice.size()) == 0);
+    EXPECT(ReadIspe(image, width, height) && width == 1920 && height == 1080);
+    const HeifCodedImage::Property* hvcC = FindProperty(image, "hvcC");
+    EXPECT(hvcC && hvcC->essential && hvcC->box.size() > 21 && memcmp(hvcC->box.data() + 9, kGeneralProfile, sizeof(kGeneralProfile)) == 0);
+    EXPECT(!FindProperty(image, "clap"));
+
+    // 参数集只在序列头中；奇数输出尺寸由 clap 裁掉补齐的一行一列
+    std::vector<BYTE> header, slices;
+    AppendNal(header, vps, true);
+    AppendNal(header, sps, true);
+    AppendNal(header, pps, true);
+    AppendNal(slices, slice, true);
+    EXPECT(SUCCEEDED(WriteToMemory([&](IStream* s) { return WriteHeifFromHevc(slices, header, 1919, 1079, nullptr, s); }, file)));
+    EXPECT(SUCCEEDED(ExtractHeifImage(file.data(), file.size(), image)));
+    EXPECT(ReadIspe(image, width, height) && width == 1920 && height == 1080);
+    const HeifCodedImage::Property* clap = FindProperty(image, "clap");
+    EXPECT(clap && clap->essential && clap->box.size() == 40 && ReadBe32(clap->box.data() + 8) == 1919 && ReadBe32(clap->box.data() + 16) == 1079);
+
+    // 输出尺寸大于 SPS 的解码输出尺寸，或缺少参数集时失败
+    EXPECT(WriteToMemory([&](IStream* s) { return WriteHeifFromHevc(stream, std::vector<BYTE>(), 1920, 1088, nullptr, s); }, file) == HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    EXPECT(WriteToMemory([&](IStream* s) { return WriteHeifFromHevc(slices, std::vector<BYTE>(), 1920, 1080, nullptr, s); }, file) == HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+}
+
+// WriteHeifGrid 写出后由 ExtractHeifImage 读回主图像 (grid 项)
+static void TestGridRoundTrip() {
+    const std::vector<BYTE> colr = MakeBox("colr", { 'n', 'c', 'l', 'x', 0, 1, 0, 13, 0, 6, 0x80 });
+    std::vector<HeifCodedImage> tiles;
+    for (BYTE i = 0; i < 6; ++i) { tiles.push_back(MakeTile(256, static_cast<BYTE>(0x10 + i), colr)); }
+    HeifCodedImage::MetadataItem exif;
+    memcpy(exif.type, "Exif", 4);
+    exif.data = { 0, 0, 0, 0, 'M', 'M', 0, 42 };
+    tiles[0].metadata.push_back(exif);
+    const HeifCodedImage thumbnail = MakeTile(64, 0xEE, colr);
+    std::vector<const HeifCodedImage*> pointers;
+    for (const auto& tile : tiles) { pointers.push_back(&tile); }
+
+    // 3 x 2 个 256 像素的图块拼成 700 x 500，超出的部分由 grid 的输出尺寸裁掉
+    std::vector<BYTE> file;
+    HeifCodedImage grid;
+    UINT32 width = 0, height = 0;
+    EXPECT(SUCCEEDED(WriteToMemory([&](IStream* s) { return WriteHeifGrid(700, 500, 3, 2, pointers, &thumbnail, s); }, file)));
+    EXPECT(SUCCEEDED(ExtractHeifImage(file.data(), file.size(), grid)));
+    EXPECT(memcmp(grid.type, "grid", 4) == 0);
+    const BYTE expected[] = { 0, 0, 1, 2, 0x02, 0xBC, 0x01, 0xF4 }; // version, flags, rows - 1, columns - 1, 16 位的宽与高
+    EXPECT(grid.data.size() == sizeof(expected) && memcmp(grid.data.data(), expected, sizeof(expected)) == 0);
+    EXPECT(ReadIspe(grid, width, height) && width == 700 && height == 500);
+    const HeifCodedImage::Property* gridColr = FindProperty(grid, "colr");
+    EXPECT(gridColr && gridColr->box == colr);
+    EXPECT(!FindProperty(grid, "hvcC")); // 编码参数只属于图块
+    EXPECT(grid.metadata.size() == 1 && memcmp(grid.metadata[0].type, "Exif", 4) == 0 && grid.metadata[0].data == exif.data);
+    // 图块数据按行优先顺序紧随 grid 描述写入 mdat
+    std::vector<BYTE> payload(expected, expected + sizeof(expected));
+    for (const auto& tile : tiles) { payload.insert(payload.end(), tile.data.begin(), tile.data.end()); }
+    EXPECT(std::search(file.begin(), file.end(), payload.begin(), payload.end()) != file.end());
+
+    // 宽度超过 16 位时 grid 描述改用 32 位字段
+    const HeifCodedImage wideTile = MakeTile(512, 0x20, colr);
+    const std::vector<const HeifCodedImage*> row(129, &wideTile);
+    EXPECT(SUCCEEDED(WriteToMemory([&](IStream* s) { return WriteHeifGrid(65600, 300, 129, 1, row, nullptr, s); }, file)));
+    EXPECT(SUCCEEDED(ExtractHeifImage(file.data(), file.size(), grid)));
+    EXPECT(grid.data.size() == 12 && grid.data[1] == 1 && grid.data[2] == 0 && grid.data[3] == 128);
+    EXPECT(grid.data.size() == 12 && ReadBe32(grid.data.data() + 4) == 65600 && ReadBe32(grid.data.data() + 8) == 300);
+
+    // 图块尺寸不一致或拼合后不足输出尺寸时拒绝
+    tiles[4] = MakeTile(128, 0x14, colr);
+    EXPECT(WriteToMemory([&](IStream* s) { return WriteHeifGrid(700, 500, 3, 2, pointers, nullptr, s); }, file) == HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    tiles[4] = MakeTile(256, 0x14, colr);
+    EXPECT(WriteToMemory([&](IStream* s) { return WriteHeifGrid(800, 500, 3, 2, pointers, nullptr, s); }, file) == HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+}
+
+// WIC 编码出的单图 HEIF：解析 iloc 取出数据、解析 ipma 取出属性，再作为图块封装为 grid
+static void TestWicTile() {
+    ConversionContext context;
+    if (FAILED(context.Initialize(GUID_ContainerFormatHeif, 0.8f)) || !CheckHevcEncoderAvailability(context.factory.Get())) {
+        printf("  skipped: no WIC HEVC encoder\n");
+        return;
+    }
+    const UINT kSize = 64;
+    std::vector<BYTE> pixels(kSize * kSize * 4);
+    for (UINT y = 0; y < kSize; ++y) {
+        for (UINT x = 0; x < kSize; ++x) {
+            BYTE* pixel = pixels.data() + (static_cast<size_t>(y) * kSize + x) * 4;
+            pixel[0] = static_cast<BYTE>(x * 4);
+            pixel[1] = static_cast<BYTE>(y * 4);
+            pixel[2] = static_cast<BYTE>((x + y) * 2);
+            pixel[3] = 0xFF;
+        }
+    }
+    ComPtr<IWICBitmap> pBitmap;
+    HRESULT hr = context.factory->CreateBitmapFromMemory(kSize, kSize, GUID_WICPixelFormat32bppBGR, kSize * 4, static_cast<UINT>(pixels.size()), pixels.data(), &pBitmap);
+    std::vector<BYTE> file;
+    if (SUCCEEDED(hr)) { hr = WriteToMemory([&](IStream* s) { return EncodeImage(context, pBitmap.Get(), s); }, file); }
+    EXPECT(SUCCEEDED(hr));
+    if (FAILED(hr)) return;
+
+    HeifCodedImage tile;
+    UINT32 width = 0, height = 0;
+    EXPECT(SUCCEEDED(ExtractHeifImage(file.data(), file.size(), tile)));
+    EXPECT(memcmp(tile.type, "hvc1", 4) == 0);
+    EXPECT(IsLengthPrefixed(tile.data));
+    EXPECT(FindProperty(tile, "hvcC") != nullptr);
+    EXPECT(ReadIspe(tile, width, height) && width == kSize && height == kSize);
+
+    const std::vector<const HeifCodedImage*> tiles(2, &tile);
+    HeifCodedImage grid;
+    EXPECT(SUCCEEDED(WriteToMemory([&](IStream* s) { return WriteHeifGrid(2 * kSize - 10, kSize, 2, 1, tiles, nullptr, s); }, file)));
+    EXPECT(SUCCEEDED(ExtractHeifImage(file.data(), file.size(), grid)));
+    EXPECT(memcmp(grid.type, "grid", 4) == 0 && ReadIspe(grid, width, height) && width == 2 * kSize - 10 && height == kSize);
+}
+
+int main() {
+    if (FAILED(CoInitializeEx(NULL, COINIT_MULTITHREADED))) { printf("Failed to initialize COM.\n"); return 1; }
+    struct Test {
+        const char* name;
+        void (*run)();
+    };
+    static const Test kTests[] = {
+        { "Xxh64", TestXxh64 },
+        { "SpsConformanceWindow", TestSpsConformanceWindow },
+        { "GridRoundTrip", TestGridRoundTrip },
+        { "WicTile", TestWicTile },
+    };
+    for (const auto& test : kTests) {
+        const int before = g_failures;
+        test.run();
+        printf("%s %s\n", g_failures == before ? "[ OK ]" : "[FAIL]", test.name);
+    }
+    CoUninitialize();
+    if (g_failures) { printf("%d check(s) failed.\n", g_failures); }
+    return g_failures ? 1 : 0;
+}
@@ -1,129 +1,22 @@
-#include <iostream>
+// 命令行入口：解析参数后交给 ImageConverterLib 中的转换引擎
+#include "ConverterInternal.h"
 
-#define NOMINMAX
-#include <windows.h>
-#include <wincodec.h>
-#include <wrl/client.h>
-#include <vector>
-#include <string>
-#include <stdexcept>
-#include <shlwapi.h>
-#include <pathcch.h>
-#include <thread>
-#include <mutex>
-#include <atomic>
-#include <functional>
-#include <algorithm>
-
-#pragma comment(lib, "windowscodecs.lib")
-#pragma comment(lib, "shlwapi.lib")
-#pragma comment(lib, "pathcch.lib")
-
-using Microsoft::WRL::ComPtr;
-
-// 新增：定义转换模式的枚举，让代码更清晰
-enum class ConversionMode {
-    ToHeic,
-    ToJpeg
-};
-
-// 函数前向声明
-HRESULT ConvertImage(const WCHAR* inputPath, const WCHAR* outputPath, float quality, const GUID& targetEncoderGuid); // 改造后的通用转换函数
 void ShowHelp(const WCHAR* appName);
-bool IsSupportedInputFile(const std::wstring& fileName, ConversionMode mode); // 改造后的文件支持判断函数
-bool CheckHevcEncoderAvailability();
-
-std::mutex console_mutex;
-
-// === 修改：Worker线程函数，使其更通用 ===
-void Worker(
-    const std::vector<std::wstring>* filesToProcess,
-    const std::wstring* outputDir,
-    std::atomic<size_t>* task_index,
-    std::atomic<int>* success_count,
-    std::atomic<int>* fail_count,
-    float quality,
-    const WCHAR* targetExtension,       // 新增：接收目标文件后缀
-    const GUID* pTargetEncoderGuid      // 新增：接收目标编码器GUID
-) {
-    HRESULT hr_com = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
-    if (FAILED(hr_com)) {
-        std::lock_guard<std::mutex> lock(console_mutex);
-        wprintf(L"Error: Failed to initialize COM in worker thread. HR=0x%X\n", hr_com);
-        return;
-    }
-
-    while (true) {
-        size_t index = task_index->fetch_add(1);
-        if (index >= filesToProcess->size()) {
-            break;
-        }
-
-        const std::wstring& inputFile = (*filesToProcess)[index];
-        const WCHAR* fileName = PathFindFileNameW(inputFile.c_str());
-
-        WCHAR finalOutPath[MAX_PATH];
-        PathCchCombine(finalOutPath, MAX_PATH, outputDir->c_str(), fileName);
-        PathCchRenameExtension(finalOutPath, MAX_PATH, targetExtension); // 使用传入的目标后缀
-
-        std::wstring tempOutPath = std::wstring(finalOutPath) + L".tmp";
-
-        // 调用通用的转换函数
-        HRESULT hr = ConvertImage(inputFile.c_str(), tempOutPath.c_str(), quality, *pTargetEncoderGuid);
-
-        bool final_success = false;
-        std::wstring status_message;
-
-        if (SUCCEEDED(hr)) {
-            DeleteFileW(finalOutPath);
-            if (MoveFileW(tempOutPath.c_str(), finalOutPath)) {
-                final_success = true;
-                status_message = L"OK";
-            }
-            else {
-                DWORD lastError = GetLastError();
-                if (lastError == ERROR_ACCESS_DENIED) {
-                    status_message = L"FAILED (Permission Denied to Finalize)";
-                }
-                else {
-                    wchar_t buffer[64];
-                    swprintf_s(buffer, 64, L"FAILED (Move Error: %lu)", lastError);
-                    status_message = buffer;
-                }
-                DeleteFileW(tempOutPath.c_str());
-            }
-        }
-        else {
-            if (hr == E_ACCESSDENIED) { status_message = L"FAILED (Permission Denied)"; }
-            else if (hr == HRESULT_FROM_WIN32(ERROR_DISK_FULL)) { status_message = L"FAILED (Disk Full)"; }
-            else if (hr == WINCODEC_ERR_BADHEADER) { status_message = L"FAILED (Corrupt Input File)"; }
-            else {
-                wchar_t buffer[64];
-                swprintf_s(buffer, 64, L"FAILED (Code: 0x%08X)", static_cast<unsigned int>(hr));
-                status_message = buffer;
-            }
-            DeleteFileW(tempOutPath.c_str());
-        }
-
-        {
-            std::lock_guard<std::mutex> lock(console_mutex);
-            // 优化输出，显示转换方向
-            wprintf(L"[%zu/%zu] Converting %s -> %s ... %s\n",
-                index + 1, filesToProcess->size(),
-                PathFindFileNameW(inputFile.c_str()),
-                PathFindFileNameW(finalOutPath),
-                status_message.c_str());
-        }
-
-        if (final_success) {
-            success_count->fetch_add(1);
-        }
-        else {
-            fail_count->fetch_add(1);
-        }
+bool ParseCountArg(const wchar_t* text, unsigned& value); // 新增：解析线程数等正整数参数
+
+// 解析 "1,2,4,8" 形式的线程数列表
+bool ParseThreadList(const wchar_t* text, std::vector<unsigned>& counts) {
+    counts.clear();
+    const wchar_t* p = text;
+    while (*p) {
+        wchar_t* end = nullptr;
+        unsigned long value = wcstoul(p, &end, 10);
+        if (end == p || value == 0 || value > 4096) return false;
+        counts.push_back(static_cast<unsigned>(value));
+        p = (*end == L',') ? end + 1 : end;
+        if (*end != L',' && *end != L'\0') return false;
     }
-
-    CoUninitialize();
+    return !counts.empty();
 }
 
 // === 修改：主函数wmain，负责模式调度 ===
@@ -131,24 +24,29 @@ int wmain(int argc, wchar_t* argv[]) {
     HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
     if (FAILED(hr)) { wprintf(L"Failed to initialize COM. HR = 0x%X\n", hr); return 1; }
 
-    if (!CheckHevcEncoderAvailability()) {
-        wprintf(L"\nError: HEIC/HEVC component is unavailable or not fully functional on this system.\n");
-        wprintf(L"This program requires the official \"HEVC Video Extensions\" to read/write HEIC files.\n\n");
-        wprintf(L"Please install it from the Microsoft Store. Trying the free version first is recommended:\n");
-        wprintf(L"1. (Free) HEVC Video Extensions from Device Manufacturer:\n   https://www.microsoft.com/store/productId/9N4WGH0Z6VHQ\n\n");
-        wprintf(L"2. (Paid Alternative) HEVC Video Extensions:\n   https://www.microsoft.com/store/productId/9NMZLZ57R3T7\n\n");
-        wprintf(L"After installation, please run this program again.\n");
-        CoUninitialize();
-        system("pause");
-        return 1;
-    }
-
     if (argc <= 1) { ShowHelp(argv[0]); CoUninitialize(); return 1; }
 
     std::vector<std::wstring> inputPaths;
     std::wstring outputDir;
     float quality = -1.0f;
     ConversionMode mode = ConversionMode::ToHeic; // 默认模式：转为HEIC
+    PipelineConfig config; // 新增：流水线各阶段线程数，0 表示按核心数自动决定
+    bool recursive = false;  // 新增：递归遍历子目录并在输出目录中重建目录结构
+    bool incremental = false; // 新增：跳过自上次转换后未变化的文件
+    bool resume = false;      // 新增：继续被中断的上一次运行
+    bool dedup = false;       // 新增：内容相同的输入只编码一次
+    bool dedupCopy = false;   // 新增：--dedup copy，复制而不是硬链接
+    std::wstring metricsPath; // 新增：逐文件指标的 JSON lines 文件
+    bool skipProbe = false;   // 新增：不做 HEVC 探测，缺少组件时由实际转换的失败报告
+    bool watch = false;       // 新增：初始扫描后继续监视输入目录
+    unsigned watchQuietMs = 200;
+    unsigned shardIndex = 0, shardCount = 0; // 新增：--shard k/N，shardCount 为 0 表示不分片
+    std::wstring leaseDir;    // 新增：工作租约目录，多个节点共享
+    OutputLevel outputLevel = OutputLevel::Normal;
+    bool benchMode = false;  // 新增：基准测试模式
+    bool autoWorkers = true; // 新增：未指定 -j 或 --encode-threads 时自动调整编码线程数
+    BenchmarkOptions benchOptions;
+    unsigned scanThreads = 0;
 
     for (int i = 1; i < argc; ++i) {
         std::wstring arg = argv[i];
@@ -166,98 +64,271 @@ int wmain(int argc, wchar_t* argv[]) {
                 }
             }
         }
+        // 新增：流水线各阶段的线程数与队列深度
+        else if (arg == L"--io-threads") { if (i + 1 < argc && !ParseCountArg(argv[++i], config.ioThreads)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--decode-threads") { if (i + 1 < argc && !ParseCountArg(argv[++i], config.decodeThreads)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--encode-threads") { if (i + 1 < argc && !ParseCountArg(argv[++i], config.encodeThreads)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--write-threads") { if (i + 1 < argc && !ParseCountArg(argv[++i], config.writeThreads)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--order") {
+            if (i + 1 < argc) {
+                std::wstring order = argv[++i];
+                if (order == L"size") { config.largestFirst = true; }
+                else if (order == L"scan") { config.largestFirst = false; }
+                else { wprintf(L"Warning: Invalid value for %s. Using 'size'.\n", arg.c_str()); }
+            }
+        }
+        else if (arg == L"--thumbnail") { if (i + 1 < argc && !ParseCountArg(argv[++i], config.thumbnailSize)) { wprintf(L"Warning: Invalid value for %s. Ignored.\n", arg.c_str()); config.thumbnailSize = 0; } }
+        else if (arg == L"--preview") { if (i + 1 < argc && !ParseCountArg(argv[++i], config.previewSize)) { wprintf(L"Warning: Invalid value for %s. Ignored.\n", arg.c_str()); config.previewSize = 0; } }
+        else if (arg == L"--sidecar") { config.thumbnailSidecar = true; }
+        else if (arg == L"--strip-metadata") { config.copyMetadata = false; }
+        else if (arg == L"--target-size") { if (i + 1 < argc) { try { const unsigned long long value = std::stoull(argv[++i]); if (value == 0 || value > MAXDWORD / 1024) { throw std::out_of_range("target-size"); } config.targetSize = value * 1024; } catch (const std::exception&) { wprintf(L"Warning: Invalid value for %s. Ignored.\n", arg.c_str()); config.targetSize = 0; } } }
+        else if (arg == L"--grid-tile") { if (i + 1 < argc) { try { const unsigned long value = std::stoul(argv[++i]); if (value != 0 && (value < 64 || value > 8192)) { throw std::out_of_range("grid-tile"); } config.gridTileSize = static_cast<UINT>(value); } catch (const std::exception&) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } } }
+        else if (arg == L"--max-dimension") { if (i + 1 < argc) { try { const unsigned long value = std::stoul(argv[++i]); if (value == 0 || value > 65535) { throw std::out_of_range("max-dimension"); } config.maxDimension = static_cast<UINT>(value); } catch (const std::exception&) { wprintf(L"Warning: Invalid value for %s. Ignored.\n", arg.c_str()); config.maxDimension = 0; } } }
+        else if (arg == L"--gpu") { if (i + 1 < argc) { try { config.gpuIndex = std::stoi(argv[++i]); if (config.gpuIndex < 0) { throw std::invalid_argument("gpu"); } } catch (const std::exception&) { wprintf(L"Warning: Invalid value for %s. Using WIC.\n", arg.c_str()); config.gpuIndex = -1; } } }
+        else if (arg == L"--max-memory") { if (i + 1 < argc) { try { const unsigned long long value = std::stoull(argv[++i]); if (value > ULLONG_MAX / (1024 * 1024)) { throw std::out_of_range("max-memory"); } config.maxMemory = value * 1024 * 1024; } catch (const std::exception&) { wprintf(L"Warning: Invalid value for %s. Ignored.\n", arg.c_str()); } } }
+        else if (arg == L"--pixel-pool") { if (i + 1 < argc) { try { const unsigned long long value = std::stoull(argv[++i]); if (value > ULLONG_MAX / (1024 * 1024)) { throw std::out_of_range("pixel-pool"); } config.pixelPoolLimit = value * 1024 * 1024; } catch (const std::exception&) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } } }
+        else if (arg == L"--buffer-limit") { if (i + 1 < argc) { try { const unsigned long long value = std::stoull(argv[++i]); if (value > ULLONG_MAX / (1024 * 1024)) { throw std::out_of_range("buffer-limit"); } config.bufferLimit = value * 1024 * 1024; } catch (const std::exception&) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } } }
+        else if (arg == L"-r" || arg == L"--recursive") { recursive = true; }
+        else if (arg == L"--incremental") { incremental = true; }
+        else if (arg == L"--resume") { resume = true; }
+        else if (arg == L"--dedup") { dedup = true; if (i + 1 < argc && (wcscmp(argv[i + 1], L"link") == 0 || wcscmp(argv[i + 1], L"copy") == 0)) { dedupCopy = wcscmp(argv[++i], L"copy") == 0; } }
+        else if (arg == L"--skip-probe") { skipProbe = true; }
+        else if (arg == L"--metrics") { if (i + 1 < argc) { metricsPath = argv[++i]; } }
+        else if (arg == L"--watch") { watch = true; }
+        else if (arg == L"--watch-quiet") { if (i + 1 < argc && !ParseCountArg(argv[++i], watchQuietMs)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--shard") { if (i + 1 < argc) { unsigned k = 0, n = 0; if (swscanf_s(argv[++i], L"%u/%u", &k, &n) == 2 && n > 0 && n <= 65536 && k >= 1 && k <= n) { shardIndex = k - 1; shardCount = n; } else { wprintf(L"Warning: Invalid value for %s. Expected k/N with 1 <= k <= N. Processing all files.\n", arg.c_str()); } } }
+        else if (arg == L"--lease-dir") { if (i + 1 < argc) { leaseDir = argv[++i]; } }
+        else if (arg == L"--quiet") { outputLevel = OutputLevel::Quiet; }
+        else if (arg == L"--bench") { benchMode = true; }
+        else if (arg == L"-j" || arg == L"--jobs") {
+            if (i + 1 < argc) {
+                std::wstring value = argv[++i];
+                if (value == L"auto") { autoWorkers = true; config.encodeThreads = 0; }
+                else if (ParseCountArg(value.c_str(), config.encodeThreads)) { autoWorkers = false; }
+                else { wprintf(L"Warning: Invalid value for %s. Using auto.\n", arg.c_str()); }
+            }
+        }
+        else if (arg == L"--bench-iterations") { if (i + 1 < argc && !ParseCountArg(argv[++i], benchOptions.iterations)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--bench-threads") { if (i + 1 < argc && !ParseThreadList(argv[++i], benchOptions.threadCounts)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--bench-null") { benchOptions.nullOutput = true; }
+        else if (arg == L"--bench-json") { benchOptions.json = true; }
+        else if (arg == L"--bench-report") { if (i + 1 < argc) { benchOptions.reportPath = argv[++i]; } }
+        else if (arg == L"--verbose") { outputLevel = OutputLevel::Verbose; }
+        else if (arg == L"--scan-threads") { if (i + 1 < argc && !ParseCountArg(argv[++i], scanThreads)) { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } }
+        else if (arg == L"--queue-depth") { unsigned depth = 0; if (i + 1 < argc) { if (ParseCountArg(argv[++i], depth)) { config.queueDepth = depth; } else { wprintf(L"Warning: Invalid value for %s. Using default.\n", arg.c_str()); } } }
     }
 
+    // 新增：监视模式总是使用增量清单，重启或通知溢出后重新扫描时跳过已转换的文件
+    if (watch) { incremental = true; }
+    // 新增：租约按分片数划分桶；监视模式下新文件按分片静态归属，不参与租约
+    if (!leaseDir.empty() && shardCount == 0) { wprintf(L"Warning: --lease-dir requires --shard. Ignored.\n"); leaseDir.clear(); }
+    if (!leaseDir.empty() && watch) { wprintf(L"Warning: --lease-dir cannot be combined with --watch. Ignored.\n"); leaseDir.clear(); }
     if (inputPaths.empty() || outputDir.empty()) { wprintf(L"\nError: Both input and output paths must be specified.\n\n"); ShowHelp(argv[0]); CoUninitialize(); return 1; }
+    // 新增：输入输出路径统一转为 \\?\ 扩展长度形式 (含 UNC)，之后拼接出的路径都不受 MAX_PATH 限制
+    {
+        HRESULT hr_path = ToExtendedLengthPath(outputDir, outputDir);
+        for (auto& path : inputPaths) { if (SUCCEEDED(hr_path)) { hr_path = ToExtendedLengthPath(path, path); } }
+        if (FAILED(hr_path)) { wprintf(L"Error: Invalid input or output path (HR=0x%08X).\n", static_cast<unsigned int>(hr_path)); CoUninitialize(); return 1; }
+    }
+    if (!leaseDir.empty()) { HRESULT hr_lease = ToExtendedLengthPath(leaseDir, leaseDir); if (FAILED(hr_lease)) { wprintf(L"Error: Invalid lease directory (HR=0x%08X).\n", static_cast<unsigned int>(hr_lease)); CoUninitialize(); return 1; } }
     if (GetFileAttributesW(outputDir.c_str()) == INVALID_FILE_ATTRIBUTES) { if (!CreateDirectoryW(outputDir.c_str(), NULL)) { wprintf(L"Error: Failed to create output directory: %s\n", outputDir.c_str()); CoUninitialize(); return 1; } }
 
-    // 根据模式确定转换参数
-    const WCHAR* targetExtension;
-    GUID targetEncoderGuid;
+    // 修改：显卡初始化、HEVC 探测与流水线搭建都由转换引擎完成，与 Converter 库接口共用
+    if (config.encodeThreads != 0) autoWorkers = false; // --encode-threads 等同于 -j <n>
+    EngineSettings settings;
+    settings.mode = mode;
+    settings.quality = quality;
+    settings.config = config;
+    settings.autoWorkers = autoWorkers;
+    settings.probe = !skipProbe;
+    settings.outputLevel = outputLevel;
+    ConversionEngine engine(settings);
+    if (FAILED(engine.GpuStatus())) { wprintf(L"Warning: No hardware HEVC encoder available on GPU %d (HR = 0x%X). Using WIC.\n", config.gpuIndex, engine.GpuStatus()); }
+    const std::shared_future<bool>& hevcProbe = engine.Probe();
+    auto failMissingCodec = [&]() {
+        ShowHevcInstallGuidance();
+        engine.Finish();
+        CoUninitialize();
+        system("pause");
+        return 1;
+    };
+
+    Pipeline& pipeline = engine.GetPipeline();
+    const WCHAR* targetExtension = pipeline.targetExtension;
+    wprintf(mode == ConversionMode::ToJpeg ? L"Mode: HEIC -> JPEG\n" : L"Mode: Image -> HEIC\n");
 
-    if (mode == ConversionMode::ToJpeg) {
-        targetExtension = L".jpg";
-        targetEncoderGuid = GUID_ContainerFormatJpeg;
-        wprintf(L"Mode: HEIC -> JPEG\n");
+    const unsigned int num_cores = GetLogicalProcessorCount();
+    config = engine.Config(); // 已按核心数与 NUMA 节点补全
+    if (scanThreads == 0) scanThreads = recursive ? std::min(8u, num_cores) : 1u;
+
+    if (benchMode) {
+        if (hevcProbe.valid() && !hevcProbe.get()) { return failMissingCodec(); }
+        int benchResult = RunBenchmark(benchOptions, inputPaths, mode, recursive, outputDir, pipeline.targetEncoderGuid, targetExtension, quality, num_cores);
+        engine.Finish();
+        CoUninitialize();
+        return benchResult;
     }
-    else { // 默认 ToHeic
-        targetExtension = L".heic";
-        targetEncoderGuid = GUID_ContainerFormatHeif;
-        wprintf(L"Mode: Image -> HEIC\n");
+    if (engine.LaneCount() > 1 && outputLevel == OutputLevel::Verbose) wprintf(L"NUMA: %zu nodes/groups, decode and encode kept node-local.\n", engine.LaneCount());
+    if (outputLevel == OutputLevel::Verbose) wprintf(L"Pixel conversion kernels: %s\n", GetPixelKernels().name);
+
+    if (outputLevel != OutputLevel::Quiet) wprintf(L"\nScanning inputs. Starting pipeline: %u I/O, %u decode, %s%u encode, %u write threads (queue depth %zu)...\n\n",
+        config.ioThreads, config.decodeThreads, pipeline.encodeGate ? L"up to " : L"", config.encodeThreads, config.writeThreads, config.queueDepth);
+
+    pipeline.shard.index = shardIndex;
+    pipeline.shard.count = shardCount;
+    pipeline.shard.outputRootLength = outputDir.size();
+    // 新增：分片时各节点共享输出目录，清单与日志按分片分开，避免多个进程写同一文件
+    std::wstring stateSuffix;
+    if (shardCount > 0) { WCHAR suffix[48]; swprintf_s(suffix, L".shard-%u-of-%u", shardIndex + 1, shardCount); stateSuffix = suffix; }
+    if (outputLevel == OutputLevel::Verbose) wprintf(L"Decoded bitmap memory capped at %llu MB.\n", pipeline.pixelPool->Capacity() / (1024 * 1024));
+
+    ProgressReporter& reporter = engine.Reporter();
+    // 新增：ETW 事件总是可用 (无会话监听时几乎没有开销)，--metrics 时另写 JSON lines
+    MetricsSink metrics;
+    if (!metricsPath.empty()) {
+        HRESULT hr_metrics = metrics.OpenFile(metricsPath);
+        if (FAILED(hr_metrics)) { wprintf(L"Warning: Failed to open metrics file %s (HR=0x%08X).\n", metricsPath.c_str(), static_cast<unsigned int>(hr_metrics)); }
     }
+    reporter.SetMetrics(&metrics);
 
-    std::vector<std::wstring> filesToProcess;
-    for (const auto& path : inputPaths) {
-        DWORD attributes = GetFileAttributesW(path.c_str());
-        if (attributes == INVALID_FILE_ATTRIBUTES) { wprintf(L"Warning: Input path not found, skipping: %s\n", path.c_str()); continue; }
-        if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
-            std::wstring searchPath = path + L"\\*";
-            WIN32_FIND_DATAW findData;
-            HANDLE hFind = FindFirstFileW(searchPath.c_str(), &findData);
-            if (hFind != INVALID_HANDLE_VALUE) {
-                do { if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) { std::wstring fullPath = path + L"\\" + findData.cFileName; if (IsSupportedInputFile(fullPath, mode)) { filesToProcess.push_back(fullPath); } } } while (FindNextFileW(hFind, &findData) != 0);
-                FindClose(hFind);
+    // 修改：租约在清单与日志之前打开，打不开时回退为按分片保存状态
+    WorkLeases leases;
+    if (!leaseDir.empty()) {
+        HRESULT hr_lease = leases.Open(leaseDir, shardIndex, shardCount);
+        if (FAILED(hr_lease)) { wprintf(L"Warning: Failed to open lease directory %s (HR=0x%08X). Using the static shard only.\n", leaseDir.c_str(), static_cast<unsigned int>(hr_lease)); leaseDir.clear(); }
+    }
+    // 新增：--lease-dir 时清单与日志按桶保存，在领到桶时打开；桶被其他节点接手时增量与续传状态随桶转移
+    const size_t bucketCount = leaseDir.empty() ? 0 : static_cast<size_t>(shardCount) * ShardFilter::kBucketsPerShard;
+    std::vector<std::unique_ptr<ConversionManifest>> bucketManifests(bucketCount);
+    std::vector<std::unique_ptr<RunJournal>> bucketJournals(bucketCount);
+    size_t bucketResumed = 0;
+    if (bucketCount > 0) {
+        pipeline.bucketJournals.assign(bucketCount, nullptr);
+        if (incremental) { pipeline.bucketManifests.assign(bucketCount, nullptr); }
+    }
+    auto openBucketState = [&](size_t bucket) {
+        WCHAR suffix[48];
+        swprintf_s(suffix, L".bucket-%zu-of-%zu", bucket + 1, bucketCount);
+        const std::wstring basePath = outputDir + L"\\.heicconv" + suffix;
+        if (incremental) {
+            std::unique_ptr<ConversionManifest> bucketManifest(new ConversionManifest());
+            HRESULT hr_manifest = bucketManifest->Open(basePath + L".manifest");
+            if (SUCCEEDED(hr_manifest)) { pipeline.bucketManifests[bucket] = bucketManifest.get(); bucketManifests[bucket] = std::move(bucketManifest); }
+            else { wprintf(L"Warning: Failed to open manifest %s.manifest (HR=0x%08X). Converting all files in this bucket.\n", basePath.c_str(), static_cast<unsigned int>(hr_manifest)); }
+        }
+        std::unique_ptr<RunJournal> bucketJournal(new RunJournal());
+        size_t resumed = 0;
+        HRESULT hr_journal = bucketJournal->Open(basePath + L".journal", MakeJournalKey(pipeline), resume, resumed);
+        if (SUCCEEDED(hr_journal)) { bucketResumed += resumed; pipeline.bucketJournals[bucket] = bucketJournal.get(); bucketJournals[bucket] = std::move(bucketJournal); }
+        else { wprintf(L"Warning: Failed to open journal %s.journal (HR=0x%08X). This bucket cannot be resumed.\n", basePath.c_str(), static_cast<unsigned int>(hr_journal)); }
+    };
+
+    ConversionManifest manifest;
+    if (incremental && bucketCount == 0) {
+        std::wstring manifestPath = outputDir + L"\\.heicconv" + stateSuffix + L".manifest";
+        HRESULT hr_manifest = manifest.Open(manifestPath, watch);
+        if (SUCCEEDED(hr_manifest)) { pipeline.manifest = &manifest; }
+        else { wprintf(L"Warning: Failed to open manifest %s (HR=0x%08X). Converting all files.\n", manifestPath.c_str(), static_cast<unsigned int>(hr_manifest)); }
+    }
+    // 新增：每次运行都写运行日志，--resume 时先读入被中断的运行已完成的文件
+    RunJournal journal;
+    if (bucketCount == 0) {
+        const std::wstring journalPath = outputDir + L"\\.heicconv" + stateSuffix + L".journal";
+        size_t resumed = 0;
+        HRESULT hr_journal = journal.Open(journalPath, MakeJournalKey(pipeline), resume, resumed);
+        if (SUCCEEDED(hr_journal)) {
+            pipeline.journal = &journal;
+            if (resume && outputLevel != OutputLevel::Quiet) wprintf(L"Resuming: %zu files completed by the previous run will be skipped.\n", resumed);
+        }
+        else { wprintf(L"Warning: Failed to open journal %s (HR=0x%08X). This run cannot be resumed.\n", journalPath.c_str(), static_cast<unsigned int>(hr_journal)); }
+    }
+    // 新增：内容去重缓存，与清单、日志一样按分片分开保存
+    DedupCache dedupCache;
+    if (dedup) {
+        const std::wstring dedupPath = outputDir + L"\\.heicconv" + stateSuffix + L".dedup";
+        HRESULT hr_dedup = dedupCache.Open(dedupPath, MakeJournalKey(pipeline), dedupCopy);
+        if (SUCCEEDED(hr_dedup)) { pipeline.dedup = &dedupCache; }
+        else { wprintf(L"Warning: Failed to open dedup cache %s (HR=0x%08X). Converting all files.\n", dedupPath.c_str(), static_cast<unsigned int>(hr_dedup)); }
+    }
+    // 新增：清理被中断的运行遗留的临时文件，一次遍历目录完成
+    const size_t orphans = SweepOrphanedTempFiles(outputDir, targetExtension, recursive);
+    if (orphans && outputLevel != OutputLevel::Quiet) wprintf(L"Removed %zu orphaned temporary files.\n", orphans);
+    engine.Start();
+
+    // 主线程作为生产者：各阶段线程已启动，找到第一个文件即开始转换
+    // 新增：--lease-dir 时按批领取桶；预读队列满时投递阻塞，因此只在本节点有余力时才领取下一批，剩余的桶留给其他节点。
+    // 修改：输入目录只遍历一次，第一批桶的文件边扫描边投递，其余按桶暂存，之后每批只从内存中取出
+    auto initialScan = [&]() {
+        if (!leaseDir.empty()) {
+            LeasedInputs leased(bucketCount);
+            std::vector<bool> wave;
+            auto claimWave = [&]() {
+                if (!leases.ClaimWave(2, wave)) return false;
+                for (size_t bucket = 0; bucket < bucketCount; ++bucket) { if (wave[bucket]) { openBucketState(bucket); } }
+                leased.Claim(pipeline, wave);
+                return true;
+            };
+            if (claimWave()) {
+                pipeline.shard.leased = true;
+                pipeline.leasedInputs = &leased;
+                EnumerateInputs(inputPaths, mode, recursive, scanThreads, outputDir, pipeline);
+                pipeline.leasedInputs = nullptr;
+                pipeline.shard.leased = false;
+                while (claimWave()) {}
             }
         }
-        else { if (IsSupportedInputFile(path, mode)) { filesToProcess.push_back(path); } else { wprintf(L"Warning: Unsupported input file for this mode, skipping: %s\n", path.c_str()); } }
+        else { EnumerateInputs(inputPaths, mode, recursive, scanThreads, outputDir, pipeline); }
+        return !hevcProbe.valid() || hevcProbe.get();
+    };
+    if (watch) { WatchInputs(inputPaths, mode, recursive, outputDir, watchQuietMs, pipeline, initialScan); }
+    else { initialScan(); }
+    engine.Finish(); // 等待在途的转换与异步写入上报结果
+    leases.Finish(reporter.Failed() == 0); // 新增：有失败时释放租约，让这些桶可被重新领取
+    manifest.Close();
+    // 有失败时保留日志，--resume 只重试失败的文件
+    journal.Close(reporter.Failed() == 0);
+    for (auto& bucketManifest : bucketManifests) { if (bucketManifest) { bucketManifest->Close(); } }
+    for (auto& bucketJournal : bucketJournals) { if (bucketJournal) { bucketJournal->Close(reporter.Failed() == 0); } }
+    if (resume && bucketResumed > 0 && outputLevel != OutputLevel::Quiet) wprintf(L"Resumed: %zu files completed by the previous run were skipped.\n", bucketResumed);
+    dedupCache.Close();
+    // 新增：探测失败，或跳过探测/缓存过时而实际转换全部因缺少组件失败，都给出安装指引
+    // 修改：只有编码器一侧的失败才计入，且只在探测被跳过或结果来自缓存时采信；损坏或无法识别的输入不再被当作缺少组件
+    const bool probeFailed = hevcProbe.valid() && !hevcProbe.get();
+    const bool probeUnverified = !hevcProbe.valid() || engine.ProbeFromCache();
+    if (probeFailed || (probeUnverified && pipeline.codecFailures.load() > 0 && reporter.Converted() == 0)) {
+        if (!probeFailed) { ClearHevcProbe(); }
+        return failMissingCodec();
+    }
+    if (pipeline.encodeGate && outputLevel == OutputLevel::Verbose) {
+        if (engine.TunedWorkers() > 0) { wprintf(L"Auto tuning settled on %u encode threads.\n", engine.TunedWorkers()); }
+        else { wprintf(L"Auto tuning did not finish before the inputs ran out.\n"); }
     }
 
-    if (filesToProcess.empty()) { wprintf(L"\nNo supported image files found to process for the selected mode.\n"); CoUninitialize(); return 0; }
-
-    SYSTEM_INFO sysInfo;
-    GetSystemInfo(&sysInfo);
-    const unsigned int num_threads = std::max(1u, (unsigned int)sysInfo.dwNumberOfProcessors);
-    wprintf(L"\nFound %zu files. Starting conversion on %u threads...\n\n", filesToProcess.size(), num_threads);
-
-    std::atomic<size_t> task_index(0);
-    std::atomic<int> success_count(0);
-    std::atomic<int> fail_count(0);
-
-    std::vector<std::thread> threads;
-    for (unsigned int i = 0; i < num_threads; ++i) { threads.emplace_back(Worker, &filesToProcess, &outputDir, &task_index, &success_count, &fail_count, quality, targetExtension, &targetEncoderGuid); }
-    for (auto& t : threads) { if (t.joinable()) { t.join(); } }
+    // 新增：分片时先汇总各节点的统计；本节点没有分到文件时同样上报
+    if (shardCount > 0) {
+        if (leases.Stolen() > 0 && outputLevel != OutputLevel::Quiet) wprintf(L"Took over %zu work buckets from other shards.\n", leases.Stolen());
+        if (leases.Lost() > 0) wprintf(L"Warning: %zu work bucket leases expired and were taken over by other nodes; their files may have been converted twice.\n", leases.Lost());
+        ReportShardTotals(leaseDir.empty() ? outputDir + L"\\.heicconv.shards" : leaseDir, shardIndex, shardCount, reporter.Converted(), reporter.Failed(), reporter.Skipped());
+    }
+    if (pipeline.dedup && dedupCache.Linked() + dedupCache.Copied() > 0 && outputLevel != OutputLevel::Quiet) {
+        wprintf(L"Duplicate inputs: %zu outputs hard-linked, %zu copied instead of encoded.\n", dedupCache.Linked(), dedupCache.Copied());
+    }
+    if (pipeline.discoveredFiles.load() == 0) { wprintf(L"\nNo supported image files found to process for the selected mode.\n"); CoUninitialize(); return 0; }
 
-    wprintf(L"\nConversion finished. %d successful, %d failed.\n", success_count.load(), fail_count.load());
+    const int success_count = reporter.Converted();
+    const int fail_count = reporter.Failed();
+    const int skip_count = reporter.Skipped();
+    if (skip_count > 0) { wprintf(L"\nConversion finished. %d successful, %d failed, %d unchanged.\n", success_count, fail_count, skip_count); }
+    else { wprintf(L"\nConversion finished. %d successful, %d failed.\n", success_count, fail_count); }
     CoUninitialize();
     return 0;
 }
 
-
-// --- 辅助函数实现 ---
-
-bool CheckHevcEncoderAvailability() {
-    ComPtr<IWICImagingFactory> pFactory;
-    HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&pFactory));
-    if (FAILED(hr)) return false;
-    ComPtr<IWICBitmapEncoder> pEncoder;
-    hr = pFactory->CreateEncoder(GUID_ContainerFormatHeif, NULL, &pEncoder);
-    if (FAILED(hr)) return false;
-    ComPtr<IStream> pStream;
-    hr = CreateStreamOnHGlobal(NULL, TRUE, &pStream);
-    if (FAILED(hr)) return false;
-    hr = pEncoder->Initialize(pStream.Get(), WICBitmapEncoderNoCache);
-    if (FAILED(hr)) return false;
-    ComPtr<IWICBitmapFrameEncode> pFrameEncode;
-    ComPtr<IPropertyBag2> pPropertyBag;
-    hr = pEncoder->CreateNewFrame(&pFrameEncode, &pPropertyBag);
-    if (FAILED(hr)) return false;
-    hr = pFrameEncode->Initialize(pPropertyBag.Get());
-    if (FAILED(hr)) return false;
-    ComPtr<IWICBitmap> pBitmap;
-    hr = pFactory->CreateBitmap(1, 1, GUID_WICPixelFormat32bppPBGRA, WICBitmapCacheOnDemand, &pBitmap);
-    if (FAILED(hr)) return false;
-    hr = pFrameEncode->WriteSource(pBitmap.Get(), NULL);
-    if (FAILED(hr)) return false;
-    hr = pFrameEncode->Commit();
-    if (FAILED(hr)) return false;
-    return true;
-}
-
 // === 修改：ShowHelp函数，增加新参数说明 ===
 void ShowHelp(const WCHAR* appName) {
     wprintf(L"HEIC Converter - Converts images to/from HEIC using Windows API.\n\n");
     wprintf(L"Usage:\n");
-    wprintf(L"  %s -i <inputs...> -o <output_dir> [--to format] [-q quality]\n\n", PathFindFileNameW(appName));
+    wprintf(L"  %s -i <inputs...> -o <output_dir> [--to format] [-q quality] [-r]\n\n", PathFindFileNameW(appName));
     wprintf(L"Arguments:\n");
     wprintf(L"  -i, --input   One or more input files or directories.\n");
     wprintf(L"  -o, --output  The directory where converted files will be saved.\n");
@@ -265,91 +336,113 @@ void ShowHelp(const WCHAR* appName) {
     wprintf(L"                Default is 'heic'.\n");
     wprintf(L"  -q, --quality (Optional) Set the quality of the output image (0-100).\n");
     wprintf(L"                Default is a high quality setting.\n");
+    wprintf(L"  -r, --recursive\n");
+    wprintf(L"                (Optional) Also convert files in subdirectories and recreate the\n");
+    wprintf(L"                directory structure under the output directory.\n");
+    wprintf(L"  --scan-threads <n>\n");
+    wprintf(L"                (Optional) Threads used to walk directories in recursive mode.\n");
+    wprintf(L"  --incremental (Optional) Skip files whose size, modification time and output\n");
+    wprintf(L"                settings match the last successful conversion. The state is\n");
+    wprintf(L"                kept in .heicconv.manifest in the output directory.\n");
+    wprintf(L"  --resume      (Optional) Continue an interrupted run: files it completed (listed\n");
+    wprintf(L"                in .heicconv.journal) are skipped without checking their outputs.\n");
+    wprintf(L"                A finished run with failures can be resumed to retry only those.\n");
+    wprintf(L"  --dedup [link|copy]\n");
+    wprintf(L"                (Optional) Encode inputs with identical content only once; the other\n");
+    wprintf(L"                copies get a hard link (default) or a copy of the first output. Known\n");
+    wprintf(L"                contents are kept in .heicconv.dedup, so later runs reuse them too.\n");
+    wprintf(L"  --watch       (Optional) After the initial pass keep running and convert new or\n");
+    wprintf(L"                changed files in the input directories as they arrive, until Ctrl+C.\n");
+    wprintf(L"                Implies --incremental.\n");
+    wprintf(L"  --watch-quiet <ms>\n");
+    wprintf(L"                (Optional) A file is converted once it has not changed for <ms> and\n");
+    wprintf(L"                its writer has closed it. Default is 200.\n");
+    wprintf(L"  --shard <k/N> (Optional) Process only shard k of N (1-based) of the inputs, chosen by a\n");
+    wprintf(L"                stable hash of each file's relative path, so that several machines can\n");
+    wprintf(L"                share one job and reruns go to the same machine. Each shard keeps its own\n");
+    wprintf(L"                manifest and journal and reports totals across all shards when it ends.\n");
+    wprintf(L"  --lease-dir <dir>\n");
+    wprintf(L"                (Optional) With --shard, coordinate the machines through leases in a\n");
+    wprintf(L"                shared directory: a machine that finishes its shard takes over work the\n");
+    wprintf(L"                others have not started yet. Use an empty directory for each new job.\n");
+    wprintf(L"  --skip-probe  (Optional) Skip the HEVC encoder check at startup. A successful check\n");
+    wprintf(L"                is cached per user until the codec components change.\n");
+    wprintf(L"  --metrics <file>\n");
+    wprintf(L"                (Optional) Append one JSON line per file: outcome, bytes, megapixels,\n");
+    wprintf(L"                compression ratio, per-stage and queue wait times. The same fields are\n");
+    wprintf(L"                always available as ETW events of the provider *ImageToHeicConverter.\n");
+    wprintf(L"  --quiet       (Optional) Only print the final summary.\n");
+    wprintf(L"  --verbose     (Optional) Print one line per file instead of a progress line.\n");
+    wprintf(L"  --bench       (Optional) Benchmark the inputs instead of a normal run and print\n");
+    wprintf(L"                per-stage latency percentiles and throughput per thread count.\n");
+    wprintf(L"    --bench-iterations <n>   Passes over the corpus per thread count (default 3).\n");
+    wprintf(L"    --bench-threads <list>   Comma separated thread counts, e.g. 1,4,8.\n");
+    wprintf(L"    --bench-null             Encode to a null stream to measure codec cost only.\n");
+    wprintf(L"    --bench-json             Write JSON instead of CSV.\n");
+    wprintf(L"    --bench-report <file>    Write the report to a file instead of the console.\n");
+    wprintf(L"  -j <n|auto>   (Optional) Number of concurrent encoders. 'auto' (default) measures\n");
+    wprintf(L"                throughput on the first few hundred files and keeps the best count.\n");
+    wprintf(L"  --io-threads <n>, --decode-threads <n>, --encode-threads <n>, --write-threads <n>\n");
+    wprintf(L"                (Optional) Thread count of each pipeline stage. Default depends on CPU cores.\n");
+    wprintf(L"  --queue-depth <n>\n");
+    wprintf(L"                (Optional) Max images queued between two stages. Caps memory usage.\n");
+    wprintf(L"  --buffer-limit <MB>\n");
+    wprintf(L"                (Optional) Files up to this size are read, encoded and written\n");
+    wprintf(L"                entirely in memory. Larger files use a temp file. 0 = always\n");
+    wprintf(L"                use temp files. Default is 256.\n");
+    wprintf(L"  --thumbnail <px>\n");
+    wprintf(L"                (Optional) Embed a thumbnail whose long edge is <px>, scaled from the\n");
+    wprintf(L"                already decoded image (or taken from the source's own thumbnail).\n");
+    wprintf(L"  --preview <px>\n");
+    wprintf(L"                (Optional) Also produce a larger preview image (sidecar only).\n");
+    wprintf(L"  --sidecar     (Optional) Write thumbnail/preview as name.thumb.jpg / name.preview.jpg.\n");
+    wprintf(L"  --max-dimension <px>\n");
+    wprintf(L"                (Optional) Downscale images whose long edge exceeds <px> before encoding\n");
+    wprintf(L"                (area averaging, aspect ratio kept). Smaller images are not enlarged.\n");
+    wprintf(L"  --grid-tile <px>\n");
+    wprintf(L"                (Optional) Images beyond the HEVC size limit are read in strips and\n");
+    wprintf(L"                encoded as a HEIF grid of <px> tiles spread over all encode threads.\n");
+    wprintf(L"                Default is 512; 0 disables grid encoding. Grid images use the fixed\n");
+    wprintf(L"                quality and WIC: --target-size and --gpu do not apply (noted per file).\n");
+    wprintf(L"  --target-size <KB>\n");
+    wprintf(L"                (Optional) Keep each output at or under <KB>. The quality is searched\n");
+    wprintf(L"                with a few in-memory encodes (capped by -q when given), starting from\n");
+    wprintf(L"                the quality that fit similar images. Animations use the fixed quality.\n");
+    wprintf(L"  --strip-metadata\n");
+    wprintf(L"                (Optional) Do not copy EXIF/XMP/ICC to the output. By default metadata\n");
+    wprintf(L"                blocks are copied as-is; pixels are rotated upright when the EXIF\n");
+    wprintf(L"                orientation would otherwise be lost (HEIC output or stripped metadata).\n");
+    wprintf(L"  --gpu <index> (Optional) Encode HEIC on the hardware HEVC encoder of display adapter\n");
+    wprintf(L"                <index> (0 = first) through Media Foundation. Colour conversion runs on\n");
+    wprintf(L"                the GPU. Images the encoder rejects, animations and images with an\n");
+    wprintf(L"                embedded thumbnail or EXIF/XMP/ICC metadata are encoded with WIC.\n");
+    wprintf(L"  --order <size|scan>\n");
+    wprintf(L"                (Optional) 'size' (default) starts the most expensive images first so the\n");
+    wprintf(L"                batch does not end on one large file; 'scan' keeps directory order.\n");
+    wprintf(L"  --max-memory <MB>\n");
+    wprintf(L"                (Optional) Memory budget for images in flight. Each image's working set\n");
+    wprintf(L"                is estimated from its dimensions before decoding and admitted only when\n");
+    wprintf(L"                it fits; smaller images are processed while large ones wait.\n");
+    wprintf(L"  --pixel-pool <MB>\n");
+    wprintf(L"                (Optional) Upper bound for decoded bitmaps held in memory at once.\n");
+    wprintf(L"                Buffers are reused between images. Default is half of physical memory.\n");
     wprintf(L"  -h, --help    Show this help message.\n\n");
     wprintf(L"Examples:\n");
     wprintf(L"  1. Convert JPG/PNG to HEIC (default mode):\n");
     wprintf(L"     %s -i C:\\pics -o D:\\HEIC_Output\n\n", PathFindFileNameW(appName));
     wprintf(L"  2. Convert HEIC to JPEG with 90 quality:\n");
-    wprintf(L"     %s -i C:\\heic_pics -o D:\\JPEG_Output --to jpeg -q 90\n", PathFindFileNameW(appName));
-}
-
-// === 修改：IsSupportedImageFile函数，根据模式判断输入 ===
-bool IsSupportedInputFile(const std::wstring& fileName, ConversionMode mode) {
-    std::wstring extension = PathFindExtensionW(fileName.c_str());
-    if (extension.empty()) return false;
-
-    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-
-    if (mode == ConversionMode::ToHeic) {
-        const std::vector<std::wstring> supportedExtensions = { L".jpg", L".jpeg", L".png", L".bmp", L".tiff", L".gif" };
-        for (const auto& ext : supportedExtensions) {
-            if (extension == ext) return true;
-        }
-    }
-    else if (mode == ConversionMode::ToJpeg) {
-        // 根据要求，转为JPEG时，输入必须是HEIC
-        if (extension == L".heic") {
-            return true;
-        }
-    }
-    return false;
+    wprintf(L"     %s -i C:\\heic_pics -o D:\\JPEG_Output --to jpeg -q 90\n\n", PathFindFileNameW(appName));
+    wprintf(L"  3. Convert a whole photo archive, keeping its folder structure:\n");
+    wprintf(L"     %s -i E:\\Archive -o F:\\Archive_HEIC -r\n", PathFindFileNameW(appName));
 }
 
-// === 重构：通用的核心转换函数 (替换掉旧的ConvertImageToHeic) ===
-HRESULT ConvertImage(const WCHAR* inputPath, const WCHAR* outputPath, float quality, const GUID& targetEncoderGuid) {
-    HRESULT hr = S_OK;
-    ComPtr<IWICImagingFactory> pFactory;
-    hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&pFactory));
-    if (FAILED(hr)) return hr;
-
-    ComPtr<IWICBitmapDecoder> pDecoder;
-    hr = pFactory->CreateDecoderFromFilename(inputPath, NULL, GENERIC_READ, WICDecodeMetadataCacheOnLoad, &pDecoder);
-    if (FAILED(hr)) return hr;
-
-    ComPtr<IWICBitmapFrameDecode> pFrameDecode;
-    hr = pDecoder->GetFrame(0, &pFrameDecode);
-    if (FAILED(hr)) return hr;
-
-    ComPtr<IWICStream> pStream;
-    hr = pFactory->CreateStream(&pStream);
-    if (FAILED(hr)) return hr;
-    hr = pStream->InitializeFromFilename(outputPath, GENERIC_WRITE);
-    if (FAILED(hr)) return hr;
-
-    ComPtr<IWICBitmapEncoder> pEncoder;
-    // 使用传入的GUID来创建目标编码器
-    hr = pFactory->CreateEncoder(targetEncoderGuid, NULL, &pEncoder);
-    if (FAILED(hr)) return hr;
-
-    hr = pEncoder->Initialize(pStream.Get(), WICBitmapEncoderNoCache);
-    if (FAILED(hr)) return hr;
-
-    ComPtr<IWICBitmapFrameEncode> pFrameEncode;
-    ComPtr<IPropertyBag2> pPropertyBag;
-    hr = pEncoder->CreateNewFrame(&pFrameEncode, &pPropertyBag);
-    if (FAILED(hr)) return hr;
-
-    if (quality >= 0.0f && quality <= 1.0f) {
-        PROPBAG2 option = { 0 };
-        wchar_t propName[] = L"ImageQuality";
-        option.pstrName = propName;
-        VARIANT varValue;
-        VariantInit(&varValue);
-        varValue.vt = VT_R4;
-        varValue.fltVal = quality;
-        hr = pPropertyBag->Write(1, &option, &varValue);
-        if (FAILED(hr)) { /* Warning can be logged here if needed */ }
+// 新增：解析正整数参数
+bool ParseCountArg(const wchar_t* text, unsigned& value) {
+    try {
+        unsigned long parsed = std::stoul(text);
+        if (parsed == 0 || parsed > 4096) return false;
+        value = static_cast<unsigned>(parsed);
+        return true;
     }
-
-    hr = pFrameEncode->Initialize(pPropertyBag.Get());
-    if (FAILED(hr)) return hr;
-
-    hr = pFrameEncode->WriteSource(pFrameDecode.Get(), NULL);
-    if (FAILED(hr)) return hr;
-
-    hr = pFrameEncode->Commit();
-    if (FAILED(hr)) return hr;
-
-    hr = pEncoder->Commit();
-    return hr;
+    catch (const std::exception&) { return false; }
 }
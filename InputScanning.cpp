@@ -0,0 +1,448 @@
+// 输入枚举与 --watch 目录监视
+#include "ConverterInternal.h"
+
+// === 新增：流式枚举输入，边扫描边把文件投递给预读阶段 ===
+void PushInputFile(Pipeline& pipeline, std::wstring fullPath, const std::shared_ptr<const std::wstring>& outputDir, ULONGLONG size, const FILETIME& lastWriteTime) {
+    // 新增：--lease-dir 时先按桶归类，尚未领到的桶暂存
+    size_t bucket = 0;
+    if (pipeline.leasedInputs || !pipeline.bucketJournals.empty()) { bucket = pipeline.shard.Bucket(*outputDir, PathFindFileNameW(fullPath.c_str())); }
+    if (pipeline.leasedInputs && pipeline.leasedInputs->Defer(bucket, fullPath, outputDir, size, lastWriteTime)) return;
+    ImageJobPtr job = std::make_unique<ImageJob>();
+    job->bucket = bucket;
+    job->inputPath = std::move(fullPath);
+    job->outputDir = outputDir;
+    job->sourceSize = size;
+    job->cost = EstimateConversionCost(job->inputPath.c_str(), size);
+    job->sourceWriteTime = (static_cast<ULONGLONG>(lastWriteTime.dwHighDateTime) << 32) | lastWriteTime.dwLowDateTime;
+    SubmitJob(pipeline, std::move(job));
+}
+
+// 新增：输出目录缓存。每个目录只在发现第一个待转换文件时创建一次，缺失的上级目录一并补齐。
+class OutputDirectoryCache {
+public:
+    bool Ensure(const std::wstring& dir) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return EnsureLocked(dir);
+    }
+
+    void MarkExisting(const std::wstring& dir) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        created_.insert(dir);
+    }
+
+private:
+    bool EnsureLocked(const std::wstring& dir) {
+        if (created_.count(dir)) return true;
+        size_t separator = dir.find_last_of(L"\\/");
+        if (separator != std::wstring::npos && separator > 0 && dir[separator - 1] != L':') {
+            if (!EnsureLocked(dir.substr(0, separator))) return false;
+        }
+        if (!CreateDirectoryW(dir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) return false;
+        created_.insert(dir);
+        return true;
+    }
+
+    std::mutex mutex_;
+    std::unordered_set<std::wstring> created_;
+};
+
+// 新增：并行目录遍历。每个线程优先处理自己队列尾部的目录 (深度优先，局部性好)，
+// 自己的队列空了再从其他线程队列头部窃取 (靠近根的大目录)。
+class DirectoryWalker {
+public:
+    DirectoryWalker(Pipeline& pipeline, ConversionMode mode, bool recursive, OutputDirectoryCache& dirCache, unsigned threadCount)
+        : pipeline_(pipeline), mode_(mode), recursive_(recursive), dirCache_(dirCache) {
+        for (unsigned i = 0; i < std::max(1u, threadCount); ++i) { queues_.push_back(std::make_unique<WorkQueue>()); }
+    }
+
+    void AddRoot(const std::wstring& inputDir, const std::shared_ptr<const std::wstring>& outputDir) {
+        Enqueue(0, DirectoryTask{ inputDir, outputDir });
+    }
+
+    // 启动遍历线程并阻塞，直到所有目录都处理完毕
+    void Run() {
+        if (pending_.load() == 0) return;
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < queues_.size(); ++i) { threads.emplace_back(&DirectoryWalker::WalkerThread, this, i); }
+        for (auto& t : threads) { t.join(); }
+    }
+
+private:
+    struct DirectoryTask {
+        std::wstring inputDir;
+        std::shared_ptr<const std::wstring> outputDir;
+    };
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<DirectoryTask> tasks;
+    };
+
+    void Enqueue(unsigned owner, DirectoryTask task) {
+        pending_.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(queues_[owner]->mutex);
+            queues_[owner]->tasks.push_back(std::move(task));
+        }
+        idleCv_.notify_one();
+    }
+
+    bool TryGetTask(unsigned id, DirectoryTask& task) {
+        {
+            WorkQueue& own = *queues_[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues_.size(); ++offset) {
+            WorkQueue& victim = *queues_[(id + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WalkerThread(unsigned id) {
+        DirectoryTask task;
+        while (true) {
+            if (TryGetTask(id, task)) {
+                ScanDirectory(id, task);
+                if (pending_.fetch_sub(1) == 1) { idleCv_.notify_all(); }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idleMutex_);
+            if (pending_.load() == 0) break;
+            idleCv_.wait_for(lock, std::chrono::milliseconds(5));
+        }
+    }
+
+    void ScanDirectory(unsigned id, const DirectoryTask& task) {
+        std::wstring searchPath = task.inputDir + L"\\*";
+        WIN32_FIND_DATAW findData;
+        // FindExInfoBasic 不查询短文件名，LARGE_FETCH 每次系统调用返回更多目录项
+        HANDLE hFind = FindFirstFileExW(searchPath.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        if (hFind == INVALID_HANDLE_VALUE) return;
+
+        bool outputReady = false;
+        do {
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                if (!recursive_ || (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) continue; // 不跟随目录联接，避免循环
+                if (wcscmp(findData.cFileName, L".") == 0 || wcscmp(findData.cFileName, L"..") == 0) continue;
+                Enqueue(id, DirectoryTask{ task.inputDir + L"\\" + findData.cFileName,
+                    std::make_shared<const std::wstring>(*task.outputDir + L"\\" + findData.cFileName) });
+            }
+            else if (IsSupportedInputFile(findData.cFileName, mode_) && pipeline_.shard.Accepts(*task.outputDir, findData.cFileName)) {
+                // 按目录批量创建：只在该目录第一个匹配文件出现时创建输出目录
+                if (!outputReady) {
+                    outputReady = true;
+                    if (!dirCache_.Ensure(*task.outputDir)) {
+                        std::lock_guard<std::mutex> lock(console_mutex);
+                        wprintf(L"Warning: Failed to create output directory: %s\n", task.outputDir->c_str());
+                    }
+                }
+                PushInputFile(pipeline_, task.inputDir + L"\\" + findData.cFileName, task.outputDir,
+                    (static_cast<ULONGLONG>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow, findData.ftLastWriteTime);
+            }
+        } while (FindNextFileW(hFind, &findData) != 0);
+        FindClose(hFind);
+    }
+
+    Pipeline& pipeline_;
+    const ConversionMode mode_;
+    const bool recursive_;
+    OutputDirectoryCache& dirCache_;
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::atomic<size_t> pending_{ 0 }; // 已入队但尚未扫描完的目录数
+    std::mutex idleMutex_;
+    std::condition_variable idleCv_;
+};
+
+void EnumerateInputs(const std::vector<std::wstring>& inputPaths, ConversionMode mode, bool recursive, unsigned scanThreads, const std::wstring& outputDir, Pipeline& pipeline) {
+    OutputDirectoryCache dirCache;
+    dirCache.MarkExisting(outputDir);
+    auto outputRoot = std::make_shared<const std::wstring>(outputDir);
+    DirectoryWalker walker(pipeline, mode, recursive, dirCache, scanThreads);
+
+    for (const auto& path : inputPaths) {
+        WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+        if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &fileInfo)) {
+            std::lock_guard<std::mutex> lock(console_mutex);
+            wprintf(L"Warning: Input path not found, skipping: %s\n", path.c_str());
+            continue;
+        }
+        const DWORD attributes = fileInfo.dwFileAttributes;
+        // 每个输入目录映射到输出根目录；递归模式下其子目录结构在输出根目录下重建
+        if (attributes & FILE_ATTRIBUTE_DIRECTORY) { walker.AddRoot(path, outputRoot); }
+        else {
+            if (IsSupportedInputFile(path.c_str(), mode)) {
+                if (!pipeline.shard.Accepts(*outputRoot, PathFindFileNameW(path.c_str()))) continue; // 新增：属于其他分片
+                PushInputFile(pipeline, path, outputRoot, (static_cast<ULONGLONG>(fileInfo.nFileSizeHigh) << 32) | fileInfo.nFileSizeLow, fileInfo.ftLastWriteTime);
+            }
+            else {
+                std::lock_guard<std::mutex> lock(console_mutex);
+                wprintf(L"Warning: Unsupported input file for this mode, skipping: %s\n", path.c_str());
+            }
+        }
+    }
+    walker.Run();
+}
+
+// === 新增：--watch 模式。初始扫描后继续监视输入目录，流水线线程和各线程的 WIC 上下文保持常驻 ===
+// 每个输入目录一个重叠 ReadDirectoryChangesW，全部挂在同一个完成端口上。文件在 quietMs 内没有新的变化、
+// 且能以不共享写的方式打开 (写入方已关闭句柄) 后才投递给流水线，避免转换写了一半的文件。
+class DirectoryWatcher {
+public:
+    DirectoryWatcher(Pipeline& pipeline, ConversionMode mode, bool recursive, const std::wstring& outputDir, DWORD quietMs)
+        : pipeline_(pipeline), mode_(mode), recursive_(recursive), outputPrefix_(outputDir + L"\\"), quietMs_(quietMs) {
+        port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+        dirCache_.MarkExisting(outputDir);
+    }
+
+    ~DirectoryWatcher() {
+        // 取消未完成的监视请求，等它们从完成端口返回后才能释放缓冲区
+        for (auto& root : roots_) { if (root->armed) { CancelIoEx(root->directory, &root->overlapped); } }
+        while (outstanding_ > 0) {
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            LPOVERLAPPED overlapped = nullptr;
+            if (!GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, 1000) && !overlapped) break;
+            if (overlapped) { --outstanding_; }
+        }
+        for (auto& root : roots_) { CloseHandle(root->directory); }
+        if (port_) { CloseHandle(port_); }
+    }
+
+    HRESULT AddRoot(const std::wstring& inputDir, const std::shared_ptr<const std::wstring>& outputDir) {
+        if (!port_) return HRESULT_FROM_WIN32(GetLastError());
+        HANDLE directory = CreateFileW(inputDir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if (directory == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+        std::unique_ptr<Root> root(new Root());
+        root->index = roots_.size();
+        root->directory = directory;
+        root->inputDir = inputDir;
+        root->outputDir = outputDir;
+        root->buffer.resize(kBufferBytes / sizeof(DWORD)); // FILE_NOTIFY_INFORMATION 需要 DWORD 对齐
+        // 完成键为 roots_ 下标 + 1，0 留给 Stop
+        if (!CreateIoCompletionPort(directory, port_, root->index + 1, 0)) {
+            const DWORD error = GetLastError();
+            CloseHandle(directory);
+            return HRESULT_FROM_WIN32(error);
+        }
+        roots_.push_back(std::move(root));
+        if (!Arm(*roots_.back())) return HRESULT_FROM_WIN32(GetLastError());
+        return S_OK;
+    }
+
+    size_t RootCount() const { return roots_.size(); }
+
+    // 阻塞直到 Stop 被调用或所有目录都已无法监视
+    void Run() {
+        while (true) {
+            DWORD timeout = INFINITE;
+            if (!pending_.empty()) {
+                const ULONGLONG now = GetTickCount64();
+                ULONGLONG earliest = ULLONG_MAX;
+                for (const auto& entry : pending_) { earliest = std::min(earliest, entry.second.deadline); }
+                timeout = earliest > now ? static_cast<DWORD>(earliest - now) : 0;
+            }
+            else if (outstanding_ == 0) { break; }
+
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            LPOVERLAPPED overlapped = nullptr;
+            const BOOL ok = GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, timeout);
+            if (overlapped) {
+                --outstanding_;
+                Root& root = *roots_[key - 1];
+                root.armed = false;
+                const DWORD error = ok ? ERROR_SUCCESS : GetLastError();
+                if (error == ERROR_SUCCESS && bytes > 0) { Collect(root); }
+                else if (error == ERROR_SUCCESS || error == ERROR_NOTIFY_ENUM_DIR) { Rescan(root); } // 通知缓冲区溢出，变化已丢失
+                if (error != ERROR_SUCCESS && error != ERROR_NOTIFY_ENUM_DIR) {
+                    std::lock_guard<std::mutex> lock(console_mutex);
+                    wprintf(L"Warning: Stopped watching %s (error %lu).\n", root.inputDir.c_str(), error);
+                }
+                else if (!Arm(root)) {
+                    std::lock_guard<std::mutex> lock(console_mutex);
+                    wprintf(L"Warning: Stopped watching %s (error %lu).\n", root.inputDir.c_str(), GetLastError());
+                }
+            }
+            else if (ok && key == 0) { break; } // Stop
+            SubmitSettled();
+        }
+    }
+
+    // 可从任意线程调用，包括控制台的 Ctrl+C 处理函数
+    void Stop() { PostQueuedCompletionStatus(port_, 0, 0, nullptr); }
+
+private:
+    static const DWORD kBufferBytes = 64 * 1024; // 网络共享上 ReadDirectoryChangesW 的缓冲区上限
+    static const DWORD kNotifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+
+    struct Root {
+        OVERLAPPED overlapped = {};
+        HANDLE directory = INVALID_HANDLE_VALUE;
+        bool armed = false;
+        size_t index = 0;
+        std::wstring inputDir;
+        std::shared_ptr<const std::wstring> outputDir;
+        std::vector<DWORD> buffer;
+    };
+    struct PendingFile {
+        ULONGLONG deadline;          // GetTickCount64 时刻，此前没有新变化才视为写完
+        size_t root;
+        bool mayBeDirectory;         // 新建或移入的子目录，其中的文件不会逐个产生通知
+    };
+
+    bool Arm(Root& root) {
+        root.overlapped = OVERLAPPED();
+        if (!ReadDirectoryChangesW(root.directory, root.buffer.data(), kBufferBytes, recursive_ ? TRUE : FALSE, kNotifyFilter, NULL, &root.overlapped, NULL)) return false;
+        root.armed = true;
+        ++outstanding_;
+        return true;
+    }
+
+    void Collect(Root& root) {
+        const BYTE* cursor = reinterpret_cast<const BYTE*>(root.buffer.data());
+        const ULONGLONG deadline = GetTickCount64() + quietMs_;
+        while (true) {
+            const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(cursor);
+            std::wstring path = root.inputDir + L"\\" + std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            // 输出目录位于输入目录之下时忽略自己写出的文件
+            if (path.compare(0, outputPrefix_.size(), outputPrefix_) != 0) {
+                switch (info->Action) {
+                case FILE_ACTION_ADDED:
+                case FILE_ACTION_RENAMED_NEW_NAME:
+                case FILE_ACTION_MODIFIED: {
+                    const bool supported = IsSupportedInputFile(path.c_str(), mode_);
+                    const bool mayBeDirectory = recursive_ && info->Action != FILE_ACTION_MODIFIED && !supported;
+                    if (supported || mayBeDirectory) { pending_[std::move(path)] = PendingFile{ deadline, root.index, mayBeDirectory }; }
+                    break;
+                }
+                case FILE_ACTION_REMOVED:
+                case FILE_ACTION_RENAMED_OLD_NAME:
+                    pending_.erase(path);
+                    break;
+                }
+            }
+            if (info->NextEntryOffset == 0) break;
+            cursor += info->NextEntryOffset;
+        }
+    }
+
+    // 输入目录中某个文件对应的输出目录；同一目录下的文件共享同一份字符串
+    std::shared_ptr<const std::wstring> OutputDirFor(const Root& root, const std::wstring& path) {
+        const size_t separator = path.find_last_of(L'\\');
+        if (separator <= root.inputDir.size()) return root.outputDir;
+        const std::wstring relative = path.substr(root.inputDir.size(), separator - root.inputDir.size());
+        auto& cached = outputDirs_[*root.outputDir + relative];
+        if (!cached) { cached = std::make_shared<const std::wstring>(*root.outputDir + relative); }
+        return cached;
+    }
+
+    void Rescan(const Root& root) {
+        {
+            std::lock_guard<std::mutex> lock(console_mutex);
+            wprintf(L"Warning: Change notifications overflowed for %s. Rescanning.\n", root.inputDir.c_str());
+        }
+        // --watch 总是启用增量清单，未变化的文件在预读阶段即被跳过
+        EnumerateInputs(std::vector<std::wstring>(1, root.inputDir), mode_, recursive_, 1, *root.outputDir, pipeline_);
+    }
+
+    void SubmitSettled() {
+        const ULONGLONG now = GetTickCount64();
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (it->second.deadline > now) { ++it; continue; }
+            WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+            if (!GetFileAttributesExW(it->first.c_str(), GetFileExInfoStandard, &fileInfo)) { it = pending_.erase(it); continue; } // 已删除或改名
+            const Root& root = *roots_[it->second.root];
+            if (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                if (it->second.mayBeDirectory && !(fileInfo.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                    const std::wstring outputDir = *OutputDirFor(root, it->first + L"\\");
+                    if (dirCache_.Ensure(outputDir)) { EnumerateInputs(std::vector<std::wstring>(1, it->first), mode_, true, 1, outputDir, pipeline_); }
+                }
+                it = pending_.erase(it);
+                continue;
+            }
+            if (it->second.mayBeDirectory) { it = pending_.erase(it); continue; }
+            std::shared_ptr<const std::wstring> outputDir = OutputDirFor(root, it->first);
+            if (!pipeline_.shard.Accepts(*outputDir, PathFindFileNameW(it->first.c_str()))) { it = pending_.erase(it); continue; } // 新增：属于其他分片
+            // 写入方仍持有可写句柄时共享冲突，稍后重试
+            HANDLE file = CreateFileW(it->first.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE) {
+                if (GetLastError() == ERROR_SHARING_VIOLATION) { it->second.deadline = now + quietMs_; ++it; }
+                else { it = pending_.erase(it); }
+                continue;
+            }
+            CloseHandle(file);
+            if (!dirCache_.Ensure(*outputDir)) {
+                std::lock_guard<std::mutex> lock(console_mutex);
+                wprintf(L"Warning: Failed to create output directory: %s\n", outputDir->c_str());
+            }
+            PushInputFile(pipeline_, it->first, outputDir, (static_cast<ULONGLONG>(fileInfo.nFileSizeHigh) << 32) | fileInfo.nFileSizeLow, fileInfo.ftLastWriteTime);
+            it = pending_.erase(it);
+        }
+    }
+
+    Pipeline& pipeline_;
+    const ConversionMode mode_;
+    const bool recursive_;
+    const std::wstring outputPrefix_;
+    const DWORD quietMs_;
+    HANDLE port_ = NULL;
+    size_t outstanding_ = 0; // 已提交但尚未从完成端口返回的监视请求
+    std::vector<std::unique_ptr<Root>> roots_;
+    std::unordered_map<std::wstring, PendingFile> pending_;
+    std::unordered_map<std::wstring, std::shared_ptr<const std::wstring>> outputDirs_;
+    OutputDirectoryCache dirCache_;
+};
+
+static std::atomic<DirectoryWatcher*> g_activeWatcher{ nullptr };
+static std::atomic<ProgressReporter*> g_watchReporter{ nullptr }; // 新增：控制台事件时写出已缓冲的指标
+
+static BOOL WINAPI WatchConsoleHandler(DWORD controlType) {
+    if (controlType != CTRL_C_EVENT && controlType != CTRL_BREAK_EVENT && controlType != CTRL_CLOSE_EVENT) return FALSE;
+    DirectoryWatcher* watcher = g_activeWatcher.load();
+    if (watcher) { watcher->Stop(); }
+    // 关闭控制台窗口时进程可能在正常收尾之前被结束
+    ProgressReporter* reporter = g_watchReporter.load();
+    if (reporter) { reporter->FlushMetrics(); }
+    return TRUE;
+}
+
+// 修改：先挂上目录监视再进行初始扫描，扫描期间到达的文件不会漏掉；扫描与通知重复投递的文件由增量清单去重。
+// initialScan 返回 false 时 (例如 HEVC 探测失败) 不进入监视
+void WatchInputs(const std::vector<std::wstring>& inputPaths, ConversionMode mode, bool recursive, const std::wstring& outputDir, DWORD quietMs, Pipeline& pipeline,
+    const std::function<bool()>& initialScan) {
+    DirectoryWatcher watcher(pipeline, mode, recursive, outputDir, quietMs);
+    auto outputRoot = std::make_shared<const std::wstring>(outputDir);
+    for (const auto& path : inputPaths) {
+        const DWORD attributes = GetFileAttributesW(path.c_str());
+        if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) continue;
+        HRESULT hr = watcher.AddRoot(path, outputRoot);
+        if (FAILED(hr)) {
+            std::lock_guard<std::mutex> lock(console_mutex);
+            wprintf(L"Warning: Cannot watch %s (HR=0x%08X).\n", path.c_str(), static_cast<unsigned int>(hr));
+        }
+    }
+    if (!initialScan()) return;
+    if (watcher.RootCount() == 0) { wprintf(L"Warning: --watch needs at least one input directory. Exiting after the initial scan.\n"); return; }
+    {
+        std::lock_guard<std::mutex> lock(console_mutex);
+        wprintf(L"Watching %zu director%s for new images. Press Ctrl+C to stop.\n", watcher.RootCount(), watcher.RootCount() == 1 ? L"y" : L"ies");
+    }
+    g_activeWatcher = &watcher;
+    g_watchReporter = pipeline.reporter;
+    SetConsoleCtrlHandler(WatchConsoleHandler, TRUE);
+    watcher.Run();
+    SetConsoleCtrlHandler(WatchConsoleHandler, FALSE);
+    g_watchReporter = nullptr;
+    g_activeWatcher = nullptr;
+}
@@ -0,0 +1,152 @@
+// 路径拼接、长路径与临时文件清理
+#include "ConverterInternal.h"
+
+// === 修改：IsSupportedImageFile函数，根据模式判断输入；使用静态表，不做任何内存分配 ===
+bool IsSupportedInputFile(const WCHAR* fileName, ConversionMode mode) {
+    static const WCHAR* const kHeicInputExtensions[] = { L".jpg", L".jpeg", L".png", L".bmp", L".tiff", L".gif" };
+    // 根据要求，转为JPEG时，输入必须是HEIC
+    // 修改：同时接受 .heif/.hif；内容是否真是 HEIF 由预读阶段的文件头嗅探确认
+    static const WCHAR* const kJpegInputExtensions[] = { L".heic", L".heif", L".hif" };
+
+    const WCHAR* extension = PathFindExtensionW(fileName);
+    if (*extension == L'\0') return false;
+
+    if (mode == ConversionMode::ToHeic) {
+        for (const WCHAR* ext : kHeicInputExtensions) {
+            if (CompareStringOrdinal(extension, -1, ext, -1, TRUE) == CSTR_EQUAL) return true;
+        }
+    }
+    else if (mode == ConversionMode::ToJpeg) {
+        for (const WCHAR* ext : kJpegInputExtensions) {
+            if (CompareStringOrdinal(extension, -1, ext, -1, TRUE) == CSTR_EQUAL) return true;
+        }
+    }
+    return false;
+}
+
+// 新增：根据输入文件名和目标后缀生成输出路径
+// 修改：在本线程预分配的 PATHCCH_MAX_CCH 缓冲区中拼接，支持长路径；PathAllocCombine 每次调用都要分配，这里不用
+HRESULT MakeOutputPath(const std::wstring& outputDir, const std::wstring& inputPath, const WCHAR* targetExtension, std::wstring& outPath) {
+    thread_local std::vector<WCHAR> buffer(PATHCCH_MAX_CCH);
+    const WCHAR* fileName = PathFindFileNameW(inputPath.c_str());
+    HRESULT hr = PathCchCombineEx(buffer.data(), buffer.size(), outputDir.c_str(), fileName, PATHCCH_ALLOW_LONG_PATHS);
+    if (SUCCEEDED(hr)) { hr = PathCchRenameExtension(buffer.data(), buffer.size(), targetExtension); } // 使用传入的目标后缀
+    if (FAILED(hr)) return hr;
+    outPath.assign(buffer.data());
+    return S_OK;
+}
+
+// 新增：预估转换开销。解码后的像素数决定编码耗时，压缩率高的格式同样大小的文件像素更多
+ULONGLONG EstimateConversionCost(const WCHAR* fileName, ULONGLONG fileSize) {
+    struct FormatWeight { const WCHAR* extension; ULONGLONG weight; };
+    static const FormatWeight kWeights[] = {
+        { L".jpg", 10 }, { L".jpeg", 10 }, { L".heic", 12 }, { L".heif", 12 }, { L".hif", 12 }, { L".png", 3 }, { L".gif", 4 }, { L".tiff", 2 }, { L".bmp", 1 }
+    };
+    const WCHAR* extension = PathFindExtensionW(fileName);
+    for (const FormatWeight& entry : kWeights) {
+        if (CompareStringOrdinal(extension, -1, entry.extension, -1, TRUE) == CSTR_EQUAL) return fileSize * entry.weight;
+    }
+    return fileSize * 4;
+}
+
+std::wstring MakeNumberedPath(const std::wstring& path, UINT number, UINT count) {
+    const size_t extensionOffset = PathFindExtensionW(path.c_str()) - path.c_str();
+    const int digits = count >= 1000 ? (count >= 10000 ? 5 : 4) : 3;
+    wchar_t suffix[16];
+    swprintf_s(suffix, L"_%0*u", digits, number);
+    return path.substr(0, extensionOffset) + suffix + path.substr(extensionOffset);
+}
+
+// 新增：大小写无关的路径哈希 (FNV-1a 64)
+ULONGLONG HashPath(const std::wstring& path) {
+    thread_local std::wstring normalized;
+    normalized.resize(std::max<size_t>(path.size() + 1, MAX_PATH));
+    DWORD length = GetFullPathNameW(path.c_str(), static_cast<DWORD>(normalized.size()), &normalized[0], NULL);
+    if (length >= normalized.size()) {
+        normalized.resize(length + 1);
+        length = GetFullPathNameW(path.c_str(), static_cast<DWORD>(normalized.size()), &normalized[0], NULL);
+    }
+    if (length == 0 || length >= normalized.size()) { normalized.assign(path); length = static_cast<DWORD>(path.size()); }
+    normalized.resize(length);
+    // 去掉 \\?\ 前缀再计算，与使用普通路径的旧清单保持一致
+    StripExtendedPrefix(normalized);
+    length = static_cast<DWORD>(normalized.size());
+    if (length > 0) { CharUpperBuffW(&normalized[0], length); }
+
+    ULONGLONG hash = 14695981039346656037ull;
+    for (WCHAR ch : normalized) {
+        hash ^= static_cast<ULONGLONG>(ch);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+size_t SweepOrphanedTempFiles(const std::wstring& outputDir, const WCHAR* targetExtension, bool recursive) {
+    // 另一个实例可能正在写同一目录，最近仍在修改的临时文件保留
+    const ULONGLONG kGracePeriod = 10ull * 60 * 10000000; // 10 分钟，单位 100ns
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    const ULONGLONG cutoff = ((static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime) - kGracePeriod;
+
+    size_t removed = 0;
+    std::vector<std::wstring> pending(1, outputDir);
+    while (!pending.empty()) {
+        const std::wstring dir = std::move(pending.back());
+        pending.pop_back();
+        WIN32_FIND_DATAW findData;
+        HANDLE hFind = FindFirstFileExW((dir + L"\\*").c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        if (hFind == INVALID_HANDLE_VALUE) continue;
+        do {
+            const WCHAR* name = findData.cFileName;
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                if (recursive && !(findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && wcscmp(name, L".") != 0 && wcscmp(name, L"..") != 0) { pending.push_back(dir + L"\\" + name); }
+                continue;
+            }
+            // 只处理本工具写出的 name.<目标扩展名>.tmp、旁车 name.*.jpg.tmp 和清单的 .tmp
+            const WCHAR* extension = PathFindExtensionW(name);
+            if (CompareStringOrdinal(extension, -1, L".tmp", -1, TRUE) != CSTR_EQUAL) continue;
+            const std::wstring stem(name, extension - name);
+            const WCHAR* innerExtension = PathFindExtensionW(stem.c_str());
+            const bool ours = CompareStringOrdinal(innerExtension, -1, targetExtension, -1, TRUE) == CSTR_EQUAL
+                || CompareStringOrdinal(innerExtension, -1, L".jpg", -1, TRUE) == CSTR_EQUAL
+                || CompareStringOrdinal(innerExtension, -1, L".manifest", -1, TRUE) == CSTR_EQUAL;
+            const ULONGLONG writeTime = (static_cast<ULONGLONG>(findData.ftLastWriteTime.dwHighDateTime) << 32) | findData.ftLastWriteTime.dwLowDateTime;
+            if (ours && writeTime < cutoff && DeleteFileW((dir + L"\\" + name).c_str())) { ++removed; }
+        } while (FindNextFileW(hFind, &findData));
+        FindClose(hFind);
+    }
+    return removed;
+}
+
+// === 新增：长路径支持 ===
+HRESULT ToExtendedLengthPath(const std::wstring& path, std::wstring& extended) {
+    // 先取得绝对路径 (\\?\ 前缀下不再解析 . 和 ..)，再由 PathCch 规范化并强制加上 \\?\ 或 \\?\UNC\ 前缀
+    DWORD length = GetFullPathNameW(path.c_str(), 0, NULL, NULL);
+    if (length == 0) return HRESULT_FROM_WIN32(GetLastError());
+    std::wstring full(length, L'\0');
+    length = GetFullPathNameW(path.c_str(), length, &full[0], NULL);
+    if (length == 0 || length >= full.size()) return HRESULT_FROM_WIN32(GetLastError());
+    full.resize(length);
+
+    PWSTR pCanonical = nullptr;
+    HRESULT hr = PathAllocCanonicalize(full.c_str(), PATHCCH_ALLOW_LONG_PATHS | PATHCCH_ENSURE_IS_EXTENDED_LENGTH_PATH, &pCanonical);
+    if (FAILED(hr)) return hr;
+    std::wstring result(pCanonical);
+    LocalFree(pCanonical);
+    // 目录路径以后都按 dir + L"\\" + name 拼接，去掉末尾的分隔符 (驱动器根目录除外)
+    if (result.size() > 7 && result.back() == L'\\' && result[result.size() - 2] != L':') { result.pop_back(); }
+    extended.swap(result);
+    return S_OK;
+}
+
+void StripExtendedPrefix(std::wstring& path) {
+    // \\?\UNC\server\share 的等价形式是 \\server\share，保留开头的两个反斜杠
+    if (path.compare(0, 8, L"\\\\?\\UNC\\") == 0) { path.erase(2, 6); }
+    else if (path.compare(0, 4, L"\\\\?\\") == 0) { path.erase(0, 4); }
+}
+
+const std::wstring& MakeTempPath(const std::wstring& path) {
+    thread_local std::wstring buffer;
+    buffer.assign(path).append(L".tmp"); // assign 复用已有容量，长路径也只在首次增长时分配
+    return buffer;
+}
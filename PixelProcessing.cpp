@@ -0,0 +1,520 @@
+// 像素缓冲池、SIMD 转换与缩放
+#include "ConverterInternal.h"
+
+// === 新增：PixelBufferPool 实现 ===
+ULONGLONG DefaultPixelPoolLimit() {
+    MEMORYSTATUSEX status = { sizeof(status) };
+    if (!GlobalMemoryStatusEx(&status)) return 4ull * 1024 * 1024 * 1024;
+    return std::max<ULONGLONG>(status.ullTotalPhys / 2, 256ull * 1024 * 1024);
+}
+
+size_t PixelBufferPool::SizeClass(size_t bytes) {
+    // 级别为 1MB、1.5MB、2MB、3MB、4MB、6MB ...，浪费不超过三分之一，同时让相近尺寸的照片共用一级
+    const size_t unit = 1024 * 1024;
+    size_t base = unit;
+    for (;;) {
+        if (bytes <= base) return base;
+        if (bytes <= base + base / 2) return base + base / 2;
+        if (base >= (static_cast<size_t>(1) << (sizeof(size_t) * 8 - 2))) return (bytes + 0xFFFF) & ~static_cast<size_t>(0xFFFF);
+        base *= 2;
+    }
+}
+
+PixelBufferPool::~PixelBufferPool() {
+    for (const FreeBlock& block : free_) { VirtualFree(block.data, 0, MEM_RELEASE); }
+}
+
+void PixelBufferPool::EvictOne() {
+    // 调用方持有锁；释放最大的空闲块，尽快腾出额度
+    auto largest = std::max_element(free_.begin(), free_.end(), [](const FreeBlock& a, const FreeBlock& b) { return a.size < b.size; });
+    VirtualFree(largest->data, 0, MEM_RELEASE);
+    committed_ -= largest->size;
+    free_.erase(largest);
+}
+
+BYTE* PixelBufferPool::Acquire(size_t bytes, DWORD numaNode, size_t& blockSize) {
+    const size_t size = SizeClass(bytes);
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        // 优先复用同级别、同节点的空闲块
+        for (auto it = free_.begin(); it != free_.end(); ++it) {
+            if (it->size == size && it->numaNode == numaNode) {
+                BYTE* data = it->data;
+                free_.erase(it);
+                outstanding_ += size;
+                blockSize = size;
+                return data;
+            }
+        }
+        // 额度不足时先回收不匹配的空闲块
+        while (!free_.empty() && committed_ + size > capacity_) { EvictOne(); }
+        if (committed_ + size <= capacity_ || outstanding_ == 0) {
+            BYTE* data = static_cast<BYTE*>(numaNode == NUMA_NO_PREFERRED_NODE
+                ? VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)
+                : VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, numaNode));
+            if (!data) return nullptr;
+            committed_ += size;
+            outstanding_ += size;
+            blockSize = size;
+            return data;
+        }
+        // 使用中的块会在编码完成后归还
+        released_.wait(lock);
+    }
+}
+
+void PixelBufferPool::Release(BYTE* block, size_t blockSize, DWORD numaNode) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    outstanding_ -= blockSize;
+    if (committed_ > capacity_) {
+        // 超额分配的大块不保留
+        VirtualFree(block, 0, MEM_RELEASE);
+        committed_ -= blockSize;
+    }
+    else {
+        FreeBlock freeBlock = { block, blockSize, numaNode };
+        free_.push_back(freeBlock);
+    }
+    released_.notify_all();
+}
+
+// === 新增：PooledBitmap 实现 ===
+HRESULT PooledBitmap::RuntimeClassInitialize(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, PixelBufferPool* pPool, DWORD numaNode) {
+    HRESULT hr = pSource->GetSize(&width_, &height_);
+    if (FAILED(hr)) return hr;
+    hr = pSource->GetPixelFormat(&format_);
+    if (FAILED(hr)) return hr;
+    if (FAILED(pSource->GetResolution(&dpiX_, &dpiY_))) { dpiX_ = dpiY_ = 96.0; }
+
+    // 新增：WIC 通用转换器处理较慢的格式 (16 位 PNG/TIFF、8 位索引色 GIF) 在这里用 SIMD 内核直接转为 32 位
+    WICPixelFormatGUID convertedFormat = GUID_WICPixelFormatUndefined;
+    const PixelRowKernel kernel = GetPixelKernels().Select(format_, convertedFormat);
+    if (kernel) return ConvertFrom(pFactory, pSource, kernel, convertedFormat, pPool, numaNode);
+
+    // 其余索引色需要调色板，交给 WIC 自己的位图处理
+    if (IsEqualGUID(format_, GUID_WICPixelFormat1bppIndexed) || IsEqualGUID(format_, GUID_WICPixelFormat2bppIndexed) ||
+        IsEqualGUID(format_, GUID_WICPixelFormat4bppIndexed) || IsEqualGUID(format_, GUID_WICPixelFormat8bppIndexed)) {
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    }
+
+    bitsPerPixel_ = GetBitsPerPixel(pFactory, format_);
+    if (bitsPerPixel_ == 0) return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    hr = Allocate(pPool, numaNode);
+    if (FAILED(hr)) return hr;
+
+    // CopyPixels 的缓冲区大小是 UINT，超大图按行带分段解码
+    const UINT rowsPerBand = static_cast<UINT>(std::min<size_t>(height_, std::max<size_t>(1, UINT_MAX / stride_)));
+    for (UINT y = 0; y < height_; y += rowsPerBand) {
+        WICRect band = { 0, static_cast<INT>(y), static_cast<INT>(width_), static_cast<INT>(std::min(rowsPerBand, height_ - y)) };
+        hr = pSource->CopyPixels(&band, static_cast<UINT>(stride_), static_cast<UINT>(stride_ * band.Height), pixels_ + stride_ * y);
+        if (FAILED(hr)) return hr;
+    }
+    return S_OK;
+}
+
+HRESULT PooledBitmap::RuntimeClassInitialize(UINT width, UINT height, REFWICPixelFormatGUID format, UINT bitsPerPixel, double dpiX, double dpiY, PixelBufferPool* pPool, DWORD numaNode) {
+    width_ = width;
+    height_ = height;
+    format_ = format;
+    bitsPerPixel_ = bitsPerPixel;
+    dpiX_ = dpiX;
+    dpiY_ = dpiY;
+    return Allocate(pPool, numaNode);
+}
+
+HRESULT PooledBitmap::Allocate(PixelBufferPool* pPool, DWORD numaNode) {
+    stride_ = ((static_cast<size_t>(width_) * bitsPerPixel_ + 7) / 8 + 3) & ~static_cast<size_t>(3);
+    const size_t bytes = stride_ * height_;
+    if (bytes == 0) return WINCODEC_ERR_INVALIDPARAMETER;
+    numaNode_ = numaNode;
+    if (pPool) {
+        pixels_ = pPool->Acquire(bytes, numaNode, blockSize_);
+        if (pixels_) pool_ = pPool;
+    }
+    else {
+        pixels_ = static_cast<BYTE*>(VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, numaNode));
+    }
+    return pixels_ ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT PooledBitmap::ConvertFrom(IWICImagingFactory* pFactory, IWICBitmapSource* pSource, PixelRowKernel kernel, REFWICPixelFormatGUID convertedFormat, PixelBufferPool* pPool, DWORD numaNode) {
+    const UINT sourceBits = GetBitsPerPixel(pFactory, format_);
+    if (sourceBits == 0) return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    // 索引色：调色板补齐到 256 项，越界索引显示为不透明黑色
+    std::vector<UINT32> palette;
+    if (IsEqualGUID(format_, GUID_WICPixelFormat8bppIndexed)) {
+        ComPtr<IWICPalette> pPalette;
+        UINT colorCount = 0;
+        HRESULT hr = pFactory->CreatePalette(&pPalette);
+        if (SUCCEEDED(hr)) { hr = pSource->CopyPalette(pPalette.Get()); }
+        if (SUCCEEDED(hr)) { hr = pPalette->GetColorCount(&colorCount); }
+        palette.assign(256, 0xFF000000u);
+        if (SUCCEEDED(hr)) { hr = pPalette->GetColors(std::min(colorCount, 256u), palette.data(), &colorCount); }
+        if (FAILED(hr)) return hr;
+    }
+
+    format_ = convertedFormat;
+    bitsPerPixel_ = 32;
+    HRESULT hr = Allocate(pPool, numaNode);
+    if (FAILED(hr)) return hr;
+
+    // 源像素按带读入中转缓冲区 (约 4MB)，逐行转换到池中的内存
+    const size_t sourceStride = ((static_cast<size_t>(width_) * sourceBits + 7) / 8 + 3) & ~static_cast<size_t>(3);
+    if (sourceStride > UINT_MAX) return WINCODEC_ERR_VALUEOVERFLOW;
+    const UINT rowsPerBand = static_cast<UINT>(std::min<size_t>(height_, std::max<size_t>(1, (4u * 1024 * 1024) / sourceStride)));
+    std::vector<BYTE> band(sourceStride * rowsPerBand);
+    for (UINT y = 0; y < height_; y += rowsPerBand) {
+        const UINT rows = std::min(rowsPerBand, height_ - y);
+        const WICRect rect = { 0, static_cast<INT>(y), static_cast<INT>(width_), static_cast<INT>(rows) };
+        hr = pSource->CopyPixels(&rect, static_cast<UINT>(sourceStride), static_cast<UINT>(sourceStride * rows), band.data());
+        if (FAILED(hr)) return hr;
+        for (UINT row = 0; row < rows; ++row) {
+            kernel(band.data() + sourceStride * row, pixels_ + stride_ * (y + row), width_, palette.empty() ? nullptr : palette.data());
+        }
+    }
+    return S_OK;
+}
+
+PooledBitmap::~PooledBitmap() {
+    if (!pixels_) return;
+    if (pool_) { pool_->Release(pixels_, blockSize_, numaNode_); }
+    else { VirtualFree(pixels_, 0, MEM_RELEASE); }
+}
+
+IFACEMETHODIMP PooledBitmap::GetSize(UINT* puiWidth, UINT* puiHeight) {
+    if (!puiWidth || !puiHeight) return E_INVALIDARG;
+    *puiWidth = width_;
+    *puiHeight = height_;
+    return S_OK;
+}
+
+IFACEMETHODIMP PooledBitmap::GetPixelFormat(WICPixelFormatGUID* pPixelFormat) {
+    if (!pPixelFormat) return E_INVALIDARG;
+    *pPixelFormat = format_;
+    return S_OK;
+}
+
+IFACEMETHODIMP PooledBitmap::GetResolution(double* pDpiX, double* pDpiY) {
+    if (!pDpiX || !pDpiY) return E_INVALIDARG;
+    *pDpiX = dpiX_;
+    *pDpiY = dpiY_;
+    return S_OK;
+}
+
+IFACEMETHODIMP PooledBitmap::CopyPixels(const WICRect* prc, UINT cbStride, UINT cbBufferSize, BYTE* pbBuffer) {
+    if (!pbBuffer) return E_INVALIDARG;
+    WICRect rect = { 0, 0, static_cast<INT>(width_), static_cast<INT>(height_) };
+    if (prc) rect = *prc;
+    if (rect.X < 0 || rect.Y < 0 || rect.Width < 0 || rect.Height < 0 ||
+        static_cast<UINT>(rect.X) + static_cast<UINT>(rect.Width) > width_ || static_cast<UINT>(rect.Y) + static_cast<UINT>(rect.Height) > height_) {
+        return E_INVALIDARG;
+    }
+    if (rect.Width == 0 || rect.Height == 0) return S_OK;
+    // 亚字节格式只支持从字节边界开始的矩形
+    const size_t startBit = static_cast<size_t>(rect.X) * bitsPerPixel_;
+    if (startBit % 8 != 0) return WINCODEC_ERR_INVALIDPARAMETER;
+
+    const size_t rowBytes = (static_cast<size_t>(rect.Width) * bitsPerPixel_ + 7) / 8;
+    if (cbStride < rowBytes) return WINCODEC_ERR_INSUFFICIENTBUFFER;
+    if (static_cast<ULONGLONG>(cbStride) * (rect.Height - 1) + rowBytes > cbBufferSize) return WINCODEC_ERR_INSUFFICIENTBUFFER;
+
+    const BYTE* src = pixels_ + stride_ * rect.Y + startBit / 8;
+    for (INT row = 0; row < rect.Height; ++row) {
+        memcpy(pbBuffer + static_cast<size_t>(cbStride) * row, src + stride_ * row, rowBytes);
+    }
+    return S_OK;
+}
+
+// === 新增：SIMD 像素内核 ===
+// 16 位通道按 (v + 128) >> 8 舍入到 8 位 (饱和)，各指令集版本结果逐位一致；SIMD 版本的行尾交给标量版本
+
+static inline BYTE Narrow16(UINT v) { return static_cast<BYTE>(std::min(255u, (v + 128) >> 8)); }
+
+static void Rgba64ToBgraScalar(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const UINT16* s = reinterpret_cast<const UINT16*>(src);
+    for (UINT x = 0; x < width; ++x, s += 4, dst += 4) { dst[0] = Narrow16(s[2]); dst[1] = Narrow16(s[1]); dst[2] = Narrow16(s[0]); dst[3] = Narrow16(s[3]); }
+}
+
+static void Bgra64ToBgraScalar(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const UINT16* s = reinterpret_cast<const UINT16*>(src);
+    for (UINT x = 0; x < width; ++x, s += 4, dst += 4) { dst[0] = Narrow16(s[0]); dst[1] = Narrow16(s[1]); dst[2] = Narrow16(s[2]); dst[3] = Narrow16(s[3]); }
+}
+
+static void Rgb48ToBgraScalar(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const UINT16* s = reinterpret_cast<const UINT16*>(src);
+    for (UINT x = 0; x < width; ++x, s += 3, dst += 4) { dst[0] = Narrow16(s[2]); dst[1] = Narrow16(s[1]); dst[2] = Narrow16(s[0]); dst[3] = 0xFF; }
+}
+
+static void Bgr48ToBgraScalar(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const UINT16* s = reinterpret_cast<const UINT16*>(src);
+    for (UINT x = 0; x < width; ++x, s += 3, dst += 4) { dst[0] = Narrow16(s[0]); dst[1] = Narrow16(s[1]); dst[2] = Narrow16(s[2]); dst[3] = 0xFF; }
+}
+
+static void Gray16ToBgraScalar(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const UINT16* s = reinterpret_cast<const UINT16*>(src);
+    for (UINT x = 0; x < width; ++x, dst += 4) { const BYTE g = Narrow16(s[x]); dst[0] = g; dst[1] = g; dst[2] = g; dst[3] = 0xFF; }
+}
+
+static void Index8ToBgraScalar(const BYTE* src, BYTE* dst, UINT width, const UINT32* palette) {
+    for (UINT x = 0; x < width; ++x) { const UINT32 color = palette[src[x]]; memcpy(dst + x * 4, &color, 4); }
+}
+
+static void AccumulateScalar(float* acc, const float* src, size_t count, float weight) {
+    for (size_t i = 0; i < count; ++i) { acc[i] += weight * src[i]; }
+}
+
+// --- AVX2 ---
+// packus 在每个 128 位通道内交错两个来源，permute4x64 (0xD8) 恢复像素顺序
+template <bool SwapRedBlue>
+static void Narrow64Avx2(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i order = SwapRedBlue
+        ? _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+        : _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    UINT x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + static_cast<size_t>(x) * 8));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + static_cast<size_t>(x) * 8 + 32));
+        a = _mm256_srli_epi16(_mm256_adds_epu16(a, bias), 8);
+        b = _mm256_srli_epi16(_mm256_adds_epu16(b, bias), 8);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        if (SwapRedBlue) { packed = _mm256_shuffle_epi8(packed, order); }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + static_cast<size_t>(x) * 4), packed);
+    }
+    (SwapRedBlue ? Rgba64ToBgraScalar : Bgra64ToBgraScalar)(src + static_cast<size_t>(x) * 8, dst + static_cast<size_t>(x) * 4, width - x, nullptr);
+}
+
+static void Gray16ToBgraAvx2(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m256i spread = _mm256_set1_epi32(0x00010101);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    UINT x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i gray = _mm_srli_epi16(_mm_adds_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + static_cast<size_t>(x) * 2)), bias), 8);
+        const __m256i pixels = _mm256_or_si256(_mm256_mullo_epi32(_mm256_cvtepu16_epi32(gray), spread), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + static_cast<size_t>(x) * 4), pixels);
+    }
+    Gray16ToBgraScalar(src + static_cast<size_t>(x) * 2, dst + static_cast<size_t>(x) * 4, width - x, nullptr);
+}
+
+static void Index8ToBgraAvx2(const BYTE* src, BYTE* dst, UINT width, const UINT32* palette) {
+    const int* table = reinterpret_cast<const int*>(palette);
+    UINT x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + x)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + static_cast<size_t>(x) * 4), _mm256_i32gather_epi32(table, indices, 4));
+    }
+    Index8ToBgraScalar(src + x, dst + static_cast<size_t>(x) * 4, width - x, palette);
+}
+
+static void AccumulateAvx2(float* acc, const float* src, size_t count, float weight) {
+    const __m256 w = _mm256_set1_ps(weight);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) { _mm256_storeu_ps(acc + i, _mm256_fmadd_ps(w, _mm256_loadu_ps(src + i), _mm256_loadu_ps(acc + i))); }
+    AccumulateScalar(acc + i, src + i, count - i, weight);
+}
+
+// --- AVX-512 (F + BW) ---
+// 512 位 packus 同样按 128 位通道交错，permutexvar 按 qword 重排为 a0..a3 b0..b3
+template <bool SwapRedBlue>
+static void Narrow64Avx512(const BYTE* src, BYTE* dst, UINT width, const UINT32*) {
+    const __m512i bias = _mm512_set1_epi16(128);
+    const __m512i qwordOrder = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m512i order = _mm512_broadcast_i32x4(SwapRedBlue
+        ? _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+        : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    UINT x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m512i a = _mm512_loadu_si512(src + static_cast<size_t>(x) * 8);
+        __m512i b = _mm512_loadu_si512(src + static_cast<size_t>(x) * 8 + 64);
+        a = _mm512_srli_epi16(_mm512_adds_epu16(a, bias), 8);
+        b = _mm512_srli_epi16(_mm512_adds_epu16(b, bias), 8);
+        __m512i packed = _mm512_permutexvar_epi64(qwordOrder, _mm512_packus_epi16(a, b));
+        if (SwapRedBlue) { packed = _mm512_shuffle_epi8(packed, order); }
+        _mm512_storeu_si512(dst + static_cast<size_t>(x) * 4, packed);
+    }
+    Narrow64Avx2<SwapRedBlue>(src + static_cast<size_t>(x) * 8, dst + static_cast<size_t>(x) * 4, width - x, nullptr);
+}
+
+static void AccumulateAvx512(float* acc, const float* src, size_t count, float weight) {
+    const __m512 w = _mm512_set1_ps(weight);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) { _mm512_storeu_ps(acc + i, _mm512_fmadd_ps(w, _mm512_loadu_ps(src + i), _mm512_loadu_ps(acc + i))); }
+    AccumulateAvx2(acc + i, src + i, count - i, weight);
+}
+
+// CPU 支持指令集之外还要确认操作系统保存对应的寄存器状态
+static bool OsSavesVectorState(unsigned long long mask) { return (_xgetbv(0) & mask) == mask; }
+
+const PixelKernels& GetPixelKernels() {
+    static const PixelKernels kernels = [] {
+        PixelKernels k;
+        k.rgba64ToBgra = Rgba64ToBgraScalar;
+        k.bgra64ToBgra = Bgra64ToBgraScalar;
+        k.rgb48ToBgra = Rgb48ToBgraScalar;
+        k.bgr48ToBgra = Bgr48ToBgraScalar;
+        k.gray16ToBgra = Gray16ToBgraScalar;
+        k.index8ToBgra = Index8ToBgraScalar;
+        k.accumulate = AccumulateScalar;
+
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return k;
+        __cpuid(info, 1);
+        const bool fma = (info[2] & (1 << 12)) != 0;
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        if (!fma || !osxsave || !avx || !OsSavesVectorState(0x6)) return k; // XMM + YMM
+        __cpuidex(info, 7, 0);
+        const bool avx2 = (info[1] & (1 << 5)) != 0;
+        const bool avx512f = (info[1] & (1 << 16)) != 0;
+        const bool avx512bw = (info[1] & (1 << 30)) != 0;
+        if (!avx2) return k;
+
+        k.name = L"AVX2";
+        k.rgba64ToBgra = Narrow64Avx2<true>;
+        k.bgra64ToBgra = Narrow64Avx2<false>;
+        k.gray16ToBgra = Gray16ToBgraAvx2;
+        k.index8ToBgra = Index8ToBgraAvx2;
+        k.accumulate = AccumulateAvx2;
+        if (avx512f && avx512bw && OsSavesVectorState(0xE6)) { // + opmask、ZMM 低半部分与 ZMM16-31
+            k.name = L"AVX-512";
+            k.rgba64ToBgra = Narrow64Avx512<true>;
+            k.bgra64ToBgra = Narrow64Avx512<false>;
+            k.accumulate = AccumulateAvx512;
+        }
+        return k;
+    }();
+    return kernels;
+}
+
+PixelRowKernel PixelKernels::Select(REFWICPixelFormatGUID source, WICPixelFormatGUID& converted) const {
+    converted = GUID_WICPixelFormat32bppBGRA;
+    if (IsEqualGUID(source, GUID_WICPixelFormat64bppRGBA)) return rgba64ToBgra;
+    if (IsEqualGUID(source, GUID_WICPixelFormat64bppBGRA)) return bgra64ToBgra;
+    if (IsEqualGUID(source, GUID_WICPixelFormat48bppRGB)) return rgb48ToBgra;
+    if (IsEqualGUID(source, GUID_WICPixelFormat48bppBGR)) return bgr48ToBgra;
+    if (IsEqualGUID(source, GUID_WICPixelFormat16bppGray)) return gray16ToBgra;
+    if (IsEqualGUID(source, GUID_WICPixelFormat8bppIndexed)) return index8ToBgra;
+    converted = GUID_WICPixelFormat32bppPBGRA;
+    if (IsEqualGUID(source, GUID_WICPixelFormat64bppPRGBA)) return rgba64ToBgra;
+    if (IsEqualGUID(source, GUID_WICPixelFormat64bppPBGRA)) return bgra64ToBgra;
+    converted = GUID_WICPixelFormatUndefined;
+    return nullptr;
+}
+
+// --- 面积平均缩小 ---
+
+struct ResampleTap {
+    UINT first;       // 第一个参与的源像素
+    UINT count;
+    size_t weights;   // 在权重数组中的起始位置
+};
+
+// 每个输出像素覆盖 [o*scale, (o+1)*scale) 的源区间，权重为各源像素被覆盖的比例，总和为 1
+static void BuildResampleTaps(UINT sourceSize, UINT outputSize, std::vector<ResampleTap>& taps, std::vector<float>& weights) {
+    const double scale = static_cast<double>(sourceSize) / outputSize;
+    taps.resize(outputSize);
+    weights.clear();
+    for (UINT o = 0; o < outputSize; ++o) {
+        const double begin = o * scale;
+        const double end = std::min<double>(sourceSize, (o + 1) * scale);
+        const UINT first = static_cast<UINT>(begin);
+        const UINT last = std::min(sourceSize - 1, static_cast<UINT>(std::ceil(end)) - 1);
+        taps[o] = { first, last - first + 1, weights.size() };
+        for (UINT i = first; i <= last; ++i) {
+            weights.push_back(static_cast<float>((std::min<double>(i + 1, end) - std::max<double>(i, begin)) / scale));
+        }
+    }
+}
+
+// 一行 32 位像素水平缩小为每通道一个 float
+static void ResampleRow(const BYTE* row, const std::vector<ResampleTap>& taps, const std::vector<float>& weights, float* out) {
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t o = 0; o < taps.size(); ++o) {
+        const ResampleTap& tap = taps[o];
+        const BYTE* pixel = row + static_cast<size_t>(tap.first) * 4;
+        const float* weight = weights.data() + tap.weights;
+        __m128 sum = _mm_setzero_ps();
+        for (UINT i = 0; i < tap.count; ++i, pixel += 4) {
+            int value;
+            memcpy(&value, pixel, 4);
+            const __m128i channels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(channels), _mm_set1_ps(weight[i])));
+        }
+        _mm_storeu_ps(out + o * 4, sum);
+    }
+}
+
+static void StoreResampledRow(const float* sums, BYTE* dst, UINT width) {
+    for (UINT x = 0; x < width; ++x) {
+        const __m128i value = _mm_cvtps_epi32(_mm_loadu_ps(sums + static_cast<size_t>(x) * 4)); // 就近舍入
+        const int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(value, value), value));
+        memcpy(dst + static_cast<size_t>(x) * 4, &pixel, 4);
+    }
+}
+
+HRESULT ResizeToFit(IWICImagingFactory* pFactory, PixelBufferPool* pPool, DWORD numaNode, IWICBitmapSource* pSource, UINT maxDimension, ComPtr<IWICBitmapSource>& resized) {
+    UINT width = 0, height = 0;
+    HRESULT hr = pSource->GetSize(&width, &height);
+    if (FAILED(hr)) return hr;
+    if (maxDimension == 0 || std::max(width, height) <= maxDimension) { resized = pSource; return S_OK; }
+    const double ratio = static_cast<double>(maxDimension) / std::max(width, height);
+    const UINT outWidth = std::max(1u, static_cast<UINT>(width * ratio + 0.5));
+    const UINT outHeight = std::max(1u, static_cast<UINT>(height * ratio + 0.5));
+
+    // 32 位 BGRA 类格式 (包括内核转换后的结果) 直接读取；其他格式经 WIC 转为预乘 BGRA，避免透明边缘串色
+    WICPixelFormatGUID format = GUID_WICPixelFormatUndefined;
+    hr = pSource->GetPixelFormat(&format);
+    if (FAILED(hr)) return hr;
+    ComPtr<IWICBitmapSource> pInput = pSource;
+    if (!IsEqualGUID(format, GUID_WICPixelFormat32bppBGRA) && !IsEqualGUID(format, GUID_WICPixelFormat32bppPBGRA) && !IsEqualGUID(format, GUID_WICPixelFormat32bppBGR)) {
+        ComPtr<IWICFormatConverter> pConverter;
+        hr = pFactory->CreateFormatConverter(&pConverter);
+        if (SUCCEEDED(hr)) { hr = pConverter->Initialize(pSource, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, NULL, 0.0f, WICBitmapPaletteTypeCustom); }
+        if (FAILED(hr)) return hr;
+        pInput = pConverter;
+        format = GUID_WICPixelFormat32bppPBGRA;
+    }
+    double dpiX = 96.0, dpiY = 96.0;
+    if (FAILED(pSource->GetResolution(&dpiX, &dpiY))) { dpiX = dpiY = 96.0; }
+    ComPtr<PooledBitmap> pOutput;
+    hr = Microsoft::WRL::MakeAndInitialize<PooledBitmap>(&pOutput, outWidth, outHeight, format, 32u, dpiX, dpiY, pPool, numaNode);
+    if (FAILED(hr)) return hr;
+
+    std::vector<ResampleTap> taps;
+    std::vector<float> weights;
+    BuildResampleTaps(width, outWidth, taps, weights);
+    const size_t rowStride = static_cast<size_t>(width) * 4;
+    if (rowStride > UINT_MAX) return WINCODEC_ERR_VALUEOVERFLOW;
+    std::vector<BYTE> sourceRow(rowStride);
+    std::vector<float> resampled(static_cast<size_t>(outWidth) * 4);
+    std::vector<float> accumulator(resampled.size());
+    const PixelKernels& kernels = GetPixelKernels();
+
+    // 源图按行顺序读取并水平缩小，再按覆盖比例累加到输出行；内存中只有一行源像素和两行 float
+    const double scaleY = static_cast<double>(height) / outHeight;
+    UINT loadedRow = UINT_MAX;
+    for (UINT oy = 0; oy < outHeight && SUCCEEDED(hr); ++oy) {
+        const double begin = oy * scaleY;
+        const double end = std::min<double>(height, (oy + 1) * scaleY);
+        const UINT last = std::min(height - 1, static_cast<UINT>(std::ceil(end)) - 1);
+        std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+        for (UINT y = static_cast<UINT>(begin); y <= last && SUCCEEDED(hr); ++y) {
+            // 相邻输出行共享边界上的源行，只读取、缩小一次
+            if (y != loadedRow) {
+                const WICRect rect = { 0, static_cast<INT>(y), static_cast<INT>(width), 1 };
+                hr = pInput->CopyPixels(&rect, static_cast<UINT>(rowStride), static_cast<UINT>(rowStride), sourceRow.data());
+                if (FAILED(hr)) break;
+                ResampleRow(sourceRow.data(), taps, weights, resampled.data());
+                loadedRow = y;
+            }
+            const float weight = static_cast<float>((std::min<double>(y + 1, end) - std::max<double>(y, begin)) / scaleY);
+            kernels.accumulate(accumulator.data(), resampled.data(), accumulator.size(), weight);
+        }
+        if (SUCCEEDED(hr)) { StoreResampledRow(accumulator.data(), pOutput->Pixels() + pOutput->Stride() * oy, outWidth); }
+    }
+    if (FAILED(hr)) return hr;
+    resized = pOutput;
+    return S_OK;
+}
@@ -0,0 +1,81 @@
+// 处理器拓扑与线程绑定
+#include "ConverterInternal.h"
+
+// 新增：统计所有处理器组中的活动逻辑处理器
+unsigned GetLogicalProcessorCount() {
+    return ProcessorTopology::Get().LogicalProcessors();
+}
+
+// === 新增：ProcessorTopology 实现 ===
+const ProcessorTopology& ProcessorTopology::Get() {
+    static const ProcessorTopology topology; // 线程安全的局部静态初始化
+    return topology;
+}
+
+ProcessorTopology::ProcessorTopology() {
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationNumaNode, NULL, &length);
+    std::vector<BYTE> buffer(length);
+    if (length > 0 && GetLogicalProcessorInformationEx(RelationNumaNode, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length)) {
+        // 未使用 RelationNumaNodeEx 时，跨处理器组的节点会按组分别返回一项
+        for (DWORD offset = 0; offset < length;) {
+            auto info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data() + offset);
+            if (info->Relationship == RelationNumaNode) {
+                PlacementDomain domain;
+                domain.numaNode = static_cast<USHORT>(info->NumaNode.NodeNumber);
+                domain.affinity = info->NumaNode.GroupMask;
+                for (KAFFINITY mask = domain.affinity.Mask; mask; mask &= mask - 1) { ++domain.processors; }
+                if (domain.processors > 0) {
+                    for (const PlacementDomain& existing : domains_) { if (existing.numaNode != domain.numaNode) numa_ = true; }
+                    total_ += domain.processors;
+                    domains_.push_back(domain);
+                }
+            }
+            offset += info->Size;
+        }
+    }
+    if (domains_.empty()) {
+        // 无法获取拓扑：当作单个域，不设置亲和性
+        PlacementDomain domain;
+        DWORD count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        if (count == 0) {
+            SYSTEM_INFO sysInfo;
+            GetSystemInfo(&sysInfo);
+            count = sysInfo.dwNumberOfProcessors;
+        }
+        domain.processors = std::max(1u, static_cast<unsigned>(count));
+        total_ = domain.processors;
+        domains_.push_back(domain);
+        numa_ = false;
+    }
+}
+
+std::vector<size_t> ProcessorTopology::Assign(unsigned count) const {
+    // 每次选 (已分配数 + 1) / 处理器数 最小的域，使线程交错分布而不是先占满第一个组
+    std::vector<size_t> placement;
+    std::vector<unsigned> assigned(domains_.size(), 0);
+    placement.reserve(count);
+    for (unsigned k = 0; k < count; ++k) {
+        size_t best = 0;
+        for (size_t d = 1; d < domains_.size(); ++d) {
+            if (static_cast<ULONGLONG>(assigned[d] + 1) * domains_[best].processors < static_cast<ULONGLONG>(assigned[best] + 1) * domains_[d].processors) { best = d; }
+        }
+        ++assigned[best];
+        placement.push_back(best);
+    }
+    return placement;
+}
+
+std::vector<unsigned> ProcessorTopology::Distribute(unsigned count) const {
+    std::vector<unsigned> perDomain(domains_.size(), 0);
+    for (size_t d : Assign(count)) { ++perDomain[d]; }
+    for (unsigned& n : perDomain) { n = std::max(1u, n); } // 每个节点都需要解码和编码线程，否则该节点的通道无人处理
+    return perDomain;
+}
+
+void ProcessorTopology::Pin(std::thread& thread, size_t domain) const {
+    // 单个域时交给系统调度
+    if (domains_.size() <= 1 || domain >= domains_.size()) return;
+    GROUP_AFFINITY affinity = domains_[domain].affinity;
+    SetThreadGroupAffinity(static_cast<HANDLE>(thread.native_handle()), &affinity, NULL);
+}
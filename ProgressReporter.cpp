@@ -0,0 +1,303 @@
+// 进度输出与逐文件指标
+#include "ConverterInternal.h"
+
+std::mutex console_mutex;
+
+// === 新增：ProgressReporter 实现 ===
+// 修改：环形缓冲区按注册分配，不再按预计的生产者数取模复用，两个线程共用一个单生产者缓冲区时会互相覆盖
+CompletionRing* ProgressReporter::RegisterProducer() {
+    std::lock_guard<std::mutex> lock(ringsMutex_);
+    rings_.push_back(std::make_unique<CompletionRing>());
+    return rings_.back().get();
+}
+
+void ProgressReporter::Post(CompletionRing* ring, CompletionRecord& record) {
+    if (record.job) { record.job->timeline.Mark(JobTimeline::Done); }
+    // 缓冲区满说明输出线程暂时落后，让出时间片等待即可
+    while (!ring->TryPush(record)) { std::this_thread::yield(); }
+}
+
+void ProgressReporter::Start(const Pipeline* pipeline) {
+    pipeline_ = pipeline;
+    startTick_ = GetTickCount64();
+    thread_ = std::thread(&ProgressReporter::Run, this);
+}
+
+void ProgressReporter::Stop() {
+    stopping_ = true;
+    if (thread_.joinable()) { thread_.join(); }
+    Drain();
+    if (level_ == OutputLevel::Normal) {
+        std::lock_guard<std::mutex> lock(console_mutex);
+        RenderProgress();
+        wprintf(L"\n");
+        lastLineLength_ = 0;
+    }
+}
+
+void ProgressReporter::Run() {
+    while (!stopping_.load()) {
+        Drain();
+        const ULONGLONG now = GetTickCount64();
+        if (level_ == OutputLevel::Normal && now - lastRenderTick_ >= 250) {
+            std::lock_guard<std::mutex> lock(console_mutex);
+            RenderProgress();
+            lastRenderTick_ = now;
+        }
+        // 新增：指标文件至少每秒写出一次，不必等到攒满缓冲区
+        if (metrics_ && now - lastFlushTick_ >= 1000) {
+            metrics_->Flush();
+            lastFlushTick_ = now;
+        }
+        Sleep(20);
+    }
+}
+
+void ProgressReporter::Drain() {
+    CompletionRecord record;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        drainRings_.clear();
+        for (const auto& ring : rings_) { drainRings_.push_back(ring.get()); }
+    }
+    for (CompletionRing* ring : drainRings_) {
+        while (ring->TryPop(record)) {
+            Handle(record);
+            record.job.reset();
+        }
+    }
+}
+
+void ProgressReporter::Handle(CompletionRecord& record) {
+    const ImageJob& job = *record.job;
+    processedBytes_ += job.sourceSize;
+    if (metrics_) { metrics_->Record(record); }
+    wchar_t status[64];
+    // 新增：网格编码的大图按固定质量由 WIC 编码，--target-size 与 --gpu 对其不起作用，普通模式下也逐个提示
+    const bool gridTargetSize = job.gridEncode && pipeline_->targetSize;
+    const bool gridGpu = job.gridEncode && pipeline_->gpu;
+    bool notice = false;
+    switch (record.outcome) {
+    case JobOutcome::Converted:
+        ++converted_;
+        notice = gridTargetSize || gridGpu;
+        if (!notice) { wcscpy_s(status, L"OK"); }
+        else { swprintf_s(status, L"OK (Grid; %s%s%s not applied)", gridTargetSize ? L"--target-size" : L"", gridTargetSize && gridGpu ? L" and " : L"", gridGpu ? L"--gpu" : L""); }
+        break;
+    case JobOutcome::Skipped: ++skipped_; wcscpy_s(status, L"SKIPPED (Unchanged)"); break;
+    case JobOutcome::Resumed: ++skipped_; wcscpy_s(status, L"SKIPPED (Completed Earlier)"); break;
+    default:
+        ++failed_;
+        if (record.finalizeError == ERROR_ACCESS_DENIED) { wcscpy_s(status, L"FAILED (Permission Denied to Finalize)"); }
+        else if (record.finalizeError != ERROR_SUCCESS) { swprintf_s(status, L"FAILED (Move Error: %lu)", record.finalizeError); }
+        else if (record.hr == E_ACCESSDENIED) { wcscpy_s(status, L"FAILED (Permission Denied)"); }
+        else if (record.hr == HRESULT_FROM_WIN32(ERROR_DISK_FULL)) { wcscpy_s(status, L"FAILED (Disk Full)"); }
+        else if (record.hr == WINCODEC_ERR_BADHEADER) { wcscpy_s(status, L"FAILED (Corrupt Input File)"); }
+        else if (record.hr == WINCODEC_ERR_UNKNOWNIMAGEFORMAT) { wcscpy_s(status, L"FAILED (Not an Image File)"); }
+        else if (record.hr == E_TARGET_SIZE_UNREACHABLE) { wcscpy_s(status, L"FAILED (Target Size Unreachable)"); }
+        else { swprintf_s(status, L"FAILED (Code: 0x%08X)", static_cast<unsigned int>(record.hr)); }
+        break;
+    }
+
+    // 普通模式只记录失败与网格提示，详细模式逐个文件输出
+    if (level_ == OutputLevel::Verbose || (level_ == OutputLevel::Normal && (record.outcome == JobOutcome::Failed || notice))) {
+        wchar_t line[1024];
+        const bool scanComplete = pipeline_->scanComplete.load();
+        // 优化输出，显示转换方向；扫描未结束时总数后加 "+"
+        swprintf_s(line, L"[%zu/%zu%s] Converting %s -> %s ... %s",
+            job.index + 1, pipeline_->discoveredFiles.load(), scanComplete ? L"" : L"+",
+            PathFindFileNameW(job.inputPath.c_str()),
+            PathFindFileNameW(job.finalOutPath.c_str()),
+            status);
+        std::lock_guard<std::mutex> lock(console_mutex);
+        PrintLine(line);
+    }
+}
+
+void ProgressReporter::PrintLine(const WCHAR* line) {
+    // 先清除当前进度行，再输出整行，下一次刷新时重新绘制进度
+    if (lastLineLength_ > 0) { wprintf(L"\r%*s\r", static_cast<int>(lastLineLength_), L""); lastLineLength_ = 0; }
+    wprintf(L"%s\n", line);
+}
+
+void ProgressReporter::RenderProgress() {
+    const size_t done = static_cast<size_t>(converted_ + failed_ + skipped_);
+    const size_t total = pipeline_->discoveredFiles.load();
+    const bool scanComplete = pipeline_->scanComplete.load();
+    const double seconds = std::max(0.001, (GetTickCount64() - startTick_) / 1000.0);
+    const double filesPerSecond = done / seconds;
+    const double mbPerSecond = processedBytes_ / seconds / (1024.0 * 1024.0);
+
+    wchar_t eta[32] = L"--:--:--";
+    if (scanComplete && filesPerSecond > 0.0 && total >= done) {
+        ULONGLONG remaining = static_cast<ULONGLONG>((total - done) / filesPerSecond);
+        swprintf_s(eta, L"%02llu:%02llu:%02llu", remaining / 3600, (remaining / 60) % 60, remaining % 60);
+    }
+
+    wchar_t line[256];
+    int length = swprintf_s(line, L"[%zu/%zu%s] %.1f files/s, %.1f MB/s, ETA %s, %d failed",
+        done, total, scanComplete ? L"" : L"+", filesPerSecond, mbPerSecond, eta, failed_);
+    if (length < 0) return;
+    // 新行比旧行短时用空格覆盖残留字符
+    const int pad = static_cast<int>(lastLineLength_) > length ? static_cast<int>(lastLineLength_) - length : 0;
+    wprintf(L"\r%s%*s", line, pad, L"");
+    fflush(stdout);
+    lastLineLength_ = static_cast<size_t>(length);
+}
+
+// === 新增：逐文件指标 (MetricsSink) 实现 ===
+// 提供者 GUID 由名称按 EventSource 规则哈希得到，可在 tracelog/WPR 中以 *ImageToHeicConverter 指定
+TRACELOGGING_DEFINE_PROVIDER(g_traceProvider, "ImageToHeicConverter",
+    (0x212ec46a, 0x7afe, 0x535b, 0x0c, 0xc0, 0xee, 0x10, 0x89, 0x50, 0xb5, 0x29));
+
+namespace {
+
+double Span(const JobTimeline& timeline, JobTimeline::Point from, JobTimeline::Point to) {
+    const LONGLONG start = timeline.ticks[from], end = timeline.ticks[to];
+    return start && end >= start ? TicksToMs(end - start) : 0.0;
+}
+
+const char* ContainerName(const GUID& container) {
+    if (IsEqualGUID(container, GUID_ContainerFormatJpeg)) return "jpeg";
+    if (IsEqualGUID(container, GUID_ContainerFormatPng)) return "png";
+    if (IsEqualGUID(container, GUID_ContainerFormatGif)) return "gif";
+    if (IsEqualGUID(container, GUID_ContainerFormatTiff)) return "tiff";
+    if (IsEqualGUID(container, GUID_ContainerFormatBmp)) return "bmp";
+    if (IsEqualGUID(container, GUID_ContainerFormatWebp)) return "webp";
+    if (IsEqualGUID(container, GUID_ContainerFormatHeif)) return "heif";
+    return "unknown";
+}
+
+// 路径转为 UTF-8 并按 JSON 规则转义，去掉 \\?\ 前缀便于阅读
+void AppendJsonPath(std::string& out, const std::wstring& path) {
+    std::wstring plain(path);
+    StripExtendedPrefix(plain);
+    out += '"';
+    if (!plain.empty()) {
+        const int length = WideCharToMultiByte(CP_UTF8, 0, plain.c_str(), static_cast<int>(plain.size()), NULL, 0, NULL, NULL);
+        std::string utf8(length > 0 ? length : 0, '\0');
+        if (length > 0) { WideCharToMultiByte(CP_UTF8, 0, plain.c_str(), static_cast<int>(plain.size()), &utf8[0], length, NULL, NULL); }
+        for (char ch : utf8) {
+            if (ch == '"' || ch == '\\') { out += '\\'; out += ch; }
+            else if (static_cast<unsigned char>(ch) < 0x20) { char escaped[8]; sprintf_s(escaped, "\\u%04x", static_cast<unsigned>(ch)); out += escaped; }
+            else { out += ch; }
+        }
+    }
+    out += '"';
+}
+
+} // namespace
+
+const char* ResultCategory(const CompletionRecord& record) {
+    switch (record.outcome) {
+    case JobOutcome::Converted: return "converted";
+    case JobOutcome::Skipped: return "unchanged";
+    case JobOutcome::Resumed: return "resumed";
+    default: break;
+    }
+    if (record.finalizeError != ERROR_SUCCESS) return "finalize";
+    if (record.hr == E_ACCESSDENIED || record.hr == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED)) return "access_denied";
+    if (record.hr == HRESULT_FROM_WIN32(ERROR_DISK_FULL)) return "disk_full";
+    if (record.hr == WINCODEC_ERR_BADHEADER || record.hr == WINCODEC_ERR_BADIMAGE || record.hr == WINCODEC_ERR_STREAMREAD) return "corrupt_input";
+    if (record.hr == WINCODEC_ERR_UNKNOWNIMAGEFORMAT) return "not_an_image";
+    if (record.hr == E_TARGET_SIZE_UNREACHABLE) return "target_size";
+    if (record.hr == E_OUTOFMEMORY) return "out_of_memory";
+    if (record.job && record.job->encoderUnavailable) return "codec_unavailable";
+    if (HRESULT_FACILITY(record.hr) == FACILITY_WIN32) return "io";
+    if (HRESULT_FACILITY(record.hr) == FACILITY_WINCODEC_ERR) return "codec";
+    return "other";
+}
+
+MetricsSink::MetricsSink() {
+    registered_ = SUCCEEDED(TraceLoggingRegister(g_traceProvider));
+}
+
+MetricsSink::~MetricsSink() {
+    Close();
+    if (registered_) { TraceLoggingUnregister(g_traceProvider); }
+}
+
+HRESULT MetricsSink::OpenFile(const std::wstring& path) {
+    // 追加写入，--watch 重启后继续同一文件
+    file_ = CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+    buffer_.reserve(kFlushBytes + 4096);
+    return S_OK;
+}
+
+void MetricsSink::Record(const CompletionRecord& record) {
+    const bool tracing = registered_ && TraceLoggingProviderEnabled(g_traceProvider, 0, 0);
+    if (!tracing && file_ == INVALID_HANDLE_VALUE) return;
+
+    const ImageJob& job = *record.job;
+    const JobTimeline& t = job.timeline;
+    const char* category = ResultCategory(record);
+    const double megapixels = static_cast<double>(t.width) * t.height / 1e6;
+    const double ratio = record.outputBytes ? static_cast<double>(job.sourceSize) / record.outputBytes : 0.0;
+    const double totalMs = Span(t, JobTimeline::ReadStart, JobTimeline::Done);
+    const double readMs = Span(t, JobTimeline::ReadStart, JobTimeline::ReadEnd);
+    const double decodeMs = Span(t, JobTimeline::DecodeStart, JobTimeline::DecodeEnd);
+    const double encodeMs = Span(t, JobTimeline::EncodeStart, JobTimeline::EncodeEnd);
+    const double writeMs = Span(t, JobTimeline::WriteStart, JobTimeline::Done);
+    const double readWaitMs = Span(t, JobTimeline::Queued, JobTimeline::ReadStart);
+    const double decodeWaitMs = Span(t, JobTimeline::ReadEnd, JobTimeline::DecodeStart);
+    const double encodeWaitMs = Span(t, JobTimeline::DecodeEnd, JobTimeline::EncodeStart);
+    const double writeWaitMs = Span(t, JobTimeline::EncodeEnd, JobTimeline::WriteStart);
+
+    if (tracing) {
+        TraceLoggingWrite(g_traceProvider, "FileCompleted",
+            TraceLoggingLevel(record.outcome == JobOutcome::Failed ? WINEVENT_LEVEL_WARNING : WINEVENT_LEVEL_INFO),
+            TraceLoggingWideString(job.inputPath.c_str(), "Input"),
+            TraceLoggingString(category, "Outcome"),
+            TraceLoggingHexInt32(record.hr, "HResult"),
+            TraceLoggingString(ContainerName(job.container), "Container"),
+            TraceLoggingUInt64(job.sourceSize, "InputBytes"),
+            TraceLoggingUInt64(record.outputBytes, "OutputBytes"),
+            TraceLoggingUInt32(t.width, "Width"),
+            TraceLoggingUInt32(t.height, "Height"),
+            TraceLoggingFloat64(ratio, "CompressionRatio"),
+            TraceLoggingFloat64(totalMs, "DurationMs"),
+            TraceLoggingFloat64(readMs, "ReadMs"),
+            TraceLoggingFloat64(decodeMs, "DecodeMs"),
+            TraceLoggingFloat64(encodeMs, "EncodeMs"),
+            TraceLoggingFloat64(writeMs, "WriteMs"),
+            TraceLoggingFloat64(readWaitMs, "ReadWaitMs"),
+            TraceLoggingFloat64(decodeWaitMs, "DecodeWaitMs"),
+            TraceLoggingFloat64(encodeWaitMs, "EncodeWaitMs"),
+            TraceLoggingFloat64(writeWaitMs, "WriteWaitMs"));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (file_ == INVALID_HANDLE_VALUE) return;
+
+    buffer_ += "{\"input\":";
+    AppendJsonPath(buffer_, job.inputPath);
+    buffer_ += ",\"output\":";
+    AppendJsonPath(buffer_, job.finalOutPath);
+    char fields[768];
+    sprintf_s(fields, ",\"outcome\":\"%s\",\"hr\":\"0x%08X\",\"container\":\"%s\",\"input_bytes\":%llu,\"output_bytes\":%llu,"
+        "\"width\":%u,\"height\":%u,\"megapixels\":%.3f,\"compression_ratio\":%.3f,\"duration_ms\":%.3f,"
+        "\"read_ms\":%.3f,\"decode_ms\":%.3f,\"encode_ms\":%.3f,\"write_ms\":%.3f,"
+        "\"read_wait_ms\":%.3f,\"decode_wait_ms\":%.3f,\"encode_wait_ms\":%.3f,\"write_wait_ms\":%.3f}\n",
+        category, static_cast<unsigned int>(record.hr), ContainerName(job.container), job.sourceSize, record.outputBytes,
+        t.width, t.height, megapixels, ratio, totalMs, readMs, decodeMs, encodeMs, writeMs, readWaitMs, decodeWaitMs, encodeWaitMs, writeWaitMs);
+    buffer_ += fields;
+    if (buffer_.size() >= kFlushBytes) { FlushLocked(); }
+}
+
+void MetricsSink::Flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FlushLocked();
+}
+
+void MetricsSink::FlushLocked() {
+    if (file_ == INVALID_HANDLE_VALUE || buffer_.empty()) return;
+    DWORD written = 0;
+    WriteFile(file_, buffer_.data(), static_cast<DWORD>(buffer_.size()), &written, NULL);
+    buffer_.clear();
+}
+
+void MetricsSink::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FlushLocked();
+    if (file_ != INVALID_HANDLE_VALUE) { CloseHandle(file_); file_ = INVALID_HANDLE_VALUE; }
+}
@@ -0,0 +1,229 @@
+// 分片与工作租约
+#include "ConverterInternal.h"
+
+// === 新增：--shard 分片与 --lease-dir 工作租约实现 ===
+bool ShardFilter::Accepts(const std::wstring& outputDir, const WCHAR* fileName) const {
+    if (count == 0 || leased) return true;
+    return Bucket(outputDir, fileName) % count == index;
+}
+
+size_t ShardFilter::Bucket(const std::wstring& outputDir, const WCHAR* fileName) const {
+    if (count == 0) return 0;
+    // 相对路径 = 输出目录去掉根目录部分 (与输入目录结构一致) + 文件名。
+    // 只折叠 ASCII 大小写，结果与区域设置无关，各节点和各次运行一致
+    ULONGLONG hash = 14695981039346656037ull;
+    auto mix = [&hash](WCHAR ch) {
+        if (ch >= L'a' && ch <= L'z') { ch = static_cast<WCHAR>(ch - (L'a' - L'A')); }
+        if (ch == L'/') { ch = L'\\'; }
+        hash = (hash ^ static_cast<ULONGLONG>(ch)) * 1099511628211ull;
+    };
+    for (size_t i = std::min(outputRootLength, outputDir.size()); i < outputDir.size(); ++i) { mix(outputDir[i]); }
+    mix(L'\\');
+    for (const WCHAR* p = fileName; *p; ++p) { mix(*p); }
+
+    return static_cast<size_t>(hash % (static_cast<ULONGLONG>(count) * kBucketsPerShard));
+}
+
+bool LeasedInputs::Defer(size_t bucket, std::wstring& path, const std::shared_ptr<const std::wstring>& outputDir, ULONGLONG size, const FILETIME& lastWriteTime) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (claimed_[bucket]) return false;
+    pending_[bucket].push_back(Entry{ std::move(path), outputDir, size, lastWriteTime });
+    return true;
+}
+
+void LeasedInputs::Claim(Pipeline& pipeline, const std::vector<bool>& wave) {
+    std::vector<Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t bucket = 0; bucket < wave.size(); ++bucket) {
+            if (!wave[bucket] || claimed_[bucket]) continue;
+            claimed_[bucket] = true;
+            for (Entry& entry : pending_[bucket]) { entries.push_back(std::move(entry)); }
+            std::vector<Entry>().swap(pending_[bucket]);
+        }
+    }
+    // 预读队列满时在此阻塞，只在本节点有余力时才会领取下一批
+    for (Entry& entry : entries) { PushInputFile(pipeline, std::move(entry.path), entry.outputDir, entry.size, entry.lastWriteTime); }
+}
+
+HRESULT WorkLeases::Open(const std::wstring& dir, unsigned shard, unsigned shardCount) {
+    dir_ = dir;
+    shard_ = shard;
+    shardCount_ = shardCount;
+    if (!CreateDirectoryW(dir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) return HRESULT_FROM_WIN32(GetLastError());
+    heartbeat_ = std::thread(&WorkLeases::Heartbeat, this);
+    return S_OK;
+}
+
+// 新增：经句柄改名租约文件，改的总是句柄所指的那个文件
+static bool RenameLeaseHandle(HANDLE handle, const std::wstring& path, BOOL replaceIfExists) {
+    const size_t nameBytes = path.size() * sizeof(WCHAR);
+    std::vector<BYTE> renameBuffer(sizeof(FILE_RENAME_INFO) + nameBytes);
+    FILE_RENAME_INFO* pRename = reinterpret_cast<FILE_RENAME_INFO*>(renameBuffer.data());
+    pRename->ReplaceIfExists = replaceIfExists;
+    pRename->RootDirectory = NULL;
+    pRename->FileNameLength = static_cast<DWORD>(nameBytes);
+    memcpy(pRename->FileName, path.c_str(), nameBytes);
+    return SetFileInformationByHandle(handle, FileRenameInfo, pRename, static_cast<DWORD>(renameBuffer.size())) != FALSE;
+}
+
+std::wstring WorkLeases::BucketPath(size_t bucket, const WCHAR* suffix) const {
+    WCHAR name[48];
+    swprintf_s(name, L"\\bucket-%05zu%s", bucket, suffix);
+    return dir_ + name;
+}
+
+bool WorkLeases::TryClaim(size_t bucket) {
+    if (GetFileAttributesW(BucketPath(bucket, L".done").c_str()) != INVALID_FILE_ATTRIBUTES) return false;
+    const std::wstring leasePath = BucketPath(bucket, L".lease");
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        // CREATE_NEW 在 SMB 上同样是原子的，只有一个节点能创建成功
+        HANDLE lease = CreateFileW(leasePath.c_str(), GENERIC_WRITE | FILE_WRITE_ATTRIBUTES | DELETE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (lease != INVALID_HANDLE_VALUE) {
+            char owner[MAX_COMPUTERNAME_LENGTH + 32] = { 0 };
+            DWORD nameLength = MAX_COMPUTERNAME_LENGTH + 1;
+            GetComputerNameA(owner, &nameLength);
+            const int length = static_cast<int>(nameLength) + sprintf_s(owner + nameLength, sizeof(owner) - nameLength, " %lu\n", GetCurrentProcessId());
+            DWORD written = 0;
+            WriteFile(lease, owner, static_cast<DWORD>(length), &written, NULL);
+            std::lock_guard<std::mutex> lock(mutex_);
+            held_.push_back(Lease{ bucket, lease, false });
+            return true;
+        }
+        if (GetLastError() != ERROR_FILE_EXISTS || attempt > 0) return false;
+        // 持有者停止续租 (节点崩溃或失联) 后可以接管：先改名让其他抢占者失败，再重新创建。
+        // 修改：检查时间与改名都经同一个句柄，改走的一定是刚判定为过期的那个文件，不会误改其他节点在此期间新建的租约
+        HANDLE stale = CreateFileW(leasePath.c_str(), FILE_READ_ATTRIBUTES | DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (stale == INVALID_HANDLE_VALUE) {
+            if (GetLastError() == ERROR_FILE_NOT_FOUND) continue; // 刚被释放，重试创建
+            return false;
+        }
+        FILE_BASIC_INFO info;
+        bool taken = false;
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        const ULONGLONG current = (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+        if (GetFileInformationByHandleEx(stale, FileBasicInfo, &info, sizeof(info))) {
+            const ULONGLONG touched = static_cast<ULONGLONG>(info.LastWriteTime.QuadPart);
+            if (current >= touched && current - touched >= kStaleAfter) {
+                WCHAR suffix[48];
+                swprintf_s(suffix, L".stale-%lu-%llu", GetCurrentProcessId(), current);
+                taken = RenameLeaseHandle(stale, leasePath + suffix, FALSE);
+            }
+        }
+        if (taken) {
+            FILE_DISPOSITION_INFO disposition = { TRUE };
+            SetFileInformationByHandle(stale, FileDispositionInfo, &disposition, sizeof(disposition));
+        }
+        CloseHandle(stale);
+        if (!taken) return false;
+    }
+    return false;
+}
+
+bool WorkLeases::ClaimWave(size_t maxBuckets, std::vector<bool>& wave) {
+    const size_t bucketCount = static_cast<size_t>(shardCount_) * ShardFilter::kBucketsPerShard;
+    wave.assign(bucketCount, false);
+    size_t claimed = 0;
+    // 先领本分片的桶，再从下一个分片开始依次领取其他节点尚未开始的桶，避免空闲节点都挤向同一个分片
+    for (unsigned offset = 0; offset < shardCount_ && claimed < maxBuckets; ++offset) {
+        const unsigned owner = (shard_ + offset) % shardCount_;
+        for (size_t bucket = owner; bucket < bucketCount && claimed < maxBuckets; bucket += shardCount_) {
+            if (!attempted_.insert(bucket).second) continue; // 本次运行已处理或已确认被占用
+            if (TryClaim(bucket)) {
+                wave[bucket] = true;
+                ++claimed;
+                if (offset > 0) ++stolen_;
+            }
+            else { attempted_.erase(bucket); }
+        }
+    }
+    return claimed > 0;
+}
+
+void WorkLeases::Heartbeat() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        stopCv_.wait_for(lock, std::chrono::seconds(30));
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        for (Lease& lease : held_) {
+            if (lease.lost) continue;
+            SetFileTime(lease.handle, NULL, NULL, &now);
+            // 新增：失联期间可能已被其他节点判为过期并改名、删除；此后不再续租，结束时也不把它标为 .done
+            if (!HoldsLease(lease)) { lease.lost = true; lost_.fetch_add(1); }
+        }
+    }
+}
+
+bool WorkLeases::HoldsLease(const Lease& lease) const {
+    FILE_STANDARD_INFO standard;
+    if (GetFileInformationByHandleEx(lease.handle, FileStandardInfo, &standard, sizeof(standard)) && standard.DeletePending) return false;
+    // FileNameInfo 返回卷 (或共享) 内的路径，只比较文件名部分
+    std::vector<BYTE> buffer(sizeof(FILE_NAME_INFO) + 1024 * sizeof(WCHAR));
+    FILE_NAME_INFO* pName = reinterpret_cast<FILE_NAME_INFO*>(buffer.data());
+    if (!GetFileInformationByHandleEx(lease.handle, FileNameInfo, pName, static_cast<DWORD>(buffer.size()))) return true; // 无法确认时按仍持有处理
+    const std::wstring current(pName->FileName, pName->FileNameLength / sizeof(WCHAR));
+    const std::wstring expected = BucketPath(lease.bucket, L".lease");
+    const WCHAR* name = PathFindFileNameW(expected.c_str());
+    const size_t nameLength = wcslen(name);
+    return current.size() >= nameLength && _wcsicmp(current.c_str() + current.size() - nameLength, name) == 0;
+}
+
+void WorkLeases::Finish(bool completed) {
+    if (!heartbeat_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stopCv_.notify_all();
+    heartbeat_.join();
+    // 处理完的桶改名为 .done，之后其他节点不再领取；未完成时删除租约，让其他节点立即接手。
+    // 都通过句柄完成，租约若已被其他节点接管也不会误改对方的文件
+    // 修改：已被接管的租约只关闭句柄，桶由接管的节点负责
+    for (const Lease& lease : held_) {
+        bool renamed = false;
+        if (completed && !lease.lost && HoldsLease(lease)) { renamed = RenameLeaseHandle(lease.handle, BucketPath(lease.bucket, L".done"), TRUE); }
+        if (!renamed && !lease.lost) {
+            FILE_DISPOSITION_INFO disposition = { TRUE };
+            SetFileInformationByHandle(lease.handle, FileDispositionInfo, &disposition, sizeof(disposition));
+        }
+        CloseHandle(lease.handle);
+    }
+    held_.clear();
+}
+
+// 每个分片把本次运行的统计写到协调目录，再汇总所有已报告的分片
+void ReportShardTotals(const std::wstring& coordinationDir, unsigned shard, unsigned shardCount, int converted, int failed, int skipped) {
+    if (!CreateDirectoryW(coordinationDir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) return;
+    WCHAR name[48];
+    swprintf_s(name, L"\\shard-%u-of-%u.summary", shard + 1, shardCount);
+    const std::wstring ownPath = coordinationDir + name;
+    const std::wstring tempPath = ownPath + L".tmp";
+    char text[96];
+    const int length = sprintf_s(text, "%d %d %d\n", converted, failed, skipped);
+    HANDLE file = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file != INVALID_HANDLE_VALUE) {
+        DWORD written = 0;
+        const BOOL ok = WriteFile(file, text, static_cast<DWORD>(length), &written, NULL);
+        CloseHandle(file);
+        if (!ok || !MoveFileExW(tempPath.c_str(), ownPath.c_str(), MOVEFILE_REPLACE_EXISTING)) { DeleteFileW(tempPath.c_str()); }
+    }
+
+    int totals[3] = { 0, 0, 0 };
+    unsigned reported = 0;
+    for (unsigned i = 0; i < shardCount; ++i) {
+        swprintf_s(name, L"\\shard-%u-of-%u.summary", i + 1, shardCount);
+        HANDLE summary = CreateFileW((coordinationDir + name).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (summary == INVALID_HANDLE_VALUE) continue;
+        char buffer[96] = { 0 };
+        DWORD bytesRead = 0;
+        int values[3] = { 0, 0, 0 };
+        if (ReadFile(summary, buffer, sizeof(buffer) - 1, &bytesRead, NULL) && sscanf_s(buffer, "%d %d %d", &values[0], &values[1], &values[2]) == 3) {
+            for (int v = 0; v < 3; ++v) { totals[v] += values[v]; }
+            ++reported;
+        }
+        CloseHandle(summary);
+    }
+    wprintf(L"All shards (%u of %u reported): %d successful, %d failed, %d unchanged.\n", reported, shardCount, totals[0], totals[1], totals[2]);
+}